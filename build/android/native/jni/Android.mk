@@ -148,7 +148,9 @@ LOCAL_SRC_FILES := \
 	../../../src/map_settings_manager.cpp          \
 	../../../src/mapblock.cpp                      \
 	../../../src/mapblock_mesh.cpp                 \
+	../../../src/mapblock_snapshot.cpp             \
 	../../../src/mapgen.cpp                        \
+	../../../src/mapgen_bench.cpp                  \
 	../../../src/mapgen_flat.cpp                   \
 	../../../src/mapgen_v6.cpp                     \
 	../../../src/mapgen_v7.cpp                     \
@@ -895,6 +895,49 @@ core.register_chatcommand("time", {
 })
 register_chatcommand_alias("settime", "time")
 
+core.register_chatcommand("mapgen_stats", {
+	description = "Show the time of the map generation stages per chunk",
+	privs = {server = true},
+	func = function(name, param)
+		local stats = core.get_mapgen_stats()
+		if not stats then
+			return false, "Mapgen stats are disabled (enable_mapgen_stats)"
+		end
+
+		local total = {chunks = 0}
+		local stages = {}
+		for _, thread in ipairs(stats) do
+			for k, v in pairs(thread) do
+				if total[k] == nil then
+					total[k] = 0
+					if k ~= "chunks" then
+						stages[#stages + 1] = k
+					end
+				end
+				total[k] = total[k] + v
+			end
+		end
+		table.sort(stages)
+
+		local function format_stats(label, s)
+			local parts = {}
+			for _, stage in ipairs(stages) do
+				parts[#parts + 1] = ("%s %.2f"):format(stage,
+					s[stage] / math.max(s.chunks, 1))
+			end
+			return ("%s: %d chunks, ms/chunk: %s"):format(label, s.chunks,
+				table.concat(parts, ", "))
+		end
+
+		local lines = {}
+		for i, thread in ipairs(stats) do
+			lines[#lines + 1] = format_stats("Emerge-" .. (i - 1), thread)
+		end
+		lines[#lines + 1] = format_stats("All", total)
+		return true, table.concat(lines, "\n")
+	end
+})
+
 core.register_chatcommand("days", {
 	description = "Show day count since world creation",
 	func = function()
@@ -65,13 +65,13 @@ CavesNoiseIntersection::~CavesNoiseIntersection()
 
 
 void CavesNoiseIntersection::generateCaves(MMVManip *vm,
-	v3s16 nmin, v3s16 nmax, u8 *biomemap)
+	v3s16 nmin, v3s16 nmax, u8 *biomemap, WorkerPool *pool)
 {
 	assert(vm);
 	assert(biomemap);
 
-	noise_cave1->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
-	noise_cave2->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
+	noise_cave1->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z, NULL, pool);
+	noise_cave2->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z, NULL, pool);
 
 	v3s16 em = vm->m_area.getExtent();
 	u32 index2d = 0;  // Biomemap index
@@ -191,12 +191,13 @@ CavernsNoise::~CavernsNoise()
 }
 
 
-bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax)
+bool CavernsNoise::generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax,
+	WorkerPool *pool)
 {
 	assert(vm);
 
 	// Calculate noise
-	noise_cavern->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z);
+	noise_cavern->perlinMap3D(nmin.X, nmin.Y - 1, nmin.Z, NULL, pool);
 
 	// Cache cavern_amp values
 	float *cavern_amp = new float[m_csize.Y + 1];
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define DEFAULT_LAVA_DEPTH (-256)
 
 class GenerateNotifier;
+class WorkerPool;
 
 /*
 	CavesNoiseIntersection is a cave digging algorithm that carves smooth,
@@ -45,7 +46,8 @@ class CavesNoiseIntersection
 			s32 seed, float cave_width);
 	~CavesNoiseIntersection();
 
-	void generateCaves(MMVManip *vm, v3s16 nmin, v3s16 nmax, u8 *biomemap);
+	void generateCaves(MMVManip *vm, v3s16 nmin, v3s16 nmax, u8 *biomemap,
+		WorkerPool *pool=NULL);
 
 private:
 	INodeDefManager *m_ndef;
@@ -74,7 +76,8 @@ class CavernsNoise
 			float cavern_threshold);
 	~CavernsNoise();
 
-	bool generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax);
+	bool generateCaverns(MMVManip *vm, v3s16 nmin, v3s16 nmax,
+		WorkerPool *pool=NULL);
 
 private:
 	INodeDefManager *m_ndef;
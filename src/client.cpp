@@ -534,8 +534,11 @@ void Client::step(float dtime)
 			}
 		}
 
-		if (num_processed_meshes > 0)
+		if (num_processed_meshes > 0) {
 			g_profiler->graphAdd("num_processed_meshes", num_processed_meshes);
+			// Meshes and the nodes that may occlude blocks have changed
+			m_env.getClientMap().invalidateDrawList();
+		}
 	}
 
 	/*
@@ -33,6 +33,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/srp.h"
 #include "face_position_cache.h"
 
+// Camera turns smaller than this (cosine of the angle) don't make
+// GetNextBlocks look at all blocks in range again
+#define SCAN_CAMERA_DIR_MIN_COS 0.999f
+
 const char *ClientInterface::statenames[] = {
 	"Invalid",
 	"Disconnecting",
@@ -56,7 +60,7 @@ std::string ClientInterface::state2Name(ClientState state)
 void RemoteClient::ResendBlockIfOnWire(v3s16 p)
 {
 	// if this block is on wire, mark it for sending again as soon as possible
-	if (m_blocks_sending.find(p) != m_blocks_sending.end()) {
+	if (m_blocks_sending.find(getBlockKey(p)) != m_blocks_sending.end()) {
 		SetBlockNotSent(p);
 	}
 }
@@ -102,10 +106,6 @@ void RemoteClient::GetNextBlocks (
 	// Predict to next block
 	v3f playerpos_predicted = playerpos + playerspeeddir*MAP_BLOCKSIZE*BS;
 
-	v3s16 center_nodepos = floatToInt(playerpos_predicted, BS);
-
-	v3s16 center = getNodeBlockPos(center_nodepos);
-
 	// Camera position and direction
 	v3f camera_pos = sao->getEyePosition();
 	v3f camera_dir = v3f(0,0,1);
@@ -115,6 +115,35 @@ void RemoteClient::GetNextBlocks (
 	/*infostream<<"camera_dir=("<<camera_dir.X<<","<<camera_dir.Y<<","
 			<<camera_dir.Z<<")"<<std::endl;*/
 
+	// get view range and camera fov from the client
+	s16 wanted_range = sao->getWantedRange();
+	float camera_fov = sao->getFov();
+
+	SelectBlocksToSend(&env->getMap(), emerge, dtime, playerpos_predicted,
+			camera_pos, camera_dir, camera_fov, wanted_range, dest);
+}
+
+void RemoteClient::SelectBlocksToSend(
+		Map *map,
+		EmergeManager *emerge,
+		float dtime,
+		v3f playerpos_predicted,
+		v3f camera_pos,
+		v3f camera_dir,
+		float camera_fov,
+		s16 wanted_range,
+		std::vector<PrioritySortedBlockTransfer> &dest)
+{
+	v3s16 center_nodepos = floatToInt(playerpos_predicted, BS);
+
+	v3s16 center = getNodeBlockPos(center_nodepos);
+
+	// if FOV, wanted_range are not available (old client), fall back to old default
+	if (wanted_range <= 0) wanted_range = 1000;
+	if (camera_fov <= 0) camera_fov = (72.0*M_PI/180) * 4./3.;
+
+	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
+
 	/*
 		Get the starting value of the block finder radius.
 	*/
@@ -125,6 +154,20 @@ void RemoteClient::GetNextBlocks (
 		m_last_center = center;
 	}
 
+	const s16 full_d_max = MYMIN(g_settings->getS16("max_block_send_distance"), wanted_range);
+
+	/*
+		Blocks out of sight were skipped when everything in range was
+		looked at, so look again once the camera has moved or turned.
+	*/
+	if (m_nearest_unsent_d > full_d_max &&
+			(cam_pos_nodes != m_scan_camera_pos ||
+			camera_dir.dotProduct(m_scan_camera_dir) < SCAN_CAMERA_DIR_MIN_COS ||
+			camera_fov != m_scan_camera_fov))
+	{
+		m_nearest_unsent_d = 0;
+	}
+
 	/*infostream<<"m_nearest_unsent_reset_timer="
 			<<m_nearest_unsent_reset_timer<<std::endl;*/
 
@@ -173,14 +216,6 @@ void RemoteClient::GetNextBlocks (
 	*/
 	s32 new_nearest_unsent_d = -1;
 
-	// get view range and camera fov from the client
-	s16 wanted_range = sao->getWantedRange();
-	float camera_fov = sao->getFov();
-	// if FOV, wanted_range are not available (old client), fall back to old default
-	if (wanted_range <= 0) wanted_range = 1000;
-	if (camera_fov <= 0) camera_fov = (72.0*M_PI/180) * 4./3.;
-
-	const s16 full_d_max = MYMIN(g_settings->getS16("max_block_send_distance"), wanted_range);
 	const s16 d_opt = MYMIN(g_settings->getS16("block_send_optimize_distance"), wanted_range);
 	const s16 d_blocks_in_sight = full_d_max * BS * MAP_BLOCKSIZE;
 	//infostream << "Fov from client " << camera_fov << " full_d_max " << full_d_max << std::endl;
@@ -198,7 +233,6 @@ void RemoteClient::GetNextBlocks (
 	s32 nearest_sent_d = -1;
 	//bool queue_is_full = false;
 
-	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
 	const bool occ_cull = g_settings->getBool("server_side_occlusion_culling");
 
 	s16 d;
@@ -207,11 +241,12 @@ void RemoteClient::GetNextBlocks (
 			Get the border/face dot coordinates of a "d-radiused"
 			box
 		*/
-		std::vector<v3s16> list = FacePositionCache::getFacePositions(d);
+		const std::vector<v3s16> &list = FacePositionCache::getFacePositions(d);
 
-		std::vector<v3s16>::iterator li;
+		std::vector<v3s16>::const_iterator li;
 		for(li = list.begin(); li != list.end(); ++li) {
 			v3s16 p = *li + center;
+			u64 key = getBlockKey(p);
 
 			/*
 				Send throttling
@@ -235,7 +270,13 @@ void RemoteClient::GetNextBlocks (
 			}
 
 			// Don't send blocks that are currently being transferred
-			if (m_blocks_sending.find(p) != m_blocks_sending.end())
+			if (m_blocks_sending.find(key) != m_blocks_sending.end())
+				continue;
+
+			/*
+				Don't send already sent blocks
+			*/
+			if (m_blocks_sent.find(key) != m_blocks_sent.end())
 				continue;
 
 			/*
@@ -258,20 +299,10 @@ void RemoteClient::GetNextBlocks (
 				continue;
 			}
 
-			/*
-				Don't send already sent blocks
-			*/
-			{
-				if(m_blocks_sent.find(p) != m_blocks_sent.end())
-				{
-					continue;
-				}
-			}
-
 			/*
 				Check if map has this block
 			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+			MapBlock *block = map->getBlockNoCreateNoEx(p);
 
 			bool surely_not_found_on_disk = false;
 			bool block_is_invalid = false;
@@ -304,7 +335,7 @@ void RemoteClient::GetNextBlocks (
 				}
 
 				if (occ_cull && !block_is_invalid &&
-						env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
+						map->isBlockOccluded(block, cam_pos_nodes)) {
 					continue;
 				}
 			}
@@ -360,8 +391,13 @@ void RemoteClient::GetNextBlocks (
 		new_nearest_unsent_d = nearest_emergefull_d;
 	} else {
 		if(d > full_d_max){
-			new_nearest_unsent_d = 0;
+			// Everything in range has been looked at. Don't scan again
+			// until the view changes or blocks are marked not sent.
+			new_nearest_unsent_d = d;
 			m_nothing_to_send_pause_timer = 2.0;
+			m_scan_camera_pos = cam_pos_nodes;
+			m_scan_camera_dir = camera_dir;
+			m_scan_camera_fov = camera_fov;
 		} else {
 			if(nearest_sent_d != -1)
 				new_nearest_unsent_d = nearest_sent_d;
@@ -376,23 +412,24 @@ void RemoteClient::GetNextBlocks (
 
 void RemoteClient::GotBlock(v3s16 p)
 {
-	if (m_blocks_modified.find(p) == m_blocks_modified.end()) {
-		if (m_blocks_sending.find(p) != m_blocks_sending.end())
-			m_blocks_sending.erase(p);
+	u64 key = getBlockKey(p);
+	if (m_blocks_modified.find(key) == m_blocks_modified.end()) {
+		if (m_blocks_sending.find(key) != m_blocks_sending.end())
+			m_blocks_sending.erase(key);
 		else
 			m_excess_gotblocks++;
 
-		m_blocks_sent.insert(p);
+		m_blocks_sent.insert(key);
 	}
 }
 
 void RemoteClient::SentBlock(v3s16 p)
 {
-	if (m_blocks_modified.find(p) != m_blocks_modified.end())
-		m_blocks_modified.erase(p);
+	u64 key = getBlockKey(p);
+	m_blocks_modified.erase(key);
 
-	if(m_blocks_sending.find(p) == m_blocks_sending.end())
-		m_blocks_sending[p] = 0.0;
+	if(m_blocks_sending.find(key) == m_blocks_sending.end())
+		m_blocks_sending[key] = 0.0;
 	else
 		infostream<<"RemoteClient::SentBlock(): Sent block"
 				" already in m_blocks_sending"<<std::endl;
@@ -400,19 +437,18 @@ void RemoteClient::SentBlock(v3s16 p)
 
 void RemoteClient::SetBlockNotSent(v3s16 p)
 {
-	m_nearest_unsent_d = 0;
 	m_nothing_to_send_pause_timer = 0;
+	// Only the shells from this block outward have to be scanned again
+	m_nearest_unsent_d = MYMIN(m_nearest_unsent_d, getShellDistance(p));
 
-	if(m_blocks_sending.find(p) != m_blocks_sending.end())
-		m_blocks_sending.erase(p);
-	if(m_blocks_sent.find(p) != m_blocks_sent.end())
-		m_blocks_sent.erase(p);
-	m_blocks_modified.insert(p);
+	u64 key = getBlockKey(p);
+	m_blocks_sending.erase(key);
+	m_blocks_sent.erase(key);
+	m_blocks_modified.insert(key);
 }
 
 void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
 {
-	m_nearest_unsent_d = 0;
 	m_nothing_to_send_pause_timer = 0;
 
 	for(std::map<v3s16, MapBlock*>::iterator
@@ -420,12 +456,12 @@ void RemoteClient::SetBlocksNotSent(std::map<v3s16, MapBlock*> &blocks)
 			i != blocks.end(); ++i)
 	{
 		v3s16 p = i->first;
-		m_blocks_modified.insert(p);
+		m_nearest_unsent_d = MYMIN(m_nearest_unsent_d, getShellDistance(p));
 
-		if(m_blocks_sending.find(p) != m_blocks_sending.end())
-			m_blocks_sending.erase(p);
-		if(m_blocks_sent.find(p) != m_blocks_sent.end())
-			m_blocks_sent.erase(p);
+		u64 key = getBlockKey(p);
+		m_blocks_modified.insert(key);
+		m_blocks_sending.erase(key);
+		m_blocks_sent.erase(key);
 	}
 }
 
@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <vector>
 #include <set>
 
+class Map;
 class MapBlock;
 class ServerEnvironment;
 class EmergeManager;
@@ -258,6 +259,7 @@ class RemoteClient
 		m_state(CS_Created),
 		m_nearest_unsent_d(0),
 		m_nearest_unsent_reset_timer(0.0),
+		m_scan_camera_fov(0.0),
 		m_excess_gotblocks(0),
 		m_nothing_to_send_pause_timer(0.0),
 		m_name(""),
@@ -281,6 +283,16 @@ class RemoteClient
 	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
 			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
 
+	/*
+		The part of GetNextBlocks that looks for blocks around the
+		player's predicted position and camera.
+		The emerge manager is only used for blocks missing in map.
+	*/
+	void SelectBlocksToSend(Map *map, EmergeManager *emerge, float dtime,
+			v3f playerpos_predicted, v3f camera_pos, v3f camera_dir,
+			float camera_fov, s16 wanted_range,
+			std::vector<PrioritySortedBlockTransfer> &dest);
+
 	void GotBlock(v3s16 p);
 
 	void SentBlock(v3s16 p);
@@ -367,19 +379,38 @@ class RemoteClient
 	/* current state of client */
 	ClientState m_state;
 
+	// Key of a block position in the block sets below
+	static u64 getBlockKey(v3s16 p)
+	{
+		return ((u64)(u16)p.X << 32) | ((u64)(u16)p.Y << 16) | (u16)p.Z;
+	}
+
+	// Index of the shell around m_last_center the block is in
+	s16 getShellDistance(v3s16 p) const
+	{
+		s32 d = MYMAX(MYMAX(abs(p.X - m_last_center.X),
+				abs(p.Y - m_last_center.Y)), abs(p.Z - m_last_center.Z));
+		return MYMIN(d, S16_MAX);
+	}
+
 	/*
 		Blocks that have been sent to client.
 		- These don't have to be sent again.
 		- A block is cleared from here when client says it has
 		  deleted it from it's memory
 
-		List of block positions.
+		Set of block position keys.
 		No MapBlock* is stored here because the blocks can get deleted.
 	*/
-	std::set<v3s16> m_blocks_sent;
+	UNORDERED_SET<u64> m_blocks_sent;
+	// All shells closer than this have been looked at
 	s16 m_nearest_unsent_d;
 	v3s16 m_last_center;
 	float m_nearest_unsent_reset_timer;
+	// Camera when all blocks in range were last looked at
+	v3s16 m_scan_camera_pos;
+	v3f m_scan_camera_dir;
+	float m_scan_camera_fov;
 
 	/*
 		Blocks that are currently on the line.
@@ -389,7 +420,7 @@ class RemoteClient
 		Block is removed when GOTBLOCKS is received.
 		Value is time from sending. (not used at the moment)
 	*/
-	std::map<v3s16, float> m_blocks_sending;
+	UNORDERED_MAP<u64, float> m_blocks_sending;
 
 	/*
 		Blocks that have been modified since last sending them.
@@ -397,9 +428,9 @@ class RemoteClient
 		client reports it has received them to account for blocks
 		that are being modified while on the line.
 
-		List of block positions.
+		Set of block position keys.
 	*/
-	std::set<v3s16> m_blocks_modified;
+	UNORDERED_SET<u64> m_blocks_modified;
 
 	/*
 		Count of excess GotBlocks().
@@ -45,7 +45,9 @@ ClientMap::ClientMap(
 	m_control(control),
 	m_camera_position(0,0,0),
 	m_camera_direction(0,0,1),
-	m_camera_fov(M_PI)
+	m_camera_fov(M_PI),
+	m_drawlist_valid(false),
+	m_occlusion_valid(false)
 {
 	m_box = aabb3f(-BS*1000000,-BS*1000000,-BS*1000000,
 			BS*1000000,BS*1000000,BS*1000000);
@@ -98,6 +100,38 @@ MapSector * ClientMap::emergeSector(v2s16 p2d)
 	return sector;
 }
 
+void ClientMap::indexBlock(MapBlock *block)
+{
+	Map::indexBlock(block);
+	DrawListRegion &region = m_block_regions[
+		getContainerPos(block->getPos(), CLIENTMAP_REGION_SIZE)];
+	region.blocks.push_back(block);
+	region.occlusion.push_back(BLOCK_OCCLUSION_UNKNOWN);
+	invalidateDrawList();
+}
+
+void ClientMap::unindexBlock(v3s16 p)
+{
+	Map::unindexBlock(p);
+	std::map<v3s16, DrawListRegion>::iterator it =
+		m_block_regions.find(getContainerPos(p, CLIENTMAP_REGION_SIZE));
+	if (it != m_block_regions.end()) {
+		DrawListRegion &region = it->second;
+		for (size_t i = 0; i < region.blocks.size(); i++) {
+			if (region.blocks[i]->getPos() != p)
+				continue;
+			region.blocks[i] = region.blocks.back();
+			region.blocks.pop_back();
+			region.occlusion[i] = region.occlusion.back();
+			region.occlusion.pop_back();
+			break;
+		}
+		if (region.blocks.empty())
+			m_block_regions.erase(it);
+	}
+	invalidateDrawList();
+}
+
 void ClientMap::OnRegisterSceneNode()
 {
 	if(IsVisible)
@@ -139,27 +173,96 @@ void ClientMap::getBlocksInViewRange(v3s16 cam_pos_nodes,
 void ClientMap::updateDrawList(video::IVideoDriver* driver)
 {
 	ScopeProfiler sp(g_profiler, "CM::updateDrawList()", SPT_AVG);
+	ScopeProfiler sp_graph(g_profiler, "CM::updateDrawList", SPT_GRAPH_ADD);
 	g_profiler->add("CM::updateDrawList() count", 1);
 
-	for (std::map<v3s16, MapBlock*>::iterator i = m_drawlist.begin();
-			i != m_drawlist.end(); ++i) {
-		MapBlock *block = i->second;
-		block->refDrop();
-	}
-	m_drawlist.clear();
-
 	v3f camera_position = m_camera_position;
 	v3f camera_direction = m_camera_direction;
 
 	v3s16 cam_pos_nodes = floatToInt(camera_position, BS);
+
+	float range = 100000 * BS;
+#if defined(__ANDROID__) || defined(__IOS__)
+	range = m_control.wanted_range * 4 * BS;
+#endif
+	if (m_control.range_all == false)
+		range = m_control.wanted_range * BS;
+
+	// No occlusion culling when free_move is on and camera is
+	// inside ground
+	bool occlusion_culling_enabled = true;
+	if (g_settings->getBool("free_move")) {
+		MapNode n = getNodeNoEx(cam_pos_nodes);
+		if (n.getContent() == CONTENT_IGNORE ||
+				m_nodedef->get(n).solidness == 2)
+			occlusion_culling_enabled = false;
+	}
+
+	/*
+		Keep the draw list if neither the camera nor the blocks and their
+		meshes have changed since it was made
+	*/
+	DrawListCamera drawlist_camera;
+	drawlist_camera.position = camera_position;
+	drawlist_camera.direction = camera_direction;
+	drawlist_camera.fov = m_camera_fov;
+	drawlist_camera.offset = m_camera_offset;
+	drawlist_camera.range = range;
+	drawlist_camera.max_blocks = m_control.wanted_max_blocks;
+	drawlist_camera.range_all = m_control.range_all;
+	drawlist_camera.occlusion_culling = occlusion_culling_enabled;
+	drawlist_camera.position_nodes = cam_pos_nodes;
+
+	if (m_drawlist_valid && drawlist_camera == m_drawlist_camera) {
+		for (std::vector<MapBlock *>::iterator i = m_drawlist_in_range.begin();
+				i != m_drawlist_in_range.end(); ++i)
+			(*i)->resetUsageTimer();
+		g_profiler->add("CM::updateDrawList() kept", 1);
+		return;
+	}
+
+	/*
+		Blocks are only tested for occlusion again when the camera has
+		moved to another node or the map has changed. Otherwise moving
+		or turning the camera only repeats the cheap sight tests.
+	*/
+	if (!m_occlusion_valid ||
+			cam_pos_nodes != m_drawlist_camera.position_nodes) {
+		for (std::map<v3s16, DrawListRegion>::iterator ri =
+				m_block_regions.begin(); ri != m_block_regions.end(); ++ri) {
+			std::vector<u8> &occlusion = ri->second.occlusion;
+			std::fill(occlusion.begin(), occlusion.end(),
+					BLOCK_OCCLUSION_UNKNOWN);
+		}
+	}
+	m_occlusion_valid = true;
+	m_drawlist_valid = true;
+	m_drawlist_camera = drawlist_camera;
+
+	std::map<v3s16, MapBlock*> drawlist;
+	m_drawlist_in_range.clear();
+
 	v3s16 p_blocks_min;
 	v3s16 p_blocks_max;
 	getBlocksInViewRange(cam_pos_nodes, &p_blocks_min, &p_blocks_max);
 
+	// Maximum radius of a region
+	const f32 region_max_radius = 0.866025403784 *
+			CLIENTMAP_REGION_SIZE * MAP_BLOCKSIZE * BS;
+	const v3s16 region_center_nodes = v3s16(1, 1, 1) *
+			(CLIENTMAP_REGION_SIZE * MAP_BLOCKSIZE / 2);
+
+	// Number of regions whose blocks were looked at
+	u32 regions_in_range = 0;
+	// Number of regions skipped as a whole
+	u32 regions_culled = 0;
 	// Number of blocks in rendering range
 	u32 blocks_in_range = 0;
 	// Number of blocks occlusion culled
 	u32 blocks_occlusion_culled = 0;
+	// Number of blocks tested for occlusion, the others reused the result
+	// of an earlier update
+	u32 blocks_occlusion_tested = 0;
 	// Number of blocks in rendering range but don't have a mesh
 	u32 blocks_in_range_without_mesh = 0;
 	// Blocks that had mesh that would have been drawn according to
@@ -167,65 +270,52 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 	u32 blocks_would_have_drawn = 0;
 	// Blocks that were drawn and had a mesh
 	u32 blocks_drawn = 0;
-	// Blocks which had a corresponding meshbuffer for this pass
-	//u32 blocks_had_pass_meshbuf = 0;
-	// Blocks from which stuff was actually drawn
-	//u32 blocks_without_stuff = 0;
 	// Distance to farthest drawn block
 	float farthest_drawn = 0;
 
-	// No occlusion culling when free_move is on and camera is
-	// inside ground
-	bool occlusion_culling_enabled = true;
-	if (g_settings->getBool("free_move")) {
-		MapNode n = getNodeNoEx(cam_pos_nodes);
-		if (n.getContent() == CONTENT_IGNORE ||
-				m_nodedef->get(n).solidness == 2)
-			occlusion_culling_enabled = false;
-	}
-
-	for (std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
-			si != m_sectors.end(); ++si) {
-		MapSector *sector = si->second;
-		v2s16 sp = sector->getPos();
+	for (std::map<v3s16, DrawListRegion>::iterator ri =
+			m_block_regions.begin(); ri != m_block_regions.end(); ++ri) {
+		v3s16 region_blocks_min = ri->first * CLIENTMAP_REGION_SIZE;
+		v3s16 region_blocks_max = region_blocks_min +
+				v3s16(1, 1, 1) * (CLIENTMAP_REGION_SIZE - 1);
 
 		if (m_control.range_all == false) {
-			if (sp.X < p_blocks_min.X || sp.X > p_blocks_max.X ||
-					sp.Y < p_blocks_min.Z || sp.Y > p_blocks_max.Z)
+			if (region_blocks_max.X < p_blocks_min.X ||
+					region_blocks_min.X > p_blocks_max.X ||
+					region_blocks_max.Z < p_blocks_min.Z ||
+					region_blocks_min.Z > p_blocks_max.Z)
 				continue;
 		}
 
-		MapBlockVect sectorblocks;
-		sector->getBlocks(sectorblocks);
-
-		/*
-			Loop through blocks in sector
-		*/
+		// Whenever any block of the region is in sight, the sphere
+		// around the region is too
+		v3f region_center = intToFloat(region_blocks_min * MAP_BLOCKSIZE +
+				region_center_nodes, BS);
+		if (!isSphereInSight(region_center, region_max_radius,
+				camera_position, camera_direction, m_camera_fov, range)) {
+			regions_culled++;
+			continue;
+		}
+		regions_in_range++;
 
-		u32 sector_blocks_drawn = 0;
+		DrawListRegion &region = ri->second;
+		for (size_t i = 0; i < region.blocks.size(); i++) {
+			MapBlock *block = region.blocks[i];
+			v3s16 bp = block->getPos();
 
-		for (MapBlockVect::iterator i = sectorblocks.begin();
-				i != sectorblocks.end(); ++i) {
-			MapBlock *block = *i;
+			if (m_control.range_all == false) {
+				if (bp.X < p_blocks_min.X || bp.X > p_blocks_max.X ||
+						bp.Z < p_blocks_min.Z || bp.Z > p_blocks_max.Z)
+					continue;
+			}
 
 			/*
 				Compare block position to camera position, skip
 				if not seen on display
 			*/
 
-			if (block->mesh != NULL)
-				block->mesh->updateCameraOffset(m_camera_offset);
-
-			float range = 100000 * BS;
-#if defined(__ANDROID__) || defined(__IOS__)
-				range = m_control.wanted_range * 4 * BS;	
-#endif
-			
-			if (m_control.range_all == false)
-				range = m_control.wanted_range * BS;
-
 			float d = 0.0;
-			if (!isBlockInSight(block->getPos(), camera_position,
+			if (!isBlockInSight(bp, camera_position,
 					camera_direction, m_camera_fov, range, &d))
 				continue;
 
@@ -239,17 +329,27 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 				continue;
 			}
 
+			// This block is in range. Reset usage timer, also when it is
+			// culled, so that blocks right behind a wall are kept loaded.
+			block->resetUsageTimer();
+			m_drawlist_in_range.push_back(block);
+
 			/*
 				Occlusion culling
 			*/
-			if (occlusion_culling_enabled && isBlockOccluded(block, cam_pos_nodes)) {
-				blocks_occlusion_culled++;
-				continue;
+			if (occlusion_culling_enabled) {
+				u8 &occlusion = region.occlusion[i];
+				if (occlusion == BLOCK_OCCLUSION_UNKNOWN) {
+					blocks_occlusion_tested++;
+					occlusion = isBlockOccluded(block, cam_pos_nodes) ?
+							BLOCK_OCCLUSION_OCCLUDED : BLOCK_OCCLUSION_VISIBLE;
+				}
+				if (occlusion == BLOCK_OCCLUSION_OCCLUDED) {
+					blocks_occlusion_culled++;
+					continue;
+				}
 			}
 
-			// This block is in range. Reset usage timer.
-			block->resetUsageTimer();
-
 			// Limit block count in case of a sudden increase
 			blocks_would_have_drawn++;
 			if (blocks_drawn >= m_control.wanted_max_blocks &&
@@ -257,27 +357,65 @@ void ClientMap::updateDrawList(video::IVideoDriver* driver)
 					d > m_control.wanted_range * BS)
 				continue;
 
+			// Meshes out of sight are moved to the camera offset when
+			// they come into sight
+			block->mesh->updateCameraOffset(m_camera_offset);
+
 			// Add to set
-			block->refGrab();
-			m_drawlist[block->getPos()] = block;
+			drawlist[bp] = block;
 
-			sector_blocks_drawn++;
+			m_last_drawn_sectors.insert(v2s16(bp.X, bp.Z));
 			blocks_drawn++;
 			if (d / BS > farthest_drawn)
 				farthest_drawn = d / BS;
+		}
+	}
 
-		} // foreach sectorblocks
-
-		if (sector_blocks_drawn != 0)
-			m_last_drawn_sectors.insert(sp);
+	/*
+		Grab the blocks that came into the draw list and drop those that
+		left it. Both lists are sorted by position.
+	*/
+	u32 blocks_added = 0;
+	u32 blocks_removed = 0;
+	std::map<v3s16, MapBlock*>::iterator old_i = m_drawlist.begin();
+	for (std::map<v3s16, MapBlock*>::iterator i = drawlist.begin();
+			i != drawlist.end(); ++i) {
+		while (old_i != m_drawlist.end() && old_i->first < i->first) {
+			old_i->second->refDrop();
+			blocks_removed++;
+			++old_i;
+		}
+		if (old_i != m_drawlist.end() && old_i->first == i->first &&
+				old_i->second == i->second) {
+			++old_i;
+			continue;
+		}
+		if (old_i != m_drawlist.end() && old_i->first == i->first) {
+			// Another block has been loaded at the same position
+			old_i->second->refDrop();
+			blocks_removed++;
+			++old_i;
+		}
+		i->second->refGrab();
+		blocks_added++;
+	}
+	for (; old_i != m_drawlist.end(); ++old_i) {
+		old_i->second->refDrop();
+		blocks_removed++;
 	}
+	m_drawlist.swap(drawlist);
 
 	m_control.blocks_would_have_drawn = blocks_would_have_drawn;
 	m_control.blocks_drawn = blocks_drawn;
 	m_control.farthest_drawn = farthest_drawn;
 
+	g_profiler->avg("CM: regions in range", regions_in_range);
+	g_profiler->avg("CM: regions culled", regions_culled);
 	g_profiler->avg("CM: blocks in range", blocks_in_range);
 	g_profiler->avg("CM: blocks occlusion culled", blocks_occlusion_culled);
+	g_profiler->avg("CM: blocks occlusion tested", blocks_occlusion_tested);
+	g_profiler->avg("CM: blocks added to draw list", blocks_added);
+	g_profiler->avg("CM: blocks removed from draw list", blocks_removed);
 	if (blocks_in_range != 0)
 		g_profiler->avg("CM: blocks in range without mesh (frac)",
 				(float)blocks_in_range_without_mesh / blocks_in_range);
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "camera.h"
 #include <set>
 #include <map>
+#include <vector>
 
 struct MapDrawControl
 {
@@ -57,6 +58,48 @@ struct MapDrawControl
 class Client;
 class ITextureSource;
 
+// Edge length in blocks of the regions that updateDrawList culls as a whole
+#define CLIENTMAP_REGION_SIZE 8
+
+// What the draw list depends on besides the blocks and their meshes.
+// When only this changes, updateDrawList reuses the occlusion culling
+// results of the blocks as long as the camera stays in the same node.
+struct DrawListCamera
+{
+	v3f position;
+	v3f direction;
+	f32 fov;
+	v3s16 offset;
+	float range;
+	u32 max_blocks;
+	bool range_all;
+	bool occlusion_culling;
+
+	v3s16 position_nodes;
+
+	bool operator==(const DrawListCamera &other) const
+	{
+		return position == other.position && direction == other.direction &&
+			fov == other.fov && offset == other.offset &&
+			range == other.range && max_blocks == other.max_blocks &&
+			range_all == other.range_all &&
+			occlusion_culling == other.occlusion_culling;
+	}
+};
+
+// Loaded blocks of one region
+struct DrawListRegion
+{
+	std::vector<MapBlock *> blocks;
+	// Occlusion culling result of each block as seen from the camera node
+	// of the last updateDrawList: BLOCK_OCCLUSION_*
+	std::vector<u8> occlusion;
+};
+
+#define BLOCK_OCCLUSION_UNKNOWN 0
+#define BLOCK_OCCLUSION_VISIBLE 1
+#define BLOCK_OCCLUSION_OCCLUDED 2
+
 /*
 	ClientMap
 
@@ -119,9 +162,21 @@ class ClientMap : public Map, public scene::ISceneNode
 		return m_box;
 	}
 
+	// Keeps the blocks sorted into regions for updateDrawList
+	void indexBlock(MapBlock *block);
+	void unindexBlock(v3s16 p);
+
 	void getBlocksInViewRange(v3s16 cam_pos_nodes,
 		v3s16 *p_blocks_min, v3s16 *p_blocks_max);
 	void updateDrawList(video::IVideoDriver* driver);
+	// Makes the next updateDrawList rebuild the draw list and test
+	// occlusion again even if the camera has not moved, e.g. because
+	// meshes have changed
+	void invalidateDrawList()
+	{
+		m_drawlist_valid = false;
+		m_occlusion_valid = false;
+	}
 	void renderMap(video::IVideoDriver* driver, s32 pass);
 
 	int getBackgroundBrightness(float max_d, u32 daylight_factor,
@@ -147,6 +202,19 @@ class ClientMap : public Map, public scene::ISceneNode
 	v3s16 m_camera_offset;
 
 	std::map<v3s16, MapBlock*> m_drawlist;
+	bool m_drawlist_valid;
+	DrawListCamera m_drawlist_camera;
+	// Blocks in range with a mesh, drawn or culled, whose usage timers
+	// are reset while the draw list is kept. They are not grabbed:
+	// unindexBlock invalidates the draw list before a block is deleted.
+	std::vector<MapBlock *> m_drawlist_in_range;
+
+	// Loaded blocks by region position (block position divided by
+	// CLIENTMAP_REGION_SIZE)
+	std::map<v3s16, DrawListRegion> m_block_regions;
+	// Whether the occlusion results in m_block_regions are those of
+	// m_drawlist_camera.position_nodes
+	bool m_occlusion_valid;
 
 	std::set<v2s16> m_last_drawn_sectors;
 
@@ -380,7 +380,7 @@ void MapblockMeshGenerator::prepareLiquidNodeDrawing()
 	getSpecialTile(0, &tile_liquid_top);
 	getSpecialTile(1, &tile_liquid);
 
-	MapNode ntop = data->m_vmanip.getNodeNoEx(blockpos_nodes + v3s16(p.X, p.Y + 1, p.Z));
+	MapNode ntop = data->m_nodes.getNodeNoEx(blockpos_nodes + v3s16(p.X, p.Y + 1, p.Z));
 	c_flowing = nodedef->getId(f->liquid_alternative_flowing);
 	c_source = nodedef->getId(f->liquid_alternative_source);
 	top_is_same_liquid = (ntop.getContent() == c_flowing) || (ntop.getContent() == c_source);
@@ -410,7 +410,7 @@ void MapblockMeshGenerator::getLiquidNeighborhood()
 	for (int u = -1; u <= 1; u++) {
 		NeighborData &neighbor = liquid_neighbors[w + 1][u + 1];
 		v3s16 p2 = p + v3s16(u, 0, w);
-		MapNode n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+		MapNode n2 = data->m_nodes.getNodeNoEx(blockpos_nodes + p2);
 		neighbor.content = n2.getContent();
 		neighbor.level = -0.5 * BS;
 		neighbor.is_same_liquid = false;
@@ -436,7 +436,7 @@ void MapblockMeshGenerator::getLiquidNeighborhood()
 		// NOTE: This doesn't get executed if neighbor
 		//       doesn't exist
 		p2.Y++;
-		n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+		n2 = data->m_nodes.getNodeNoEx(blockpos_nodes + p2);
 		if (n2.getContent() == c_source || n2.getContent() == c_flowing)
 			neighbor.top_is_same_liquid = true;
 	}
@@ -609,7 +609,7 @@ void MapblockMeshGenerator::drawGlasslikeNode()
 		// Check this neighbor
 		v3s16 dir = g_6dirs[face];
 		v3s16 neighbor_pos = blockpos_nodes + p + dir;
-		MapNode neighbor = data->m_vmanip.getNodeNoExNoEmerge(neighbor_pos);
+		MapNode neighbor = data->m_nodes.getNodeNoEx(neighbor_pos);
 		// Don't make face if neighbor is of same type
 		if (neighbor.getContent() == n.getContent())
 			continue;
@@ -710,7 +710,7 @@ void MapblockMeshGenerator::drawGlasslikeFramedNode()
 			if (!check_nb[i])
 				continue;
 			v3s16 n2p = blockpos_nodes + p + g_26dirs[i];
-			MapNode n2 = data->m_vmanip.getNodeNoEx(n2p);
+			MapNode n2 = data->m_nodes.getNodeNoEx(n2p);
 			content_t n2c = n2.getContent();
 			if (n2c == current || n2c == CONTENT_IGNORE)
 				nb[i] = 1;
@@ -931,7 +931,7 @@ void MapblockMeshGenerator::drawPlantlikeRootedNode()
 	if (data->m_smooth_lighting) {
 		getSmoothLightFrame();
 	} else {
-		MapNode ntop = data->m_vmanip.getNodeNoEx(blockpos_nodes + p);
+		MapNode ntop = data->m_nodes.getNodeNoEx(blockpos_nodes + p);
 		light = getInteriorLight(ntop, 1, nodedef);
 	}
 	drawPlantlike();
@@ -967,7 +967,7 @@ void MapblockMeshGenerator::drawFirelikeNode()
 	content_t current = n.getContent();
 	for (int i = 0; i < 6; i++) {
 		v3s16 n2p = blockpos_nodes + p + g_6dirs[i];
-		MapNode n2 = data->m_vmanip.getNodeNoEx(n2p);
+		MapNode n2 = data->m_nodes.getNodeNoEx(n2p);
 		content_t n2c = n2.getContent();
 		if (n2c != CONTENT_IGNORE && n2c != CONTENT_AIR && n2c != current) {
 			neighbor[i] = true;
@@ -1037,7 +1037,7 @@ void MapblockMeshGenerator::drawFencelikeNode()
 	// Now a section of fence, +X, if there's a post there
 	v3s16 p2 = p;
 	p2.X++;
-	MapNode n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+	MapNode n2 = data->m_nodes.getNodeNoEx(blockpos_nodes + p2);
 	const ContentFeatures *f2 = &nodedef->get(n2);
 	if (f2->drawtype == NDT_FENCELIKE) {
 		static const aabb3f bar_x1(BS / 2 - bar_len,  BS / 4 - bar_rad, -bar_rad,
@@ -1059,7 +1059,7 @@ void MapblockMeshGenerator::drawFencelikeNode()
 	// Now a section of fence, +Z, if there's a post there
 	p2 = p;
 	p2.Z++;
-	n2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p2);
+	n2 = data->m_nodes.getNodeNoEx(blockpos_nodes + p2);
 	f2 = &nodedef->get(n2);
 	if (f2->drawtype == NDT_FENCELIKE) {
 		static const aabb3f bar_z1(-bar_rad,  BS / 4 - bar_rad, BS / 2 - bar_len,
@@ -1081,7 +1081,7 @@ void MapblockMeshGenerator::drawFencelikeNode()
 
 bool MapblockMeshGenerator::isSameRail(v3s16 dir)
 {
-	MapNode node2 = data->m_vmanip.getNodeNoEx(blockpos_nodes + p + dir);
+	MapNode node2 = data->m_nodes.getNodeNoEx(blockpos_nodes + p + dir);
 	if (node2.getContent() == n.getContent())
 		return true;
 	const ContentFeatures &def2 = nodedef->get(node2);
@@ -1205,7 +1205,7 @@ void MapblockMeshGenerator::drawNodeboxNode()
 		for (int dir = 0; dir != 6; dir++) {
 			int flag = 1 << dir;
 			v3s16 p2 = blockpos_nodes + p + connection_dirs[dir];
-			MapNode n2 = data->m_vmanip.getNodeNoEx(p2);
+			MapNode n2 = data->m_nodes.getNodeNoEx(p2);
 			if (nodedef->nodeboxConnects(n, n2, flag))
 				neighbors_set |= flag;
 		}
@@ -1330,7 +1330,7 @@ void MapblockMeshGenerator::generate()
 	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
 	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
 	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
-		n = data->m_vmanip.getNodeNoEx(blockpos_nodes + p);
+		n = data->m_nodes.getNodeNoEx(blockpos_nodes + p);
 		f = &nodedef->get(n);
 		drawNode();
 	}
@@ -42,6 +42,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "content_sao.h"
 #include "remoteplayer.h"
 
+#include <sstream>
+
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string) :
 	m_connect_string(connect_string),
 	m_conn(NULL),
@@ -195,6 +197,11 @@ void MapDatabasePostgreSQL::initStatements()
 			"WHERE posX = $1::int4 AND posY = $2::int4 AND "
 			"posZ = $3::int4");
 
+	prepareStatement("read_blocks",
+		"SELECT b.posX, b.posY, b.posZ, b.data FROM blocks b "
+			"JOIN unnest($1::int4[], $2::int4[], $3::int4[]) AS p(x, y, z) "
+			"ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
+
 	if (getPGVersion() < 90500) {
 		prepareStatement("write_block_insert",
 			"INSERT INTO blocks (posX, posY, posZ, data) SELECT "
@@ -278,6 +285,53 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(pos.size());
+	if (pos.empty())
+		return;
+
+	verifyDatabase();
+
+	// Coordinates are passed as text arrays, e.g. "{1,2,3}"
+	std::ostringstream xs, ys, zs;
+	for (size_t i = 0; i < pos.size(); i++) {
+		const char *sep = i ? "," : "{";
+		xs << sep << pos[i].X;
+		ys << sep << pos[i].Y;
+		zs << sep << pos[i].Z;
+	}
+	xs << "}";
+	ys << "}";
+	zs << "}";
+	std::string x = xs.str(), y = ys.str(), z = zs.str();
+
+	const void *args[] = { x.c_str(), y.c_str(), z.c_str() };
+	const int argLen[] = { (int)x.size(), (int)y.size(), (int)z.size() };
+	const int argFmt[] = { 0, 0, 0 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		argLen, argFmt, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		// Binary results: int4 columns are in network byte order
+		v3s16 p(
+			(s32)ntohl(*(const u32 *)PQgetvalue(results, row, 0)),
+			(s32)ntohl(*(const u32 *)PQgetvalue(results, row, 1)),
+			(s32)ntohl(*(const u32 *)PQgetvalue(results, row, 2)));
+		for (size_t i = 0; i < pos.size(); i++) {
+			if (pos[i] == p)
+				(*blocks)[i].assign(PQgetvalue(results, row, 3),
+					PQgetlength(results, row, 3));
+		}
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
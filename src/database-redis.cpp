@@ -156,6 +156,63 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(pos.size());
+	if (pos.empty())
+		return;
+
+	// HMGET <hash> <field>...
+	std::vector<std::string> keys(pos.size());
+	std::vector<const char *> argv(pos.size() + 2);
+	std::vector<size_t> argvlen(pos.size() + 2);
+	argv[0] = "HMGET";
+	argvlen[0] = 5;
+	argv[1] = hash.c_str();
+	argvlen[1] = hash.size();
+	for (size_t i = 0; i < pos.size(); i++) {
+		keys[i] = i64tos(getBlockAsInteger(pos[i]));
+		argv[i + 2] = keys[i].c_str();
+		argvlen[i + 2] = keys[i].size();
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), &argv[0], &argvlen[0]));
+
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		errorstream << "loadBlocks: loading " << pos.size()
+			<< " blocks failed: " << errstr << std::endl;
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' errored: ") + errstr);
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != pos.size()) {
+		errorstream << "loadBlocks: loading " << pos.size()
+			<< " blocks returned invalid reply type " << reply->type
+			<< std::endl;
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' gave invalid reply."));
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		redisReply *elem = reply->element[i];
+		// Missing blocks come back as nil
+		if (elem->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(elem->str, elem->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
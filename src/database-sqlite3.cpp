@@ -46,6 +46,11 @@ SQLite format specification:
 #define BUSY_FATAL_TRESHOLD	3000	// Allow SQLITE_BUSY to be returned, which will cause a minetest crash.
 #define BUSY_ERROR_INTERVAL	10000	// Safety net: report again every 10 seconds
 
+// Number of positions bound to the batched block read statement
+#define READ_BATCH_SIZE 16
+// Number of rows written by the batched block write statement
+#define WRITE_BATCH_SIZE 16
+
 
 #define SQLRES(s, r, m) \
 	if ((s) != (r)) { \
@@ -173,6 +178,52 @@ void Database_SQLite3::openDatabase()
 		"Failed to modify sqlite3 synchronous mode");
 	SQLOK(sqlite3_exec(m_database, "PRAGMA foreign_keys = ON", NULL, NULL, NULL),
 		"Failed to enable sqlite3 foreign key support");
+
+	// Empty keeps the journal mode the database already has
+	std::string journal_mode = g_settings->get("sqlite_journal_mode");
+	if (!journal_mode.empty())
+		setJournalMode(journal_mode);
+
+	s32 cache_size = g_settings->getS32("sqlite_cache_size");
+	if (cache_size > 0) {
+		// Negative values are in KiB instead of pages
+		query_str = "PRAGMA cache_size = -" + itos(cache_size);
+		SQLOK(sqlite3_exec(m_database, query_str.c_str(), NULL, NULL, NULL),
+			"Failed to set sqlite3 cache size");
+	}
+
+	s32 mmap_size = g_settings->getS32("sqlite_mmap_size");
+	if (mmap_size > 0) {
+		query_str = "PRAGMA mmap_size = " + i64tos((s64)mmap_size * 1024 * 1024);
+		SQLOK(sqlite3_exec(m_database, query_str.c_str(), NULL, NULL, NULL),
+			"Failed to set sqlite3 mmap size");
+	}
+}
+
+void Database_SQLite3::setJournalMode(const std::string &mode)
+{
+	std::string wanted = lowercase(mode);
+	if (wanted != "delete" && wanted != "truncate" && wanted != "persist" &&
+			wanted != "wal") {
+		warningstream << "SQLite3: Unknown journal mode \"" << mode
+			<< "\", keeping the current one" << std::endl;
+		return;
+	}
+
+	// Returns the journal mode in effect afterwards
+	std::string query_str = "PRAGMA journal_mode = " + wanted;
+	sqlite3_stmt *stmt;
+	SQLOK(sqlite3_prepare_v2(m_database, query_str.c_str(), -1, &stmt, NULL),
+		"Failed to prepare query '" + query_str + "'");
+	std::string result;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		result = lowercase(sqlite_to_string(stmt, 0));
+	SQLOK_ERRSTREAM(sqlite3_finalize(stmt), "Failed to finalize journal_mode query");
+
+	if (result != wanted) {
+		warningstream << "SQLite3: Could not set journal mode to " << wanted
+			<< ", using " << result << std::endl;
+	}
 }
 
 void Database_SQLite3::verifyDatabase()
@@ -205,7 +256,9 @@ MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
 	Database_SQLite3(savedir, "map"),
 	MapDatabase(),
 	m_stmt_read(NULL),
+	m_stmt_read_batch(NULL),
 	m_stmt_write(NULL),
+	m_stmt_write_batch(NULL),
 	m_stmt_list(NULL),
 	m_stmt_delete(NULL)
 {
@@ -215,7 +268,9 @@ MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_batch)
 	FINALIZE_STATEMENT(m_stmt_write)
+	FINALIZE_STATEMENT(m_stmt_write_batch)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_delete)
 }
@@ -237,10 +292,17 @@ void MapDatabaseSQLite3::createDatabase()
 void MapDatabaseSQLite3::initStatements()
 {
 	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+	// READ_BATCH_SIZE placeholders
+	PREPARE_STATEMENT(read_batch, "SELECT `pos`, `data` FROM `blocks` "
+		"WHERE `pos` IN (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
 #ifdef __ANDROID__
 	PREPARE_STATEMENT(write,  "INSERT INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 #else
 	PREPARE_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
+	// WRITE_BATCH_SIZE rows
+	PREPARE_STATEMENT(write_batch, "REPLACE INTO `blocks` (`pos`, `data`) VALUES "
+		"(?, ?), (?, ?), (?, ?), (?, ?), (?, ?), (?, ?), (?, ?), (?, ?), "
+		"(?, ?), (?, ?), (?, ?), (?, ?), (?, ?), (?, ?), (?, ?), (?, ?)");
 #endif
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
@@ -291,10 +353,52 @@ bool MapDatabaseSQLite3::saveBlock(const v3s16 &pos, const std::string &data)
 	SQLOK(sqlite3_bind_blob(m_stmt_write, 2, data.data(), data.size(), NULL),
 		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
 
-	SQLRES(sqlite3_step(m_stmt_write), SQLITE_DONE, "Failed to save block")
+	bool good = sqlite3_step(m_stmt_write) == SQLITE_DONE;
 	sqlite3_reset(m_stmt_write);
 
-	return true;
+	if (!good) {
+		warningstream << "saveBlock: Block failed to save "
+			<< PP(pos) << ": " << sqlite3_errmsg(m_database) << std::endl;
+	}
+	return good;
+}
+
+bool MapDatabaseSQLite3::saveBlocks(const std::vector<v3s16> &pos,
+	const std::vector<std::string> &blocks)
+{
+#ifdef __ANDROID__
+	// REPLACE is not reliable there, see saveBlock()
+	return MapDatabase::saveBlocks(pos, blocks);
+#else
+	verifyDatabase();
+
+	bool good = true;
+	size_t i = 0;
+	for (; i + WRITE_BATCH_SIZE <= pos.size(); i += WRITE_BATCH_SIZE) {
+		for (int j = 0; j < WRITE_BATCH_SIZE; j++) {
+			const std::string &data = blocks[i + j];
+			bindPos(m_stmt_write_batch, pos[i + j], 2 * j + 1);
+			SQLOK(sqlite3_bind_blob(m_stmt_write_batch, 2 * j + 2,
+					data.data(), data.size(), NULL),
+				"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+		}
+
+		// Keep writing the other batches; the caller retries the whole call
+		if (sqlite3_step(m_stmt_write_batch) != SQLITE_DONE) {
+			warningstream << "saveBlocks: Blocks failed to save from "
+				<< PP(pos[i]) << ": " << sqlite3_errmsg(m_database)
+				<< std::endl;
+			good = false;
+		}
+		sqlite3_reset(m_stmt_write_batch);
+	}
+
+	// The remaining blocks don't fill a batch
+	for (; i < pos.size(); i++)
+		good &= saveBlock(pos[i], blocks[i]);
+
+	return good;
+#endif
 }
 
 void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
@@ -318,6 +422,43 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(pos.size());
+
+	for (size_t start = 0; start < pos.size(); start += READ_BATCH_SIZE) {
+		size_t count = MYMIN(pos.size() - start, (size_t)READ_BATCH_SIZE);
+		s64 keys[READ_BATCH_SIZE];
+		for (size_t i = 0; i < count; i++)
+			keys[i] = getBlockAsInteger(pos[start + i]);
+
+		// Unused placeholders repeat the first position
+		for (int i = 0; i < READ_BATCH_SIZE; i++) {
+			SQLOK(sqlite3_bind_int64(m_stmt_read_batch, i + 1,
+					keys[(size_t)i < count ? i : 0]),
+				"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+		}
+
+		while (sqlite3_step(m_stmt_read_batch) == SQLITE_ROW) {
+			s64 key = sqlite3_column_int64(m_stmt_read_batch, 0);
+			const char *data = (const char *) sqlite3_column_blob(m_stmt_read_batch, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_batch, 1);
+			if (!data)
+				continue;
+
+			for (size_t i = 0; i < count; i++) {
+				if (keys[i] == key)
+					(*blocks)[start + i].assign(data, len);
+			}
+		}
+		sqlite3_reset(m_stmt_read_batch);
+	}
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
@@ -117,6 +117,7 @@ class Database_SQLite3 : public Database
 private:
 	// Open the database
 	void openDatabase();
+	void setJournalMode(const std::string &mode);
 
 	bool m_initialized;
 
@@ -139,6 +140,10 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> *blocks);
+	bool saveBlocks(const std::vector<v3s16> &pos,
+		const std::vector<std::string> &blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
@@ -153,7 +158,9 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	// Map
 	sqlite3_stmt *m_stmt_read;
+	sqlite3_stmt *m_stmt_read_batch;
 	sqlite3_stmt *m_stmt_write;
+	sqlite3_stmt *m_stmt_write_batch;
 	sqlite3_stmt *m_stmt_list;
 	sqlite3_stmt *m_stmt_delete;
 };
@@ -67,3 +67,22 @@ v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+
+void MapDatabase::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++)
+		loadBlock(pos[i], &(*blocks)[i]);
+}
+
+
+bool MapDatabase::saveBlocks(const std::vector<v3s16> &pos,
+	const std::vector<std::string> &blocks)
+{
+	bool ok = true;
+	for (size_t i = 0; i < pos.size(); i++)
+		ok &= saveBlock(pos[i], blocks[i]);
+	return ok;
+}
@@ -43,6 +43,15 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Loads several blocks at once; (*blocks)[i] is left empty if pos[i]
+	// is not in the database. Backends override this to use fewer queries.
+	virtual void loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> *blocks);
+	// Saves blocks[i] at pos[i]; returns false if any of them failed.
+	// Backends override this to use fewer queries.
+	virtual bool saveBlocks(const std::vector<v3s16> &pos,
+		const std::vector<std::string> &blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
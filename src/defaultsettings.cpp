@@ -275,6 +275,7 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("ipv6_server", "false");
 	settings->setDefault("workaround_window_size", "5");
 	settings->setDefault("max_packets_per_iteration", "1024");
+	settings->setDefault("congestion_control", "legacy");
 	settings->setDefault("port", "40000");
 	settings->setDefault("strict_protocol_version_checking", "false");
 	settings->setDefault("player_transfer_distance", "0");
@@ -319,14 +320,22 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("server_unload_unused_data_timeout", "29");
 	settings->setDefault("max_objects_per_block", "16");
 	settings->setDefault("server_map_save_interval", "5.3");
+	settings->setDefault("map_save_queue_limit", "1024");
+	settings->setDefault("zstd_map_compression", "false");
+	settings->setDefault("map_compression_level_disk", "-1");
+	settings->setDefault("map_compression_level_net", "-1");
 	settings->setDefault("chat_message_max_size", "500");
 	settings->setDefault("chat_message_limit_per_10sec", "5.0");
 	settings->setDefault("chat_message_limit_trigger_kick", "50");
 	settings->setDefault("sqlite_synchronous", "2");
+	settings->setDefault("sqlite_journal_mode", "");
+	settings->setDefault("sqlite_cache_size", "16384");
+	settings->setDefault("sqlite_mmap_size", "0");
 	settings->setDefault("full_block_send_enable_min_time_from_building", "2.0");
 	settings->setDefault("dedicated_server_step", "0.1");
 	settings->setDefault("active_block_mgmt_interval", "2.0");
 	settings->setDefault("abm_interval", "1.0");
+	settings->setDefault("num_abm_threads", "1");
 	settings->setDefault("nodetimer_interval", "0.2");
 	settings->setDefault("ignore_world_load_errors", "false");
 	settings->setDefault("remote_media", "");
@@ -334,7 +343,9 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("emergequeue_limit_total", "512");
 	settings->setDefault("emergequeue_limit_diskonly", "64");
 	settings->setDefault("emergequeue_limit_generate", "64");
+	settings->setDefault("emergequeue_load_batch_size", "16");
 	settings->setDefault("num_emerge_threads", "1");
+	settings->setDefault("num_mapchunk_threads", "0");
 	settings->setDefault("secure.enable_security", "true");
 	settings->setDefault("secure.trusted_mods", "");
 	settings->setDefault("secure.http_mods", "");
@@ -357,6 +368,7 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("liquid_loop_max", "100000");
 	settings->setDefault("liquid_queue_purge_time", "0");
 	settings->setDefault("liquid_update", "1.0");
+	settings->setDefault("num_liquid_threads", "1");
 
 	// Mapgen
 	settings->setDefault("mg_name", "v7p");
@@ -369,6 +381,7 @@ void set_default_settings(Settings *settings) {
 	settings->setDefault("max_block_generate_distance", "8");
 	settings->setDefault("projecting_dungeons", "false");
 	settings->setDefault("enable_mapgen_debug_info", "false");
+	settings->setDefault("enable_mapgen_stats", "false");
 
 	// Server list announcing
 	settings->setDefault("server_announce", "false");
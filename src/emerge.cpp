@@ -21,12 +21,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
-#include <queue>
 
 #include "util/container.h"
 #include "util/thread.h"
 #include "threading/event.h"
+#include "threading/mutex_auto_lock.h"
 
 #include "config.h"
 #include "constants.h"
@@ -49,6 +51,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 class EmergeThread : public Thread {
 public:
 	bool enable_mapgen_debug_info;
+	bool enable_mapgen_stats;
 	int id;
 
 	EmergeThread(Server *server, int ethreadid);
@@ -73,9 +76,17 @@ class EmergeThread : public Thread {
 	Mapgen *m_mapgen;
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	std::deque<v3s16> m_block_queue;
+
+	// Stages of the chunk being generated, and the sum of all chunks
+	MapgenStats m_chunk_stats;
+	MapgenStats m_stats;
+	Mutex m_stats_mutex;
+
+	void addChunkStats();
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	void prefetchQueuedBlocks(v3s16 pos);
 
 	EmergeAction getBlockOrStartGen(
 		v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
@@ -89,21 +100,15 @@ class EmergeThread : public Thread {
 //// EmergeManager
 ////
 
-EmergeManager::EmergeManager(Server *server)
+EmergeManager::EmergeManager(IGameDef *gamedef)
 {
-	this->ndef      = server->getNodeDefManager();
-	this->biomemgr  = new BiomeManager(server);
-	this->oremgr    = new OreManager(server);
-	this->decomgr   = new DecorationManager(server);
-	this->schemmgr  = new SchematicManager(server);
-	this->gen_notify_on = 0;
+	init(gamedef);
+}
 
-	// Note that accesses to this variable are not synchronized.
-	// This is because the *only* thread ever starting or stopping
-	// EmergeThreads should be the ServerThread.
-	this->m_threads_active = false;
 
-	enable_mapgen_debug_info = g_settings->getBool("enable_mapgen_debug_info");
+EmergeManager::EmergeManager(Server *server)
+{
+	init(server);
 
 	// If unspecified, leave a proc for the main thread and one for
 	// some other misc thread
@@ -127,6 +132,9 @@ EmergeManager::EmergeManager(Server *server)
 	if (m_qlimit_generate < 1)
 		m_qlimit_generate = 1;
 
+	m_load_batch_size = rangelim(
+		g_settings->getU16("emergequeue_load_batch_size"), 1, 256);
+
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(server, i));
 
@@ -134,6 +142,32 @@ EmergeManager::EmergeManager(Server *server)
 }
 
 
+void EmergeManager::init(IGameDef *gamedef)
+{
+	this->ndef      = gamedef->getNodeDefManager();
+	this->biomemgr  = new BiomeManager(gamedef, this);
+	this->oremgr    = new OreManager(gamedef);
+	this->decomgr   = new DecorationManager(gamedef);
+	this->schemmgr  = new SchematicManager(gamedef, this);
+	this->gen_notify_on = 0;
+
+	// Note that accesses to this variable are not synchronized.
+	// This is because the *only* thread ever starting or stopping
+	// EmergeThreads should be the ServerThread.
+	this->m_threads_active = false;
+
+	enable_mapgen_debug_info = g_settings->getBool("enable_mapgen_debug_info");
+	enable_mapgen_stats = g_settings->getBool("enable_mapgen_stats");
+
+	this->chunk_pool = NULL;
+	u16 chunk_threads = g_settings->getU16("num_mapchunk_threads");
+	if (chunk_threads == 0)
+		chunk_threads = Thread::getNumberOfProcessors();
+	if (chunk_threads > 1)
+		this->chunk_pool = new WorkerPool("MapgenChunk", chunk_threads);
+}
+
+
 EmergeManager::~EmergeManager()
 {
 	for (u32 i = 0; i != m_threads.size(); i++) {
@@ -156,6 +190,7 @@ EmergeManager::~EmergeManager()
 	delete oremgr;
 	delete decomgr;
 	delete schemmgr;
+	delete chunk_pool;
 }
 
 
@@ -175,6 +210,21 @@ bool EmergeManager::initMapgens(MapgenParams *params)
 }
 
 
+bool EmergeManager::getMapgenStats(std::vector<MapgenStats> *stats)
+{
+	if (!enable_mapgen_stats)
+		return false;
+
+	stats->resize(m_threads.size());
+	for (u32 i = 0; i != m_threads.size(); i++) {
+		MutexAutoLock lock(m_threads[i]->m_stats_mutex);
+		(*stats)[i] = m_threads[i]->m_stats;
+	}
+
+	return true;
+}
+
+
 Mapgen *EmergeManager::getCurrentMapgen()
 {
 	if (!m_threads_active)
@@ -427,6 +477,7 @@ EmergeThread *EmergeManager::getOptimalThread()
 
 EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	enable_mapgen_debug_info(false),
+	enable_mapgen_stats(false),
 	id(ethreadid),
 	m_server(server),
 	m_map(NULL),
@@ -449,9 +500,25 @@ void EmergeThread::signal()
 }
 
 
+void EmergeThread::addChunkStats()
+{
+	m_chunk_stats.chunks = 1;
+	for (int i = 0; i != NUM_MGSTAGES; i++) {
+		g_profiler->avg(std::string("EmergeThread: mapgen ") +
+			mapgen_stage_names[i] + " [ms]", m_chunk_stats.stage_us[i] / 1000.0f);
+	}
+
+	{
+		MutexAutoLock lock(m_stats_mutex);
+		m_stats.add(m_chunk_stats);
+	}
+	m_chunk_stats.reset();
+}
+
+
 bool EmergeThread::pushBlock(v3s16 pos)
 {
-	m_block_queue.push(pos);
+	m_block_queue.push_back(pos);
 	return true;
 }
 
@@ -465,7 +532,7 @@ void EmergeThread::cancelPendingItems()
 		v3s16 pos;
 
 		pos = m_block_queue.front();
-		m_block_queue.pop();
+		m_block_queue.pop_front();
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
@@ -499,7 +566,7 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 		return false;
 
 	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	m_block_queue.pop_front();
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -507,6 +574,62 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
+// Queued blocks farther away than this (in blocks, on any axis) are
+// not read together with the block being loaded
+#define LOAD_BATCH_RADIUS 3
+
+struct QueuedBlockDistance {
+	v3s16 pos;
+	s32 dist_sq;
+
+	bool operator<(const QueuedBlockDistance &other) const
+	{
+		return dist_sq < other.dist_sq;
+	}
+};
+
+// Requires env mutex held
+void EmergeThread::prefetchQueuedBlocks(v3s16 pos)
+{
+	u16 batch_size = m_emerge->m_load_batch_size;
+	if (batch_size <= 1)
+		return;
+
+	std::vector<QueuedBlockDistance> nearby;
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		for (std::deque<v3s16>::const_iterator it = m_block_queue.begin();
+				it != m_block_queue.end(); ++it) {
+			v3s16 d = *it - pos;
+			if (abs(d.X) > LOAD_BATCH_RADIUS || abs(d.Y) > LOAD_BATCH_RADIUS ||
+					abs(d.Z) > LOAD_BATCH_RADIUS)
+				continue;
+			QueuedBlockDistance qb;
+			qb.pos = *it;
+			qb.dist_sq = d.X * d.X + d.Y * d.Y + d.Z * d.Z;
+			nearby.push_back(qb);
+		}
+	}
+
+	if (nearby.empty())
+		return;
+
+	if (nearby.size() > (size_t)batch_size - 1) {
+		std::partial_sort(nearby.begin(), nearby.begin() + (batch_size - 1),
+			nearby.end());
+		nearby.resize(batch_size - 1);
+	}
+
+	std::vector<v3s16> batch;
+	batch.reserve(nearby.size() + 1);
+	batch.push_back(pos);
+	for (size_t i = 0; i < nearby.size(); i++)
+		batch.push_back(nearby[i].pos);
+
+	m_map->prefetchBlocks(batch);
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
@@ -519,6 +642,7 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 			return EMERGE_FROM_MEMORY;
 	} else {
 		// 2). Attempt to load block from disk if it was not in the memory
+		prefetchQueuedBlocks(pos);
 		*block = m_map->loadBlock(pos);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
@@ -601,6 +725,9 @@ void *EmergeThread::run()
 	m_emerge = m_server->m_emerge;
 	m_mapgen = m_emerge->m_mapgens[id];
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
+	enable_mapgen_stats = m_emerge->enable_mapgen_stats;
+	if (enable_mapgen_stats)
+		m_mapgen->stats = &m_chunk_stats;
 
 	try {
 	while (!stopRequested()) {
@@ -634,6 +761,9 @@ void *EmergeThread::run()
 					t.stop(true); // Hide output
 			}
 
+			if (enable_mapgen_stats)
+				addChunkStats();
+
 			block = finishGen(pos, &bmdata, &modified_blocks);
 		}
 
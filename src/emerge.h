@@ -42,7 +42,9 @@ class BiomeManager;
 class OreManager;
 class DecorationManager;
 class SchematicManager;
+class IGameDef;
 class Server;
+class WorkerPool;
 
 // Structure containing inputs/outputs for chunk generation
 struct BlockMakeData {
@@ -93,6 +95,7 @@ class EmergeManager {
 public:
 	INodeDefManager *ndef;
 	bool enable_mapgen_debug_info;
+	bool enable_mapgen_stats;
 
 	// Generation Notify
 	u32 gen_notify_on;
@@ -115,8 +118,15 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
+	// Threads shared by all mapgens for generating parts of a mapchunk
+	// at the same time, NULL if disabled
+	WorkerPool *chunk_pool;
+
 	// Methods
 	EmergeManager(Server *server);
+	// Without emerge threads and mapgens, for generating with mapgens
+	// created by the caller
+	EmergeManager(IGameDef *gamedef);
 	~EmergeManager();
 
 	bool initMapgens(MapgenParams *mgparams);
@@ -142,6 +152,9 @@ class EmergeManager {
 
 	Mapgen *getCurrentMapgen();
 
+	// Stage timings of each emerge thread, false if they are not kept
+	bool getMapgenStats(std::vector<MapgenStats> *stats);
+
 	// Mapgen helpers methods
 	Biome *getBiomeAtPoint(v3s16 p);
 	int getSpawnLevelAtPoint(v2s16 p);
@@ -151,6 +164,8 @@ class EmergeManager {
 	static v3s16 getContainingChunk(v3s16 blockpos, s16 chunksize);
 
 private:
+	void init(IGameDef *gamedef);
+
 	std::vector<Mapgen *> m_mapgens;
 	std::vector<EmergeThread *> m_threads;
 	bool m_threads_active;
@@ -162,6 +177,7 @@ class EmergeManager {
 	u16 m_qlimit_total;
 	u16 m_qlimit_diskonly;
 	u16 m_qlimit_generate;
+	u16 m_load_batch_size;
 
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
@@ -42,6 +42,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database.h"
 #include "config.h"
 #include "porting.h"
+#include "mapgen_bench.h"
 #if USE_CURSES
 	#include "terminal_chat_console.h"
 #endif
@@ -192,8 +193,16 @@ int main(int argc, char *argv[])
 	if (cmd_args.getFlag("run-unittests")) {
 		return run_tests();
 	}
+
+	// Run the benchmarks of the unit test modules
+	if (cmd_args.getFlag("run-benchmarks"))
+		return run_benchmarks();
 #endif
 
+	// Run the mapgen benchmark
+	if (cmd_args.exists("mapgen-bench"))
+		return run_mapgen_benchmark(cmd_args) ? 0 : 1;
+
 	GameParams game_params;
 #ifdef SERVER
 	porting::attachOrCreateConsole();
@@ -264,6 +273,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Set network port (UDP)"))));
 	allowed_options->insert(std::make_pair("run-unittests", ValueSpec(VALUETYPE_FLAG,
 			_("Run the unit tests and exit"))));
+	allowed_options->insert(std::make_pair("run-benchmarks", ValueSpec(VALUETYPE_FLAG,
+			_("Run the benchmarks of the unit tests and exit"))));
 	allowed_options->insert(std::make_pair("map-dir", ValueSpec(VALUETYPE_STRING,
 			_("Same as --world (deprecated)"))));
 	allowed_options->insert(std::make_pair("world", ValueSpec(VALUETYPE_STRING,
@@ -286,6 +297,14 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Migrate from current map backend to another (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("migrate-players", ValueSpec(VALUETYPE_STRING,
 		_("Migrate from current players backend to another (Only works when using minetestserver or with --server)"))));
+	allowed_options->insert(std::make_pair("mapgen-bench", ValueSpec(VALUETYPE_STRING,
+			_("Generate chunks with the given mapgen, print timings and exit"))));
+	allowed_options->insert(std::make_pair("mapgen-bench-seed", ValueSpec(VALUETYPE_STRING,
+			_("Map seed for --mapgen-bench"))));
+	allowed_options->insert(std::make_pair("mapgen-bench-size", ValueSpec(VALUETYPE_STRING,
+			_("Edge length in chunks of the cube --mapgen-bench generates (default 3)"))));
+	allowed_options->insert(std::make_pair("mapgen-bench-threads", ValueSpec(VALUETYPE_STRING,
+			_("Number of threads for --mapgen-bench (0 = one per processor)"))));
 	allowed_options->insert(std::make_pair("terminal", ValueSpec(VALUETYPE_FLAG,
 			_("Feature an interactive terminal (Only works when using minetestserver or with --server)"))));
 #ifndef SERVER
@@ -47,6 +47,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database-sqlite3.h"
 #endif
 #include "script/scripting_server.h"
+#include "threading/atomic.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/thread.h"
+#include <algorithm>
 #include <deque>
 #include <queue>
 #if USE_LEVELDB
@@ -60,20 +64,116 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif
 
 
+/*
+	MapBlockTable
+*/
+
+MapBlockTable::MapBlockTable():
+	m_mask(0),
+	m_count(0)
+{
+	rehash(64);
+}
+
+MapBlock *MapBlockTable::find(v3s16 p) const
+{
+	for (u32 i = hash(p) & m_mask;; i = (i + 1) & m_mask) {
+		const Slot &slot = m_slots[i];
+		if (slot.block == NULL)
+			return NULL;
+		if (slot.pos == p)
+			return slot.block;
+	}
+}
+
+void MapBlockTable::insert(MapBlock *block)
+{
+	// Keep at least half of the slots empty
+	if ((m_count + 1) * 2 > m_slots.size())
+		rehash(m_slots.size() * 2);
+
+	v3s16 p = block->getPos();
+	u32 i = hash(p) & m_mask;
+	while (m_slots[i].block != NULL && m_slots[i].pos != p)
+		i = (i + 1) & m_mask;
+
+	if (m_slots[i].block == NULL)
+		m_count++;
+	m_slots[i].pos = p;
+	m_slots[i].block = block;
+}
+
+void MapBlockTable::erase(v3s16 p)
+{
+	u32 i = hash(p) & m_mask;
+	while (m_slots[i].block != NULL && m_slots[i].pos != p)
+		i = (i + 1) & m_mask;
+	if (m_slots[i].block == NULL)
+		return;
+	m_count--;
+
+	// Move back the following blocks that could not be put into their
+	// own slot, so that no lookup stops early at the emptied slot
+	for (u32 j = (i + 1) & m_mask; m_slots[j].block != NULL;
+			j = (j + 1) & m_mask) {
+		u32 k = hash(m_slots[j].pos) & m_mask;
+		// Skip the block if its own slot is cyclically in (i, j]
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		m_slots[i] = m_slots[j];
+		i = j;
+	}
+	m_slots[i].block = NULL;
+}
+
+void MapBlockTable::rehash(u32 capacity)
+{
+	std::vector<Slot> old_slots;
+	old_slots.swap(m_slots);
+
+	Slot empty;
+	empty.block = NULL;
+	m_slots.resize(capacity, empty);
+	m_mask = capacity - 1;
+	m_count = 0;
+	for (size_t i = 0; i < old_slots.size(); i++) {
+		if (old_slots[i].block != NULL)
+			insert(old_slots[i].block);
+	}
+}
+
 /*
 	Map
 */
 
+/*
+	The last block each thread got from Map::getBlockNoCreateNoEx. The
+	epoch changes whenever a block is removed from any map or a map is
+	created or deleted, which invalidates the cache of every thread.
+*/
+struct MapBlockLookupCache {
+	const Map *map;
+	u32 epoch;
+	s16 x, y, z;
+	MapBlock *block;
+};
+
+static Atomic<u32> g_block_lookup_epoch(0);
+static thread_local MapBlockLookupCache t_block_lookup_cache;
+
 Map::Map(std::ostream &dout, IGameDef *gamedef):
 	m_dout(dout),
 	m_gamedef(gamedef),
 	m_sector_cache(NULL),
+	m_liquid_thread(NULL),
+	m_liquid_job_size(0),
 	m_nodedef(gamedef->ndef()),
 	m_transforming_liquid_loop_count_multiplier(1.0f),
 	m_unprocessed_count(0),
 	m_inc_trending_up_start_time(0),
 	m_queue_size_timer_started(false)
 {
+	g_block_lookup_epoch++;
 }
 
 Map::~Map()
@@ -86,6 +186,8 @@ Map::~Map()
 	{
 		delete i->second;
 	}
+
+	g_block_lookup_epoch++;
 }
 
 void Map::addEventReceiver(MapEventReceiver *event_receiver)
@@ -145,14 +247,36 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerateNoEx(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
+	MapBlockLookupCache &cache = t_block_lookup_cache;
+	u32 epoch = g_block_lookup_epoch;
+	if (cache.map == this && cache.epoch == epoch && cache.x == p3d.X &&
+			cache.y == p3d.Y && cache.z == p3d.Z)
+		return cache.block;
+
+	MapBlock *block = m_blocks.find(p3d);
+	// Misses are not cached, since adding a block does not change the epoch
+	if (block != NULL) {
+		cache.map = this;
+		cache.epoch = epoch;
+		cache.x = p3d.X;
+		cache.y = p3d.Y;
+		cache.z = p3d.Z;
+		cache.block = block;
+	}
 	return block;
 }
 
+void Map::indexBlock(MapBlock *block)
+{
+	m_blocks.insert(block);
+}
+
+void Map::unindexBlock(v3s16 p)
+{
+	m_blocks.erase(p);
+	g_block_lookup_epoch++;
+}
+
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -280,10 +404,15 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 		m_gamedef->rollback()->reportAction(action);
 	}
 
-	/*
-		Add neighboring liquid nodes and this node to transform queue.
-		(it's vital for the node itself to get updated last, if it was removed.)
-	 */
+	queueLiquidUpdate(p);
+}
+
+/*
+	Add neighboring liquid nodes and this node to transform queue.
+	(it's vital for the node itself to get updated last, if it was removed.)
+ */
+void Map::queueLiquidUpdate(v3s16 p)
+{
 	v3s16 dirs[7] = {
 		v3s16(0,0,1), // back
 		v3s16(0,1,0), // top
@@ -312,6 +441,83 @@ void Map::removeNodeAndUpdate(v3s16 p,
 	addNodeAndUpdate(p, MapNode(CONTENT_AIR), modified_blocks, true);
 }
 
+void Map::addNodesAndUpdate(const std::vector<std::pair<v3s16, MapNode> > &nodes,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		bool remove_metadata)
+{
+	bool rollback = m_gamedef->rollback() != NULL;
+	std::vector<RollbackNode> rollback_oldnodes;
+	// The node each change set, for positions changed more than once
+	std::vector<RollbackNode> rollback_newnodes;
+	// Index in set_nodes of the last change of each position
+	std::map<v3s16, size_t> last_changes;
+
+	// The light is updated from the node each position had before the
+	// first change, so later changes of the same position are not added
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	std::set<v3s16> changed;
+	std::vector<size_t> set_nodes;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		v3s16 p = nodes[i].first;
+		MapBlock *block = getBlockNoCreateNoEx(getNodeBlockPos(p));
+		if (!block)
+			continue;
+
+		if (rollback)
+			rollback_oldnodes.push_back(RollbackNode(this, p, m_gamedef));
+
+		MapNode oldnode = getNodeNoEx(p);
+		if (changed.insert(p).second)
+			oldnodes.push_back(std::pair<v3s16, MapNode>(p, oldnode));
+
+		if (remove_metadata)
+			removeNodeMetadata(p);
+
+		// Ignore light (because calling voxalgo::update_lighting_nodes)
+		MapNode n = nodes[i].second;
+		n.setLight(LIGHTBANK_DAY, 0, m_nodedef);
+		n.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
+		setNode(p, n);
+		if (rollback) {
+			rollback_newnodes.push_back(RollbackNode(this, p, m_gamedef));
+			last_changes[p] = set_nodes.size();
+		}
+		set_nodes.push_back(i);
+	}
+
+	voxalgo::update_lighting_nodes(this, oldnodes, modified_blocks);
+
+	for (std::map<v3s16, MapBlock*>::iterator
+			i = modified_blocks.begin();
+			i != modified_blocks.end(); ++i)
+		i->second->expireDayNightDiff();
+
+	for (size_t i = 0; i < set_nodes.size(); i++) {
+		v3s16 p = nodes[set_nodes[i]].first;
+		if (rollback) {
+			// The last change of a position reports the node with its
+			// updated light, like addNodeAndUpdate
+			if (last_changes[p] == i)
+				rollback_newnodes[i] = RollbackNode(this, p, m_gamedef);
+			RollbackAction action;
+			action.setSetNode(p, rollback_oldnodes[i], rollback_newnodes[i]);
+			m_gamedef->rollback()->reportAction(action);
+		}
+		queueLiquidUpdate(p);
+	}
+}
+
+void Map::removeNodesAndUpdate(const std::vector<v3s16> &positions,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	std::vector<std::pair<v3s16, MapNode> > nodes;
+	nodes.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		nodes.push_back(std::pair<v3s16, MapNode>(positions[i],
+			MapNode(CONTENT_AIR)));
+	addNodesAndUpdate(nodes, modified_blocks, true);
+}
+
 bool Map::addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata)
 {
 	MapEditEvent event;
@@ -341,6 +547,24 @@ bool Map::addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata)
 	return succeeded;
 }
 
+void Map::addNodesWithEvent(const std::vector<std::pair<v3s16, MapNode> > &nodes,
+		bool remove_metadata)
+{
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	addNodesAndUpdate(nodes, modified_blocks, remove_metadata);
+
+	// Copy modified_blocks to event
+	for (std::map<v3s16, MapBlock*>::iterator
+			i = modified_blocks.begin();
+			i != modified_blocks.end(); ++i)
+		event.modified_blocks.insert(i->first);
+
+	dispatchEvent(&event);
+}
+
 bool Map::removeNodeWithEvent(v3s16 p)
 {
 	MapEditEvent event;
@@ -636,9 +860,666 @@ void Map::transforming_liquid_add(v3s16 p) {
         m_transforming_liquid.push_back(p);
 }
 
-s32 Map::transforming_liquid_size() {
-        return m_transforming_liquid.size();
-}
+s32 Map::transforming_liquid_size() {
+        return m_transforming_liquid.size() + m_liquid_backlog.size() +
+                m_liquid_job_size;
+}
+
+/*
+	The map blocks around one map block, looked up once to copy the nodes
+	the liquids of the block are decided from
+*/
+struct LiquidBlockNeighborhood {
+	v3s16 blockpos;
+	MapBlock *blocks[27];
+
+	LiquidBlockNeighborhood(Map *map, v3s16 pos) :
+		blockpos(pos)
+	{
+		for (s16 z = 0; z < 3; z++)
+		for (s16 y = 0; y < 3; y++)
+		for (s16 x = 0; x < 3; x++)
+			blocks[z * 9 + y * 3 + x] = map->getBlockNoCreateNoEx(
+				blockpos + v3s16(x - 1, y - 1, z - 1));
+	}
+
+	// Like Map::getNodeNoEx for the block and the nodes next to it
+	MapNode getNode(v3s16 p) const
+	{
+		v3s16 bp = getNodeBlockPos(p);
+		v3s16 d = bp - blockpos + v3s16(1, 1, 1);
+		MapBlock *block = blocks[d.Z * 9 + d.Y * 3 + d.X];
+		if (block == NULL || block->isDummy())
+			return MapNode(CONTENT_IGNORE);
+		bool is_valid_position;
+		return block->getNodeNoCheck(p - bp * MAP_BLOCKSIZE, &is_valid_position);
+	}
+};
+
+#define LIQUID_SNAPSHOT_SIZE (MAP_BLOCKSIZE + 2)
+#define LIQUID_SNAPSHOT_VOLUME \
+	(LIQUID_SNAPSHOT_SIZE * LIQUID_SNAPSHOT_SIZE * LIQUID_SNAPSHOT_SIZE)
+
+/*
+	A copy of the nodes of one map block and of the nodes next to it. The
+	liquid thread decides the queued nodes of the block from it while the
+	server thread goes on changing the map.
+*/
+struct LiquidBlockSnapshot {
+	v3s16 blockpos;
+	// LIQUID_SNAPSHOT_VOLUME nodes from (-1, -1, -1) to (MAP_BLOCKSIZE,
+	// MAP_BLOCKSIZE, MAP_BLOCKSIZE) relative to the block, X first
+	const MapNode *nodes;
+
+	// Like Map::getNodeNoEx for the block and the nodes next to it
+	MapNode getNode(v3s16 p) const
+	{
+		v3s16 d = p - blockpos * MAP_BLOCKSIZE + v3s16(1, 1, 1);
+		return nodes[(d.Z * LIQUID_SNAPSHOT_SIZE + d.Y) *
+			LIQUID_SNAPSHOT_SIZE + d.X];
+	}
+};
+
+// Copies the nodes of a LiquidBlockSnapshot out of the map
+static void copy_liquid_snapshot(const LiquidBlockNeighborhood &nbh,
+	MapNode *nodes)
+{
+	const s16 size = LIQUID_SNAPSHOT_SIZE;
+	v3s16 p0 = nbh.blockpos * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	MapBlock *block = nbh.blocks[13];
+	const MapNode *data = (block != NULL && !block->isDummy()) ?
+		block->getData() : NULL;
+
+	for (s16 z = 0; z < size; z++)
+	for (s16 y = 0; y < size; y++) {
+		MapNode *row = &nodes[(z * size + y) * size];
+		if (data != NULL && z >= 1 && z <= MAP_BLOCKSIZE &&
+				y >= 1 && y <= MAP_BLOCKSIZE) {
+			// The part of the row inside the block is copied at once
+			row[0] = nbh.getNode(p0 + v3s16(0, y, z));
+			memcpy(row + 1, data + ((z - 1) * MAP_BLOCKSIZE + y - 1) *
+				MAP_BLOCKSIZE, MAP_BLOCKSIZE * sizeof(MapNode));
+			row[size - 1] = nbh.getNode(p0 + v3s16(size - 1, y, z));
+		} else {
+			for (s16 x = 0; x < size; x++)
+				row[x] = nbh.getNode(p0 + v3s16(x, y, z));
+		}
+	}
+}
+
+/*
+	What becomes of one queued liquid node in a step. All nodes of a step
+	are decided from the map as it was before the step, so they can be
+	decided in any order and on any thread.
+*/
+struct LiquidTransform {
+	// The node as it was decided from, and as it is to be
+	MapNode oldnode;
+	MapNode newnode;
+	// The node that is placed if the liquid can't flow into this node
+	content_t floodable_node;
+	// Bits (1 << i) of the g_6dirs neighbours with flowing liquid of the
+	// same kind, and of the floodable ones
+	u8 flow_dirs;
+	u8 air_dirs;
+	// The floodable neighbours are queued even if nothing changes
+	bool queue_airs;
+	bool must_reflow;
+	bool changed;
+
+	// What becomes of a node that is not decided: nothing
+	LiquidTransform() :
+		floodable_node(CONTENT_AIR),
+		flow_dirs(0),
+		air_dirs(0),
+		queue_airs(false),
+		must_reflow(false),
+		changed(false)
+	{}
+};
+
+static void decide_liquid_transform(INodeDefManager *nodedef,
+	const LiquidBlockSnapshot &nbh, v3s16 p0, LiquidTransform *t)
+{
+	MapNode n0 = nbh.getNode(p0);
+	t->oldnode = n0;
+	t->flow_dirs = 0;
+	t->air_dirs = 0;
+	t->queue_airs = false;
+	t->must_reflow = false;
+	t->changed = false;
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = nodedef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = nodedef->getId(cf.liquid_alternative_flowing);
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+	t->floodable_node = floodable_node;
+	// if the current node is a water source the floodable neighbors
+	// should be enqueded for transformation regardless of whether the
+	// current node changes or not.
+	t->queue_airs = liquid_type != LIQUID_NONE;
+
+	/*
+		Collect information about the environment
+	 */
+	const v3s16 *dirs = g_6dirs;
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 1:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 4:
+				nt = NEIGHBOR_LOWER;
+				break;
+		}
+		v3s16 npos = p0 + dirs[i];
+		NodeNeighbor nb(nbh.getNode(npos), nt, npos);
+		const ContentFeatures &cfnb = nodedef->get(nb.n);
+		switch (cfnb.liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					t->air_dirs |= 1 << i;
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
+						if (nb.t == NEIGHBOR_LOWER)
+							flowing_down = true;
+						else
+							ignored_sources = true;
+					}
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodedef->getId(cfnb.liquid_alternative_flowing);
+				if (nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(dirs[i].Y != -1)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodedef->getId(cfnb.liquid_alternative_flowing);
+				if (nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					t->flow_dirs |= 1 << i;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = nodedef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = nodedef->getId(nodedef->get(liquid_kind).liquid_alternative_source);
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighbouring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level) {
+						max_node_level = nb_liquid_level;
+					}
+					break;
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+						max_node_level = nb_liquid_level - 1;
+					break;
+			}
+		}
+
+		u8 viscosity = nodedef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				t->must_reflow = true;
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return;
+
+	/*
+		decide on the new node
+	 */
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bit to 0
+		n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+	n0.setContent(new_node_content);
+	t->newnode = n0;
+	t->changed = true;
+}
+
+// Orders indices of node positions by the map blocks of the nodes, then by
+// the positions and then by the indices
+struct LiquidBlockOrder {
+	const std::vector<v3s16> *positions;
+	const std::vector<v3s16> *blockpos;
+
+	bool operator()(u32 a, u32 b) const
+	{
+		const v3s16 &ba = (*blockpos)[a], &bb = (*blockpos)[b];
+		if (ba != bb)
+			return ba < bb;
+		const v3s16 &pa = (*positions)[a], &pb = (*positions)[b];
+		if (pa != pb)
+			return pa < pb;
+		return a < b;
+	}
+};
+
+// Orders indices of node positions by the positions and then by the indices
+struct LiquidPositionOrder {
+	const std::vector<v3s16> *positions;
+
+	bool operator()(u32 a, u32 b) const
+	{
+		const v3s16 &pa = (*positions)[a], &pb = (*positions)[b];
+		if (pa != pb)
+			return pa < pb;
+		return a < b;
+	}
+};
+
+// Removes all but the first of equal positions, keeping their order
+static void remove_duplicate_positions(std::vector<v3s16> *positions)
+{
+	std::vector<u32> order(positions->size());
+	for (u32 i = 0; i < order.size(); i++)
+		order[i] = i;
+	LiquidPositionOrder cmp = { positions };
+	std::sort(order.begin(), order.end(), cmp);
+
+	std::vector<bool> keep(positions->size(), true);
+	for (u32 i = 1; i < order.size(); i++) {
+		if ((*positions)[order[i]] == (*positions)[order[i - 1]])
+			keep[order[i]] = false;
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < positions->size(); i++) {
+		if (keep[i])
+			(*positions)[n++] = (*positions)[i];
+	}
+	positions->resize(n);
+}
+
+/*
+	The queued liquid nodes of a step, with copies of the map blocks they
+	are decided from. Deciding them also works out the nodes to queue
+	next, as if all changes are applied: ordering and deduplicating those
+	is the larger part of the work.
+*/
+class LiquidTransformJob : public WorkerPool::Batch
+{
+public:
+	/*
+		Takes over the positions to decide and the backlog, the nodes
+		queued by earlier steps from backlog_begin on, and copies the map
+		blocks around the positions
+	*/
+	LiquidTransformJob(Map *map, INodeDefManager *nodedef,
+		std::vector<v3s16> &positions, std::vector<v3s16> &backlog,
+		size_t backlog_begin) :
+		m_nodedef(nodedef),
+		m_backlog_begin(backlog_begin)
+	{
+		m_positions.swap(positions);
+		m_backlog.swap(backlog);
+		m_transforms.resize(m_positions.size());
+
+		v3s16 last_blockpos;
+		for (u32 i = 0; i < m_positions.size(); i++) {
+			v3s16 blockpos = getNodeBlockPos(m_positions[i]);
+			if (i > 0 && blockpos == last_blockpos)
+				continue;
+			last_blockpos = blockpos;
+			if (m_snapshot_index.find(blockpos) != m_snapshot_index.end())
+				continue;
+			u32 index = m_snapshot_index.size();
+			m_snapshot_index[blockpos] = index;
+		}
+
+		m_nodes.resize(m_snapshot_index.size() * LIQUID_SNAPSHOT_VOLUME);
+		for (std::map<v3s16, u32>::iterator it = m_snapshot_index.begin();
+				it != m_snapshot_index.end(); ++it) {
+			copy_liquid_snapshot(LiquidBlockNeighborhood(map, it->first),
+				&m_nodes[it->second * LIQUID_SNAPSHOT_VOLUME]);
+		}
+	}
+
+	// Number of nodes in the job, decided or not
+	size_t getSize() const
+	{
+		return m_positions.size() + m_backlog.size() - m_backlog_begin;
+	}
+
+	// Decides all nodes, sharded by map block on the pool if there is one,
+	// and works out the backlog
+	void decide(WorkerPool *pool)
+	{
+		std::vector<v3s16> blockpos(m_positions.size());
+		for (u32 i = 0; i < m_positions.size(); i++) {
+			blockpos[i] = getNodeBlockPos(m_positions[i]);
+			m_order.push_back(i);
+		}
+		LiquidBlockOrder order = { &m_positions, &blockpos };
+		std::sort(m_order.begin(), m_order.end(), order);
+
+		// A node queued twice is decided once, where it was queued first
+		std::vector<u32> unique_order;
+		unique_order.reserve(m_order.size());
+		for (u32 i = 0; i < m_order.size(); i++) {
+			if (i > 0 && m_positions[m_order[i]] ==
+					m_positions[m_order[i - 1]])
+				continue;
+			unique_order.push_back(m_order[i]);
+		}
+		m_order.swap(unique_order);
+
+		for (u32 i = 0; i < m_order.size(); i++) {
+			v3s16 p = blockpos[m_order[i]];
+			if (i == 0 || p != m_blocks.back()) {
+				m_blocks.push_back(p);
+				m_block_begin.push_back(i);
+			}
+		}
+		m_block_begin.push_back(m_order.size());
+
+		if (pool) {
+			pool->run(this, m_blocks.size());
+		} else {
+			for (u32 i = 0; i < m_blocks.size(); i++)
+				runItem(i);
+		}
+
+		makeBacklog();
+	}
+
+	void runItem(u32 i)
+	{
+		u32 index = m_snapshot_index.find(m_blocks[i])->second;
+		LiquidBlockSnapshot snapshot = { m_blocks[i],
+			&m_nodes[index * LIQUID_SNAPSHOT_VOLUME] };
+		for (u32 j = m_block_begin[i]; j < m_block_begin[i + 1]; j++) {
+			u32 k = m_order[j];
+			decide_liquid_transform(m_nodedef, snapshot, m_positions[k],
+				&m_transforms[k]);
+		}
+	}
+
+	const std::vector<v3s16> &getPositions() const { return m_positions; }
+	const std::vector<LiquidTransform> &getTransforms() const
+	{
+		return m_transforms;
+	}
+	// The nodes to decide next, once the job is decided
+	std::vector<v3s16> &getBacklog() { return m_backlog; }
+
+private:
+	void makeBacklog()
+	{
+		std::vector<v3s16> backlog(m_backlog.begin() + m_backlog_begin,
+			m_backlog.end());
+		// list of nodes that due to viscosity have not reached their max level height
+		std::vector<v3s16> must_reflow;
+
+		const v3s16 *dirs = g_6dirs;
+		for (size_t k = 0; k < m_positions.size(); k++) {
+			v3s16 p0 = m_positions[k];
+			const LiquidTransform &t = m_transforms[k];
+
+			if (t.queue_airs) {
+				for (u16 i = 0; i < 6; i++)
+					if ((t.air_dirs & (1 << i)) && i != 1)
+						backlog.push_back(p0 + dirs[i]);
+			}
+			if (t.must_reflow)
+				must_reflow.push_back(p0);
+			if (!t.changed)
+				continue;
+
+			/*
+				enqueue neighbors for update if neccessary
+			 */
+			switch (m_nodedef->get(t.newnode.getContent()).liquid_type) {
+				case LIQUID_SOURCE:
+				case LIQUID_FLOWING:
+					// make sure source flows into all neighboring nodes
+					for (u16 i = 0; i < 6; i++)
+						if ((t.flow_dirs & (1 << i)) && i != 1)
+							backlog.push_back(p0 + dirs[i]);
+					for (u16 i = 0; i < 6; i++)
+						if ((t.air_dirs & (1 << i)) && i != 1)
+							backlog.push_back(p0 + dirs[i]);
+					break;
+				case LIQUID_NONE:
+					// this flow has turned to air; neighboring flows might need to do the same
+					for (u16 i = 0; i < 6; i++)
+						if (t.flow_dirs & (1 << i))
+							backlog.push_back(p0 + dirs[i]);
+					break;
+			}
+		}
+		backlog.insert(backlog.end(), must_reflow.begin(), must_reflow.end());
+
+		remove_duplicate_positions(&backlog);
+		m_backlog.swap(backlog);
+		m_backlog_begin = 0;
+	}
+
+	INodeDefManager *m_nodedef;
+	std::vector<v3s16> m_positions;
+	std::vector<LiquidTransform> m_transforms;
+	std::vector<v3s16> m_backlog;
+	size_t m_backlog_begin;
+	// Indices of m_positions by map block, without repeated positions.
+	// m_block_begin[i] is the first one in m_blocks[i].
+	std::vector<u32> m_order;
+	std::vector<v3s16> m_blocks;
+	std::vector<u32> m_block_begin;
+	// Index of the snapshot of each map block in m_nodes
+	std::map<v3s16, u32> m_snapshot_index;
+	// LIQUID_SNAPSHOT_VOLUME nodes for each snapshot
+	std::vector<MapNode> m_nodes;
+};
+
+/*
+	Decides the liquid nodes of a step in the background. The server thread
+	hands over one job at a time and takes it back once it is decided.
+*/
+class LiquidThread : public UpdateThread
+{
+public:
+	// num_threads includes this thread
+	LiquidThread(u16 num_threads) :
+		UpdateThread("Liquid"),
+		m_pool(NULL),
+		m_job(NULL),
+		m_done(NULL)
+	{
+		if (num_threads > 1)
+			m_pool = new WorkerPool("Liquid", num_threads);
+	}
+
+	~LiquidThread()
+	{
+		delete m_job;
+		delete m_done;
+		delete m_pool;
+	}
+
+	// Whether there is no job being decided or waiting to be taken back
+	bool isIdle()
+	{
+		MutexAutoLock lock(m_mutex);
+		return m_job == NULL && m_done == NULL;
+	}
+
+	void submit(LiquidTransformJob *job)
+	{
+		{
+			MutexAutoLock lock(m_mutex);
+			m_job = job;
+		}
+		deferUpdate();
+	}
+
+	// Returns the decided job, or NULL if there is none. With wait, waits
+	// for the job being decided.
+	LiquidTransformJob *takeDone(bool wait)
+	{
+		{
+			MutexAutoLock lock(m_mutex);
+			if (m_done == NULL && (!wait || m_job == NULL))
+				return NULL;
+		}
+		// Posted once for every decided job
+		m_done_sem.wait();
+		MutexAutoLock lock(m_mutex);
+		LiquidTransformJob *job = m_done;
+		m_done = NULL;
+		return job;
+	}
+
+protected:
+	void doUpdate()
+	{
+		LiquidTransformJob *job;
+		{
+			MutexAutoLock lock(m_mutex);
+			job = m_job;
+		}
+		if (job == NULL)
+			return;
+
+		job->decide(m_pool);
+
+		{
+			MutexAutoLock lock(m_mutex);
+			m_job = NULL;
+			m_done = job;
+		}
+		m_done_sem.post();
+	}
+
+private:
+	WorkerPool *m_pool;
+	Mutex m_mutex;
+	LiquidTransformJob *m_job;
+	LiquidTransformJob *m_done;
+	Semaphore m_done_sem;
+};
 
 void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 		ServerEnvironment *env)
@@ -646,19 +1527,29 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 	DSTACK(FUNCTION_NAME);
 	//TimeTaker timer("transformLiquids()");
 
-	u32 loopcount = 0;
-	u32 initial_size = m_transforming_liquid.size();
+	/*
+		Apply what the liquid thread has decided since the last step. If it
+		is not done yet, it goes on in the background and the queue waits.
+	 */
+	if (m_liquid_thread) {
+		LiquidTransformJob *job = m_liquid_thread->takeDone(false);
+		if (job) {
+			applyLiquidTransforms(*job, modified_blocks, env);
+			delete job;
+		}
+		if (!m_liquid_thread->isIdle())
+			return;
+	}
 
-	/*if(initial_size != 0)
-		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
+	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
+	u32 loop_max = liquid_loop_max;
 
-	// list of nodes that due to viscosity have not reached their max level height
-	std::deque<v3s16> must_reflow;
+	purgeTransformingLiquid(liquid_loop_max);
 
-	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
+	u32 initial_size = transforming_liquid_size();
 
-	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
-	u32 loop_max = liquid_loop_max;
+	/*if(initial_size != 0)
+		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
 
 #if 0
 
@@ -677,236 +1568,83 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 	loop_max *= m_transforming_liquid_loop_count_multiplier;
 #endif
 
-	while (m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= loop_max)
-			break;
-		loopcount++;
+	/*
+		Take the queued nodes of this step, those queued by the last
+		steps first, and copy the map blocks around them. What becomes of
+		them is decided on the liquid thread, or right away if there is
+		none.
+	 */
+	if (initial_size == 0)
+		return;
 
-		/*
-			Get a queued transforming liquid node
-		*/
-		v3s16 p0 = m_transforming_liquid.front();
+	size_t backlog_taken = MYMIN(m_liquid_backlog.size(), (size_t)loop_max);
+	std::vector<v3s16> positions(m_liquid_backlog.begin(),
+		m_liquid_backlog.begin() + backlog_taken);
+	while (positions.size() < loop_max && m_transforming_liquid.size() > 0) {
+		positions.push_back(m_transforming_liquid.front());
 		m_transforming_liquid.pop_front();
+	}
 
-		MapNode n0 = getNodeNoEx(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = m_nodedef->getId(cf.liquid_alternative_flowing);
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
-				break;
-		}
-
-		/*
-			Collect information about the environment
-		 */
-		const v3s16 *dirs = g_6dirs;
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 1:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 4:
-					nt = NEIGHBOR_LOWER;
-					break;
-			}
-			v3s16 npos = p0 + dirs[i];
-			NodeNeighbor nb(getNodeNoEx(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			switch (m_nodedef->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = m_nodedef->getId(cfnb.liquid_alternative_flowing);
-					if (m_nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(dirs[i].Y != -1)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = m_nodedef->getId(cfnb.liquid_alternative_flowing);
-					if (m_nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
-		}
+	LiquidTransformJob *job = new LiquidTransformJob(this, m_nodedef,
+		positions, m_liquid_backlog, backlog_taken);
+	m_liquid_job_size = job->getSize();
+	if (m_liquid_thread) {
+		m_liquid_thread->submit(job);
+	} else {
+		job->decide(NULL);
+		applyLiquidTransforms(*job, modified_blocks, env);
+		delete job;
+	}
+}
 
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->getId(m_nodedef->get(liquid_kind).liquid_alternative_source);
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighbouring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
+void Map::finishLiquidTransforms(std::map<v3s16, MapBlock*> &modified_blocks,
+		ServerEnvironment *env)
+{
+	if (m_liquid_thread == NULL)
+		return;
 
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
+	LiquidTransformJob *job = m_liquid_thread->takeDone(true);
+	if (job) {
+		applyLiquidTransforms(*job, modified_blocks, env);
+		delete job;
+	}
+}
 
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
+void Map::applyLiquidTransforms(LiquidTransformJob &job,
+		std::map<v3s16, MapBlock*> &modified_blocks,
+		ServerEnvironment *env)
+{
+	const std::vector<v3s16> &positions = job.getPositions();
+	const std::vector<LiquidTransform> &transforms = job.getTransforms();
 
-		}
+	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
 
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
+	/*
+		Apply the changes in queue order on this thread. The nodes were
+		decided from copies of the map, so a node that has changed since
+		is queued again rather than overwritten.
+	 */
+	for (size_t k = 0; k < positions.size(); k++) {
+		v3s16 p0 = positions[k];
+		const LiquidTransform &t = transforms[k];
+		if (!t.changed)
 			continue;
 
+		// An on_flood callback of a node before may have changed this one
+		MapNode n00 = getNodeNoEx(p0);
+		if (n00.getContent() != t.oldnode.getContent() ||
+				n00.param2 != t.oldnode.param2) {
+			m_transforming_liquid.push_back(p0);
+			continue;
+		}
 
 		/*
 			update the current node
 		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bit to 0
-			n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-
-		// change the node.
-		n0.setContent(new_node_content);
+		MapNode n0 = t.newnode;
 
 		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
+		if (t.floodable_node != CONTENT_AIR) {
 			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
 				continue;
 		}
@@ -943,39 +1681,20 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 			modified_blocks[blockpos] =  block;
 			changed_nodes.push_back(std::pair<v3s16, MapNode>(p0, n00));
 		}
-
-		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
-		}
 	}
-	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
 
-	for (std::deque<v3s16>::iterator iter = must_reflow.begin(); iter != must_reflow.end(); ++iter)
-		m_transforming_liquid.push_back(*iter);
+	// The neighbours to update next were queued by the job
+	m_liquid_backlog.swap(job.getBacklog());
+	m_liquid_job_size = 0;
 
 	voxalgo::update_lighting_nodes(this, changed_nodes, modified_blocks);
+}
 
-
-	/* ----------------------------------------------------------------------
-	 * Manage the queue so that it does not grow indefinately
-	 */
+/* ----------------------------------------------------------------------
+ * Manage the queue so that it does not grow indefinately
+ */
+void Map::purgeTransformingLiquid(u32 liquid_loop_max)
+{
 	u16 time_until_purge = g_settings->getU16("liquid_queue_purge_time");
 
 	if (time_until_purge == 0)
@@ -985,7 +1704,7 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 
 	u64 curr_time = porting::getTimeMs();
 	u32 prev_unprocessed = m_unprocessed_count;
-	m_unprocessed_count = m_transforming_liquid.size();
+	m_unprocessed_count = transforming_liquid_size();
 
 	// if unprocessed block count is decreasing or stable
 	if (m_unprocessed_count <= prev_unprocessed) {
@@ -1014,11 +1733,17 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 		infostream << "transformLiquids(): DUMPING " << dump_qty
 		           << " blocks from the queue" << std::endl;
 
+		// The nodes queued by earlier liquid updates are the oldest
+		size_t dump_backlog = MYMIN(dump_qty, m_liquid_backlog.size());
+		m_liquid_backlog.erase(m_liquid_backlog.begin(),
+			m_liquid_backlog.begin() + dump_backlog);
+		dump_qty -= dump_backlog;
+
 		while (dump_qty--)
 			m_transforming_liquid.pop_front();
 
 		m_queue_size_timer_started = false; // optimistically assume we can keep up now
-		m_unprocessed_count = m_transforming_liquid.size();
+		m_unprocessed_count = transforming_liquid_size();
 	}
 }
 
@@ -1098,6 +1823,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->raiseChangeCounter();
 	return true;
 }
 
@@ -1113,6 +1839,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->raiseChangeCounter();
 }
 
 NodeTimer Map::getNodeTimer(v3s16 p)
@@ -1235,6 +1962,195 @@ bool Map::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes) {
 			step, stepfac, startoff, endoff, needed_count));
 }
 
+/*
+	MapSaveThread
+*/
+
+// Maximum number of blocks written in one transaction. The database mutex
+// is held while writing, so this bounds how long block loads may wait.
+#define MAP_SAVE_BATCH_SIZE 64
+
+// Time to wait before writing again after a failed write
+#define MAP_SAVE_RETRY_INTERVAL_MS 1000
+
+MapSaveThread::MapSaveThread(MapDatabase *db, Mutex *db_mutex, u32 queue_limit):
+	Thread("MapSave"),
+	m_db(db),
+	m_db_mutex(db_mutex),
+	m_queue_limit(queue_limit),
+	m_write_failed(false)
+{
+}
+
+MapSaveThread::~MapSaveThread()
+{
+	stop();
+	m_queue_event.signal();
+	wait();
+
+	if (!flush())
+		errorstream << "MapSaveThread: " << getQueueSize()
+			<< " blocks could not be written and are lost" << std::endl;
+}
+
+void *MapSaveThread::run()
+{
+	DSTACK(FUNCTION_NAME);
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		m_queue_event.wait();
+		while (!stopRequested() && writeBatch())
+			;
+
+		bool write_failed;
+		{
+			MutexAutoLock lock(m_queue_mutex);
+			write_failed = m_write_failed;
+		}
+		if (write_failed) {
+			for (u32 t = 0; t < MAP_SAVE_RETRY_INTERVAL_MS &&
+					!stopRequested(); t += 100)
+				sleep_ms(100);
+			m_queue_event.signal();
+		}
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+	return NULL;
+}
+
+void MapSaveThread::push(v3s16 pos, std::string *data)
+{
+	for (;;) {
+		{
+			MutexAutoLock lock(m_queue_mutex);
+			std::map<v3s16, std::string>::iterator it = m_queue.find(pos);
+			if (it != m_queue.end()) {
+				it->second.swap(*data);
+				break;
+			}
+			// While writes fail, waiting for the writer could take forever
+			if (m_queue.size() < m_queue_limit || m_write_failed) {
+				m_queue[pos].swap(*data);
+				break;
+			}
+		}
+
+		// Backpressure: wait for the writer to catch up
+		g_profiler->add("ServerMap: save queue full waits (num)", 1);
+		ScopeProfiler sp(g_profiler, "ServerMap: save queue full wait", SPT_AVG);
+		m_queue_event.signal();
+		m_written_event.wait();
+	}
+
+	m_queue_event.signal();
+}
+
+bool MapSaveThread::getPending(v3s16 pos, std::string *data)
+{
+	MutexAutoLock lock(m_queue_mutex);
+	std::map<v3s16, std::string>::const_iterator it = m_queue.find(pos);
+	if (it == m_queue.end())
+		return false;
+	*data = it->second;
+	return true;
+}
+
+bool MapSaveThread::isPending(v3s16 pos)
+{
+	MutexAutoLock lock(m_queue_mutex);
+	return m_queue.find(pos) != m_queue.end();
+}
+
+void MapSaveThread::cancel(v3s16 pos)
+{
+	MutexAutoLock lock(m_queue_mutex);
+	m_queue.erase(pos);
+}
+
+void MapSaveThread::listPending(std::vector<v3s16> &dst)
+{
+	MutexAutoLock lock(m_queue_mutex);
+	for (std::map<v3s16, std::string>::const_iterator it = m_queue.begin();
+			it != m_queue.end(); ++it)
+		dst.push_back(it->first);
+}
+
+bool MapSaveThread::flush()
+{
+	while (writeBatch())
+		;
+	return getQueueSize() == 0;
+}
+
+size_t MapSaveThread::getQueueSize()
+{
+	MutexAutoLock lock(m_queue_mutex);
+	return m_queue.size();
+}
+
+bool MapSaveThread::writeBatch()
+{
+	// Held until the blocks are written so that readers either find them
+	// in the queue or in the database
+	MutexAutoLock dblock(*m_db_mutex);
+
+	std::vector<v3s16> pos;
+	std::vector<std::string> data;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		size_t count = MYMIN(m_queue.size(), (size_t)MAP_SAVE_BATCH_SIZE);
+		pos.reserve(count);
+		data.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			std::map<v3s16, std::string>::iterator it = m_queue.begin();
+			pos.push_back(it->first);
+			data[i].swap(it->second);
+			m_queue.erase(it);
+		}
+	}
+
+	if (pos.empty())
+		return false;
+
+	u64 t_start = porting::getTimeMs();
+	bool ok = false;
+	try {
+		m_db->beginSave();
+		ok = m_db->saveBlocks(pos, data);
+		m_db->endSave();
+	} catch (DatabaseException &e) {
+		// E.g. SQLite3 failing to start or commit the transaction
+		errorstream << "MapSaveThread: " << e.what() << std::endl;
+		ok = false;
+	}
+
+	g_profiler->avg("ServerMap: save batch size", pos.size());
+	g_profiler->avg("ServerMap: save batch write time (ms)",
+		porting::getTimeMs() - t_start);
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_write_failed = !ok;
+		if (!ok) {
+			// Queue the blocks again, unless they were saved again in the
+			// meantime. The database mutex is still held, so readers find
+			// them in the queue.
+			errorstream << "MapSaveThread: Failed to write some of "
+				<< pos.size() << " blocks, retrying later" << std::endl;
+			g_profiler->add("ServerMap: failed save batches (num)", 1);
+			for (size_t i = 0; i < pos.size(); i++) {
+				if (m_queue.find(pos[i]) == m_queue.end())
+					m_queue[pos[i]].swap(data[i]);
+			}
+		}
+	}
+
+	m_written_event.signal();
+	return ok;
+}
+
 /*
 	ServerMap
 */
@@ -1243,7 +2159,8 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	Map(dout_server, gamedef),
 	settings_mgr(g_settings, savedir + DIR_DELIM + "map_meta.txt"),
 	m_emerge(emerge),
-	m_map_metadata_changed(true)
+	m_map_metadata_changed(true),
+	m_save_thread(NULL)
 {
 	verbosestream<<FUNCTION_NAME<<std::endl;
 
@@ -1268,9 +2185,37 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
 
+	u16 save_queue_limit = g_settings->getU16("map_save_queue_limit");
+	if (save_queue_limit > 0) {
+		m_save_thread = new MapSaveThread(dbase, &m_db_mutex, save_queue_limit);
+		m_save_thread->start();
+	}
+
 	m_savedir = savedir;
 	m_map_saving_enabled = false;
 
+	m_block_ser_ver = SER_FMT_VER_HIGHEST_WRITE;
+	if (g_settings->getBool("zstd_map_compression")) {
+#if USE_ZSTD
+		m_block_ser_ver = SER_FMT_VER_ZSTD;
+#else
+		warningstream << "zstd_map_compression is enabled, but this build "
+			"has no zstd support; saving blocks with zlib" << std::endl;
+#endif
+	}
+	m_block_compression_level = g_settings->getS16("map_compression_level_disk");
+
+	u16 liquid_threads = g_settings->getU16("num_liquid_threads");
+	if (liquid_threads > 0) {
+		m_liquid_thread = new LiquidThread(liquid_threads);
+		if (!m_liquid_thread->start()) {
+			errorstream << "ServerMap: failed to start the liquid thread, "
+				"deciding liquids on the server thread" << std::endl;
+			delete m_liquid_thread;
+			m_liquid_thread = NULL;
+		}
+	}
+
 	try
 	{
 		// If directory exists, check contents and load if possible
@@ -1326,6 +2271,15 @@ ServerMap::~ServerMap()
 {
 	verbosestream<<FUNCTION_NAME<<std::endl;
 
+	// Liquid nodes still being decided are dropped like the rest of the
+	// liquid queue
+	if (m_liquid_thread) {
+		m_liquid_thread->stop();
+		m_liquid_thread->wait();
+		delete m_liquid_thread;
+		m_liquid_thread = NULL;
+	}
+
 	try
 	{
 		if(m_map_saving_enabled)
@@ -1345,6 +2299,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	// Write whatever is still queued
+	delete m_save_thread;
+
 	/*
 		Close database if it was opened
 	*/
@@ -1907,6 +2864,7 @@ s16 ServerMap::findGroundLevel(v2s16 p2d)
 }
 
 bool ServerMap::loadFromFolders() {
+	MutexAutoLock dblock(m_db_mutex);
 	if (!dbase->initialized() &&
 			!fs::PathExists(m_savedir + DIR_DELIM + "map.sqlite"))
 		return true;
@@ -2067,6 +3025,10 @@ void ServerMap::save(ModifiedState save_level)
 	if(save_started)
 		endSave();
 
+	if (m_save_thread)
+		g_profiler->avg("ServerMap: save queue (blocks)",
+			m_save_thread->getQueueSize());
+
 	/*
 		Only print if something happened or saved whole map
 	*/
@@ -2089,7 +3051,21 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 		errorstream << "Map::listAllLoadableBlocks(): Result will be missing "
 				<< "all blocks that are stored in flat files." << std::endl;
 	}
+	MutexAutoLock dblock(m_db_mutex);
 	dbase->listAllLoadableBlocks(dst);
+
+	// Blocks that are saved for the first time may still be queued
+	if (m_save_thread) {
+		std::vector<v3s16> pending;
+		m_save_thread->listPending(pending);
+		if (!pending.empty()) {
+			std::set<v3s16> stored(dst.begin(), dst.end());
+			for (size_t i = 0; i < pending.size(); i++) {
+				if (stored.find(pending[i]) == stored.end())
+					dst.push_back(pending[i]);
+			}
+		}
+	}
 }
 
 void ServerMap::listAllLoadedBlocks(std::vector<v3s16> &dst)
@@ -2315,22 +3291,65 @@ MapDatabase *ServerMap::createDatabase(
 		throw ModError(std::string("Database backend ") + name + " not supported.");
 }
 
+// The save thread uses its own transactions
 void ServerMap::beginSave()
 {
+	if (m_save_thread)
+		return;
+	MutexAutoLock dblock(m_db_mutex);
 	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	if (m_save_thread)
+		return;
+	MutexAutoLock dblock(m_db_mutex);
 	dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase);
+	if (!m_save_thread) {
+		MutexAutoLock dblock(m_db_mutex);
+		// Prefetched data for this block is outdated now
+		m_prefetched_blocks.erase(block->getPos());
+		return saveBlock(block, dbase, m_block_ser_ver, m_block_compression_level);
+	}
+
+	v3s16 p3d = block->getPos();
+	if (block->isDummy()) {
+		warningstream << "saveBlock: Not writing dummy block "
+			<< PP(p3d) << std::endl;
+		return true;
+	}
+
+	std::string data;
+	{
+		ScopeProfiler sp(g_profiler, "ServerMap: serialize block", SPT_AVG);
+		serializeBlock(block, m_block_ser_ver, m_block_compression_level, &data);
+	}
+
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		m_prefetched_blocks.erase(p3d);
+	}
+
+	// The queued data is what loadBlock() returns from now on. It stays
+	// queued until it has been written, so the block is not lost if the
+	// write fails after the block was unloaded.
+	m_save_thread->push(p3d, &data);
+	block->resetModified();
+	return true;
 }
 
 bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
+{
+	return saveBlock(block, db, SER_FMT_VER_HIGHEST_WRITE, -1);
+}
+
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, u8 version,
+	int compression_level)
 {
 	v3s16 p3d = block->getPos();
 
@@ -2341,24 +3360,27 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
 		return true;
 	}
 
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::string data;
+	serializeBlock(block, version, compression_level, &data);
+	bool ret = db->saveBlock(p3d, data);
+	if (ret) {
+		// We just wrote it to the disk so clear modified flag
+		block->resetModified();
+	}
+	return ret;
+}
 
+void ServerMap::serializeBlock(MapBlock *block, u8 version,
+	int compression_level, std::string *data)
+{
 	/*
 		[0] u8 serialization version
 		[1] data
 	*/
 	std::ostringstream o(std::ios_base::binary);
 	o.write((char*) &version, 1);
-	block->serialize(o, version, true);
-
-	std::string data = o.str();
-	bool ret = db->saveBlock(p3d, data);
-	if (ret) {
-		// We just wrote it to the disk so clear modified flag
-		block->resetModified();
-	}
-	return ret;
+	block->serialize(o, version, true, compression_level);
+	*data = o.str();
 }
 
 void ServerMap::loadBlock(const std::string &sectordir, const std::string &blockfile,
@@ -2411,7 +3433,9 @@ void ServerMap::loadBlock(const std::string &sectordir, const std::string &block
 		}
 
 		/*
-			Save blocks loaded in old format in new format
+			Save blocks loaded in old format in new format.
+			Blocks are not converted to zstd here; they get it the next
+			time they are saved for another reason.
 		*/
 
 		if(version < SER_FMT_VER_HIGHEST_WRITE || save_after_load)
@@ -2512,7 +3536,19 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
 	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		std::map<v3s16, std::string>::iterator it =
+			m_prefetched_blocks.find(blockpos);
+		if (it != m_prefetched_blocks.end()) {
+			ret.swap(it->second);
+			m_prefetched_blocks.erase(it);
+			g_profiler->add("ServerMap: prefetched block loads (num)", 1);
+		} else if (!m_save_thread || !m_save_thread->getPending(blockpos, &ret)) {
+			dbase->loadBlock(blockpos, &ret);
+		}
+	}
+
 	if (ret != "") {
 		loadBlock(&ret, blockpos, createSector(p2d), false);
 	} else {
@@ -2583,10 +3619,53 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 	return block;
 }
 
+// Upper bound for ServerMap::m_prefetched_blocks
+#define PREFETCHED_BLOCKS_MAX 1024
+
+void ServerMap::prefetchBlocks(const std::vector<v3s16> &blockpos)
+{
+	MutexAutoLock dblock(m_db_mutex);
+
+	std::vector<v3s16> wanted;
+	wanted.reserve(blockpos.size());
+	for (size_t i = 0; i < blockpos.size(); i++) {
+		const v3s16 &p = blockpos[i];
+		if (getBlockNoCreateNoEx(p) == NULL &&
+				m_prefetched_blocks.find(p) == m_prefetched_blocks.end() &&
+				!(m_save_thread && m_save_thread->isPending(p)))
+			wanted.push_back(p);
+	}
+
+	// A single block is read by loadBlock() directly
+	if (wanted.size() < 2)
+		return;
+
+	// Entries are only left behind if their blocks were generated or
+	// dropped from the emerge queue; don't let them pile up
+	if (m_prefetched_blocks.size() + wanted.size() > PREFETCHED_BLOCKS_MAX)
+		m_prefetched_blocks.clear();
+
+	std::vector<std::string> data;
+	{
+		ScopeProfiler sp(g_profiler, "ServerMap: prefetch blocks", SPT_AVG);
+		dbase->loadBlocks(wanted, &data);
+	}
+
+	for (size_t i = 0; i < wanted.size(); i++)
+		m_prefetched_blocks[wanted[i]].swap(data[i]);
+	g_profiler->avg("ServerMap: prefetch batch size", wanted.size());
+}
+
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		m_prefetched_blocks.erase(blockpos);
+		if (m_save_thread)
+			m_save_thread->cancel(blockpos);
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <vector>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
@@ -35,6 +36,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/cpp11_container.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "threading/event.h"
+#include "threading/mutex.h"
+#include "threading/thread.h"
 
 class Settings;
 class MapDatabase;
@@ -47,6 +51,8 @@ class IGameDef;
 class IRollbackManager;
 class EmergeManager;
 class ServerEnvironment;
+class LiquidThread;
+class LiquidTransformJob;
 struct BlockMakeData;
 
 /*
@@ -137,6 +143,48 @@ class MapEventReceiver
 	virtual void onMapEditEvent(MapEditEvent *event) = 0;
 };
 
+/*
+	The blocks of a map by block position, in one open addressing hash
+	table with linear probing. Map looks blocks up here instead of going
+	through the sector and then the block container of the sector.
+
+	The table does not own the blocks, they are still owned by the
+	sectors. MapSector adds and removes its blocks through Map.
+*/
+class MapBlockTable
+{
+public:
+	MapBlockTable();
+
+	// Returns NULL if not found
+	MapBlock *find(v3s16 p) const;
+	// Adds or replaces the block at its position
+	void insert(MapBlock *block);
+	void erase(v3s16 p);
+
+	u32 size() const { return m_count; }
+
+private:
+	struct Slot {
+		v3s16 pos;
+		// NULL if the slot is empty
+		MapBlock *block;
+	};
+
+	static u32 hash(v3s16 p)
+	{
+		u32 h = (u16)p.X * 0x9E3779B1U ^ (u16)p.Y * 0x85EBCA77U ^
+			(u16)p.Z * 0xC2B2AE3DU;
+		return h ^ (h >> 16);
+	}
+
+	void rehash(u32 capacity);
+
+	std::vector<Slot> m_slots;
+	u32 m_mask;
+	u32 m_count;
+};
+
 class Map /*: public NodeContainer*/
 {
 public:
@@ -189,6 +237,10 @@ class Map /*: public NodeContainer*/
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 
+	// Called by MapSector when it gets or loses a block
+	virtual void indexBlock(MapBlock *block);
+	virtual void unindexBlock(v3s16 p);
+
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
 	{ return getBlockNoCreateNoEx(p); }
@@ -217,6 +269,17 @@ class Map /*: public NodeContainer*/
 	void removeNodeAndUpdate(v3s16 p,
 			std::map<v3s16, MapBlock*> &modified_blocks);
 
+	/*
+		Like the latter ones for many nodes, but the lighting of all of
+		them is updated at once. Nodes in blocks that are not loaded
+		are skipped.
+	*/
+	void addNodesAndUpdate(const std::vector<std::pair<v3s16, MapNode> > &nodes,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			bool remove_metadata = true);
+	void removeNodesAndUpdate(const std::vector<v3s16> &positions,
+			std::map<v3s16, MapBlock*> &modified_blocks);
+
 	/*
 		Wrappers for the latter ones.
 		These emit events.
@@ -224,6 +287,9 @@ class Map /*: public NodeContainer*/
 	*/
 	bool addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata = true);
 	bool removeNodeWithEvent(v3s16 p);
+	// Emits one MEET_OTHER event for all the modified blocks
+	void addNodesWithEvent(const std::vector<std::pair<v3s16, MapNode> > &nodes,
+			bool remove_metadata = true);
 
 	/*
 		Takes the blocks at the edges into account
@@ -266,8 +332,17 @@ class Map /*: public NodeContainer*/
 	// For debug printing. Prints "Map: ", "ServerMap: " or "ClientMap: "
 	virtual void PrintInfo(std::ostream &out);
 
+	/*
+		Applies the liquid changes decided since the last call and has the
+		next queued liquid nodes decided. With a liquid thread they are
+		decided in the background and applied by the next call, otherwise
+		right away.
+	*/
 	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
 			ServerEnvironment *env);
+	// Waits for the liquid thread and applies what it has decided
+	void finishLiquidTransforms(std::map<v3s16, MapBlock*> &modified_blocks,
+			ServerEnvironment *env);
 
 	/*
 		Node metadata
@@ -331,8 +406,18 @@ class Map /*: public NodeContainer*/
 	MapSector *m_sector_cache;
 	v2s16 m_sector_cache_p;
 
+	// All blocks of all sectors, for getBlockNoCreateNoEx
+	MapBlockTable m_blocks;
+
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
+	// Nodes queued by the liquid updates themselves, without repeats. They
+	// are decided before m_transforming_liquid.
+	std::vector<v3s16> m_liquid_backlog;
+	// Thread deciding the queued liquid nodes of a step, if any
+	LiquidThread *m_liquid_thread;
+	// Nodes in the job on the liquid thread, with its part of the backlog
+	size_t m_liquid_job_size;
 
 	// This stores the properties of the nodes on the map.
 	INodeDefManager *m_nodedef;
@@ -346,9 +431,69 @@ class Map /*: public NodeContainer*/
 	u64 m_inc_trending_up_start_time; // milliseconds
 	bool m_queue_size_timer_started;
 
+	// Adds the node at p and its liquid neighbours to m_transforming_liquid
+	void queueLiquidUpdate(v3s16 p);
+	void applyLiquidTransforms(LiquidTransformJob &job,
+			std::map<v3s16, MapBlock*> &modified_blocks,
+			ServerEnvironment *env);
+	void purgeTransformingLiquid(u32 liquid_loop_max);
+
 	DISABLE_CLASS_COPY(Map);
 };
 
+/*
+	MapSaveThread
+
+	Writes serialized blocks to the map database in the background,
+	batching them into transactions. Queued blocks that are saved again
+	before being written only keep their newest data. Blocks stay queued
+	until they have been written; failed writes are retried.
+	All database access must happen with the database mutex held.
+*/
+
+class MapSaveThread : public Thread
+{
+public:
+	MapSaveThread(MapDatabase *db, Mutex *db_mutex, u32 queue_limit);
+	~MapSaveThread();
+
+	void *run();
+
+	// Takes the block data from *data. Waits while the queue is full.
+	// Must not be called with the database mutex held.
+	void push(v3s16 pos, std::string *data);
+
+	// These require the database mutex held
+	bool getPending(v3s16 pos, std::string *data);
+	bool isPending(v3s16 pos);
+	void cancel(v3s16 pos);
+	void listPending(std::vector<v3s16> &dst);
+
+	// Writes all queued blocks from the calling thread. Returns false if
+	// some could not be written.
+	bool flush();
+
+	size_t getQueueSize();
+
+private:
+	// Writes one batch; returns false if there was nothing to write or
+	// the write failed
+	bool writeBatch();
+
+	MapDatabase *m_db;
+	Mutex *m_db_mutex;
+
+	Mutex m_queue_mutex;
+	std::map<v3s16, std::string> m_queue;
+	u32 m_queue_limit;
+	// Whether the last batch could not be written
+	bool m_write_failed;
+
+	// Signalled when blocks are queued and when they are written
+	Event m_queue_event;
+	Event m_written_event;
+};
+
 /*
 	ServerMap
 
@@ -456,10 +601,17 @@ class ServerMap : public Map
 
 	bool saveBlock(MapBlock *block);
 	static bool saveBlock(MapBlock *block, MapDatabase *db);
+	static bool saveBlock(MapBlock *block, MapDatabase *db, u8 version,
+		int compression_level);
+	static void serializeBlock(MapBlock *block, u8 version,
+		int compression_level, std::string *data);
 	// This will generate a sector with getSector if not found.
 	void loadBlock(const std::string &sectordir, const std::string &blockfile,
 			MapSector *sector, bool save_after_load=false);
 	MapBlock* loadBlock(v3s16 p);
+	// Reads the given blocks from the database in one batch so that
+	// following loadBlock() calls for them don't query it again
+	void prefetchBlocks(const std::vector<v3s16> &blockpos);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
@@ -494,6 +646,10 @@ class ServerMap : public Map
 	std::string m_savedir;
 	bool m_map_saving_enabled;
 
+	// Serialization version and compression level for saving blocks
+	u8 m_block_ser_ver;
+	int m_block_compression_level;
+
 #if 0
 	// Chunk size in MapSectors
 	// If 0, chunks are disabled.
@@ -508,6 +664,15 @@ class ServerMap : public Map
 	*/
 	bool m_map_metadata_changed;
 	MapDatabase *dbase;
+
+	// Block data read by prefetchBlocks() and not yet loaded.
+	// An empty string means the block is not in the database.
+	std::map<v3s16, std::string> m_prefetched_blocks;
+
+	// Guards dbase, m_prefetched_blocks and the save thread's queue lookups
+	Mutex m_db_mutex;
+	// NULL if blocks are written on the calling thread
+	MapSaveThread *m_save_thread;
 };
 
 
@@ -77,6 +77,10 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_day_night_differs(false),
 		m_day_night_differs_expired(true),
 		m_generated(false),
+		m_change_counter(0),
+		m_network_data_version(SER_FMT_VER_INVALID),
+		m_network_data_compression_level(0),
+		m_network_data_change_counter(0),
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_disk_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_usage_timer(0),
@@ -180,6 +184,9 @@ bool MapBlock::propagateSunlight(std::set<v3s16> & light_sources,
 {
 	INodeDefManager *nodemgr = m_gamedef->ndef();
 
+	// Light is written through getNodeRef()
+	raiseChangeCounter();
+
 	// Whether the sunlight at the top of the bottom block is valid
 	bool block_below_is_valid = true;
 
@@ -369,6 +376,27 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	updateContentSummary();
+	raiseChangeCounter();
+}
+
+void MapBlock::updateContentSummary()
+{
+	m_content_summary.clear();
+	if (data == NULL)
+		return;
+
+	// Blocks are usually made of long runs of the same content
+	content_t previous_c = CONTENT_IGNORE;
+	m_content_summary.add(previous_c);
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = data[i].getContent();
+		if (c != previous_c) {
+			m_content_summary.add(c);
+			previous_c = c;
+		}
+	}
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -553,7 +581,8 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
-void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
+void MapBlock::serialize(std::ostream &os, u8 version, bool disk,
+	int compression_level)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
@@ -594,7 +623,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 		writeU8(os, content_width);
 		writeU8(os, params_width);
 		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
+				content_width, params_width, true, compression_level);
 		delete[] tmp_nodes;
 	}
 	else
@@ -604,7 +633,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 		writeU8(os, content_width);
 		writeU8(os, params_width);
 		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
+				content_width, params_width, true, compression_level);
 	}
 
 	/*
@@ -612,7 +641,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	*/
 	std::ostringstream oss(std::ios_base::binary);
 	m_node_metadata.serialize(oss, version, disk);
-	compressZlib(oss.str(), os);
+	compress(oss.str(), os, version, compression_level);
 
 	/*
 		Data that goes to disk, but not the network
@@ -651,6 +680,29 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeF1000(os, 0); // deprecated humidity
 }
 
+const std::string &MapBlock::getNetworkData(u8 version, int compression_level,
+	bool *cache_hit)
+{
+	bool hit = !m_network_data.empty()
+		&& m_network_data_version == version
+		&& m_network_data_compression_level == compression_level
+		&& m_network_data_change_counter == m_change_counter;
+	if (cache_hit)
+		*cache_hit = hit;
+	if (hit)
+		return m_network_data;
+
+	std::ostringstream os(std::ios_base::binary);
+	serialize(os, version, false, compression_level);
+	serializeNetworkSpecific(os);
+
+	m_network_data = os.str();
+	m_network_data_version = version;
+	m_network_data_compression_level = compression_level;
+	m_network_data_change_counter = m_change_counter;
+	return m_network_data;
+}
+
 void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 {
 	if(!ser_ver_supported(version))
@@ -658,6 +710,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
+	raiseChangeCounter();
 	m_day_night_differs_expired = false;
 
 	if(version <= 21)
@@ -697,7 +750,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompress(is, oss, version);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -752,6 +805,8 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	updateContentSummary();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Done."<<std::endl);
 }
@@ -984,6 +1039,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	updateContentSummary();
 }
 
 /*
@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodemetadata.h"
 #include "nodetimer.h"
 #include "modifiedstate.h"
+#include "util/basic_macros.h"
 #include "util/numeric.h" // getContainerPos
 #include "settings.h"
 #include "mapgen.h"
@@ -125,6 +126,61 @@ class NodeContainer
 #define MOD_REASON_VMANIP                    (1 << 19)
 #define MOD_REASON_UNKNOWN                   (1 << 20)
 
+////
+//// Content id presence summary
+////
+
+/*
+	Compact summary of the content ids that occur in a MapBlock.
+
+	Every content id maps to one bit of a 256-bit mask. A set bit only means
+	that some node with a matching id may be present (ids can collide, and
+	bits are not cleared when a node is replaced), but a clear bit means that
+	no such node is present. This lets ABMs and LBMs reject whole blocks
+	without looking at their nodes.
+*/
+class ContentSummary
+{
+public:
+	ContentSummary()
+	{
+		clear();
+	}
+
+	inline void clear()
+	{
+		for (u32 i = 0; i < ARRLEN(m_bits); i++)
+			m_bits[i] = 0;
+	}
+
+	inline void add(content_t c)
+	{
+		m_bits[(c >> 5) & 7] |= 1U << (c & 31);
+	}
+
+	inline void add(const ContentSummary &other)
+	{
+		for (u32 i = 0; i < ARRLEN(m_bits); i++)
+			m_bits[i] |= other.m_bits[i];
+	}
+
+	inline bool mayContain(content_t c) const
+	{
+		return (m_bits[(c >> 5) & 7] & (1U << (c & 31))) != 0;
+	}
+
+	inline bool intersects(const ContentSummary &other) const
+	{
+		for (u32 i = 0; i < ARRLEN(m_bits); i++)
+			if (m_bits[i] & other.m_bits[i])
+				return true;
+		return false;
+	}
+
+private:
+	u32 m_bits[8];
+};
+
 ////
 //// MapBlock itself
 ////
@@ -152,6 +208,9 @@ class MapBlock /*: public NodeContainer*/
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
 
+		m_content_summary.clear();
+		m_content_summary.add(CONTENT_IGNORE);
+
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
@@ -165,6 +224,7 @@ class MapBlock /*: public NodeContainer*/
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		raiseChangeCounter();
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -193,6 +253,20 @@ class MapBlock /*: public NodeContainer*/
 		m_modified_reason = 0;
 	}
 
+	// Counts changes to anything that is sent to clients. Unlike the
+	// modified state this is never reset, so it can tell whether a copy
+	// of the block made earlier is still current.
+	inline u32 getChangeCounter()
+	{
+		return m_change_counter;
+	}
+
+	// For changes that don't go through raiseModified()
+	inline void raiseChangeCounter()
+	{
+		m_change_counter++;
+	}
+
 	////
 	//// Flags
 	////
@@ -337,6 +411,7 @@ class MapBlock /*: public NodeContainer*/
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		m_content_summary.add(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -385,6 +460,7 @@ class MapBlock /*: public NodeContainer*/
 			throw InvalidPositionException();
 
 		data[z * zstride + y * ystride + x] = n;
+		m_content_summary.add(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -417,6 +493,38 @@ class MapBlock /*: public NodeContainer*/
 	// Copies data from VoxelManipulator getPosRelative()
 	void copyFrom(VoxelManipulator &dst);
 
+	////
+	//// Content summary
+	////
+
+	// May report content that is no longer in the block, see ContentSummary
+	inline const ContentSummary &getContentSummary()
+	{
+		return m_content_summary;
+	}
+
+	// Replaces the summary with one built by a full scan of the nodes.
+	// Writes made through setNode() during that scan must be kept, so callers
+	// that trigger callbacks while scanning should use resetContentSummary()
+	// before and addContentSummary() after the scan instead.
+	inline void setContentSummary(const ContentSummary &summary)
+	{
+		m_content_summary = summary;
+	}
+
+	inline void resetContentSummary()
+	{
+		m_content_summary.clear();
+	}
+
+	inline void addContentSummary(const ContentSummary &summary)
+	{
+		m_content_summary.add(summary);
+	}
+
+	// Rebuilds the summary from the node data
+	void updateContentSummary();
+
 	// Update day-night lighting difference flag.
 	// Sets m_day_night_differs to appropriate value.
 	// These methods don't care about neighboring blocks.
@@ -543,13 +651,21 @@ class MapBlock /*: public NodeContainer*/
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &os, u8 version, bool disk);
+	// compression_level is passed to the codec, negative for its default
+	void serialize(std::ostream &os, u8 version, bool disk,
+		int compression_level = -1);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
 
 	void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
+
+	// Returns serialize() followed by serializeNetworkSpecific() for the
+	// network. The result is kept until the block changes, so sending the
+	// block to several clients with the same version compresses it once.
+	const std::string &getNetworkData(u8 version, int compression_level,
+		bool *cache_hit = NULL);
 private:
 	/*
 		Private methods
@@ -652,6 +768,17 @@ class MapBlock /*: public NodeContainer*/
 
 	bool m_generated;
 
+	// Content ids present in data, kept up to date by the node setters
+	ContentSummary m_content_summary;
+
+	u32 m_change_counter;
+
+	// Cached result of getNetworkData() and what it was made from
+	std::string m_network_data;
+	u8 m_network_data_version;
+	int m_network_data_compression_level;
+	u32 m_network_data_change_counter;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
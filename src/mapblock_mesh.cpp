@@ -38,7 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 MeshMakeData::MeshMakeData(Client *client, bool use_shaders,
 		bool use_tangent_vertices):
-	m_vmanip(),
+	m_nodes(),
 	m_blockpos(-1337,-1337,-1337),
 	m_crack_pos_relative(-1337, -1337, -1337),
 	m_smooth_lighting(false),
@@ -51,72 +51,53 @@ MeshMakeData::MeshMakeData(Client *client, bool use_shaders,
 void MeshMakeData::fillBlockDataBegin(const v3s16 &blockpos)
 {
 	m_blockpos = blockpos;
-
-	v3s16 blockpos_nodes = m_blockpos*MAP_BLOCKSIZE;
-
-	m_vmanip.clear();
-	VoxelArea voxel_area(blockpos_nodes - v3s16(1,1,1) * MAP_BLOCKSIZE,
-			blockpos_nodes + v3s16(1,1,1) * MAP_BLOCKSIZE*2-v3s16(1,1,1));
-	m_vmanip.addArea(voxel_area);
+	m_nodes.reset(m_blockpos);
 }
 
-void MeshMakeData::fillBlockData(const v3s16 &block_offset, MapNode *data)
+void MeshMakeData::fillBlockData(const v3s16 &block_offset,
+		MapBlockSnapshot *snapshot)
 {
-	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
-	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
-
-	v3s16 bp = m_blockpos + block_offset;
-	v3s16 blockpos_nodes = bp * MAP_BLOCKSIZE;
-	m_vmanip.copyFrom(data, data_area, v3s16(0,0,0), blockpos_nodes, data_size);
+	m_nodes.setBlock(block_offset, snapshot);
 }
 
 void MeshMakeData::fill(MapBlock *block)
 {
 	fillBlockDataBegin(block->getPos());
 
-	fillBlockData(v3s16(0,0,0), block->getData());
-
 	// Get map for reading neigbhor blocks
 	Map *map = block->getParent();
 
-	for (u16 i=0; i<26; i++) {
-		const v3s16 &dir = g_26dirs[i];
+	for (u16 i=0; i<27; i++) {
+		const v3s16 &dir = g_27dirs[i];
 		v3s16 bp = m_blockpos + dir;
 		MapBlock *b = map->getBlockNoCreateNoEx(bp);
-		if(b)
-			fillBlockData(dir, b->getData());
+		if (b) {
+			MapBlockSnapshot *snapshot = new MapBlockSnapshot(b->getData());
+			fillBlockData(dir, snapshot);
+			snapshot->drop();
+		}
 	}
 }
 
 void MeshMakeData::fillSingleNode(MapNode *node)
 {
 	m_blockpos = v3s16(0,0,0);
-
-	v3s16 blockpos_nodes = v3s16(0,0,0);
-	VoxelArea area(blockpos_nodes-v3s16(1,1,1)*MAP_BLOCKSIZE,
-			blockpos_nodes+v3s16(1,1,1)*MAP_BLOCKSIZE*2-v3s16(1,1,1));
-	s32 volume = area.getVolume();
-	s32 our_node_index = area.index(1,1,1);
-
-	// Allocate this block + neighbors
-	m_vmanip.clear();
-	m_vmanip.addArea(area);
-
-	// Fill in data
-	MapNode *data = new MapNode[volume];
-	for(s32 i = 0; i < volume; i++)
-	{
-		if(i == our_node_index)
-		{
-			data[i] = *node;
-		}
-		else
-		{
-			data[i] = MapNode(CONTENT_AIR, LIGHT_MAX, 0);
-		}
+	m_nodes.reset(m_blockpos);
+
+	// The node at (1,1,1) surrounded by air
+	MapNode data[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+	for (u32 i = 0; i < ARRLEN(data); i++)
+		data[i] = MapNode(CONTENT_AIR, LIGHT_MAX, 0);
+	MapBlockSnapshot *air = new MapBlockSnapshot(data);
+	data[MAP_BLOCKSIZE * MAP_BLOCKSIZE + MAP_BLOCKSIZE + 1] = *node;
+	MapBlockSnapshot *center = new MapBlockSnapshot(data);
+
+	for (u16 i=0; i<27; i++) {
+		const v3s16 &dir = g_27dirs[i];
+		fillBlockData(dir, dir == v3s16(0,0,0) ? center : air);
 	}
-	m_vmanip.copyFrom(data, area, area.MinEdge, area.MinEdge, area.getExtent());
-	delete[] data;
+	air->drop();
+	center->drop();
 }
 
 void MeshMakeData::setCrack(int crack_level, v3s16 crack_pos)
@@ -230,7 +211,7 @@ static u16 getSmoothLightCombined(v3s16 p, MeshMakeData *data)
 
 	for (u32 i = 0; i < 8; i++)
 	{
-		MapNode n = data->m_vmanip.getNodeNoExNoEmerge(p - dirs8[i]);
+		MapNode n = data->m_nodes.getNodeNoEx(p - dirs8[i]);
 
 		// if it's CONTENT_IGNORE we can't do any light calculations
 		if (n.getContent() == CONTENT_IGNORE) {
@@ -785,11 +766,11 @@ static void getTileInfo(
 		TileSpec &tile
 	)
 {
-	VoxelManipulator &vmanip = data->m_vmanip;
+	const MapBlockSnapshotView &nodes = data->m_nodes;
 	INodeDefManager *ndef = data->m_client->ndef();
 	v3s16 blockpos_nodes = data->m_blockpos * MAP_BLOCKSIZE;
 
-	const MapNode &n0 = vmanip.getNodeRefUnsafe(blockpos_nodes + p);
+	const MapNode &n0 = nodes.getNodeRef(blockpos_nodes + p);
 
 	// Don't even try to get n1 if n0 is already CONTENT_IGNORE
 	if (n0.getContent() == CONTENT_IGNORE) {
@@ -797,7 +778,7 @@ static void getTileInfo(
 		return;
 	}
 
-	const MapNode &n1 = vmanip.getNodeRefUnsafeCheckFlags(blockpos_nodes + p + face_dir);
+	const MapNode &n1 = nodes.getNodeRef(blockpos_nodes + p + face_dir);
 
 	if (n1.getContent() == CONTENT_IGNORE) {
 		makes_face = false;
@@ -1032,7 +1013,7 @@ MapBlockMesh::MapBlockMesh(MeshMakeData *data, v3s16 camera_offset):
 	if (g_settings->getBool("enable_minimap")) {
 		m_minimap_mapblock = new MinimapMapblock;
 		m_minimap_mapblock->getMinimapNodes(
-			&data->m_vmanip, data->m_blockpos * MAP_BLOCKSIZE);
+			&data->m_nodes, data->m_blockpos * MAP_BLOCKSIZE);
 	}
 
 	// 4-21ms for MAP_BLOCKSIZE=16  (NOTE: probably outdated)
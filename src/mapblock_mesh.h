@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irrlichttypes_extrabloated.h"
 #include "client/tile.h"
 #include "voxel.h"
+#include "mapblock_snapshot.h"
 #include "util/cpp11_container.h"
 #include <map>
 
@@ -39,7 +40,7 @@ struct MinimapMapblock;
 
 struct MeshMakeData
 {
-	VoxelManipulator m_vmanip;
+	MapBlockSnapshotView m_nodes;
 	v3s16 m_blockpos;
 	v3s16 m_crack_pos_relative;
 	bool m_smooth_lighting;
@@ -53,10 +54,11 @@ struct MeshMakeData
 			bool use_tangent_vertices = false);
 
 	/*
-		Copy block data manually (to allow optimizations by the caller)
+		Set block data manually (to allow optimizations by the caller).
+		The snapshots are shared, not copied.
 	*/
 	void fillBlockDataBegin(const v3s16 &blockpos);
-	void fillBlockData(const v3s16 &block_offset, MapNode *data);
+	void fillBlockData(const v3s16 &block_offset, MapBlockSnapshot *snapshot);
 
 	/*
 		Copy central data directly from block, and other data from
@@ -0,0 +1,71 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblock_snapshot.h"
+#include <string.h>
+
+/*
+	MapBlockSnapshot
+*/
+
+MapBlockSnapshot::MapBlockSnapshot(const MapNode *data):
+	m_refcount(1)
+{
+	memcpy(m_data, data, sizeof(m_data));
+}
+
+/*
+	MapBlockSnapshotView
+*/
+
+const MapNode MapBlockSnapshotView::s_ignore_node(CONTENT_IGNORE);
+
+MapBlockSnapshotView::MapBlockSnapshotView():
+	m_origin(0, 0, 0)
+{
+	for (int i = 0; i < 3 * 3 * 3; i++)
+		m_blocks[i] = NULL;
+}
+
+MapBlockSnapshotView::~MapBlockSnapshotView()
+{
+	reset(v3s16(0, 0, 0));
+}
+
+void MapBlockSnapshotView::reset(v3s16 blockpos)
+{
+	m_origin = (blockpos - v3s16(1, 1, 1)) * MAP_BLOCKSIZE;
+	for (int i = 0; i < 3 * 3 * 3; i++) {
+		if (m_blocks[i])
+			m_blocks[i]->drop();
+		m_blocks[i] = NULL;
+	}
+}
+
+void MapBlockSnapshotView::setBlock(v3s16 block_offset,
+		MapBlockSnapshot *snapshot)
+{
+	MapBlockSnapshot *&block = m_blocks[((block_offset.Z + 1) * 3 +
+			block_offset.Y + 1) * 3 + block_offset.X + 1];
+	if (snapshot)
+		snapshot->grab();
+	if (block)
+		block->drop();
+	block = snapshot;
+}
@@ -0,0 +1,111 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPBLOCK_SNAPSHOT_HEADER
+#define MAPBLOCK_SNAPSHOT_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include "constants.h"
+#include "mapnode.h"
+#include "threading/atomic.h"
+#include "util/basic_macros.h"
+
+/*
+	An immutable copy of the nodes of a MapBlock, shared by the block
+	cache of the MeshUpdateQueue and the meshes being made from it.
+	When the block changes, the cache takes a new snapshot instead of
+	writing to the shared one.
+*/
+class MapBlockSnapshot
+{
+public:
+	// Copies the nodes. The creator holds the first reference.
+	MapBlockSnapshot(const MapNode *data);
+
+	void grab() { m_refcount++; }
+	void drop()
+	{
+		if (--m_refcount == 0)
+			delete this;
+	}
+
+	const MapNode *getData() const { return m_data; }
+
+private:
+	~MapBlockSnapshot() {}
+
+	MapNode m_data[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+	Atomic<u32> m_refcount;
+
+	DISABLE_CLASS_COPY(MapBlockSnapshot);
+};
+
+/*
+	Read-only view of the nodes of a block and its 26 neighbors, made of
+	snapshots. Nodes of missing blocks and nodes outside of the 3x3x3
+	blocks read as CONTENT_IGNORE.
+*/
+class MapBlockSnapshotView
+{
+public:
+	MapBlockSnapshotView();
+	~MapBlockSnapshotView();
+
+	// Drops all snapshots and centers the view on the block at blockpos
+	void reset(v3s16 blockpos);
+
+	// Grabs the snapshot for the block at block_offset (-1..1 on each
+	// axis) from the center block. NULL makes the block missing.
+	void setBlock(v3s16 block_offset, MapBlockSnapshot *snapshot);
+
+	const MapNode &getNodeRef(v3s16 p) const
+	{
+		p -= m_origin;
+		if ((u16)p.X >= 3 * MAP_BLOCKSIZE || (u16)p.Y >= 3 * MAP_BLOCKSIZE ||
+				(u16)p.Z >= 3 * MAP_BLOCKSIZE)
+			return s_ignore_node;
+		const MapBlockSnapshot *block = m_blocks[(p.Z / MAP_BLOCKSIZE * 3 +
+				p.Y / MAP_BLOCKSIZE) * 3 + p.X / MAP_BLOCKSIZE];
+		if (block == NULL)
+			return s_ignore_node;
+		return block->getData()[
+				(p.Z % MAP_BLOCKSIZE) * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+				(p.Y % MAP_BLOCKSIZE) * MAP_BLOCKSIZE + p.X % MAP_BLOCKSIZE];
+	}
+
+	MapNode getNodeNoEx(v3s16 p) const { return getNodeRef(p); }
+
+	// The snapshot of the block at block_offset, NULL if it is missing
+	const MapBlockSnapshot *getBlock(v3s16 block_offset) const
+	{
+		return m_blocks[((block_offset.Z + 1) * 3 + block_offset.Y + 1) * 3 +
+				block_offset.X + 1];
+	}
+
+private:
+	static const MapNode s_ignore_node;
+
+	// First node of the block at offset (-1,-1,-1)
+	v3s16 m_origin;
+	MapBlockSnapshot *m_blocks[3 * 3 * 3];
+
+	DISABLE_CLASS_COPY(MapBlockSnapshotView);
+};
+
+#endif
@@ -38,6 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 #include "util/serialize.h"
 #include "util/numeric.h"
+#include "util/thread.h"
 #include "filesys.h"
 #include "log.h"
 #include "mapgen_flat.h"
@@ -70,6 +71,16 @@ FlagDesc flagdesc_gennotify[] = {
 	{NULL,               0}
 };
 
+const char *mapgen_stage_names[NUM_MGSTAGES] = {
+	"terrain",
+	"caves",
+	"dungeons",
+	"ores",
+	"decorations",
+	"lighting",
+	"liquids",
+};
+
 struct MapgenDesc {
 	const char *name;
 	bool is_user_visible;
@@ -125,6 +136,7 @@ Mapgen::Mapgen()
 	biomegen  = NULL;
 	biomemap  = NULL;
 	heightmap = NULL;
+	stats     = NULL;
 }
 
 
@@ -158,6 +170,7 @@ Mapgen::Mapgen(int mapgenid, MapgenParams *params, EmergeManager *emerge) :
 	biomegen  = NULL;
 	biomemap  = NULL;
 	heightmap = NULL;
+	stats     = NULL;
 }
 
 
@@ -166,6 +179,37 @@ Mapgen::~Mapgen()
 }
 
 
+void MapgenStats::reset()
+{
+	for (int i = 0; i != NUM_MGSTAGES; i++)
+		stage_us[i] = 0;
+	chunks = 0;
+}
+
+
+void MapgenStats::add(const MapgenStats &other)
+{
+	for (int i = 0; i != NUM_MGSTAGES; i++)
+		stage_us[i] += other.stage_us[i];
+	chunks += other.chunks;
+}
+
+
+ScopeMapgenStage::ScopeMapgenStage(Mapgen *mg, MapgenStage stage) :
+	m_stats(mg->stats),
+	m_stage(stage),
+	m_start(m_stats ? porting::getTimeUs() : 0)
+{
+}
+
+
+ScopeMapgenStage::~ScopeMapgenStage()
+{
+	if (m_stats)
+		m_stats->stage_us[m_stage] += porting::getTimeUs() - m_start;
+}
+
+
 MapgenType Mapgen::getMapgenType(const std::string &mgname)
 {
 	for (size_t i = 0; i != ARRLEN(g_reg_mapgens); i++) {
@@ -377,6 +421,8 @@ inline bool Mapgen::isLiquidHorizontallyFlowable(u32 vi, v3s16 em)
 
 void Mapgen::updateLiquid(UniqueQueue<v3s16> *trans_liquid, v3s16 nmin, v3s16 nmax)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_LIQUIDS);
+
 	bool isignored, isliquid, wasignored, wasliquid, waschecked, waspushed;
 	v3s16 em  = vm->m_area.getExtent();
 
@@ -442,12 +488,72 @@ void Mapgen::setLighting(u8 light, v3s16 nmin, v3s16 nmax)
 }
 
 
-void Mapgen::lightSpread(VoxelArea &a, v3s16 p, u8 light)
+// Bits of Mapgen::getLightFlags()
+#define MGLIGHT_SOURCE      0x0F
+#define MGLIGHT_PROPAGATES  0x10
+#define MGLIGHT_SUNLIGHT    0x20
+#define MGLIGHT_KNOWN       0x80
+
+// Nodes whose light is to be spread further, in buckets by the brighter of
+// the two banks. The brightest light is spread first, so that a node is
+// seldom lit again by a brighter neighbour after it has been spread.
+class LightQueue {
+public:
+	struct Entry {
+		u32 vi;
+		v3s16 p;
+	};
+
+	LightQueue() : m_top(0) {}
+
+	void push(u8 light, u32 vi, v3s16 p)
+	{
+		u8 level = MYMAX(light & 0x0F, light >> 4);
+		Entry e = { vi, p };
+		m_buckets[level].push_back(e);
+		m_top = MYMAX(m_top, level);
+	}
+
+	bool pop(Entry *e)
+	{
+		while (m_buckets[m_top].empty()) {
+			if (m_top == 0)
+				return false;
+			m_top--;
+		}
+		*e = m_buckets[m_top].back();
+		m_buckets[m_top].pop_back();
+		return true;
+	}
+
+private:
+	std::vector<Entry> m_buckets[LIGHT_SUN + 1];
+	u8 m_top;
+};
+
+
+inline u8 Mapgen::getLightFlags(content_t c)
+{
+	u8 flags = m_light_flags[c];
+	if (!flags) {
+		const ContentFeatures &f = ndef->get(c);
+		flags = MGLIGHT_KNOWN | (f.light_source & MGLIGHT_SOURCE);
+		if (f.light_propagates)
+			flags |= MGLIGHT_PROPAGATES;
+		if (f.sunlight_propagates)
+			flags |= MGLIGHT_SUNLIGHT;
+		m_light_flags[c] = flags;
+	}
+	return flags;
+}
+
+
+inline void Mapgen::lightSpread(const VoxelArea &a, LightQueue &queue,
+	v3s16 p, u32 vi, u8 light)
 {
 	if (light <= 1 || !a.contains(p))
 		return;
 
-	u32 vi = vm->m_area.index(p);
 	MapNode &n = vm->m_data[vi];
 
 	// Decay light in each of the banks separately
@@ -463,23 +569,18 @@ void Mapgen::lightSpread(VoxelArea &a, v3s16 p, u8 light)
 	// we hit a solid block that light cannot pass through.
 	if ((light_day  <= (n.param1 & 0x0F) &&
 		light_night <= (n.param1 & 0xF0)) ||
-		!ndef->get(n).light_propagates)
+		!(getLightFlags(n.getContent()) & MGLIGHT_PROPAGATES))
 		return;
 
-	// Since this recursive function only terminates when there is no light from
-	// either bank left, we need to take the max of both banks into account for
-	// the case where spreading has stopped for one light bank but not the other.
+	// Spreading only stops when there is no light from either bank left, so
+	// the max of both banks is spread for the case where spreading has
+	// stopped for one light bank but not the other.
 	light = MYMAX(light_day, n.param1 & 0x0F) |
 			MYMAX(light_night, n.param1 & 0xF0);
 
 	n.param1 = light;
-
-	lightSpread(a, p + v3s16(0, 0, 1), light);
-	lightSpread(a, p + v3s16(0, 1, 0), light);
-	lightSpread(a, p + v3s16(1, 0, 0), light);
-	lightSpread(a, p - v3s16(0, 0, 1), light);
-	lightSpread(a, p - v3s16(0, 1, 0), light);
-	lightSpread(a, p - v3s16(1, 0, 0), light);
+	if (light > 1)
+		queue.push(light, vi, p);
 }
 
 
@@ -487,6 +588,8 @@ void Mapgen::calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nm
 	bool propagate_shadow)
 {
 	ScopeProfiler sp(g_profiler, "EmergeThread: mapgen lighting update", SPT_AVG);
+	ScopeMapgenStage stage(this, MGSTAGE_LIGHTING);
+
 	//TimeTaker t("updateLighting");
 
 	propagateSunlight(nmin, nmax, propagate_shadow);
@@ -501,30 +604,44 @@ void Mapgen::propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow)
 	//TimeTaker t("propagateSunlight");
 	VoxelArea a(nmin, nmax);
 	bool block_is_underground = (water_level >= nmax.Y);
-	v3s16 em = vm->m_area.getExtent();
+	s16 width = a.getExtent().X;
+
+	if (m_light_flags.empty())
+		m_light_flags.resize(1 << (8 * sizeof(content_t)), 0);
+
+	// The columns of a Z slice go down together, row by row, to walk the
+	// voxel data in order. lit[] holds those still receiving sunlight.
+	std::vector<u8> lit(width);
 
 	// NOTE: Direct access to the low 4 bits of param1 is okay here because,
 	// by definition, sunlight will never be in the night lightbank.
 
 	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
-		for (int x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
-			// see if we can get a light value from the overtop
-			u32 i = vm->m_area.index(x, a.MaxEdge.Y + 1, z);
-			if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
-				if (block_is_underground)
+		// see if we can get a light value from the overtop
+		u32 i = vm->m_area.index(a.MinEdge.X, a.MaxEdge.Y + 1, z);
+		u32 num_lit = 0;
+		for (s16 x = 0; x < width; x++, i++) {
+			const MapNode &n = vm->m_data[i];
+			if (n.getContent() == CONTENT_IGNORE)
+				lit[x] = !block_is_underground;
+			else
+				lit[x] = (n.param1 & 0x0F) == LIGHT_SUN || !propagate_shadow;
+			num_lit += lit[x];
+		}
+
+		for (int y = a.MaxEdge.Y; y >= a.MinEdge.Y && num_lit; y--) {
+			i = vm->m_area.index(a.MinEdge.X, y, z);
+			for (s16 x = 0; x < width; x++, i++) {
+				if (!lit[x])
 					continue;
-			} else if ((vm->m_data[i].param1 & 0x0F) != LIGHT_SUN &&
-					propagate_shadow) {
-				continue;
-			}
-			vm->m_area.add_y(em, i, -1);
 
-			for (int y = a.MaxEdge.Y; y >= a.MinEdge.Y; y--) {
 				MapNode &n = vm->m_data[i];
-				if (!ndef->get(n).sunlight_propagates)
-					break;
+				if (!(getLightFlags(n.getContent()) & MGLIGHT_SUNLIGHT)) {
+					lit[x] = 0;
+					num_lit--;
+					continue;
+				}
 				n.param1 = LIGHT_SUN;
-				vm->m_area.add_y(em, i, -1);
 			}
 		}
 	}
@@ -536,7 +653,17 @@ void Mapgen::spreadLight(v3s16 nmin, v3s16 nmax)
 {
 	//TimeTaker t("spreadLight");
 	VoxelArea a(nmin, nmax);
+	v3s16 em = vm->m_area.getExtent();
+	s32 ystride = em.X;
+	s32 zstride = em.X * em.Y;
+	LightQueue queue;
 
+	if (m_light_flags.empty())
+		m_light_flags.resize(1 << (8 * sizeof(content_t)), 0);
+
+	// Each node is spread completely before the next one is looked at, in
+	// this order, as light sources override the light they have been given
+	// by the nodes spread before them.
 	for (int z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++) {
 		for (int y = a.MinEdge.Y; y <= a.MaxEdge.Y; y++) {
 			u32 i = vm->m_area.index(a.MinEdge.X, y, z);
@@ -545,26 +672,31 @@ void Mapgen::spreadLight(v3s16 nmin, v3s16 nmax)
 				if (n.getContent() == CONTENT_IGNORE)
 					continue;
 
-				const ContentFeatures &cf = ndef->get(n);
-				if (!cf.light_propagates)
+				u8 flags = getLightFlags(n.getContent());
+				if (!(flags & MGLIGHT_PROPAGATES))
 					continue;
 
 				// TODO(hmmmmm): Abstract away direct param1 accesses with a
 				// wrapper, but something lighter than MapNode::get/setLight
 
-				u8 light_produced = cf.light_source;
+				u8 light_produced = flags & MGLIGHT_SOURCE;
 				if (light_produced)
 					n.param1 = light_produced | (light_produced << 4);
 
-				u8 light = n.param1;
-				if (light) {
-					lightSpread(a, v3s16(x,     y,     z + 1), light);
-					lightSpread(a, v3s16(x,     y + 1, z    ), light);
-					lightSpread(a, v3s16(x + 1, y,     z    ), light);
-					lightSpread(a, v3s16(x,     y,     z - 1), light);
-					lightSpread(a, v3s16(x,     y - 1, z    ), light);
-					lightSpread(a, v3s16(x - 1, y,     z    ), light);
-				}
+				if (!n.param1)
+					continue;
+
+				LightQueue::Entry e = { i, v3s16(x, y, z) };
+				do {
+					u8 light = vm->m_data[e.vi].param1;
+					v3s16 p = e.p;
+					lightSpread(a, queue, v3s16(p.X,     p.Y,     p.Z + 1), e.vi + zstride, light);
+					lightSpread(a, queue, v3s16(p.X,     p.Y + 1, p.Z    ), e.vi + ystride, light);
+					lightSpread(a, queue, v3s16(p.X + 1, p.Y,     p.Z    ), e.vi + 1,       light);
+					lightSpread(a, queue, v3s16(p.X,     p.Y,     p.Z - 1), e.vi - zstride, light);
+					lightSpread(a, queue, v3s16(p.X,     p.Y - 1, p.Z    ), e.vi - ystride, light);
+					lightSpread(a, queue, v3s16(p.X - 1, p.Y,     p.Z    ), e.vi - 1,       light);
+				} while (queue.pop(&e));
 			}
 		}
 	}
@@ -849,15 +981,72 @@ void MapgenBasic::dustTopNodes()
 }
 
 
+class TerrainSlabBatch : public WorkerPool::Batch {
+public:
+	TerrainSlabBatch(MapgenBasic *mg, s16 z_min, s16 z_max, u32 count) :
+		m_mg(mg),
+		m_z_min(z_min),
+		m_rows(z_max - z_min + 1),
+		m_surface_max_y(count, -MAX_MAP_GENERATION_LIMIT)
+	{}
+
+	void runItem(u32 i)
+	{
+		u32 count = m_surface_max_y.size();
+		m_surface_max_y[i] = m_mg->generateTerrainSlab(
+			m_z_min + m_rows * i / count,
+			m_z_min + m_rows * (i + 1) / count - 1);
+	}
+
+	s16 getSurfaceMaxY() const
+	{
+		s16 surface_max_y = -MAX_MAP_GENERATION_LIMIT;
+		for (size_t i = 0; i < m_surface_max_y.size(); i++)
+			surface_max_y = MYMAX(surface_max_y, m_surface_max_y[i]);
+		return surface_max_y;
+	}
+
+private:
+	MapgenBasic *m_mg;
+	s16 m_z_min;
+	u32 m_rows;
+	std::vector<s16> m_surface_max_y;
+};
+
+
+s16 MapgenBasic::generateTerrainSlab(s16 /*z_min*/, s16 /*z_max*/)
+{
+	return -MAX_MAP_GENERATION_LIMIT;
+}
+
+
+s16 MapgenBasic::generateTerrainSlabs()
+{
+	WorkerPool *pool = m_emerge->chunk_pool;
+	u32 count = pool ? MYMIN(pool->getThreadCount(), (u32)csize.Z) : 1;
+
+	TerrainSlabBatch batch(this, node_min.Z, node_max.Z, count);
+	if (count > 1)
+		pool->run(&batch, count);
+	else
+		batch.runItem(0);
+
+	return batch.getSurfaceMaxY();
+}
+
+
 void MapgenBasic::generateCaves(s16 max_stone_y, s16 large_cave_depth)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_CAVES);
+
 	if (max_stone_y < node_min.Y)
 		return;
 
 	CavesNoiseIntersection caves_noise(ndef, m_bmgr, csize,
 		&np_cave1, &np_cave2, seed, cave_width);
 
-	caves_noise.generateCaves(vm, node_min, node_max, biomemap);
+	caves_noise.generateCaves(vm, node_min, node_max, biomemap,
+		m_emerge->chunk_pool);
 
 	if (node_max.Y > large_cave_depth)
 		return;
@@ -875,18 +1064,23 @@ void MapgenBasic::generateCaves(s16 max_stone_y, s16 large_cave_depth)
 
 bool MapgenBasic::generateCaverns(s16 max_stone_y)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_CAVES);
+
 	if (node_min.Y > max_stone_y || node_min.Y > cavern_limit)
 		return false;
 
 	CavernsNoise caverns_noise(ndef, csize, &np_cavern,
 		seed, cavern_limit, cavern_taper, cavern_threshold);
 
-	return caverns_noise.generateCaverns(vm, node_min, node_max);
+	return caverns_noise.generateCaverns(vm, node_min, node_max,
+		m_emerge->chunk_pool);
 }
 
 
 void MapgenBasic::generateDungeons(s16 max_stone_y, MgStoneType stone_type)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_DUNGEONS);
+
 	if (max_stone_y < node_min.Y)
 		return;
 
@@ -58,6 +58,7 @@ class VoxelManipulator;
 struct BlockMakeData;
 class VoxelArea;
 class Map;
+class LightQueue;
 
 enum MapgenObject {
 	MGOBJ_VMANIP,
@@ -86,6 +87,30 @@ enum MgStoneType {
 	MGSTONE_SANDSTONE,
 };
 
+// Parts of makeChunk() whose time is kept in MapgenStats
+enum MapgenStage {
+	MGSTAGE_TERRAIN,
+	MGSTAGE_CAVES,
+	MGSTAGE_DUNGEONS,
+	MGSTAGE_ORES,
+	MGSTAGE_DECORATIONS,
+	MGSTAGE_LIGHTING,
+	MGSTAGE_LIQUIDS,
+	NUM_MGSTAGES
+};
+
+extern const char *mapgen_stage_names[NUM_MGSTAGES];
+
+struct MapgenStats {
+	u64 stage_us[NUM_MGSTAGES];
+	u32 chunks;
+
+	MapgenStats() { reset(); }
+
+	void reset();
+	void add(const MapgenStats &other);
+};
+
 struct GenNotifyEvent {
 	GenNotifyType type;
 	v3s16 pos;
@@ -193,6 +218,9 @@ class Mapgen {
 	BiomeGen *biomegen;
 	GenerateNotifier gennotify;
 
+	// Time spent in the stages of makeChunk(), if set
+	MapgenStats *stats;
+
 	Mapgen();
 	Mapgen(int mapgenid, MapgenParams *params, EmergeManager *emerge);
 	virtual ~Mapgen();
@@ -208,7 +236,6 @@ class Mapgen {
 	void updateLiquid(UniqueQueue<v3s16> *trans_liquid, v3s16 nmin, v3s16 nmax);
 
 	void setLighting(u8 light, v3s16 nmin, v3s16 nmax);
-	void lightSpread(VoxelArea &a, v3s16 p, u8 light);
 	void calcLighting(v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax,
 		bool propagate_shadow = true);
 	void propagateSunlight(v3s16 nmin, v3s16 nmax, bool propagate_shadow);
@@ -237,9 +264,29 @@ class Mapgen {
 	// that checks whether there are floodable nodes without liquid beneath
 	// the node at index vi.
 	inline bool isLiquidHorizontallyFlowable(u32 vi, v3s16 em);
+
+	// Light properties of each content id, looked up on first use
+	std::vector<u8> m_light_flags;
+	inline u8 getLightFlags(content_t c);
+
+	inline void lightSpread(const VoxelArea &a, LightQueue &queue,
+		v3s16 p, u32 vi, u8 light);
+
 	DISABLE_CLASS_COPY(Mapgen);
 };
 
+// Adds the time until the end of the scope to a stage of mg->stats
+class ScopeMapgenStage {
+public:
+	ScopeMapgenStage(Mapgen *mg, MapgenStage stage);
+	~ScopeMapgenStage();
+
+private:
+	MapgenStats *m_stats;
+	MapgenStage m_stage;
+	u64 m_start;
+};
+
 /*
 	MapgenBasic is a Mapgen implementation that handles basic functionality
 	the majority of conventional mapgens will probably want to use, but isn't
@@ -265,6 +312,15 @@ class MapgenBasic : public Mapgen {
 	virtual MgStoneType generateBiomes();
 	virtual void dustTopNodes();
 
+	// Generates the base terrain of the z rows z_min to z_max of the
+	// mapchunk and returns the highest stone surface in them. Several
+	// slabs are generated at the same time, so it must not write outside
+	// of its own slab.
+	virtual s16 generateTerrainSlab(s16 z_min, s16 z_max);
+	// Generates the whole mapchunk in slabs on the emerge manager's
+	// chunk_pool if there is one
+	s16 generateTerrainSlabs();
+
 protected:
 	EmergeManager *m_emerge;
 	BiomeManager *m_bmgr;
@@ -0,0 +1,223 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapgen_bench.h"
+#include "emerge.h"
+#include "filesys.h"
+#include "log.h"
+#include "map.h"
+#include "mapgen.h"
+#include "porting.h"
+#include "server.h"
+#include "serverenvironment.h"
+#include "settings.h"
+#include "subgame.h"
+#include "threading/atomic.h"
+#include "threading/thread.h"
+#include "util/numeric.h"
+#include "util/string.h"
+#include "util/thread.h"
+#include <cstdio>
+
+class MapgenBenchThread : public Thread
+{
+public:
+	MapgenBenchThread(Server *server, Mapgen *mg,
+		const std::vector<v3s16> *chunks, Atomic<u32> *next) :
+		Thread("MapgenBench"),
+		busy_us(0),
+		m_server(server),
+		m_mg(mg),
+		m_chunks(chunks),
+		m_next(next)
+	{
+		m_mg->stats = &stats;
+	}
+
+	~MapgenBenchThread() { delete m_mg; }
+
+	void *run();
+
+	MapgenStats stats;
+	u64 busy_us;
+
+private:
+	void generateChunk(Map *map, v3s16 bpmin);
+
+	Server *m_server;
+	Mapgen *m_mg;
+	const std::vector<v3s16> *m_chunks;
+	Atomic<u32> *m_next;
+};
+
+
+void *MapgenBenchThread::run()
+{
+	// Nothing is saved, so the map only has to exist for the manipulators
+	Map map(dstream, m_server);
+
+	u64 t0 = porting::getTimeUs();
+	u32 i;
+	while ((i = (*m_next)++) < m_chunks->size()) {
+		generateChunk(&map, (*m_chunks)[i]);
+		stats.chunks++;
+	}
+	busy_us = porting::getTimeUs() - t0;
+
+	return NULL;
+}
+
+
+void MapgenBenchThread::generateChunk(Map *map, v3s16 bpmin)
+{
+	s16 chunksize = m_mg->csize.X / MAP_BLOCKSIZE;
+
+	BlockMakeData data;
+	data.seed = m_mg->seed;
+	data.blockpos_min = bpmin;
+	data.blockpos_max = bpmin + v3s16(1, 1, 1) * (chunksize - 1);
+	data.blockpos_requested = bpmin;
+	data.nodedef = m_server->getNodeDefManager();
+	data.vmanip = new MMVManip(map);
+	data.vmanip->initialEmerge(data.blockpos_min - v3s16(1, 1, 1),
+		data.blockpos_max + v3s16(1, 1, 1));
+
+	m_mg->makeChunk(&data);
+}
+
+
+static void print_stage_times(const MapgenStats &stats, u64 busy_us)
+{
+	u64 staged_us = 0;
+	rawstream << "  Stages, ms/chunk:";
+	for (int i = 0; i != NUM_MGSTAGES; i++) {
+		rawstream << " " << mapgen_stage_names[i] << " "
+			<< (float)stats.stage_us[i] / MYMAX(stats.chunks, 1) / 1000;
+		staged_us += stats.stage_us[i];
+	}
+	rawstream << " other "
+		<< (float)(busy_us - MYMIN(staged_us, busy_us)) /
+			MYMAX(stats.chunks, 1) / 1000 << std::endl;
+}
+
+
+bool run_mapgen_benchmark(const Settings &cmd_args)
+{
+	std::string mg_name = cmd_args.get("mapgen-bench");
+	if (Mapgen::getMapgenType(mg_name) == MAPGEN_INVALID) {
+		errorstream << "Unknown mapgen \"" << mg_name << "\"" << std::endl;
+		return false;
+	}
+
+	std::string gameid = cmd_args.exists("gameid") ?
+		cmd_args.get("gameid") : g_settings->get("default_game");
+	SubgameSpec gamespec = findSubgame(gameid);
+	if (!gamespec.isValid()) {
+		errorstream << "Game \"" << gameid << "\" not found" << std::endl;
+		return false;
+	}
+
+	s16 size = cmd_args.exists("mapgen-bench-size") ?
+		mystoi(cmd_args.get("mapgen-bench-size"), 1, 32) : 3;
+	u32 num_threads = cmd_args.exists("mapgen-bench-threads") ?
+		mystoi(cmd_args.get("mapgen-bench-threads"), 0, 256) : 0;
+	if (num_threads == 0)
+		num_threads = MYMAX(Thread::getNumberOfProcessors(), 1);
+
+	// A new world takes the mapgen and seed from the settings
+	g_settings->set("mg_name", mg_name);
+	if (cmd_args.exists("mapgen-bench-seed"))
+		g_settings->set("fixed_map_seed", cmd_args.get("mapgen-bench-seed"));
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%08X", myrand());
+	std::string world_path = fs::TempPath() + DIR_DELIM "mapgen_bench_" + buf;
+
+	// Nothing is saved, so the world needs no database
+	if (!fs::CreateAllDirs(world_path) ||
+			!fs::safeWriteToFile(world_path + DIR_DELIM "world.mt",
+				"gameid = " + gamespec.id + "\nbackend = dummy\n")) {
+		errorstream << "Cannot create world " << world_path << std::endl;
+		return false;
+	}
+
+	bool success = true;
+	try {
+		Server server(world_path, gamespec, false, false, true);
+		EmergeManager *emerge = server.getEmergeManager();
+		MapgenParams *params = server.getEnv().getServerMap().getMapgenParams();
+		u64 loaded_memory = porting::getPeakMemoryUsage();
+
+		std::vector<v3s16> chunks;
+		v3s16 origin = EmergeManager::getContainingChunk(v3s16(0, 0, 0),
+			params->chunksize);
+		for (s16 x = 0; x < size; x++)
+		for (s16 y = 0; y < size; y++)
+		for (s16 z = 0; z < size; z++)
+			chunks.push_back(origin + (v3s16(x, y, z) - size / 2) *
+				params->chunksize);
+
+		std::vector<MapgenBenchThread *> threads;
+		Atomic<u32> next(0);
+		for (u32 i = 0; i < num_threads; i++) {
+			Mapgen *mg = Mapgen::createMapgen(params->mgtype, i, params, emerge);
+			threads.push_back(new MapgenBenchThread(&server, mg, &chunks, &next));
+		}
+
+		u64 t0 = porting::getTimeUs();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i]->start();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i]->wait();
+		u64 t1 = porting::getTimeUs();
+
+		MapgenStats stats;
+		u64 busy_us = 0;
+		for (size_t i = 0; i < threads.size(); i++) {
+			stats.add(threads[i]->stats);
+			busy_us += threads[i]->busy_us;
+			delete threads[i];
+		}
+
+		rawstream << "Mapgen benchmark: " << mg_name << ", seed "
+			<< params->seed << ", game " << gamespec.id << ", "
+			<< chunks.size() << " chunks of " << params->chunksize
+			<< "^3 blocks with " << num_threads << " threads"
+			<< " (num_mapchunk_threads = "
+			<< (emerge->chunk_pool ? emerge->chunk_pool->getThreadCount() : 1)
+			<< ")" << std::endl;
+		rawstream << "  " << (float)(t1 - t0) / 1000000 << " s, "
+			<< chunks.size() * 1000000.0f / MYMAX(t1 - t0, 1) << " chunks/s, "
+			<< (float)busy_us / MYMAX(chunks.size(), 1) / 1000
+			<< " ms/chunk per thread" << std::endl;
+		print_stage_times(stats, busy_us);
+		rawstream << "  Peak memory: " << porting::getPeakMemoryUsage() / 1048576
+			<< " MB, " << loaded_memory / 1048576 << " MB after loading the game"
+			<< std::endl;
+	} catch (const ModError &e) {
+		errorstream << "ModError: " << e.what() << std::endl;
+		success = false;
+	} catch (const ServerError &e) {
+		errorstream << "ServerError: " << e.what() << std::endl;
+		success = false;
+	}
+
+	fs::RecursiveDelete(world_path);
+	return success;
+}
@@ -0,0 +1,33 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef MAPGEN_BENCH_HEADER
+#define MAPGEN_BENCH_HEADER
+
+class Settings;
+
+/*
+	Loads a game into a server without network or world of its own and
+	generates a cube of map chunks around the origin with the mapgen given
+	by --mapgen-bench, then prints chunks/s, the time of the mapgen stages
+	and the peak memory usage.
+*/
+bool run_mapgen_benchmark(const Settings &cmd_args);
+
+#endif
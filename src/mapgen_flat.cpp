@@ -254,6 +254,8 @@ void MapgenFlat::generateBedrock()
 
 s16 MapgenFlat::generateTerrain()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	MapNode n_air(CONTENT_AIR);
 	MapNode n_stone(c_stone);
 	MapNode n_bedrock(c_bedrock);
@@ -249,15 +249,24 @@ void MapgenV5::makeChunk(BlockMakeData *data)
 
 int MapgenV5::generateBaseTerrain()
 {
-	u32 index = 0;
-	u32 index2d = 0;
-	int stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
 
 	noise_factor->perlinMap2D(node_min.X, node_min.Z);
 	noise_height->perlinMap2D(node_min.X, node_min.Z);
-	noise_ground->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+	noise_ground->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z,
+		NULL, m_emerge->chunk_pool);
 
-	for (s16 z=node_min.Z; z<=node_max.Z; z++) {
+	return generateTerrainSlabs();
+}
+
+
+s16 MapgenV5::generateTerrainSlab(s16 z_min, s16 z_max)
+{
+	u32 index = (z_min - node_min.Z) * zstride_1u1d;
+	u32 index2d = (z_min - node_min.Z) * ystride;
+	s16 stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
+
+	for (s16 z=z_min; z<=z_max; z++) {
 		for (s16 y=node_min.Y - 1; y<=node_max.Y + 1; y++) {
 			u32 vi = vm->m_area.index(node_min.X, y, z);
 			for (s16 x=node_min.X; x<=node_max.X; x++, vi++, index++, index2d++) {
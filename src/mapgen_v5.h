@@ -66,6 +66,7 @@ class MapgenV5 : public MapgenBasic
 	virtual void makeChunk(BlockMakeData *data);
 	int getSpawnLevelAtPoint(v2s16 p);
 	int generateBaseTerrain();
+	virtual s16 generateTerrainSlab(s16 z_min, s16 z_max);
 
 private:
 	Noise *noise_factor;
@@ -564,6 +564,8 @@ void MapgenV6::makeChunk(BlockMakeData *data)
 
 	// Add dungeons
 	if ((flags & MG_DUNGEONS) && (stone_surface_max_y >= node_min.Y)) {
+		ScopeMapgenStage stage(this, MGSTAGE_DUNGEONS);
+
 		DungeonParams dp;
 
 		dp.seed             = seed;
@@ -620,8 +622,11 @@ void MapgenV6::makeChunk(BlockMakeData *data)
 	growGrass();
 
 	// Generate some trees, and add grass, if a jungle
-	if (spflags & MGV6_TREES)
+	if (spflags & MGV6_TREES) {
+		ScopeMapgenStage stage(this, MGSTAGE_DECORATIONS);
+
 		placeTreesAndJungleGrass();
+	}
 
 	// Generate the registered decorations
 	if (flags & MG_DECORATIONS)
@@ -642,6 +647,8 @@ void MapgenV6::makeChunk(BlockMakeData *data)
 
 void MapgenV6::calculateNoise()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	int x = node_min.X;
 	int z = node_min.Z;
 	int fx = full_node_min.X;
@@ -666,6 +673,8 @@ void MapgenV6::calculateNoise()
 
 int MapgenV6::generateGround()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	//TimeTaker timer1("Generating ground level");
 	MapNode n_air(CONTENT_AIR), n_water_source(c_water_source);
 	MapNode n_stone(c_stone), n_desert_stone(c_desert_stone);
@@ -1084,6 +1093,8 @@ void MapgenV6::growGrass() // Add surface nodes
 
 void MapgenV6::generateCaves(int max_stone_y)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_CAVES);
+
 	float cave_amount = NoisePerlin2D(np_cave, node_min.X, node_min.Y, seed);
 	int volume_nodes = (node_max.X - node_min.X + 1) *
 					   (node_max.Y - node_min.Y + 1) * MAP_BLOCKSIZE;
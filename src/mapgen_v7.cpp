@@ -445,9 +445,7 @@ void MapgenV7::floatBaseExtentFromMap(s16 *float_base_min, s16 *float_base_max,
 
 int MapgenV7::generateTerrain()
 {
-	MapNode n_air(CONTENT_AIR);
-	MapNode n_stone(c_stone);
-	MapNode n_water(c_water_source);
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
 
 	//// Calculate noise for terrain generation
 	noise_terrain_persist->perlinMap2D(node_min.X, node_min.Z);
@@ -458,7 +456,8 @@ int MapgenV7::generateTerrain()
 	noise_height_select->perlinMap2D(node_min.X, node_min.Z);
 
 	if ((spflags & MGV7_MOUNTAINS) || (spflags & MGV7_FLOATLANDS)) {
-		noise_mountain->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		noise_mountain->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z,
+			NULL, m_emerge->chunk_pool);
 	}
 
 	if (spflags & MGV7_MOUNTAINS) {
@@ -471,11 +470,21 @@ int MapgenV7::generateTerrain()
 	}
 
 	//// Place nodes
+	return generateTerrainSlabs();
+}
+
+
+s16 MapgenV7::generateTerrainSlab(s16 z_min, s16 z_max)
+{
+	MapNode n_air(CONTENT_AIR);
+	MapNode n_stone(c_stone);
+	MapNode n_water(c_water_source);
+
 	v3s16 em = vm->m_area.getExtent();
 	s16 stone_surface_max_y = -MAX_MAP_GENERATION_LIMIT;
-	u32 index2d = 0;
+	u32 index2d = (z_min - node_min.Z) * csize.X;
 
-	for (s16 z = node_min.Z; z <= node_max.Z; z++)
+	for (s16 z = z_min; z <= z_max; z++)
 	for (s16 x = node_min.X; x <= node_max.X; x++, index2d++) {
 		s16 surface_y = baseTerrainLevelFromMap(index2d);
 		if (surface_y > stone_surface_max_y)
@@ -504,7 +513,8 @@ int MapgenV7::generateTerrain()
 						((y >= float_base_min && y <= float_base_max) ||
 						getFloatlandMountainFromMap(index3d, index2d, y))) {
 					vm->m_data[vi] = n_stone;  // Floatland terrain
-					stone_surface_max_y = node_max.Y;
+					if (node_max.Y > stone_surface_max_y)
+						stone_surface_max_y = node_max.Y;
 				} else if (y <= water_level) {
 					vm->m_data[vi] = n_water;  // Ground level water
 				} else if ((spflags & MGV7_FLOATLANDS) &&
@@ -525,10 +535,13 @@ int MapgenV7::generateTerrain()
 
 void MapgenV7::generateRidgeTerrain()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	if ((node_max.Y < water_level - 16) || (node_max.Y > shadow_limit))
 		return;
 
-	noise_ridge->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+	noise_ridge->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z,
+		NULL, m_emerge->chunk_pool);
 	noise_ridge_uwater->perlinMap2D(node_min.X, node_min.Z);
 
 	MapNode n_water(c_water_source);
@@ -85,6 +85,7 @@ class MapgenV7 : public MapgenBasic {
 	void floatBaseExtentFromMap(s16 *float_base_min, s16 *float_base_max, int idx_xz);
 
 	int generateTerrain();
+	virtual s16 generateTerrainSlab(s16 z_min, s16 z_max);
 	void generateRidgeTerrain();
 
 private:
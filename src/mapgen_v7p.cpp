@@ -318,6 +318,8 @@ void MapgenV7P::generateBedrock()
 
 int MapgenV7P::generateTerrain()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	MapNode n_stone(c_stone);
 	MapNode n_bedrock(c_bedrock);
 	MapNode n_water(c_water_source);
@@ -375,6 +377,8 @@ int MapgenV7P::generateTerrain()
 
 void MapgenV7P::generateRidgeTerrain()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	if (node_max.Y < water_level - 16)
 		return;
 
@@ -413,6 +417,8 @@ void MapgenV7P::generateRidgeTerrain()
 
 void MapgenV7P::generateCaves(s16 max_stone_y, s16 large_cave_depth)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_CAVES);
+
 	if (max_stone_y < node_min.Y)
 		return;
 
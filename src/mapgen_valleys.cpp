@@ -288,6 +288,8 @@ void MapgenValleys::makeChunk(BlockMakeData *data)
 // calculation necessary to determine terrain height.
 void MapgenValleys::calculateNoise()
 {
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
 	//TimeTaker t("calculateNoise", NULL, PRECISION_MICRO);
 
 	int x = node_min.X;
@@ -302,7 +304,7 @@ void MapgenValleys::calculateNoise()
 	noise_valley_depth->perlinMap2D(x, z);
 	noise_valley_profile->perlinMap2D(x, z);
 
-	noise_inter_valley_fill->perlinMap3D(x, y, z);
+	noise_inter_valley_fill->perlinMap3D(x, y, z, NULL, m_emerge->chunk_pool);
 
 	//mapgen_profiler->avg("noisemaps", tcn.stop() / 1000.f);
 
@@ -468,6 +470,14 @@ float MapgenValleys::terrainLevelAtPoint(s16 x, s16 z)
 
 
 int MapgenValleys::generateTerrain()
+{
+	ScopeMapgenStage stage(this, MGSTAGE_TERRAIN);
+
+	return generateTerrainSlabs();
+}
+
+
+s16 MapgenValleys::generateTerrainSlab(s16 z_min, s16 z_max)
 {
 	// Raising this reduces the rate of evaporation.
 	static const float evaporation = 300.f;
@@ -485,9 +495,9 @@ int MapgenValleys::generateTerrain()
 
 	v3s16 em = vm->m_area.getExtent();
 	s16 surface_max_y = -MAX_MAP_GENERATION_LIMIT;
-	u32 index_2d = 0;
+	u32 index_2d = (z_min - node_min.Z) * csize.X;
 
-	for (s16 z = node_min.Z; z <= node_max.Z; z++)
+	for (s16 z = z_min; z <= z_max; z++)
 	for (s16 x = node_min.X; x <= node_max.X; x++, index_2d++) {
 		float river_y = noise_rivers->result[index_2d];
 		float surface_y = noise_terrain_height->result[index_2d];
@@ -593,11 +603,15 @@ int MapgenValleys::generateTerrain()
 
 void MapgenValleys::generateCaves(s16 max_stone_y, s16 large_cave_depth)
 {
+	ScopeMapgenStage stage(this, MGSTAGE_CAVES);
+
 	if (max_stone_y < node_min.Y)
 		return;
 
-	noise_cave1->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
-	noise_cave2->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+	noise_cave1->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z,
+		NULL, m_emerge->chunk_pool);
+	noise_cave2->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z,
+		NULL, m_emerge->chunk_pool);
 
 	PseudoRandom ps(blockseed + 72202);
 
@@ -619,7 +633,8 @@ void MapgenValleys::generateCaves(s16 max_stone_y, s16 large_cave_depth)
 
 	// Cache the tcave values as they only vary by altitude.
 	if (node_max.Y <= massive_cave_depth) {
-		noise_massive_caves->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z);
+		noise_massive_caves->perlinMap3D(node_min.X, node_min.Y - 1, node_min.Z,
+			NULL, m_emerge->chunk_pool);
 
 		for (s16 y = node_min.Y - 1; y <= node_max.Y; y++) {
 			float tcave = massive_cave_threshold;
@@ -128,6 +128,7 @@ class MapgenValleys : public MapgenBasic {
 	void calculateNoise();
 
 	virtual int generateTerrain();
+	virtual s16 generateTerrainSlab(s16 z_min, s16 z_max);
 	float terrainLevelFromNoise(TerrainNoise *tn);
 	float adjustedTerrainLevelFromNoise(TerrainNoise *tn);
 
@@ -41,7 +41,7 @@ CachedMapBlockData::~CachedMapBlockData()
 	assert(refcount_from_queue == 0);
 
 	if (data)
-		delete[] data;
+		data->drop();
 }
 
 /*
@@ -199,29 +199,20 @@ CachedMapBlockData* MeshUpdateQueue::cacheBlock(Map *map, v3s16 p, UpdateMode mo
 				(*cache_hit_counter)++;
 			return cached_block;
 		}
+		// Meshes being made may still share the old snapshot, so it is
+		// replaced rather than overwritten
 		MapBlock *b = map->getBlockNoCreateNoEx(p);
-		if (b) {
-			if (cached_block->data == NULL)
-				cached_block->data =
-						new MapNode[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
-			memcpy(cached_block->data, b->getData(),
-					MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE * sizeof(MapNode));
-		} else {
-			delete[] cached_block->data;
-			cached_block->data = NULL;
-		}
+		if (cached_block->data)
+			cached_block->data->drop();
+		cached_block->data = b ? new MapBlockSnapshot(b->getData()) : NULL;
 		return cached_block;
 	} else {
 		// Not yet in cache
 		CachedMapBlockData *cached_block = new CachedMapBlockData();
 		m_cache[p] = cached_block;
 		MapBlock *b = map->getBlockNoCreateNoEx(p);
-		if (b) {
-			cached_block->data =
-					new MapNode[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
-			memcpy(cached_block->data, b->getData(),
-					MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE * sizeof(MapNode));
-		}
+		if (b)
+			cached_block->data = new MapBlockSnapshot(b->getData());
 		return cached_block;
 	}
 }
@@ -245,7 +236,7 @@ void MeshUpdateQueue::fillDataFromMapBlockCache(QueuedMeshUpdate *q)
 
 	int t_now = time(0);
 
-	// Collect data for 3*3*3 blocks from cache
+	// Share the snapshots of 3*3*3 blocks from the cache
 	v3s16 dp;
 	for (dp.X = -1; dp.X <= 1; dp.X++)
 	for (dp.Y = -1; dp.Y <= 1; dp.Y++)
@@ -27,7 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 struct CachedMapBlockData
 {
 	v3s16 p;
-	MapNode *data; // A copy of the MapBlock's data member
+	MapBlockSnapshot *data; // A snapshot of the MapBlock's nodes
 	int refcount_from_queue;
 	int last_used_timestamp;
 
@@ -21,7 +21,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mg_biome.h"
 #include "mg_decoration.h"
 #include "emerge.h"
-#include "server.h"
 #include "nodedef.h"
 #include "map.h" //for MMVManip
 #include "util/numeric.h"
@@ -32,10 +31,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 ///////////////////////////////////////////////////////////////////////////////
 
 
-BiomeManager::BiomeManager(Server *server) :
-	ObjDefManager(server, OBJDEF_BIOME)
+BiomeManager::BiomeManager(IGameDef *gamedef, EmergeManager *emerge) :
+	ObjDefManager(gamedef, OBJDEF_BIOME)
 {
-	m_server = server;
+	m_emerge = emerge;
 
 	// Create default biome to be used in case none exist
 	Biome *b = new Biome;
@@ -72,10 +71,8 @@ BiomeManager::~BiomeManager()
 
 void BiomeManager::clear()
 {
-	EmergeManager *emerge = m_server->getEmergeManager();
-
 	// Remove all dangling references in Decorations
-	DecorationManager *decomgr = emerge->decomgr;
+	DecorationManager *decomgr = m_emerge->decomgr;
 	for (size_t i = 0; i != decomgr->getNumObjects(); i++) {
 		Decoration *deco = (Decoration *)decomgr->getRaw(i);
 		deco->biomes.clear();
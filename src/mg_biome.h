@@ -25,7 +25,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "noise.h"
 
-class Server;
+class EmergeManager;
+class IGameDef;
 class Settings;
 class BiomeManager;
 
@@ -188,7 +189,7 @@ class BiomeGenOriginal : public BiomeGen {
 
 class BiomeManager : public ObjDefManager {
 public:
-	BiomeManager(Server *server);
+	BiomeManager(IGameDef *gamedef, EmergeManager *emerge);
 	virtual ~BiomeManager();
 
 	const char *getObjectTitle() const
@@ -225,7 +226,7 @@ class BiomeManager : public ObjDefManager {
 	virtual void clear();
 
 private:
-	Server *m_server;
+	EmergeManager *m_emerge;
 
 };
 
@@ -36,19 +36,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 ///////////////////////////////////////////////////////////////////////////////
 
 
-SchematicManager::SchematicManager(Server *server) :
-	ObjDefManager(server, OBJDEF_SCHEMATIC)
+SchematicManager::SchematicManager(IGameDef *gamedef, EmergeManager *emerge) :
+	ObjDefManager(gamedef, OBJDEF_SCHEMATIC)
 {
-	m_server = server;
+	m_emerge = emerge;
 }
 
 
 void SchematicManager::clear()
 {
-	EmergeManager *emerge = m_server->getEmergeManager();
-
 	// Remove all dangling references in Decorations
-	DecorationManager *decomgr = emerge->decomgr;
+	DecorationManager *decomgr = m_emerge->decomgr;
 	for (size_t i = 0; i != decomgr->getNumObjects(); i++) {
 		Decoration *deco = (Decoration *)decomgr->getRaw(i);
 
@@ -308,7 +306,8 @@ bool Schematic::deserializeFromMts(std::istream *is,
 	delete []schemdata;
 	schemdata = new MapNode[nodecount];
 
-	MapNode::deSerializeBulk(ss, SER_FMT_VER_HIGHEST_READ, schemdata,
+	// Schematic files are always zlib compressed, like when writing them
+	MapNode::deSerializeBulk(ss, SER_FMT_VER_HIGHEST_WRITE, schemdata,
 		nodecount, 2, 2, true);
 
 	// Fix probability values for nodes that were ignore; removed in v2
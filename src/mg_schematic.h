@@ -31,7 +31,8 @@ class Mapgen;
 class MMVManip;
 class PseudoRandom;
 class NodeResolver;
-class Server;
+class EmergeManager;
+class IGameDef;
 
 /*
 	Minetest Schematic File Format
@@ -125,7 +126,7 @@ class Schematic : public ObjDef, public NodeResolver {
 
 class SchematicManager : public ObjDefManager {
 public:
-	SchematicManager(Server *server);
+	SchematicManager(IGameDef *gamedef, EmergeManager *emerge);
 	virtual ~SchematicManager() {}
 
 	virtual void clear();
@@ -141,7 +142,7 @@ class SchematicManager : public ObjDefManager {
 	}
 
 private:
-	Server *m_server;
+	EmergeManager *m_emerge;
 };
 
 void generate_nodelist_and_update_ids(MapNode *nodes, size_t nodecount,
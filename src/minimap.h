@@ -30,6 +30,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <vector>
 #include "camera.h"
 
+class MapBlockSnapshotView;
+
 #define MINIMAP_MAX_SX 256
 #define MINIMAP_MAX_SY 256
 
@@ -60,7 +62,7 @@ struct MinimapPixel {
 };
 
 struct MinimapMapblock {
-	void getMinimapNodes(VoxelManipulator *vmanip, v3s16 pos);
+	void getMinimapNodes(const MapBlockSnapshotView *nodes, v3s16 pos);
 
 	MinimapPixel data[MAP_BLOCKSIZE * MAP_BLOCKSIZE];
 };
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <iomanip>
 #include <errno.h>
+#include <cmath>
 #include "connection.h"
 #include "serialization.h"
 #include "log.h"
@@ -68,6 +69,18 @@ static inline float CALC_DTIME(u64 lasttime, u64 curtime)
  /* starting value for window size */
 #define MIN_RELIABLE_WINDOW_SIZE 0x40
 
+/* delivery rate based congestion control:
+ * window size = bandwidth estimate * minimum rtt * gain */
+#define CC_WINDOW_GAIN 2.0
+/* shortest time to take a delivery rate sample over */
+#define CC_MIN_SAMPLE_INTERVAL 0.05
+/* the minimum rtt is measured again after this many seconds */
+#define CC_MIN_RTT_EXPIRY 10.0
+/* time the window is kept at its minimum to drain queues for that */
+#define CC_PROBE_RTT_TIME 0.2
+/* sequence numbers in use may span this many windows */
+#define CC_SEQNUM_SPAN_FACTOR 4
+
 #define MAX_UDP_PEERS 65535
 
 #define PING_TIMEOUT 5.0
@@ -75,6 +88,9 @@ static inline float CALC_DTIME(u64 lasttime, u64 curtime)
 /* maximum number of retries for reliable packets */
 #define MAX_RELIABLE_RETRY 5
 
+/* capacity of the command queue to the send thread, callers wait if it is full */
+#define COMMAND_QUEUE_SIZE 8192
+
 static u16 readPeerId(u8 *packetdata)
 {
 	return readU16(&packetdata[4]);
@@ -437,6 +453,7 @@ std::list<BufferedPacket> ReliablePacketBuffer::getTimedOuts(float timeout,
 
 			//this packet will be sent right afterwards reset timeout here
 			i->time = 0.0;
+			i->resent = true;
 			if (timed_outs.size() >= max_packets)
 				break;
 		}
@@ -579,6 +596,7 @@ void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 
 Channel::Channel() :
 		window_size(MIN_RELIABLE_WINDOW_SIZE),
+		congestion_control(CONGESTION_CONTROL_LEGACY),
 		next_incoming_seqnum(SEQNUM_INITIAL),
 		next_outgoing_seqnum(SEQNUM_INITIAL),
 		next_outgoing_split_seqnum(SEQNUM_INITIAL),
@@ -599,8 +617,18 @@ Channel::Channel() :
 		cur_kbps_lost(0.0),
 		avg_kbps_lost(0.0),
 		bpm_counter(0.0),
-		rate_samples(0)
+		rate_samples(0),
+		packets_delivered(0),
+		delivery_sample_time(0.0),
+		window_limited(false),
+		delivery_rate_index(0),
+		min_rtt(-1.0),
+		min_rtt_age(0.0),
+		min_rtt_expired(false),
+		probe_rtt_time(0.0)
 {
+	for (unsigned int i = 0; i < CC_DELIVERY_RATE_SAMPLES; i++)
+		delivery_rates[i] = 0.0;
 }
 
 Channel::~Channel()
@@ -638,6 +666,13 @@ u16 Channel::getOutgoingSequenceNumber(bool& successful)
 	u16 retval = next_outgoing_seqnum;
 	u16 lowest_unacked_seqnumber;
 
+	/* with delivery rate based congestion control the window only limits the
+	 * packets on the wire, lost ones don't stop sending until resent */
+	int max_span = window_size;
+	if (congestion_control == CONGESTION_CONTROL_BBR)
+		max_span = MYMIN(window_size * CC_SEQNUM_SPAN_FACTOR,
+				MAX_RELIABLE_WINDOW_SIZE);
+
 	/* shortcut if there ain't any packet in outgoing list */
 	if (outgoing_reliables_sent.empty())
 	{
@@ -651,7 +686,8 @@ u16 Channel::getOutgoingSequenceNumber(bool& successful)
 			// ugly cast but this one is required in order to tell compiler we
 			// know about difference of two unsigned may be negative in general
 			// but we already made sure it won't happen in this case
-			if (((u16)(next_outgoing_seqnum - lowest_unacked_seqnumber)) > window_size) {
+			if (((u16)(next_outgoing_seqnum - lowest_unacked_seqnumber)) > max_span) {
+				window_limited = true;
 				successful = false;
 				return 0;
 			}
@@ -661,7 +697,8 @@ u16 Channel::getOutgoingSequenceNumber(bool& successful)
 			// know about difference of two unsigned may be negative in general
 			// but we already made sure it won't happen in this case
 			if ((next_outgoing_seqnum + (u16)(SEQNUM_MAX - lowest_unacked_seqnumber)) >
-				window_size) {
+				max_span) {
+				window_limited = true;
 				successful = false;
 				return 0;
 			}
@@ -693,6 +730,7 @@ void Channel::UpdateBytesSent(unsigned int bytes, unsigned int packets)
 	MutexAutoLock internal(m_internal_mutex);
 	current_bytes_transfered += bytes;
 	current_packet_successfull += packets;
+	packets_delivered += packets;
 }
 
 void Channel::UpdateBytesReceived(unsigned int bytes) {
@@ -719,11 +757,90 @@ void Channel::UpdatePacketTooLateCounter()
 	current_packet_too_late++;
 }
 
+void Channel::UpdateWindowLimited()
+{
+	MutexAutoLock internal(m_internal_mutex);
+	window_limited = true;
+}
+
+void Channel::UpdateRTT(float rtt)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	if ((min_rtt < 0.0) || (rtt < min_rtt) || min_rtt_expired) {
+		min_rtt = rtt;
+		min_rtt_age = 0.0;
+		min_rtt_expired = false;
+	}
+}
+
+void Channel::UpdateDeliveryRate(float dtime)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	delivery_sample_time += dtime;
+	min_rtt_age += dtime;
+
+	/* a queue built up by ourselves hides the real minimum rtt, so empty it
+	 * from time to time while measuring again */
+	if (probe_rtt_time > 0.0) {
+		probe_rtt_time -= dtime;
+		window_size = MIN_RELIABLE_WINDOW_SIZE;
+		if (probe_rtt_time <= 0.0) {
+			packets_delivered = 0;
+			delivery_sample_time = 0.0;
+			window_limited = false;
+		}
+		return;
+	}
+
+	if ((min_rtt >= 0.0) && (min_rtt_age > CC_MIN_RTT_EXPIRY)) {
+		min_rtt_age = 0.0;
+		min_rtt_expired = true;
+		probe_rtt_time = CC_PROBE_RTT_TIME;
+		window_size = MIN_RELIABLE_WINDOW_SIZE;
+		return;
+	}
+
+	if (delivery_sample_time < MYMAX(min_rtt, CC_MIN_SAMPLE_INTERVAL))
+		return;
+
+	float rate = packets_delivered / delivery_sample_time;
+	float max_rate = 0.0;
+	for (unsigned int i = 0; i < CC_DELIVERY_RATE_SAMPLES; i++)
+		max_rate = MYMAX(max_rate, delivery_rates[i]);
+
+	/* with a window that wasn't used up the sample only tells how much
+	 * there was to send, keep it only if it raises the estimate */
+	if (window_limited || (rate > max_rate)) {
+		delivery_rates[delivery_rate_index] = rate;
+		delivery_rate_index = (delivery_rate_index + 1) % CC_DELIVERY_RATE_SAMPLES;
+
+		max_rate = 0.0;
+		for (unsigned int i = 0; i < CC_DELIVERY_RATE_SAMPLES; i++)
+			max_rate = MYMAX(max_rate, delivery_rates[i]);
+	}
+
+	packets_delivered = 0;
+	delivery_sample_time = 0.0;
+	window_limited = false;
+
+	if (min_rtt < 0.0)
+		return;
+
+	/* random packet loss doesn't shrink the window, only a lower
+	 * delivery rate does */
+	float window = max_rate * min_rtt * CC_WINDOW_GAIN;
+	window_size = MYMIN(MYMAX(window, MIN_RELIABLE_WINDOW_SIZE),
+			MAX_RELIABLE_WINDOW_SIZE);
+}
+
 void Channel::UpdateTimers(float dtime,bool legacy_peer)
 {
 	bpm_counter += dtime;
 	packet_loss_counter += dtime;
 
+	if (congestion_control == CONGESTION_CONTROL_BBR)
+		UpdateDeliveryRate(dtime);
+
 	if (packet_loss_counter > 1.0)
 	{
 		packet_loss_counter -= 1.0;
@@ -751,7 +868,7 @@ void Channel::UpdateTimers(float dtime,bool legacy_peer)
 
 #if !(defined(__ANDROID__) && defined(__aarch64__))
 		/* dynamic window size is only available for non legacy peers */
-		if (!legacy_peer) {
+		if (!legacy_peer && (congestion_control == CONGESTION_CONTROL_LEGACY)) {
 			float successfull_to_lost_ratio = 0.0;
 			bool done = false;
 
@@ -1019,8 +1136,14 @@ UDPPeer::UDPPeer(u16 a_id, Address a_address, Connection* connection) :
 	Peer(a_address,a_id,connection),
 	m_pending_disconnect(false),
 	resend_timeout(0.5),
+	m_smoothed_rtt(-1.0),
+	m_rtt_variation(0.0),
 	m_legacy_peer(true)
 {
+	if (g_settings->get("congestion_control") == "bbr")
+		m_congestion_control = CONGESTION_CONTROL_BBR;
+	else
+		m_congestion_control = CONGESTION_CONTROL_LEGACY;
 }
 
 bool UDPPeer::getAddress(MTProtocols type,Address& toset)
@@ -1041,6 +1164,7 @@ void UDPPeer::setNonLegacyPeer()
 	for(unsigned int i=0; i< CHANNEL_COUNT; i++)
 	{
 		channels->setWindowSize(g_settings->getU16("max_packets_per_iteration"));
+		channels[i].setCongestionControl(m_congestion_control);
 	}
 #endif
 }
@@ -1052,7 +1176,20 @@ void UDPPeer::reportRTT(float rtt)
 	}
 	RTTStatistics(rtt,"rudp",MAX_RELIABLE_WINDOW_SIZE*10);
 
-	float timeout = getStat(AVG_RTT) * RESEND_TIMEOUT_FACTOR;
+	float timeout;
+	if (m_congestion_control == CONGESTION_CONTROL_BBR) {
+		if (m_smoothed_rtt < 0.0) {
+			m_smoothed_rtt = rtt;
+			m_rtt_variation = rtt / 2;
+		} else {
+			m_rtt_variation = 0.75 * m_rtt_variation +
+					0.25 * fabs(m_smoothed_rtt - rtt);
+			m_smoothed_rtt = 0.875 * m_smoothed_rtt + 0.125 * rtt;
+		}
+		timeout = m_smoothed_rtt + 4 * m_rtt_variation;
+	} else {
+		timeout = getStat(AVG_RTT) * RESEND_TIMEOUT_FACTOR;
+	}
 	if (timeout < RESEND_TIMEOUT_MIN)
 		timeout = RESEND_TIMEOUT_MIN;
 	if (timeout > RESEND_TIMEOUT_MAX)
@@ -1209,10 +1346,15 @@ void UDPPeer::RunCommandQueues(
 							unsigned int maxtransfer)
 {
 
+	/* with delivery rate based congestion control the window limits how
+	 * much is sent, so take as many commands as fit into it */
+	if (!m_legacy_peer && (m_congestion_control == CONGESTION_CONTROL_BBR))
+		maxcommands = MAX_RELIABLE_WINDOW_SIZE;
+
 	for (unsigned int i = 0; i < CHANNEL_COUNT; i++) {
 		unsigned int commands_processed = 0;
 
-		if ((channels[i].queued_commands.size() > 0) &&
+		while ((channels[i].queued_commands.size() > 0) &&
 				(channels[i].queued_reliables.size() < maxtransfer) &&
 				(commands_processed < maxcommands)) {
 			try {
@@ -1224,15 +1366,17 @@ void UDPPeer::RunCommandQueues(
 				// Packet is processed, remove it from queue
 				if (processReliableSendCommand(c,max_packet_size)) {
 					channels[i].queued_commands.pop_front();
+					commands_processed++;
 				} else {
 					LOG(dout_con << m_connection->getDesc()
 							<< " Failed to queue packets for peer_id: " << c.peer_id
 							<< ", delaying sending of " << c.data.getSize()
 							<< " bytes" << std::endl);
+					break;
 				}
 			}
 			catch (ItemNotFoundException &e) {
-				// intentionally empty
+				break;
 			}
 		}
 	}
@@ -1309,15 +1453,14 @@ void * ConnectionSendThread::run()
 		runTimeouts(dtime);
 
 		/* translate commands to packets */
-		ConnectionCommand c = m_connection->m_command_queue.pop_frontNoEx(0);
-		while(c.type != CONNCMD_NONE)
-				{
-			if (c.reliable)
-				processReliableCommand(c);
+		ConnectionCommand *c;
+		while (m_connection->popCommand(&c)) {
+			if (c->reliable)
+				processReliableCommand(*c);
 			else
-				processNonReliableCommand(c);
+				processNonReliableCommand(*c);
 
-			c = m_connection->m_command_queue.pop_frontNoEx(0);
+			delete c;
 		}
 
 		/* send non reliable packets */
@@ -1907,12 +2050,11 @@ void ConnectionSendThread::sendPackets(float dtime)
 		}
 		peer->m_increment_packets_remaining = m_iteration_packets_avaialble/m_connection->m_peers.size();
 
-		if (dynamic_cast<UDPPeer*>(&peer) == 0)
-		{
+		UDPPeer *udp_peer = dynamic_cast<UDPPeer*>(&peer);
+		if (udp_peer == NULL)
 			continue;
-		}
 
-		if (dynamic_cast<UDPPeer*>(&peer)->m_pending_disconnect)
+		if (udp_peer->m_pending_disconnect)
 		{
 			pendingDisconnect.push_back(*j);
 		}
@@ -1928,39 +2070,39 @@ void ConnectionSendThread::sendPackets(float dtime)
 		for (unsigned int i=0; i < CHANNEL_COUNT; i++)
 		{
 			u16 next_to_ack = 0;
-			dynamic_cast<UDPPeer*>(&peer)->channels[i].outgoing_reliables_sent.getFirstSeqnum(next_to_ack);
+			udp_peer->channels[i].outgoing_reliables_sent.getFirstSeqnum(next_to_ack);
 			u16 next_to_receive = 0;
-			dynamic_cast<UDPPeer*>(&peer)->channels[i].incoming_reliables.getFirstSeqnum(next_to_receive);
+			udp_peer->channels[i].incoming_reliables.getFirstSeqnum(next_to_receive);
 
 			LOG(dout_con<<m_connection->getDesc()<< "\t channel: "
 						<< i << ", peer quota:"
 						<< peer->m_increment_packets_remaining
 						<< std::endl
 					<< "\t\t\treliables on wire: "
-						<< dynamic_cast<UDPPeer*>(&peer)->channels[i].outgoing_reliables_sent.size()
+						<< udp_peer->channels[i].outgoing_reliables_sent.size()
 						<< ", waiting for ack for " << next_to_ack
 						<< std::endl
 					<< "\t\t\tincoming_reliables: "
-						<< dynamic_cast<UDPPeer*>(&peer)->channels[i].incoming_reliables.size()
+						<< udp_peer->channels[i].incoming_reliables.size()
 						<< ", next reliable packet: "
-						<< dynamic_cast<UDPPeer*>(&peer)->channels[i].readNextIncomingSeqNum()
+						<< udp_peer->channels[i].readNextIncomingSeqNum()
 						<< ", next queued: " << next_to_receive
 						<< std::endl
 					<< "\t\t\treliables queued : "
-						<< dynamic_cast<UDPPeer*>(&peer)->channels[i].queued_reliables.size()
+						<< udp_peer->channels[i].queued_reliables.size()
 						<< std::endl
 					<< "\t\t\tqueued commands  : "
-						<< dynamic_cast<UDPPeer*>(&peer)->channels[i].queued_commands.size()
+						<< udp_peer->channels[i].queued_commands.size()
 						<< std::endl);
 
-			while ((dynamic_cast<UDPPeer*>(&peer)->channels[i].queued_reliables.size() > 0) &&
-					(dynamic_cast<UDPPeer*>(&peer)->channels[i].outgoing_reliables_sent.size()
-							< dynamic_cast<UDPPeer*>(&peer)->channels[i].getWindowSize())&&
+			while ((udp_peer->channels[i].queued_reliables.size() > 0) &&
+					(udp_peer->channels[i].outgoing_reliables_sent.size()
+							< udp_peer->channels[i].getWindowSize())&&
 							(peer->m_increment_packets_remaining > 0))
 			{
-				BufferedPacket p = dynamic_cast<UDPPeer*>(&peer)->channels[i].queued_reliables.front();
-				dynamic_cast<UDPPeer*>(&peer)->channels[i].queued_reliables.pop();
-				Channel* channel = &(dynamic_cast<UDPPeer*>(&peer)->channels[i]);
+				BufferedPacket p = udp_peer->channels[i].queued_reliables.front();
+				udp_peer->channels[i].queued_reliables.pop();
+				Channel* channel = &(udp_peer->channels[i]);
 				LOG(dout_con<<m_connection->getDesc()
 						<<" INFO: sending a queued reliable packet "
 						<<" channel: " << i
@@ -1969,6 +2111,11 @@ void ConnectionSendThread::sendPackets(float dtime)
 				sendAsPacketReliable(p,channel);
 				peer->m_increment_packets_remaining--;
 			}
+
+			if ((udp_peer->channels[i].queued_reliables.size() > 0) &&
+					(udp_peer->channels[i].outgoing_reliables_sent.size()
+							>= udp_peer->channels[i].getWindowSize()))
+				udp_peer->channels[i].UpdateWindowLimited();
 		}
 	}
 
@@ -2398,7 +2545,7 @@ SharedBuffer<u8> ConnectionReceiveThread::processPacket(Channel *channel,
 						channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
 				// only calculate rtt from straight sent packets
-				if (p.resend_count == 0) {
+				if ((p.resend_count == 0) && !p.resent) {
 					// Get round trip time
 					u64 current_time = porting::getTimeMs();
 
@@ -2411,6 +2558,7 @@ SharedBuffer<u8> ConnectionReceiveThread::processPacket(Channel *channel,
 						// Let peer calculate stuff according to it
 						// (avg_rtt and resend_timeout)
 						dynamic_cast<UDPPeer*>(&peer)->reportRTT(rtt);
+						channel->UpdateRTT(rtt);
 					}
 					else if (p.totaltime > 0)
 					{
@@ -2419,6 +2567,7 @@ SharedBuffer<u8> ConnectionReceiveThread::processPacket(Channel *channel,
 						// Let peer calculate stuff according to it
 						// (avg_rtt and resend_timeout)
 						dynamic_cast<UDPPeer*>(&peer)->reportRTT(rtt);
+						channel->UpdateRTT(rtt);
 					}
 				}
 				//put bytes for max bandwidth calculation
@@ -2685,7 +2834,6 @@ SharedBuffer<u8> ConnectionReceiveThread::processPacket(Channel *channel,
 Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
 		bool ipv6, PeerHandler *peerhandler) :
 	m_udpSocket(ipv6),
-	m_command_queue(),
 	m_event_queue(),
 	m_peer_id(0),
 	m_protocol_id(protocol_id),
@@ -2695,6 +2843,8 @@ Connection::Connection(u32 protocol_id, u32 max_packet_size, float timeout,
 	m_bc_peerhandler(peerhandler),
 	m_bc_receive_timeout(0),
 	m_shutting_down(false),
+	m_command_queue(COMMAND_QUEUE_SIZE),
+	m_command_overflowed(false),
 	m_next_remote_peer_id(2)
 
 {
@@ -2725,6 +2875,11 @@ Connection::~Connection()
 	m_sendThread.wait();
 	m_receiveThread.wait();
 
+	// Drop commands that were not sent anymore
+	ConnectionCommand *c;
+	while (popCommand(&c))
+		delete c;
+
 	// Delete peers
 	for(std::map<u16, Peer*>::iterator
 			j = m_peers.begin();
@@ -2849,10 +3004,45 @@ ConnectionEvent Connection::waitEvent(u32 timeout_ms)
 
 void Connection::putCommand(ConnectionCommand &c)
 {
-	if (!m_shutting_down) {
-		m_command_queue.push_back(c);
-		m_sendThread.Trigger();
+	if (m_shutting_down)
+		return;
+
+	// Take over the data buffer instead of copying it
+	ConnectionCommand *cmd = new ConnectionCommand();
+	Buffer<u8> data;
+	data.swap(c.data);
+	*cmd = c;
+	cmd->data.swap(data);
+
+	// Nothing waits for the send thread, which may have stopped already.
+	// While older commands are in the overflow list, newer ones must go
+	// there too to stay behind them.
+	if (m_command_overflowed || !m_command_queue.push(cmd)) {
+		PROFILE(g_profiler->add("Connection: command queue overflows (num)", 1));
+		MutexAutoLock lock(m_command_overflow_mutex);
+		m_command_overflow.push_back(cmd);
+		m_command_overflowed = true;
 	}
+	m_sendThread.Trigger();
+}
+
+bool Connection::popCommand(ConnectionCommand **c)
+{
+	// Commands in the queue are older than those in the overflow list
+	// from the same thread
+	if (m_command_queue.pop(c))
+		return true;
+	if (!m_command_overflowed)
+		return false;
+
+	MutexAutoLock lock(m_command_overflow_mutex);
+	if (m_command_overflow.empty())
+		return false;
+	*c = m_command_overflow.front();
+	m_command_overflow.pop_front();
+	if (m_command_overflow.empty())
+		m_command_overflowed = false;
+	return true;
 }
 
 void Connection::Serve(Address bind_addr)
@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include <iostream>
 #include <fstream>
+#include <deque>
 #include <list>
 #include <map>
 
@@ -166,11 +167,11 @@ struct BufferedPacket
 {
 	BufferedPacket(u8 *a_data, u32 a_size):
 		data(a_data, a_size), time(0.0), totaltime(0.0), absolute_send_time(-1),
-		resend_count(0)
+		resend_count(0), resent(false)
 	{}
 	BufferedPacket(u32 a_size):
 		data(a_size), time(0.0), totaltime(0.0), absolute_send_time(-1),
-		resend_count(0)
+		resend_count(0), resent(false)
 	{}
 	Buffer<u8> data; // Data of the packet, including headers
 	float time; // Seconds from buffering the packet or re-sending
@@ -178,6 +179,9 @@ struct BufferedPacket
 	u64 absolute_send_time;
 	Address address; // Sender or destination
 	unsigned int resend_count;
+	// Set on the buffered packet when it is sent again; its send time
+	// then no longer gives the round trip time
+	bool resent;
 };
 
 // This adds the base headers to the data and makes a packet out of it
@@ -444,7 +448,8 @@ struct ConnectionCommand
 		type = CONNCMD_SEND;
 		peer_id = peer_id_;
 		channelnum = channelnum_;
-		data = pkt->oldForgePacket();
+		Buffer<u8> forged = pkt->oldForgePacket();
+		data.swap(forged);
 		reliable = reliable_;
 	}
 
@@ -478,6 +483,17 @@ struct ConnectionCommand
 	}
 };
 
+/* the bandwidth estimate is the highest of this many delivery rate samples */
+#define CC_DELIVERY_RATE_SAMPLES 10
+
+enum CongestionControl
+{
+	/* grow or shrink the window in steps by the packet loss of the last second */
+	CONGESTION_CONTROL_LEGACY,
+	/* size the window from the measured delivery rate and minimum rtt */
+	CONGESTION_CONTROL_BBR
+};
+
 class Channel
 {
 
@@ -516,6 +532,9 @@ class Channel
 	void UpdateBytesLost(unsigned int bytes);
 	void UpdateBytesReceived(unsigned int bytes);
 
+	void UpdateWindowLimited();
+	void UpdateRTT(float rtt);
+
 	void UpdateTimers(float dtime, bool legacy_peer);
 
 	const float getCurrentDownloadRateKB()
@@ -543,9 +562,14 @@ class Channel
 	const unsigned int getWindowSize() const { return window_size; };
 
 	void setWindowSize(unsigned int size) { window_size = size; };
+
+	void setCongestionControl(CongestionControl cc) { congestion_control = cc; };
 private:
+	void UpdateDeliveryRate(float dtime);
+
 	Mutex m_internal_mutex;
 	int window_size;
+	CongestionControl congestion_control;
 
 	u16 next_incoming_seqnum;
 
@@ -572,6 +596,17 @@ class Channel
 	float bpm_counter;
 
 	unsigned int rate_samples;
+
+	/* state of the delivery rate based congestion control */
+	unsigned int packets_delivered;
+	float delivery_sample_time;
+	bool window_limited;
+	float delivery_rates[CC_DELIVERY_RATE_SAMPLES];
+	unsigned int delivery_rate_index;
+	float min_rtt;
+	float min_rtt_age;
+	bool min_rtt_expired;
+	float probe_rtt_time;
 };
 
 class Peer;
@@ -827,6 +862,11 @@ class UDPPeer : public Peer
 	// This is changed dynamically
 	float resend_timeout;
 
+	CongestionControl m_congestion_control;
+	// Smoothed rtt and rtt variation for the resend timeout (RFC 6298)
+	float m_smoothed_rtt;
+	float m_rtt_variation;
+
 	bool processReliableSendCommand(
 					ConnectionCommand &c,
 					unsigned int max_packet_size);
@@ -1048,7 +1088,9 @@ class Connection
 	}
 
 	UDPSocket m_udpSocket;
-	MutexedQueue<ConnectionCommand> m_command_queue;
+	// Takes the next command for the send thread, in the order each
+	// thread put them
+	bool popCommand(ConnectionCommand **c);
 
 	void putEvent(ConnectionEvent &e);
 
@@ -1077,6 +1119,14 @@ class Connection
 
 	bool m_shutting_down;
 
+	// Commands are owned by the queues until the send thread pops them.
+	// Once the bounded queue has been full, commands go to the overflow
+	// list until the send thread has emptied it.
+	BoundedMPSCQueue<ConnectionCommand *> m_command_queue;
+	Mutex m_command_overflow_mutex;
+	std::deque<ConnectionCommand *> m_command_overflow;
+	Atomic<bool> m_command_overflowed;
+
 	u16 m_next_remote_peer_id;
 };
 
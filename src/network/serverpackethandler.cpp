@@ -100,7 +100,7 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	*pkt >> client_max >> supp_compr_modes >> min_net_proto_version
 			>> max_net_proto_version >> playerName;
 
-	u8 our_max = SER_FMT_VER_HIGHEST_READ;
+	u8 our_max = m_max_ser_ver;
 	// Use the highest version supported by both
 	u8 depl_serial_v = std::min(client_max, our_max);
 	// If it's lower than the lowest supported, give up.
@@ -344,7 +344,7 @@ void Server::handleCommand_Init_Legacy(NetworkPacket* pkt)
 
 	*pkt >> client_max;
 
-	u8 our_max = SER_FMT_VER_HIGHEST_READ;
+	u8 our_max = m_max_ser_ver;
 	// Use the highest version supported by both
 	int deployed = std::min(client_max, our_max);
 	// If it's lower than the lowest supported, give up.
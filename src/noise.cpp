@@ -30,8 +30,20 @@
 #include "debug.h"
 #include "util/numeric.h"
 #include "util/string.h"
+#include "util/thread.h"
 #include "exceptions.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+	#define NOISE_SIMD_X86_SSE2
+	#include <emmintrin.h>
+	#if defined(__GNUC__)
+		// AVX2 code is compiled per function and only run if supported
+		#define NOISE_SIMD_X86_AVX2
+		#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+		#include <immintrin.h>
+	#endif
+#endif
+
 #define NOISE_MAGIC_X    1619
 #define NOISE_MAGIC_Y    31337
 #define NOISE_MAGIC_Z    52591
@@ -167,23 +179,27 @@ s32 PcgRandom::randNormalDist(s32 min, s32 max, int num_trials)
 
 ///////////////////////////////////////////////////////////////////////////////
 
-float noise2d(int x, int y, s32 seed)
+// Lattice point value from the sum of the magic number products
+static inline float noiseHash(unsigned int n)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
+	n &= 0x7fffffff;
 	n = (n >> 13) ^ n;
 	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
 	return 1.f - (float)(int)n / 0x40000000;
 }
 
 
+float noise2d(int x, int y, s32 seed)
+{
+	return noiseHash(NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y
+			+ NOISE_MAGIC_SEED * seed);
+}
+
+
 float noise3d(int x, int y, int z, s32 seed)
 {
-	unsigned int n = (NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
-			+ NOISE_MAGIC_SEED * seed) & 0x7fffffff;
-	n = (n >> 13) ^ n;
-	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
-	return 1.f - (float)(int)n / 0x40000000;
+	return noiseHash(NOISE_MAGIC_X * x + NOISE_MAGIC_Y * y + NOISE_MAGIC_Z * z
+			+ NOISE_MAGIC_SEED * seed);
 }
 
 
@@ -427,6 +443,432 @@ float NoisePerlin3D(NoiseParams *np, float x, float y, float z, s32 seed)
 }
 
 
+///////////////////////// [ Noise map kernels ] ////////////////////////////
+
+/*
+	The inner loops of the noise maps, so that they can be vectorized.
+	Every lane does exactly the same float operations in the same order
+	as the scalar code, which keeps the results bit-exact.
+*/
+struct NoiseKernels {
+	// out[i] = value of the lattice point with hash input n0 + i * NOISE_MAGIC_X
+	void (*noiseRow)(float *out, u32 n0, size_t count);
+	// out[i] = interpolation between row[index[i]] and row[index[i] + 1]
+	void (*lerpGather)(float *out, const float *row, const u32 *index,
+		const float *t, size_t count);
+	// out[i] = interpolation between a[i] and b[i]
+	void (*lerpRows)(float *out, const float *a, const float *b, float t,
+		size_t count);
+	// Octave accumulation, see Noise::updateResults
+	void (*accumulate)(float *result, const float *gradient, float g,
+		bool absvalue, size_t count);
+	void (*accumulatePersist)(float *result, float *gmap,
+		const float *gradient, const float *persistence_map,
+		bool absvalue, size_t count);
+	void (*scaleOffset)(float *result, float scale, float offset, size_t count);
+};
+
+static void noiseRow_generic(float *out, u32 n0, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		out[i] = noiseHash(n0 + NOISE_MAGIC_X * (u32)i);
+}
+
+static void lerpGather_generic(float *out, const float *row, const u32 *index,
+	const float *t, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		out[i] = linearInterpolation(row[index[i]], row[index[i] + 1], t[i]);
+}
+
+static void lerpRows_generic(float *out, const float *a, const float *b,
+	float t, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+static void accumulate_generic(float *result, const float *gradient, float g,
+	bool absvalue, size_t count)
+{
+	if (absvalue) {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * fabs(gradient[i]);
+	} else {
+		for (size_t i = 0; i != count; i++)
+			result[i] += g * gradient[i];
+	}
+}
+
+static void accumulatePersist_generic(float *result, float *gmap,
+	const float *gradient, const float *persistence_map,
+	bool absvalue, size_t count)
+{
+	for (size_t i = 0; i != count; i++) {
+		result[i] += gmap[i] * (absvalue ? fabs(gradient[i]) : gradient[i]);
+		gmap[i] *= persistence_map[i];
+	}
+}
+
+static void scaleOffset_generic(float *result, float scale, float offset,
+	size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		result[i] = result[i] * scale + offset;
+}
+
+static const NoiseKernels noise_kernels_generic = {
+	noiseRow_generic,
+	lerpGather_generic,
+	lerpRows_generic,
+	accumulate_generic,
+	accumulatePersist_generic,
+	scaleOffset_generic,
+};
+
+#ifdef NOISE_SIMD_X86_SSE2
+
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	// SSE2 has no 32 bit multiplication, multiply even and odd lanes
+	// to 64 bits and put the low halves back together
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128 noiseHash_sse2(__m128i n)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	n = _mm_and_si128(n, mask);
+	n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+	__m128i m = mullo_epi32_sse2(mullo_epi32_sse2(n, n), _mm_set1_epi32(60493));
+	m = _mm_add_epi32(m, _mm_set1_epi32(19990303));
+	m = _mm_add_epi32(mullo_epi32_sse2(n, m), _mm_set1_epi32(1376312589));
+	n = _mm_and_si128(m, mask);
+	return _mm_sub_ps(_mm_set1_ps(1.f),
+		_mm_div_ps(_mm_cvtepi32_ps(n), _mm_set1_ps((float)0x40000000)));
+}
+
+static void noiseRow_sse2(float *out, u32 n0, size_t count)
+{
+	__m128i n = _mm_add_epi32(_mm_set1_epi32(n0), _mm_set_epi32(
+		3 * NOISE_MAGIC_X, 2 * NOISE_MAGIC_X, NOISE_MAGIC_X, 0));
+	const __m128i step = _mm_set1_epi32(4 * NOISE_MAGIC_X);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(&out[i], noiseHash_sse2(n));
+		n = _mm_add_epi32(n, step);
+	}
+	for (; i != count; i++)
+		out[i] = noiseHash(n0 + NOISE_MAGIC_X * (u32)i);
+}
+
+static void lerpGather_sse2(float *out, const float *row, const u32 *index,
+	const float *t, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 v0 = _mm_set_ps(row[index[i + 3]], row[index[i + 2]],
+			row[index[i + 1]], row[index[i]]);
+		__m128 v1 = _mm_set_ps(row[index[i + 3] + 1], row[index[i + 2] + 1],
+			row[index[i + 1] + 1], row[index[i] + 1]);
+		_mm_storeu_ps(&out[i], _mm_add_ps(v0,
+			_mm_mul_ps(_mm_sub_ps(v1, v0), _mm_loadu_ps(&t[i]))));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(row[index[i]], row[index[i] + 1], t[i]);
+}
+
+static void lerpRows_sse2(float *out, const float *a, const float *b, float t,
+	size_t count)
+{
+	const __m128 tv = _mm_set1_ps(t);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 v0 = _mm_loadu_ps(&a[i]);
+		__m128 v1 = _mm_loadu_ps(&b[i]);
+		_mm_storeu_ps(&out[i], _mm_add_ps(v0,
+			_mm_mul_ps(_mm_sub_ps(v1, v0), tv)));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+static void accumulate_sse2(float *result, const float *gradient, float g,
+	bool absvalue, size_t count)
+{
+	// Clearing the sign bit is what fabs() does
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(
+		absvalue ? 0x7fffffff : -1));
+	const __m128 gv = _mm_set1_ps(g);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_and_ps(_mm_loadu_ps(&gradient[i]), absmask);
+		_mm_storeu_ps(&result[i],
+			_mm_add_ps(_mm_loadu_ps(&result[i]), _mm_mul_ps(gv, v)));
+	}
+	for (; i != count; i++)
+		result[i] += g * (absvalue ? fabs(gradient[i]) : gradient[i]);
+}
+
+static void accumulatePersist_sse2(float *result, float *gmap,
+	const float *gradient, const float *persistence_map,
+	bool absvalue, size_t count)
+{
+	const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(
+		absvalue ? 0x7fffffff : -1));
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 gv = _mm_loadu_ps(&gmap[i]);
+		__m128 v = _mm_and_ps(_mm_loadu_ps(&gradient[i]), absmask);
+		_mm_storeu_ps(&result[i],
+			_mm_add_ps(_mm_loadu_ps(&result[i]), _mm_mul_ps(gv, v)));
+		_mm_storeu_ps(&gmap[i],
+			_mm_mul_ps(gv, _mm_loadu_ps(&persistence_map[i])));
+	}
+	for (; i != count; i++) {
+		result[i] += gmap[i] * (absvalue ? fabs(gradient[i]) : gradient[i]);
+		gmap[i] *= persistence_map[i];
+	}
+}
+
+static void scaleOffset_sse2(float *result, float scale, float offset,
+	size_t count)
+{
+	const __m128 sv = _mm_set1_ps(scale);
+	const __m128 ov = _mm_set1_ps(offset);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(&result[i],
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&result[i]), sv), ov));
+	}
+	for (; i != count; i++)
+		result[i] = result[i] * scale + offset;
+}
+
+static const NoiseKernels noise_kernels_sse2 = {
+	noiseRow_sse2,
+	lerpGather_sse2,
+	lerpRows_sse2,
+	accumulate_sse2,
+	accumulatePersist_sse2,
+	scaleOffset_sse2,
+};
+
+#endif // NOISE_SIMD_X86_SSE2
+
+#ifdef NOISE_SIMD_X86_AVX2
+
+NOISE_TARGET_AVX2 static inline __m256 noiseHash_avx2(__m256i n)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	n = _mm256_and_si256(n, mask);
+	n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+	__m256i m = _mm256_mullo_epi32(_mm256_mullo_epi32(n, n),
+		_mm256_set1_epi32(60493));
+	m = _mm256_add_epi32(m, _mm256_set1_epi32(19990303));
+	m = _mm256_add_epi32(_mm256_mullo_epi32(n, m),
+		_mm256_set1_epi32(1376312589));
+	n = _mm256_and_si256(m, mask);
+	return _mm256_sub_ps(_mm256_set1_ps(1.f),
+		_mm256_div_ps(_mm256_cvtepi32_ps(n), _mm256_set1_ps((float)0x40000000)));
+}
+
+NOISE_TARGET_AVX2 static void noiseRow_avx2(float *out, u32 n0, size_t count)
+{
+	__m256i n = _mm256_add_epi32(_mm256_set1_epi32(n0), _mm256_set_epi32(
+		7 * NOISE_MAGIC_X, 6 * NOISE_MAGIC_X, 5 * NOISE_MAGIC_X, 4 * NOISE_MAGIC_X,
+		3 * NOISE_MAGIC_X, 2 * NOISE_MAGIC_X, NOISE_MAGIC_X, 0));
+	const __m256i step = _mm256_set1_epi32(8 * NOISE_MAGIC_X);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(&out[i], noiseHash_avx2(n));
+		n = _mm256_add_epi32(n, step);
+	}
+	for (; i != count; i++)
+		out[i] = noiseHash(n0 + NOISE_MAGIC_X * (u32)i);
+}
+
+NOISE_TARGET_AVX2 static void lerpGather_avx2(float *out, const float *row,
+	const u32 *index, const float *t, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i iv = _mm256_loadu_si256((const __m256i *)&index[i]);
+		__m256 v0 = _mm256_i32gather_ps(row, iv, 4);
+		__m256 v1 = _mm256_i32gather_ps(row + 1, iv, 4);
+		_mm256_storeu_ps(&out[i], _mm256_add_ps(v0,
+			_mm256_mul_ps(_mm256_sub_ps(v1, v0), _mm256_loadu_ps(&t[i]))));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(row[index[i]], row[index[i] + 1], t[i]);
+}
+
+NOISE_TARGET_AVX2 static void lerpRows_avx2(float *out, const float *a,
+	const float *b, float t, size_t count)
+{
+	const __m256 tv = _mm256_set1_ps(t);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 v0 = _mm256_loadu_ps(&a[i]);
+		__m256 v1 = _mm256_loadu_ps(&b[i]);
+		_mm256_storeu_ps(&out[i], _mm256_add_ps(v0,
+			_mm256_mul_ps(_mm256_sub_ps(v1, v0), tv)));
+	}
+	for (; i != count; i++)
+		out[i] = linearInterpolation(a[i], b[i], t);
+}
+
+NOISE_TARGET_AVX2 static void accumulate_avx2(float *result,
+	const float *gradient, float g, bool absvalue, size_t count)
+{
+	const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(
+		absvalue ? 0x7fffffff : -1));
+	const __m256 gv = _mm256_set1_ps(g);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 v = _mm256_and_ps(_mm256_loadu_ps(&gradient[i]), absmask);
+		_mm256_storeu_ps(&result[i],
+			_mm256_add_ps(_mm256_loadu_ps(&result[i]), _mm256_mul_ps(gv, v)));
+	}
+	for (; i != count; i++)
+		result[i] += g * (absvalue ? fabs(gradient[i]) : gradient[i]);
+}
+
+NOISE_TARGET_AVX2 static void accumulatePersist_avx2(float *result,
+	float *gmap, const float *gradient, const float *persistence_map,
+	bool absvalue, size_t count)
+{
+	const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(
+		absvalue ? 0x7fffffff : -1));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 gv = _mm256_loadu_ps(&gmap[i]);
+		__m256 v = _mm256_and_ps(_mm256_loadu_ps(&gradient[i]), absmask);
+		_mm256_storeu_ps(&result[i],
+			_mm256_add_ps(_mm256_loadu_ps(&result[i]), _mm256_mul_ps(gv, v)));
+		_mm256_storeu_ps(&gmap[i],
+			_mm256_mul_ps(gv, _mm256_loadu_ps(&persistence_map[i])));
+	}
+	for (; i != count; i++) {
+		result[i] += gmap[i] * (absvalue ? fabs(gradient[i]) : gradient[i]);
+		gmap[i] *= persistence_map[i];
+	}
+}
+
+NOISE_TARGET_AVX2 static void scaleOffset_avx2(float *result, float scale,
+	float offset, size_t count)
+{
+	const __m256 sv = _mm256_set1_ps(scale);
+	const __m256 ov = _mm256_set1_ps(offset);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(&result[i],
+			_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&result[i]), sv), ov));
+	}
+	for (; i != count; i++)
+		result[i] = result[i] * scale + offset;
+}
+
+static const NoiseKernels noise_kernels_avx2 = {
+	noiseRow_avx2,
+	lerpGather_avx2,
+	lerpRows_avx2,
+	accumulate_avx2,
+	accumulatePersist_avx2,
+	scaleOffset_avx2,
+};
+
+#endif // NOISE_SIMD_X86_AVX2
+
+static const NoiseKernels *getNoiseKernels(NoiseSimdLevel level)
+{
+	switch (level) {
+	case NOISE_SIMD_GENERIC:
+		return &noise_kernels_generic;
+#ifdef NOISE_SIMD_X86_SSE2
+	case NOISE_SIMD_SSE2:
+		return &noise_kernels_sse2;
+#endif
+#ifdef NOISE_SIMD_X86_AVX2
+	case NOISE_SIMD_AVX2:
+		return &noise_kernels_avx2;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+
+NoiseSimdLevel getNoiseSimdSupport()
+{
+#ifdef NOISE_SIMD_X86_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+#endif
+#ifdef NOISE_SIMD_X86_SSE2
+	return NOISE_SIMD_SSE2;
+#else
+	return NOISE_SIMD_GENERIC;
+#endif
+}
+
+// Chosen during static initialization, before any thread uses noise, and
+// constant afterwards. Noise created by other static initializers may see
+// them still zero, which selects the scalar implementation.
+static const NoiseSimdLevel g_noise_simd_level = getNoiseSimdSupport();
+static const NoiseKernels *const g_noise_kernels =
+	getNoiseKernels(g_noise_simd_level);
+
+
+NoiseSimdLevel getNoiseSimdLevel()
+{
+	return g_noise_simd_level;
+}
+
+
+// Lattice cells and interpolation factors along one axis, stepping
+// exactly like the scalar gradient maps do
+static void latticeSteps(u32 *index, float *frac, float t, float step,
+	u32 count, bool eased)
+{
+	u32 cell = 0;
+	for (u32 i = 0; i != count; i++) {
+		index[i] = cell;
+		frac[i] = eased ? easeCurve(t) : t;
+
+		t += step;
+		if (t >= 1.0) {
+			t -= 1.0;
+			cell++;
+		}
+	}
+}
+
+
+// Interpolates a plane of lattice points along x, then along y
+static void interpolateLatticePlane(const NoiseKernels *kernels,
+	float *out, float *row_buf, const float *lattice, u32 nlx, u32 nly,
+	const u32 *index_x, const float *frac_x, u32 sx,
+	const u32 *index_y, const float *frac_y, u32 sy)
+{
+	for (u32 j = 0; j != nly; j++) {
+		kernels->lerpGather(&row_buf[j * sx], &lattice[j * nlx],
+			index_x, frac_x, sx);
+	}
+
+	for (u32 j = 0; j != sy; j++) {
+		kernels->lerpRows(&out[j * sx],
+			&row_buf[index_y[j] * sx], &row_buf[(index_y[j] + 1) * sx],
+			frac_y[j], sx);
+	}
+}
+
+
 Noise::Noise(NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 {
 	memcpy(&np, np_, sizeof(np));
@@ -435,9 +877,11 @@ Noise::Noise(NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 	this->sy   = sy;
 	this->sz   = sz;
 
-	this->persist_buf  = NULL;
-	this->gradient_buf = NULL;
-	this->result       = NULL;
+	this->persist_buf   = NULL;
+	this->gradient_buf  = NULL;
+	this->result        = NULL;
+
+	this->kernels = g_noise_kernels;
 
 	allocBuffers();
 }
@@ -449,6 +893,7 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	freeSlabs();
 }
 
 
@@ -497,6 +942,16 @@ void Noise::setSpreadFactor(v3f spread)
 }
 
 
+bool Noise::setSimdLevel(NoiseSimdLevel level)
+{
+	if (level > getNoiseSimdSupport())
+		return false;
+
+	kernels = getNoiseKernels(level);
+	return true;
+}
+
+
 void Noise::setOctaves(int octaves)
 {
 	this->np.octaves = octaves;
@@ -536,6 +991,44 @@ void Noise::resizeNoiseBuf(bool is3d)
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
+
+	slab_lattice_size = nlx * nly;
+	slab_rows_size = nly * sx;
+	allocSlabs(MYMAX(slabs.size(), 1));
+}
+
+
+void Noise::allocSlabs(u32 count)
+{
+	freeSlabs();
+
+	size_t nsteps = sx + sy + sz;
+	size_t nplane = sx * sy;
+	try {
+		for (u32 i = 0; i != count; i++) {
+			SlabBuffers buf;
+			buf.index     = new u32[nsteps];
+			buf.frac      = new float[nsteps + slab_lattice_size +
+				slab_rows_size + 2 * nplane];
+			buf.lattice   = buf.frac + nsteps;
+			buf.rows      = buf.lattice + slab_lattice_size;
+			buf.planes[0] = buf.rows + slab_rows_size;
+			buf.planes[1] = buf.planes[0] + nplane;
+			slabs.push_back(buf);
+		}
+	} catch (std::bad_alloc &e) {
+		throw InvalidNoiseParamsException();
+	}
+}
+
+
+void Noise::freeSlabs()
+{
+	for (size_t i = 0; i != slabs.size(); i++) {
+		delete[] slabs[i].index;
+		delete[] slabs[i].frac;
+	}
+	slabs.clear();
 }
 
 
@@ -561,6 +1054,11 @@ void Noise::gradientMap2D(
 	u32 nlx, nly;
 	s32 x0, y0;
 
+	if (kernels) {
+		gradientMap2DSimd(x, y, step_x, step_y, seed);
+		return;
+	}
+
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
 	Interp2dFxn interpolate = eased ?
 		biLinearInterpolation : biLinearInterpolationNoEase;
@@ -627,6 +1125,12 @@ void Noise::gradientMap3D(
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
+	if (kernels) {
+		gradientMap3DSimd(x, y, z, step_x, step_y, step_z, seed,
+			0, sz, slabs[0]);
+		return;
+	}
+
 	Interp3dFxn interpolate = (np.flags & NOISE_FLAG_EASED) ?
 		triLinearInterpolation : triLinearInterpolationNoEase;
 
@@ -706,6 +1210,134 @@ void Noise::gradientMap3D(
 #undef idx
 
 
+/*
+ * Same as the gradient maps above, but the lattice values of a whole row
+ * are interpolated along x once and reused for every map row between
+ * two lattice rows, and so on for y and z. This leaves long runs of the
+ * same operations on consecutive values for the vectorized kernels.
+ */
+void Noise::gradientMap2DSimd(
+		float x, float y,
+		float step_x, float step_y,
+		s32 seed)
+{
+	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
+
+	s32 x0 = floor(x);
+	s32 y0 = floor(y);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
+
+	//calculate noise point lattice
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+	for (u32 j = 0; j != nly; j++) {
+		kernels->noiseRow(&noise_buf[j * nlx],
+			NOISE_MAGIC_X * (u32)x0 + NOISE_MAGIC_Y * (u32)(y0 + j)
+			+ NOISE_MAGIC_SEED * (u32)seed, nlx);
+	}
+
+	//calculate interpolations
+	SlabBuffers &buf = slabs[0];
+	u32 *index_x = buf.index;
+	u32 *index_y = buf.index + sx;
+	float *frac_x = buf.frac;
+	float *frac_y = buf.frac + sx;
+	latticeSteps(index_x, frac_x, u, step_x, sx, eased);
+	latticeSteps(index_y, frac_y, v, step_y, sy, eased);
+
+	interpolateLatticePlane(kernels, gradient_buf, buf.rows, noise_buf,
+		nlx, nly, index_x, frac_x, sx, index_y, frac_y, sy);
+}
+
+
+// Computes map layers k_begin to k_end only, and only the lattice
+// planes needed for them
+void Noise::gradientMap3DSimd(
+		float x, float y, float z,
+		float step_x, float step_y, float step_z,
+		s32 seed, u32 k_begin, u32 k_end, SlabBuffers &buf)
+{
+	bool eased = np.flags & NOISE_FLAG_EASED;
+
+	s32 x0 = floor(x);
+	s32 y0 = floor(y);
+	s32 z0 = floor(z);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
+	float w = z - (float)z0;
+
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+
+	u32 *index_x = buf.index;
+	u32 *index_y = buf.index + sx;
+	u32 *index_z = buf.index + sx + sy;
+	float *frac_x = buf.frac;
+	float *frac_y = buf.frac + sx;
+	float *frac_z = buf.frac + sx + sy;
+	latticeSteps(index_x, frac_x, u, step_x, sx, eased);
+	latticeSteps(index_y, frac_y, v, step_y, sy, eased);
+	latticeSteps(index_z, frac_z, w, step_z, k_end, eased);
+
+	// Only the two lattice planes around the current map layer are kept
+	float *planes[2] = { buf.planes[0], buf.planes[1] };
+	u32 plane_z[2] = { U32_MAX, U32_MAX };
+
+	for (u32 k = k_begin; k != k_end; k++) {
+		for (u32 p = 0; p != 2; p++) {
+			u32 lz = index_z[k] + p;
+			if (plane_z[p] == lz)
+				continue;
+
+			if (p == 0 && plane_z[1] == lz) {
+				float *swap = planes[0];
+				planes[0] = planes[1];
+				planes[1] = swap;
+				plane_z[1] = plane_z[0];
+				plane_z[0] = lz;
+				continue;
+			}
+
+			//calculate noise point lattice plane
+			for (u32 j = 0; j != nly; j++) {
+				kernels->noiseRow(&buf.lattice[j * nlx],
+					NOISE_MAGIC_X * (u32)x0 + NOISE_MAGIC_Y * (u32)(y0 + j)
+					+ NOISE_MAGIC_Z * (u32)(z0 + lz)
+					+ NOISE_MAGIC_SEED * (u32)seed, nlx);
+			}
+
+			interpolateLatticePlane(kernels, planes[p], buf.rows, buf.lattice,
+				nlx, nly, index_x, frac_x, sx, index_y, frac_y, sy);
+			plane_z[p] = lz;
+		}
+
+		kernels->lerpRows(&gradient_buf[k * sx * sy],
+			planes[0], planes[1], frac_z[k], sx * sy);
+	}
+}
+
+
+class NoiseSlabBatch : public WorkerPool::Batch {
+public:
+	NoiseSlabBatch(Noise *noise, float x, float y, float z, u32 count) :
+		noise(noise), x(x), y(y), z(z), count(count)
+	{}
+
+	void runItem(u32 i)
+	{
+		u32 sz = noise->sz;
+		noise->perlinMap3DSlab(x, y, z, sz * i / count, sz * (i + 1) / count,
+			noise->slabs[i]);
+	}
+
+private:
+	Noise *noise;
+	float x, y, z;
+	u32 count;
+};
+
+
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 {
 	float f = 1.0, g = 1.0;
@@ -735,15 +1367,20 @@ float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 	}
 
 	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001) {
-		for (size_t i = 0; i != bufsize; i++)
-			result[i] = result[i] * np.scale + np.offset;
+		if (kernels) {
+			kernels->scaleOffset(result, np.scale, np.offset, bufsize);
+		} else {
+			for (size_t i = 0; i != bufsize; i++)
+				result[i] = result[i] * np.scale + np.offset;
+		}
 	}
 
 	return result;
 }
 
 
-float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
+float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map,
+	WorkerPool *pool)
 {
 	float f = 1.0, g = 1.0;
 	size_t bufsize = sx * sy * sz;
@@ -752,6 +1389,21 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 	y /= np.spread.Y;
 	z /= np.spread.Z;
 
+	// The vectorized implementations compute every map layer on its own,
+	// so slabs of layers can go through all octaves independently
+	if (kernels && !persistence_map && sz > 1) {
+		u32 count = pool ? MYMIN(pool->getThreadCount(), sz) : 1;
+		if (slabs.size() < count)
+			allocSlabs(count);
+
+		NoiseSlabBatch batch(this, x, y, z, count);
+		if (count > 1)
+			pool->run(&batch, count);
+		else
+			batch.runItem(0);
+		return result;
+	}
+
 	memset(result, 0, sizeof(float) * bufsize);
 
 	if (persistence_map) {
@@ -773,17 +1425,61 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 	}
 
 	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001) {
-		for (size_t i = 0; i != bufsize; i++)
-			result[i] = result[i] * np.scale + np.offset;
+		if (kernels) {
+			kernels->scaleOffset(result, np.scale, np.offset, bufsize);
+		} else {
+			for (size_t i = 0; i != bufsize; i++)
+				result[i] = result[i] * np.scale + np.offset;
+		}
 	}
 
 	return result;
 }
 
 
+void Noise::perlinMap3DSlab(float x, float y, float z,
+	u32 k_begin, u32 k_end, SlabBuffers &buf)
+{
+	float f = 1.0, g = 1.0;
+	size_t layer = sx * sy;
+	size_t count = (k_end - k_begin) * layer;
+	float *out = &result[k_begin * layer];
+	float *gradient = &gradient_buf[k_begin * layer];
+	bool absvalue = np.flags & NOISE_FLAG_ABSVALUE;
+
+	memset(out, 0, sizeof(float) * count);
+
+	for (size_t oct = 0; oct < np.octaves; oct++) {
+		gradientMap3DSimd(x * f, y * f, z * f,
+			f / np.spread.X, f / np.spread.Y, f / np.spread.Z,
+			seed + np.seed + oct, k_begin, k_end, buf);
+
+		kernels->accumulate(out, gradient, g, absvalue, count);
+
+		f *= np.lacunarity;
+		g *= np.persist;
+	}
+
+	if (fabs(np.offset - 0.f) > 0.00001 || fabs(np.scale - 1.f) > 0.00001)
+		kernels->scaleOffset(out, np.scale, np.offset, count);
+}
+
+
 void Noise::updateResults(float g, float *gmap,
 	float *persistence_map, size_t bufsize)
 {
+	if (kernels) {
+		bool absvalue = np.flags & NOISE_FLAG_ABSVALUE;
+		if (persistence_map) {
+			kernels->accumulatePersist(result, gmap, gradient_buf,
+				persistence_map, absvalue, bufsize);
+		} else {
+			kernels->accumulate(result, gradient_buf, g,
+				absvalue, bufsize);
+		}
+		return;
+	}
+
 	// This looks very ugly, but it is 50-70% faster than having
 	// conditional statements inside the loop
 	if (np.flags & NOISE_FLAG_ABSVALUE) {
@@ -29,6 +29,9 @@
 #include "irr_v3d.h"
 #include "exceptions.h"
 #include "util/string.h"
+#include <vector>
+
+class WorkerPool;
 
 extern FlagDesc flagdesc_noiseparams[];
 
@@ -145,6 +148,26 @@ struct NoiseParams {
 //#define getNoiseParams(x, y) getStruct((x), NOISEPARAMS_FMT_STR, &(y), sizeof(y))
 //#define setNoiseParams(x, y) setStruct((x), NOISEPARAMS_FMT_STR, &(y))
 
+/*
+	Implementations of the noise map loops, in order of preference.
+	The vectorized ones give bit-exact the same results as the scalar one.
+*/
+enum NoiseSimdLevel {
+	NOISE_SIMD_NONE,
+	// Same structure as the vectorized implementations in plain C++
+	NOISE_SIMD_GENERIC,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+// Returns the best implementation the CPU supports
+NoiseSimdLevel getNoiseSimdSupport();
+// The implementation new noise objects use. It is chosen once at startup
+// and never changes.
+NoiseSimdLevel getNoiseSimdLevel();
+
+struct NoiseKernels;
+
 class Noise {
 public:
 	NoiseParams np;
@@ -163,6 +186,9 @@ class Noise {
 	void setSize(u32 sx, u32 sy, u32 sz=1);
 	void setSpreadFactor(v3f spread);
 	void setOctaves(int octaves);
+	// Selects the implementation of this noise's maps, returns false if it
+	// isn't supported. Meant for tests and benchmarks.
+	bool setSimdLevel(NoiseSimdLevel level);
 
 	void gradientMap2D(
 		float x, float y,
@@ -174,7 +200,10 @@ class Noise {
 		s32 seed);
 
 	float *perlinMap2D(float x, float y, float *persistence_map=NULL);
-	float *perlinMap3D(float x, float y, float z, float *persistence_map=NULL);
+	// With a pool, slabs of map layers are computed on its threads. The
+	// result does not depend on the number of threads.
+	float *perlinMap3D(float x, float y, float z, float *persistence_map=NULL,
+		WorkerPool *pool=NULL);
 
 	inline float *perlinMap2D_PO(float x, float xoff, float y, float yoff,
 		float *persistence_map=NULL)
@@ -186,20 +215,55 @@ class Noise {
 	}
 
 	inline float *perlinMap3D_PO(float x, float xoff, float y, float yoff,
-		float z, float zoff, float *persistence_map=NULL)
+		float z, float zoff, float *persistence_map=NULL,
+		WorkerPool *pool=NULL)
 	{
 		return perlinMap3D(
 			x + xoff * np.spread.X,
 			y + yoff * np.spread.Y,
 			z + zoff * np.spread.Z,
-			persistence_map);
+			persistence_map, pool);
 	}
 
 private:
+	friend class NoiseSlabBatch;
+
+	// Scratch buffers of the vectorized implementations, one set for
+	// every slab of map layers computed at the same time
+	struct SlabBuffers {
+		// Lattice cell and interpolation factor of every column, row
+		// and layer of the map
+		u32 *index;
+		float *frac;
+		// A plane of lattice points, the lattice rows interpolated
+		// along x and two lattice planes interpolated along x and y
+		float *lattice;
+		float *rows;
+		float *planes[2];
+	};
+	std::vector<SlabBuffers> slabs;
+	size_t slab_lattice_size;
+	size_t slab_rows_size;
+	// NULL selects the scalar implementation
+	const NoiseKernels *kernels;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	void allocSlabs(u32 count);
+	void freeSlabs();
 	void updateResults(float g, float *gmap, float *persistence_map, size_t bufsize);
 
+	void gradientMap2DSimd(
+		float x, float y,
+		float step_x, float step_y,
+		s32 seed);
+	void gradientMap3DSimd(
+		float x, float y, float z,
+		float step_x, float step_y, float step_z,
+		s32 seed, u32 k_begin, u32 k_end, SlabBuffers &buf);
+	void perlinMap3DSlab(float x, float y, float z,
+		u32 k_begin, u32 k_end, SlabBuffers &buf);
+
 };
 
 float NoisePerlin2D(NoiseParams *np, float x, float y, s32 seed);
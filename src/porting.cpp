@@ -33,10 +33,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	#include <wincrypt.h>
 	#include <algorithm>
 	#include <shlwapi.h>
+	#include <psapi.h>
 #endif
 #if !defined(_WIN32)
 	#include <unistd.h>
 	#include <sys/utsname.h>
+	#include <sys/resource.h>
 #endif
 #if defined(__hpux)
 	#define _PSTAT64
@@ -925,6 +927,33 @@ bool secure_rand_fill_buf(void *buf, size_t len)
 
 #endif
 
+#ifdef _WIN32
+
+u64 getPeakMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize;
+}
+
+#else
+
+u64 getPeakMemoryUsage()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	// Kilobytes everywhere else
+	return (u64)usage.ru_maxrss * 1024;
+#endif
+}
+
+#endif
+
 void attachOrCreateConsole(void)
 {
 #ifdef _WIN32
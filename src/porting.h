@@ -351,6 +351,9 @@ void setWin32ExceptionHandler();
 
 bool secure_rand_fill_buf(void *buf, size_t len);
 
+// Largest resident set size of the process so far in bytes, 0 if unknown
+u64 getPeakMemoryUsage();
+
 // This attaches to the parents process console, or creates a new one if it doesnt exist.
 void attachOrCreateConsole(void);
 } // namespace porting
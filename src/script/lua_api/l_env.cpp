@@ -238,6 +238,120 @@ int ModApiEnvMod::l_get_node_or_nil(lua_State *L)
 	return 1;
 }
 
+// get_nodes(positions)
+// positions = {{x=num, y=num, z=num}, ...}
+int ModApiEnvMod::l_get_nodes(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	Map &map = env->getMap();
+	u32 count = lua_objlen(L, 1);
+
+	lua_createtable(L, count, 0);
+	int content_ids = lua_gettop(L);
+	lua_createtable(L, count, 0);
+	int param2s = lua_gettop(L);
+
+	// Neighbouring positions are mostly in the same block
+	v3s16 last_blockpos;
+	MapBlock *block = NULL;
+	for (u32 i = 0; i != count; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		v3s16 pos = read_v3s16(L, -1);
+		lua_pop(L, 1);
+
+		v3s16 blockpos = getNodeBlockPos(pos);
+		if (i == 0 || blockpos != last_blockpos) {
+			block = map.getBlockNoCreateNoEx(blockpos);
+			last_blockpos = blockpos;
+		}
+
+		MapNode n(CONTENT_IGNORE);
+		if (block != NULL && !block->isDummy()) {
+			bool is_valid_position;
+			n = block->getNodeNoCheck(pos - blockpos * MAP_BLOCKSIZE,
+				&is_valid_position);
+		}
+
+		lua_pushinteger(L, n.getContent());
+		lua_rawseti(L, content_ids, i + 1);
+		lua_pushinteger(L, n.getParam2());
+		lua_rawseti(L, param2s, i + 1);
+	}
+	return 2;
+}
+
+// set_nodes(positions, content_ids, param2s)
+// positions = {{x=num, y=num, z=num}, ...}
+// content_ids = {num, ...}
+// param2s = {num, ...} or nil
+// A position listed more than once is only set to its last node
+int ModApiEnvMod::l_set_nodes(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	INodeDefManager *ndef = env->getGameDef()->ndef();
+	const ContentFeatures *unknown = &ndef->get(CONTENT_UNKNOWN);
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	bool has_param2s = lua_istable(L, 3);
+	u32 count = lua_objlen(L, 1);
+	if (lua_objlen(L, 2) != count ||
+			(has_param2s && lua_objlen(L, 3) != count))
+		return luaL_error(L, "set_nodes(): the lists differ in length");
+
+	// Everything is checked before the first node is set, and before
+	// anything that Lua errors would have to unwind
+	for (u32 i = 0; i != count; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		luaL_checktype(L, -1, LUA_TTABLE);
+		lua_rawgeti(L, 2, i + 1);
+		lua_Integer id = luaL_checkinteger(L, -1);
+		content_t c = id;
+		if (id != c || c == CONTENT_IGNORE || &ndef->get(c) == unknown ||
+				ndef->get(c).name.empty()) {
+			return luaL_error(L, "set_nodes(): content ID %d is not a "
+				"registered node", (int)id);
+		}
+		if (has_param2s) {
+			lua_rawgeti(L, 3, i + 1);
+			luaL_checkinteger(L, -1);
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 2);
+	}
+
+	std::vector<std::pair<v3s16, MapNode> > nodes;
+	std::map<v3s16, u32> node_indices;
+	nodes.reserve(count);
+	for (u32 i = 0; i != count; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		v3s16 pos = check_v3s16(L, -1);
+		lua_rawgeti(L, 2, i + 1);
+		MapNode n(lua_tointeger(L, -1));
+		if (has_param2s) {
+			lua_rawgeti(L, 3, i + 1);
+			n.param2 = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 2);
+
+		// Otherwise the callbacks of the node there would run twice
+		std::map<v3s16, u32>::iterator it = node_indices.find(pos);
+		if (it != node_indices.end()) {
+			nodes[it->second].second = n;
+			continue;
+		}
+		node_indices[pos] = nodes.size();
+		nodes.push_back(std::make_pair(pos, n));
+	}
+
+	lua_pushinteger(L, env->setNodes(nodes));
+	return 1;
+}
+
 // get_node_light(pos, timeofday)
 // pos = {x=num, y=num, z=num}
 // timeofday: nil = current time, 0 = night, 0.5 = day
@@ -1117,6 +1231,8 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(remove_node);
 	API_FCT(get_node);
 	API_FCT(get_node_or_nil);
+	API_FCT(get_nodes);
+	API_FCT(set_nodes);
 	API_FCT(get_node_light);
 	API_FCT(place_node);
 	API_FCT(dig_node);
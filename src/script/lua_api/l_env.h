@@ -47,6 +47,16 @@ class ModApiEnvMod : public ModApiBase {
 	// pos = {x=num, y=num, z=num}
 	static int l_get_node_or_nil(lua_State *L);
 
+	// get_nodes(positions)
+	// positions = {{x=num, y=num, z=num}, ...}
+	static int l_get_nodes(lua_State *L);
+
+	// set_nodes(positions, content_ids, param2s)
+	// positions = {{x=num, y=num, z=num}, ...}
+	// content_ids = {num, ...}
+	// param2s = {num, ...} or nil
+	static int l_set_nodes(lua_State *L);
+
 	// get_node_light(pos, timeofday)
 	// pos = {x=num, y=num, z=num}
 	// timeofday: nil = current time, 0 = night, 0.5 = day
@@ -857,6 +857,30 @@ int ModApiMapgen::l_get_gen_notify(lua_State *L)
 }
 
 
+// get_mapgen_stats()
+int ModApiMapgen::l_get_mapgen_stats(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	std::vector<MapgenStats> stats;
+	if (!getServer(L)->getEmergeManager()->getMapgenStats(&stats))
+		return 0;
+
+	lua_createtable(L, stats.size(), 0);
+	for (size_t i = 0; i != stats.size(); i++) {
+		lua_newtable(L);
+		lua_pushnumber(L, stats[i].chunks);
+		lua_setfield(L, -2, "chunks");
+		for (int j = 0; j != NUM_MGSTAGES; j++) {
+			lua_pushnumber(L, stats[i].stage_us[j] / 1000.0);
+			lua_setfield(L, -2, mapgen_stage_names[j]);
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+
 // register_biome({lots of stuff})
 int ModApiMapgen::l_register_biome(lua_State *L)
 {
@@ -1512,6 +1536,7 @@ void ModApiMapgen::Initialize(lua_State *L, int top)
 	API_FCT(get_noiseparams);
 	API_FCT(set_gen_notify);
 	API_FCT(get_gen_notify);
+	API_FCT(get_mapgen_stats);
 
 	API_FCT(register_biome);
 	API_FCT(register_decoration);
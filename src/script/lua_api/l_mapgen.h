@@ -65,6 +65,9 @@ class ModApiMapgen : public ModApiBase
 	// set_gen_notify(flagstring)
 	static int l_get_gen_notify(lua_State *L);
 
+	// get_mapgen_stats()
+	static int l_get_mapgen_stats(lua_State *L);
+
 	// register_biome({lots of stuff})
 	static int l_register_biome(lua_State *L);
 
@@ -24,6 +24,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	#define ZLIB_WINAPI
 #endif
 #include "zlib.h"
+#if USE_ZSTD
+	#include <zstd.h>
+#endif
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -186,11 +189,99 @@ void decompressZlib(std::istream &is, std::ostream &os)
 	inflateEnd(&z);
 }
 
-void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
+#if USE_ZSTD
+void compressZstd(SharedBuffer<u8> data, std::ostream &os, int level)
+{
+	// Level 0 is the library default in zstd
+	if (level < 0)
+		level = 0;
+	else if (level > ZSTD_maxCLevel())
+		level = ZSTD_maxCLevel();
+
+	size_t bound = ZSTD_compressBound(data.getSize());
+	SharedBuffer<u8> output_buffer(bound);
+	size_t ret = ZSTD_compress(*output_buffer, bound,
+		*data, data.getSize(), level);
+	if (ZSTD_isError(ret)) {
+		dstream << "compressZstd: " << ZSTD_getErrorName(ret) << std::endl;
+		throw SerializationError("compressZstd: compression failed");
+	}
+	os.write((char*)*output_buffer, ret);
+}
+
+void compressZstd(const std::string &data, std::ostream &os, int level)
 {
+	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
+	compressZstd(databuf, os, level);
+}
+
+void decompressZstd(std::istream &is, std::ostream &os)
+{
+	const s32 bufsize = 16384;
+	char input_buffer[bufsize];
+	char output_buffer[bufsize];
+
+	ZSTD_DStream *stream = ZSTD_createDStream();
+	if (stream == NULL)
+		throw SerializationError("decompressZstd: ZSTD_createDStream failed");
+	ZSTD_initDStream(stream);
+
+	ZSTD_inBuffer input = { input_buffer, 0, 0 };
+	for (;;) {
+		if (input.pos == input.size) {
+			is.read(input_buffer, bufsize);
+			input.size = is.gcount();
+			input.pos = 0;
+		}
+
+		ZSTD_outBuffer output = { output_buffer, bufsize, 0 };
+		size_t ret = ZSTD_decompressStream(stream, &output, &input);
+		if (ZSTD_isError(ret)) {
+			dstream << "decompressZstd: " << ZSTD_getErrorName(ret) << std::endl;
+			ZSTD_freeDStream(stream);
+			throw SerializationError("decompressZstd: decompression failed");
+		}
+		if (output.pos)
+			os.write(output_buffer, output.pos);
+
+		// The frame is complete and flushed
+		if (ret == 0)
+			break;
+
+		if (input.size == 0 && output.pos == 0) {
+			ZSTD_freeDStream(stream);
+			throw SerializationError("decompressZstd: stream ended halfway");
+		}
+	}
+
+	ZSTD_freeDStream(stream);
+
+	// Unget all the data that zstd didn't take
+	is.clear(); // Just in case EOF is set
+	for (u32 i = 0; i < input.size - input.pos; i++) {
+		is.unget();
+		if (is.fail() || is.bad())
+			throw SerializationError("decompressZstd: unget failed");
+	}
+}
+#endif
+
+void compress(SharedBuffer<u8> data, std::ostream &os, u8 version, int level)
+{
+	if (version >= SER_FMT_VER_ZSTD) {
+#if USE_ZSTD
+		compressZstd(data, os, level);
+		return;
+#else
+		throw SerializationError("compress: built without zstd support");
+#endif
+	}
+
 	if(version >= 11)
 	{
-		compressZlib(data, os);
+		// Levels above 9 are only meaningful to zstd
+		compressZlib(data, os, level > Z_BEST_COMPRESSION ?
+			Z_BEST_COMPRESSION : level);
 		return;
 	}
 
@@ -229,8 +320,23 @@ void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
 	os.write((char*)&current_byte, 1);
 }
 
+void compress(const std::string &data, std::ostream &os, u8 version, int level)
+{
+	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
+	compress(databuf, os, version, level);
+}
+
 void decompress(std::istream &is, std::ostream &os, u8 version)
 {
+	if (version >= SER_FMT_VER_ZSTD) {
+#if USE_ZSTD
+		decompressZstd(is, os);
+		return;
+#else
+		throw SerializationError("decompress: built without zstd support");
+#endif
+	}
+
 	if(version >= 11)
 	{
 		decompressZlib(is, os);
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define SERIALIZATION_HEADER
 
 #include "irrlichttypes.h"
+#include "config.h"
 #include "exceptions.h"
 #include <iostream>
 #include "util/pointer.h"
@@ -64,12 +65,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	26: Never written; read the same as 25
 	27: Added light spreading flags to blocks
 	28: Added "private" flag to NodeMetadata
+	29: Node data and node metadata compressed with zstd instead of zlib
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
+// First version that uses zstd compression
+#define SER_FMT_VER_ZSTD 29
 // Highest supported serialization version
+#if USE_ZSTD
+#define SER_FMT_VER_HIGHEST_READ 29
+#else
 #define SER_FMT_VER_HIGHEST_READ 28
-// Saved on disk version
+#endif
+// Saved on disk version, unless zstd_map_compression is enabled
 #define SER_FMT_VER_HIGHEST_WRITE 28
 // Lowest supported serialization version
 #define SER_FMT_VER_LOWEST_READ 0
@@ -90,9 +98,16 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level = -1);
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os);
 
-// These choose between zlib and a self-made one according to version
-void compress(SharedBuffer<u8> data, std::ostream &os, u8 version);
-//void compress(const std::string &data, std::ostream &os, u8 version);
+#if USE_ZSTD
+// A negative level selects the library default
+void compressZstd(SharedBuffer<u8> data, std::ostream &os, int level = -1);
+void compressZstd(const std::string &data, std::ostream &os, int level = -1);
+void decompressZstd(std::istream &is, std::ostream &os);
+#endif
+
+// These choose between zstd, zlib and a self-made one according to version
+void compress(SharedBuffer<u8> data, std::ostream &os, u8 version, int level = -1);
+void compress(const std::string &data, std::ostream &os, u8 version, int level = -1);
 void decompress(std::istream &is, std::ostream &os, u8 version);
 
 #endif
@@ -326,6 +326,12 @@ Server::Server(
 
 	m_liquid_transform_every = g_settings->getFloat("liquid_update");
 	m_max_chatmessage_length = g_settings->getU16("chat_message_max_size");
+
+	// Clients that can read zstd compressed blocks only get them if enabled
+	m_max_ser_ver = SER_FMT_VER_HIGHEST_READ;
+	if (!g_settings->getBool("zstd_map_compression"))
+		m_max_ser_ver = MYMIN(m_max_ser_ver, SER_FMT_VER_ZSTD - 1);
+	m_net_compression_level = g_settings->getS16("map_compression_level_net");
 }
 
 Server::~Server()
@@ -577,6 +583,8 @@ void Server::AsyncRunStep(bool initial_step)
 
 		std::map<v3s16, MapBlock*> modified_blocks;
 		m_env->getMap().transformLiquids(modified_blocks, m_env);
+		g_profiler->avg("Server: liquid queue size (num)",
+			m_env->getMap().transforming_liquid_size());
 #if 0
 		/*
 			Update lighting
@@ -2275,10 +2283,11 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto
 		Create a packet with the block in the right format
 	*/
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
-	block->serializeNetworkSpecific(os);
-	std::string s = os.str();
+	bool cache_hit;
+	const std::string &s = block->getNetworkData(ver, m_net_compression_level,
+		&cache_hit);
+	g_profiler->add(cache_hit ? "Server: block data cache hits (num)" :
+		"Server: block data cache misses (num)", 1);
 
 	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + s.size(), peer_id);
 
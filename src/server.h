@@ -523,6 +523,10 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// functionality
 	bool m_simple_singleplayer_mode;
 	u16 m_max_chatmessage_length;
+	// Highest serialization version to negotiate with clients
+	u8 m_max_ser_ver;
+	// Compression level for blocks sent to clients
+	int m_net_compression_level;
 	// For "dedicated" server list flag
 	bool m_dedicated;
 
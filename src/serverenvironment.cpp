@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodemetadata.h"
 #include "gamedef.h"
 #include "map.h"
+#include "noise.h"
 #include "profiler.h"
 #include "raycast.h"
 #include "remoteplayer.h"
@@ -34,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
+#include "util/thread.h"
 #include "threading/mutex_auto_lock.h"
 #include "filesys.h"
 #include "gameparams.h"
@@ -106,6 +108,7 @@ void LBMContentMapping::addLBM(LoadingBlockModifierDef *lbm_def, IGameDef *gamed
 			c_ids.begin(); iit != c_ids.end(); ++iit) {
 			content_t c_id = *iit;
 			map[c_id].push_back(lbm_def);
+			summary.add(c_id);
 		}
 	}
 }
@@ -263,8 +266,14 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp)
 	v3s16 pos;
 	MapNode n;
 	content_t c;
+	const ContentSummary &block_summary = block->getContentSummary();
 	lbm_lookup_map::const_iterator it = getLBMsIntroducedAfter(stamp);
 	for (; it != m_lbm_lookup.end(); ++it) {
+		if (!block_summary.intersects(it->second.summary)) {
+			g_profiler->add("SEnv: LBM block scans skipped (num)", 1);
+			continue;
+		}
+
 		// Cache previous version to speedup lookup which has a very high performance
 		// penalty on each call
 		content_t previous_c = CONTENT_IGNORE;
@@ -365,6 +374,131 @@ void ActiveBlockList::update(std::vector<v3s16> &active_positions,
 	}
 }
 
+/*
+	ActiveObjectIndex
+*/
+
+// Edge length of an index cell, in world units
+#define ACTIVE_OBJECT_INDEX_CELL_SIZE (MAP_BLOCKSIZE * BS)
+
+s16 ActiveObjectIndex::getCellCoord(f32 c)
+{
+	// Everything beyond the map limits (or NaN) ends up in the border cells
+	const f32 limit = MAX_MAP_GENERATION_LIMIT / MAP_BLOCKSIZE + 1;
+	f32 cell = floor(c / ACTIVE_OBJECT_INDEX_CELL_SIZE);
+	if (!(cell > -limit))
+		return -limit;
+	if (cell > limit)
+		return limit;
+	return cell;
+}
+
+u64 ActiveObjectIndex::getCellKey(s16 x, s16 y, s16 z)
+{
+	return (u64)(u16)x | ((u64)(u16)y << 16) | ((u64)(u16)z << 32);
+}
+
+void ActiveObjectIndex::insert(u16 id, v3f pos)
+{
+	if (m_objects.find(id) != m_objects.end()) {
+		update(id, pos);
+		return;
+	}
+
+	Entry entry;
+	entry.pos = pos;
+	entry.cell = getCellKey(getCellCoord(pos.X), getCellCoord(pos.Y),
+		getCellCoord(pos.Z));
+	m_objects[id] = entry;
+	m_cells[entry.cell].push_back(id);
+}
+
+void ActiveObjectIndex::update(u16 id, v3f pos)
+{
+	UNORDERED_MAP<u16, Entry>::iterator n = m_objects.find(id);
+	if (n == m_objects.end())
+		return;
+
+	Entry &entry = n->second;
+	entry.pos = pos;
+	u64 cell = getCellKey(getCellCoord(pos.X), getCellCoord(pos.Y),
+		getCellCoord(pos.Z));
+	if (cell == entry.cell)
+		return;
+
+	removeFromCell(id, entry.cell);
+	entry.cell = cell;
+	m_cells[cell].push_back(id);
+}
+
+void ActiveObjectIndex::remove(u16 id)
+{
+	UNORDERED_MAP<u16, Entry>::iterator n = m_objects.find(id);
+	if (n == m_objects.end())
+		return;
+
+	removeFromCell(id, n->second.cell);
+	m_objects.erase(n);
+}
+
+void ActiveObjectIndex::removeFromCell(u16 id, u64 cell)
+{
+	UNORDERED_MAP<u64, std::vector<u16> >::iterator n = m_cells.find(cell);
+	if (n == m_cells.end())
+		return;
+
+	std::vector<u16> &ids = n->second;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if (ids[i] != id)
+			continue;
+		ids[i] = ids.back();
+		ids.pop_back();
+		break;
+	}
+
+	if (ids.empty())
+		m_cells.erase(n);
+}
+
+void ActiveObjectIndex::getObjectsInsideRadius(std::vector<u16> &objects,
+	v3f pos, float radius) const
+{
+	// Number of cells the query box covers; a huge (or NaN) radius makes
+	// walking the cells slower than just testing every object.
+	float cells_across = 2.0f * radius / ACTIVE_OBJECT_INDEX_CELL_SIZE + 2.0f;
+	if (!(cells_across * cells_across * cells_across < m_objects.size())) {
+		for (UNORDERED_MAP<u16, Entry>::const_iterator i = m_objects.begin();
+				i != m_objects.end(); ++i) {
+			if (i->second.pos.getDistanceFrom(pos) > radius)
+				continue;
+			objects.push_back(i->first);
+		}
+		return;
+	}
+
+	v3s16 cmin(getCellCoord(pos.X - radius), getCellCoord(pos.Y - radius),
+		getCellCoord(pos.Z - radius));
+	v3s16 cmax(getCellCoord(pos.X + radius), getCellCoord(pos.Y + radius),
+		getCellCoord(pos.Z + radius));
+
+	for (s16 z = cmin.Z; z <= cmax.Z; z++)
+	for (s16 y = cmin.Y; y <= cmax.Y; y++)
+	for (s16 x = cmin.X; x <= cmax.X; x++) {
+		UNORDERED_MAP<u64, std::vector<u16> >::const_iterator n =
+			m_cells.find(getCellKey(x, y, z));
+		if (n == m_cells.end())
+			continue;
+
+		const std::vector<u16> &ids = n->second;
+		for (size_t i = 0; i < ids.size(); i++) {
+			const Entry &entry = m_objects.find(ids[i])->second;
+			if (entry.pos.getDistanceFrom(pos) > radius)
+				continue;
+			objects.push_back(ids[i]);
+		}
+	}
+}
+
 /*
 	ServerEnvironment
 */
@@ -382,10 +516,17 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_game_time(0),
 	m_game_time_fraction_counter(0),
 	m_last_clear_objects_time(0),
+	m_abm_pool(NULL),
 	m_recommended_send_interval(0.1),
 	m_max_lag_estimate(0.1),
 	m_player_database(NULL)
 {
+	u16 abm_threads = g_settings->getU16("num_abm_threads");
+	if (abm_threads == 0)
+		abm_threads = Thread::getNumberOfProcessors();
+	if (abm_threads > 1)
+		m_abm_pool = new WorkerPool("ABM", abm_threads);
+
 	// Determine which database backend to use
 	std::string conf_path = path_world + DIR_DELIM + "world.mt";
 	Settings conf;
@@ -421,6 +562,8 @@ ServerEnvironment::~ServerEnvironment()
 	// Drop/delete map
 	m_map->drop();
 
+	delete m_abm_pool;
+
 	// Delete ActiveBlockModifiers
 	for (std::vector<ABMWithState>::iterator
 		i = m_abms.begin(); i != m_abms.end(); ++i){
@@ -696,16 +839,118 @@ struct ActiveABM
 	std::set<content_t> required_neighbors;
 };
 
+// A node that passed the chance and neighbor checks of an ABM
+struct ABMCandidate
+{
+	v3s16 p0;
+	content_t c;
+	ActiveABM *aabm;
+};
+
+// Input and output of the scan of one block on the ABM worker pool
+struct ABMBlockScan
+{
+	v3s16 pos;
+	MapBlock *block;
+	// The block and its 26 neighbours, NULL if not loaded
+	MapBlock *neighbors[27];
+	u32 seed;
+	std::vector<ABMCandidate> candidates;
+};
+
 class ABMHandler
 {
 private:
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+	// All content ids in m_aabms
+	ContentSummary m_trigger_summary;
+	u32 m_blocks_scanned;
+	u32 m_blocks_skipped;
+
+	class ScanBatch : public WorkerPool::Batch
+	{
+	public:
+		ScanBatch(ABMHandler *handler, std::vector<ABMBlockScan> &scans) :
+			m_handler(handler), m_scans(scans)
+		{}
+
+		void runItem(u32 i) { m_handler->scanBlock(m_scans[i]); }
+
+	private:
+		ABMHandler *m_handler;
+		std::vector<ABMBlockScan> &m_scans;
+	};
+
+	static bool findRequiredNeighbor(const ABMBlockScan &scan, v3s16 p0,
+		const std::set<content_t> &required_neighbors)
+	{
+		v3s16 p1;
+		for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+		for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+		for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+		{
+			if(p1 == p0)
+				continue;
+			v3s16 bp = getContainerPos(p1, MAP_BLOCKSIZE);
+			MapBlock *block = scan.neighbors[
+				(bp.Z + 1) * 9 + (bp.Y + 1) * 3 + (bp.X + 1)];
+			content_t c = CONTENT_IGNORE;
+			if (block)
+				c = block->getNodeNoEx(p1 - bp * MAP_BLOCKSIZE).getContent();
+			if (required_neighbors.find(c) != required_neighbors.end())
+				return true;
+		}
+		return false;
+	}
+
+	// Runs on the worker pool; must not touch the map or the environment
+	void scanBlock(ABMBlockScan &scan)
+	{
+		MapBlock *block = scan.block;
+		PcgRandom pr(scan.seed);
+		ContentSummary summary;
+
+		v3s16 p0;
+		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
+		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
+		{
+			content_t c = block->getNodeUnsafe(p0).getContent();
+			summary.add(c);
+
+			if (c >= m_aabms.size() || !m_aabms[c])
+				continue;
+
+			for(std::vector<ActiveABM>::iterator
+				i = m_aabms[c]->begin(); i != m_aabms[c]->end(); ++i) {
+				if(pr.next() % i->chance != 0)
+					continue;
+
+				if (!i->required_neighbors.empty() &&
+						!findRequiredNeighbor(scan, p0, i->required_neighbors))
+					continue;
+
+				ABMCandidate candidate;
+				candidate.p0 = p0;
+				candidate.c = c;
+				candidate.aabm = &(*i);
+				scan.candidates.push_back(candidate);
+			}
+		}
+
+		// Nothing writes to the block during the scan, so this drops
+		// content that has been removed since the last one
+		block->setContentSummary(summary);
+	}
+
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
 		bool use_timers):
-		m_env(env)
+		m_env(env),
+		m_blocks_scanned(0),
+		m_blocks_skipped(0)
 	{
 		if(dtime_s < 0.001)
 			return;
@@ -762,6 +1007,7 @@ class ABMHandler
 					if (!m_aabms[c])
 						m_aabms[c] = new std::vector<ActiveABM>;
 					m_aabms[c]->push_back(aabm);
+					m_trigger_summary.add(c);
 				}
 			}
 		}
@@ -773,6 +1019,20 @@ class ABMHandler
 			delete m_aabms[i];
 	}
 
+	u32 getBlocksScanned() const { return m_blocks_scanned; }
+	u32 getBlocksSkipped() const { return m_blocks_skipped; }
+
+	// Whether the block may contain a node that triggers an ABM
+	bool needsScan(MapBlock *block)
+	{
+		if (!block->getContentSummary().intersects(m_trigger_summary)) {
+			m_blocks_skipped++;
+			return false;
+		}
+		m_blocks_scanned++;
+		return true;
+	}
+
 	// Find out how many objects the given block and its neighbours contain.
 	// Returns the number of objects in the block, and also in 'wider' the
 	// number of objects in the block and all its neighbours. The latter
@@ -803,7 +1063,7 @@ class ABMHandler
 	}
 	void apply(MapBlock *block)
 	{
-		if(m_aabms.empty() || block->isDummy())
+		if(m_aabms.empty() || block->isDummy() || !needsScan(block))
 			return;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -812,6 +1072,12 @@ class ABMHandler
 		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
 		m_env->m_added_objects = 0;
 
+		// Rebuild the content summary while scanning. Triggers may write to
+		// the block meanwhile, and their setNode() calls add to the fresh
+		// summary, so nothing present at the end of the scan gets lost.
+		ContentSummary summary;
+		block->resetContentSummary();
+
 		v3s16 p0;
 		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
 		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
@@ -819,6 +1085,7 @@ class ABMHandler
 		{
 			const MapNode &n = block->getNodeUnsafe(p0);
 			content_t c = n.getContent();
+			summary.add(c);
 
 			if (c >= m_aabms.size() || !m_aabms[c])
 				continue;
@@ -873,6 +1140,81 @@ class ABMHandler
 				}
 			}
 		}
+
+		block->addContentSummary(summary);
+	}
+
+	/*
+		Same as apply() for a set of blocks, but the node scan, the chance
+		rolls and the neighbor checks run on the worker pool. Only the
+		trigger calls are made from the calling thread.
+	*/
+	void applyParallel(const std::vector<MapBlock *> &blocks, WorkerPool *pool)
+	{
+		if(m_aabms.empty())
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		std::vector<ABMBlockScan> scans;
+		scans.reserve(blocks.size());
+		for (std::vector<MapBlock *>::const_iterator it = blocks.begin();
+				it != blocks.end(); ++it) {
+			MapBlock *block = *it;
+			if (block->isDummy() || !needsScan(block))
+				continue;
+
+			scans.push_back(ABMBlockScan());
+			ABMBlockScan &scan = scans.back();
+			scan.pos = block->getPos();
+			scan.block = block;
+			scan.seed = myrand();
+			for(s16 z=-1; z<=1; z++)
+			for(s16 y=-1; y<=1; y++)
+			for(s16 x=-1; x<=1; x++)
+				scan.neighbors[(z + 1) * 9 + (y + 1) * 3 + (x + 1)] =
+					map->getBlockNoCreateNoEx(scan.pos + v3s16(x, y, z));
+		}
+
+		ScanBatch batch(this, scans);
+		pool->run(&batch, scans.size());
+
+		for (std::vector<ABMBlockScan>::iterator it = scans.begin();
+				it != scans.end(); ++it) {
+			ABMBlockScan &scan = *it;
+			if (scan.candidates.empty())
+				continue;
+
+			// Triggers of previous blocks may have deleted this one
+			MapBlock *block = map->getBlockNoCreateNoEx(scan.pos);
+			if (block != scan.block || block->isDummy())
+				continue;
+
+			u32 active_object_count_wider;
+			u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+			m_env->m_added_objects = 0;
+
+			for (std::vector<ABMCandidate>::iterator
+					i = scan.candidates.begin(); i != scan.candidates.end(); ++i) {
+				// Skip nodes that an earlier trigger has replaced
+				MapNode n = block->getNodeNoEx(i->p0);
+				if (n.getContent() != i->c)
+					continue;
+
+				v3s16 p = i->p0 + block->getPosRelative();
+
+				// Call all the trigger variations
+				i->aabm->abm->trigger(m_env, p, n);
+				i->aabm->abm->trigger(m_env, p, n,
+					active_object_count, active_object_count_wider);
+
+				// Count surrounding objects again if the abms added any
+				if(m_env->m_added_objects > 0) {
+					active_object_count = countObjects(block, map, active_object_count_wider);
+					m_env->m_added_objects = 0;
+				}
+			}
+		}
 	}
 };
 
@@ -971,6 +1313,52 @@ bool ServerEnvironment::setNode(v3s16 p, const MapNode &n)
 	return true;
 }
 
+u32 ServerEnvironment::setNodes(const std::vector<std::pair<v3s16, MapNode> > &nodes)
+{
+	INodeDefManager *ndef = m_server->ndef();
+
+	// Nodes in unloaded blocks are skipped
+	std::vector<std::pair<v3s16, MapNode> > set_nodes;
+	std::vector<MapNode> old_nodes;
+	set_nodes.reserve(nodes.size());
+	old_nodes.reserve(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++) {
+		bool is_valid_position;
+		MapNode n_old = m_map->getNodeNoEx(nodes[i].first, &is_valid_position);
+		if (!is_valid_position)
+			continue;
+		set_nodes.push_back(nodes[i]);
+		old_nodes.push_back(n_old);
+	}
+
+	// Call destructors
+	for (size_t i = 0; i < set_nodes.size(); i++) {
+		if (ndef->get(old_nodes[i]).has_on_destruct)
+			m_script->node_on_destruct(set_nodes[i].first, old_nodes[i]);
+	}
+
+	// Replace nodes
+	m_map->addNodesWithEvent(set_nodes);
+
+	for (size_t i = 0; i < set_nodes.size(); i++) {
+		v3s16 p = set_nodes[i].first;
+		const MapNode &n = set_nodes[i].second;
+
+		// Update active VoxelManipulator if a mapgen thread
+		m_map->updateVManip(p);
+
+		// Call post-destructor
+		if (ndef->get(old_nodes[i]).has_after_destruct)
+			m_script->node_after_destruct(p, old_nodes[i]);
+
+		// Call constructor
+		if (ndef->get(n).has_on_construct)
+			m_script->node_on_construct(p, n);
+	}
+
+	return set_nodes.size();
+}
+
 bool ServerEnvironment::removeNode(v3s16 p)
 {
 	INodeDefManager *ndef = m_server->ndef();
@@ -1009,15 +1397,17 @@ bool ServerEnvironment::swapNode(v3s16 p, const MapNode &n)
 
 void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius)
 {
-	for (ActiveObjectMap::iterator i = m_active_objects.begin();
-		i != m_active_objects.end(); ++i) {
-		ServerActiveObject* obj = i->second;
-		u16 id = i->first;
-		v3f objectpos = obj->getBasePosition();
-		if (objectpos.getDistanceFrom(pos) > radius)
-			continue;
-		objects.push_back(id);
-	}
+	m_active_object_index.getObjectsInsideRadius(objects, pos, radius);
+}
+
+void ServerEnvironment::updateActiveObjectPosition(ServerActiveObject *object)
+{
+	// Objects not (yet) in the environment may share an id with one that is
+	ActiveObjectMap::iterator n = m_active_objects.find(object->getId());
+	if (n == m_active_objects.end() || n->second != object)
+		return;
+
+	m_active_object_index.update(object->getId(), object->getBasePosition());
 }
 
 void ServerEnvironment::clearObjects(ClearObjectsMode mode)
@@ -1057,6 +1447,7 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 	for (std::vector<u16>::iterator it = objects_to_remove.begin();
 			it != objects_to_remove.end(); ++it) {
 		m_active_objects.erase(*it);
+		m_active_object_index.remove(*it);
 	}
 
 	// Get list of loaded blocks
@@ -1343,6 +1734,7 @@ void ServerEnvironment::step(float dtime)
 			// Initialize handling of ActiveBlockModifiers
 			ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
 
+			std::vector<MapBlock *> blocks;
 			for(std::set<v3s16>::iterator
 				i = m_active_blocks.m_list.begin();
 				i != m_active_blocks.m_list.end(); ++i)
@@ -1360,9 +1752,20 @@ void ServerEnvironment::step(float dtime)
 				block->setTimestampNoChangedFlag(m_game_time);
 
 				/* Handle ActiveBlockModifiers */
-				abmhandler.apply(block);
+				if (m_abm_pool)
+					blocks.push_back(block);
+				else
+					abmhandler.apply(block);
 			}
 
+			if (m_abm_pool)
+				abmhandler.applyParallel(blocks, m_abm_pool);
+
+			g_profiler->avg("SEnv: ABM blocks scanned",
+				abmhandler.getBlocksScanned());
+			g_profiler->avg("SEnv: ABM blocks skipped by content",
+				abmhandler.getBlocksSkipped());
+
 			u32 time_ms = timer.stop(true);
 			u32 max_time_ms = 200;
 			if(time_ms > max_time_ms){
@@ -1542,31 +1945,52 @@ void ServerEnvironment::getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (ActiveObjectMap::iterator i = m_active_objects.begin();
-		i != m_active_objects.end(); ++i) {
-		u16 id = i->first;
+	v3f pos = playersao->getBasePosition();
+
+	// Entities come from the spatial index
+	std::vector<u16> objects;
+	m_active_object_index.getObjectsInsideRadius(objects, pos, radius_f);
+	for (std::vector<u16>::iterator i = objects.begin();
+		i != objects.end(); ++i) {
+		u16 id = *i;
 
 		// Get object
-		ServerActiveObject *object = i->second;
+		ServerActiveObject *object = getActiveObject(id);
 		if (object == NULL)
 			continue;
 
 		if (object->isGone())
 			continue;
 
-		f32 distance_f = object->getBasePosition().
-			getDistanceFrom(playersao->getBasePosition());
-		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
-			// Discard if too far
-			if (distance_f > player_radius_f && player_radius_f != 0)
-				continue;
-		} else if (distance_f > radius_f)
+		// Players are handled below, their radius differs
+		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+			continue;
+
+		// Discard if already on current_objects
+		if (current_objects.find(id) != current_objects.end())
+			continue;
+		// Add to added_objects
+		added_objects.push(id);
+	}
+
+	// Players are few, check each of them
+	for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
+		i != m_players.end(); ++i) {
+		PlayerSAO *object = (*i)->getPlayerSAO();
+		if (object == NULL)
+			continue;
+
+		if (object->isGone())
+			continue;
+
+		// Discard if too far
+		f32 distance_f = object->getBasePosition().getDistanceFrom(pos);
+		if (distance_f > player_radius_f && player_radius_f != 0)
 			continue;
 
 		// Discard if already on current_objects
-		std::set<u16>::iterator n;
-		n = current_objects.find(id);
-		if(n != current_objects.end())
+		u16 id = object->getId();
+		if (current_objects.find(id) != current_objects.end())
 			continue;
 		// Add to added_objects
 		added_objects.push(id);
@@ -1709,6 +2133,7 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 			<<"added (id="<<object->getId()<<")"<<std::endl;*/
 
 	m_active_objects[object->getId()] = object;
+	m_active_object_index.insert(object->getId(), object->getBasePosition());
 
 	verbosestream<<"ServerEnvironment::addActiveObjectRaw(): "
 		<<"Added id="<<object->getId()<<"; there are now "
@@ -1826,6 +2251,7 @@ void ServerEnvironment::removeRemovedObjects()
 	for (std::vector<u16>::iterator it = objects_to_remove.begin();
 			it != objects_to_remove.end(); ++it) {
 		m_active_objects.erase(*it);
+		m_active_object_index.remove(*it);
 	}
 }
 
@@ -2098,6 +2524,7 @@ void ServerEnvironment::deactivateFarObjects(bool _force_delete)
 	for (std::vector<u16>::iterator it = objects_to_remove.begin();
 			it != objects_to_remove.end(); ++it) {
 		m_active_objects.erase(*it);
+		m_active_object_index.remove(*it);
 	}
 }
 
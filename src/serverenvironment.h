@@ -37,6 +37,7 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class WorkerPool;
 
 /*
 	{Active, Loading} block modifier interface.
@@ -94,6 +95,9 @@ struct LBMContentMapping
 
 	std::vector<LoadingBlockModifierDef *> lbm_list;
 
+	// All content ids in map, to skip blocks that contain none of them
+	ContentSummary summary;
+
 	// Needs to be separate method (not inside destructor),
 	// because the LBMContentMapping may be copied and destructed
 	// many times during operation in the lbm_lookup_map.
@@ -173,6 +177,49 @@ class ActiveBlockList
 private:
 };
 
+/*
+	Spatial index of active objects, used by ServerEnvironment
+
+	Objects are bucketed by position into cubic cells the size of a
+	MapBlock, so radius queries only have to look at the objects in
+	the cells overlapping the query sphere.
+*/
+
+class ActiveObjectIndex
+{
+public:
+	void insert(u16 id, v3f pos);
+	void update(u16 id, v3f pos);
+	void remove(u16 id);
+
+	void clear()
+	{
+		m_cells.clear();
+		m_objects.clear();
+	}
+
+	size_t size() const { return m_objects.size(); }
+
+	// Appends the ids of all objects within radius of pos
+	void getObjectsInsideRadius(std::vector<u16> &objects,
+		v3f pos, float radius) const;
+
+private:
+	struct Entry
+	{
+		v3f pos;
+		u64 cell;
+	};
+
+	static s16 getCellCoord(f32 c);
+	static u64 getCellKey(s16 x, s16 y, s16 z);
+
+	void removeFromCell(u16 id, u64 cell);
+
+	UNORDERED_MAP<u64, std::vector<u16> > m_cells;
+	UNORDERED_MAP<u16, Entry> m_objects;
+};
+
 /*
 	Operation mode for ServerEnvironment::clearObjects()
 */
@@ -311,10 +358,16 @@ class ServerEnvironment : public Environment
 	bool setNode(v3s16 p, const MapNode &n);
 	bool removeNode(v3s16 p);
 	bool swapNode(v3s16 p, const MapNode &n);
+	// Like setNode for each node, but updates the light and the clients
+	// once for all of them. Returns the number of nodes that were set.
+	u32 setNodes(const std::vector<std::pair<v3s16, MapNode> > &nodes);
 
 	// Find all active objects inside a radius around a point
 	void getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius);
 
+	// Called by ServerActiveObject when its base position changes
+	void updateActiveObjectPosition(ServerActiveObject *object);
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -405,6 +458,8 @@ class ServerEnvironment : public Environment
 	const std::string m_path_world;
 	// Active object list
 	ActiveObjectMap m_active_objects;
+	// Spatial index over m_active_objects
+	ActiveObjectIndex m_active_object_index;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
 	// Some timers
@@ -426,6 +481,8 @@ class ServerEnvironment : public Environment
 	u32 m_last_clear_objects_time;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Scans active blocks for ABM matches if num_abm_threads > 1
+	WorkerPool *m_abm_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval;
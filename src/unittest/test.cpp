@@ -22,12 +22,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "itemdef.h"
 #include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
 #include "mods.h"
 
 content_t t_CONTENT_STONE;
 content_t t_CONTENT_GRASS;
 content_t t_CONTENT_TORCH;
 content_t t_CONTENT_WATER;
+content_t t_CONTENT_WATER_FLOWING;
 content_t t_CONTENT_LAVA;
 content_t t_CONTENT_BRICK;
 
@@ -83,7 +87,15 @@ class TestGameDef : public IGameDef {
 };
 
 
-TestGameDef::TestGameDef()
+TestGameDef::TestGameDef() :
+	m_craftdef(NULL),
+	m_texturesrc(NULL),
+	m_shadersrc(NULL),
+	m_soundmgr(NULL),
+	m_eventmgr(NULL),
+	m_scenemgr(NULL),
+	m_rollbackmgr(NULL),
+	m_emergemgr(NULL)
 {
 	m_itemdef = createItemDefManager();
 	m_nodedef = createNodeDefManager();
@@ -172,6 +184,8 @@ void TestGameDef::defineSomeNodes()
 	f.alpha = 128;
 	f.liquid_type = LIQUID_SOURCE;
 	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
 	f.is_ground_content = true;
 	f.groups["liquids"] = 3;
 	for(int i = 0; i < 6; i++)
@@ -179,6 +193,19 @@ void TestGameDef::defineSomeNodes()
 	idef->registerItem(itemdef);
 	t_CONTENT_WATER = ndef->set(f.name, f);
 
+	//// Flowing water
+	itemdef = ItemDefinition();
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "default:water_flowing";
+	itemdef.description = "Flowing Water";
+	f.name = itemdef.name;
+	f.liquid_type = LIQUID_FLOWING;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	f.is_ground_content = false;
+	f.groups.clear();
+	idef->registerItem(itemdef);
+	t_CONTENT_WATER_FLOWING = ndef->set(f.name, f);
+
 	//// Lava
 	itemdef = ItemDefinition();
 	itemdef.type = ITEM_NODE;
@@ -219,6 +246,14 @@ void TestGameDef::defineSomeNodes()
 	f.is_ground_content = true;
 	idef->registerItem(itemdef);
 	t_CONTENT_BRICK = ndef->set(f.name, f);
+
+	//// Aliases used by the mapgens
+	idef->registerAlias("mapgen_stone", "default:stone");
+	idef->registerAlias("mapgen_water_source", "default:water");
+	idef->registerAlias("mapgen_river_water_source", "default:water");
+	idef->registerAlias("mapgen_lava_source", "default:lava");
+	idef->registerAlias("mapgen_cobble", "default:brick");
+	ndef->updateAliases(idef);
 }
 
 ////
@@ -266,6 +301,33 @@ bool run_tests()
 	return num_modules_failed;
 }
 
+////
+//// run_benchmarks
+////
+
+bool run_benchmarks()
+{
+	DSTACK(FUNCTION_NAME);
+
+	TestGameDef gamedef;
+
+	g_logger.setLevelSilenced(LL_ERROR, true);
+
+	u32 num_modules_failed = 0;
+	std::vector<TestBase *> &benchmods = TestManager::getBenchmarkModules();
+	for (size_t i = 0; i != benchmods.size(); i++) {
+		if (!benchmods[i]->benchmarkModule(&gamedef))
+			num_modules_failed++;
+	}
+
+	g_logger.setLevelSilenced(LL_ERROR, false);
+
+	rawstream << "Benchmarks: " << num_modules_failed << " / "
+		<< benchmods.size() << " failed modules" << std::endl;
+
+	return num_modules_failed;
+}
+
 ////
 //// TestBase
 ////
@@ -290,6 +352,20 @@ bool TestBase::testModule(IGameDef *gamedef)
 	return num_tests_failed == 0;
 }
 
+bool TestBase::benchmarkModule(IGameDef *gamedef)
+{
+	rawstream << "======== Benchmarking module " << getName() << std::endl;
+	num_tests_failed = 0;
+	num_tests_run = 0;
+
+	runBenchmarks(gamedef);
+
+	if (!m_test_dir.empty())
+		fs::RecursiveDelete(m_test_dir);
+
+	return num_tests_failed == 0;
+}
+
 std::string TestBase::getTestTempDirectory()
 {
 	if (!m_test_dir.empty())
@@ -313,6 +389,31 @@ std::string TestBase::getTestTempFile()
 	return getTestTempDirectory() + DIR_DELIM + buf + ".tmp";
 }
 
+ServerMap *TestBase::makeTestMap(IGameDef *gamedef, EmergeManager *emerge,
+	s16 radius, MapNode below, MapNode above)
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "map";
+	fs::RecursiveDelete(dir);
+	fs::CreateAllDirs(dir);
+	fs::safeWriteToFile(dir + DIR_DELIM + "world.mt", "backend = dummy\n");
+	ServerMap *map = new ServerMap(dir, gamedef, emerge);
+
+	for (s16 x = -radius; x <= radius; x++)
+	for (s16 z = -radius; z <= radius; z++) {
+		v2s16 p2d(x, z);
+		MapSector *sector = new ServerMapSector(map, p2d, gamedef);
+		(*map->getSectorsPtr())[p2d] = sector;
+
+		for (s16 y = -radius; y <= radius; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			for (s16 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++)
+				block->getData()[i] = y < 0 ? below : above;
+			block->setGenerated(true);
+		}
+	}
+	return map;
+}
+
 
 /*
 	NOTE: These tests became non-working then NodeContainer was removed.
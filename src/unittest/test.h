@@ -103,14 +103,25 @@ class TestFailedException : public std::exception {
 } while (0)
 
 class IGameDef;
+class EmergeManager;
+class ServerMap;
 
 class TestBase {
 public:
 	bool testModule(IGameDef *gamedef);
+	bool benchmarkModule(IGameDef *gamedef);
 	std::string getTestTempDirectory();
 	std::string getTestTempFile();
+	// A map of the blocks within radius of the origin, with below under
+	// y = 0 and above from there up. It saves nothing, so it needs no
+	// database.
+	ServerMap *makeTestMap(IGameDef *gamedef, EmergeManager *emerge,
+		s16 radius, MapNode below, MapNode above);
 
 	virtual void runTests(IGameDef *gamedef) = 0;
+	// Timing benchmarks, only run by --run-benchmarks. Modules that have
+	// them register with TestManager::registerBenchmarkModule.
+	virtual void runBenchmarks(IGameDef *gamedef) {}
 	virtual const char *getName() = 0;
 
 	u32 num_tests_failed;
@@ -132,6 +143,17 @@ class TestManager {
 	{
 		getTestModules().push_back(module);
 	}
+
+	static std::vector<TestBase *> &getBenchmarkModules()
+	{
+		static std::vector<TestBase *> m_modules_to_benchmark;
+		return m_modules_to_benchmark;
+	}
+
+	static void registerBenchmarkModule(TestBase *module)
+	{
+		getBenchmarkModules().push_back(module);
+	}
 };
 
 // A few item and node definitions for those tests that need them
@@ -139,9 +161,11 @@ extern content_t t_CONTENT_STONE;
 extern content_t t_CONTENT_GRASS;
 extern content_t t_CONTENT_TORCH;
 extern content_t t_CONTENT_WATER;
+extern content_t t_CONTENT_WATER_FLOWING;
 extern content_t t_CONTENT_LAVA;
 extern content_t t_CONTENT_BRICK;
 
 bool run_tests();
+bool run_benchmarks();
 
 #endif
@@ -0,0 +1,194 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "serverenvironment.h"
+#include "noise.h"
+
+class TestActiveObjectIndex : public TestBase {
+public:
+	TestActiveObjectIndex()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestActiveObjectIndex"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testInsertRemove();
+	void testMatchesLinearScan();
+	void testQueryBenchmark();
+
+private:
+	static v3f randomPos(PcgRandom &pr, s32 extent);
+	static void linearScan(const std::vector<v3f> &positions,
+		std::vector<u16> &objects, v3f pos, float radius);
+};
+
+static TestActiveObjectIndex g_test_instance;
+
+void TestActiveObjectIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testInsertRemove);
+	TEST(testMatchesLinearScan);
+}
+
+void TestActiveObjectIndex::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testQueryBenchmark);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+v3f TestActiveObjectIndex::randomPos(PcgRandom &pr, s32 extent)
+{
+	return v3f(pr.range(-extent, extent), pr.range(-extent / 4, extent / 4),
+		pr.range(-extent, extent)) * BS;
+}
+
+void TestActiveObjectIndex::linearScan(const std::vector<v3f> &positions,
+	std::vector<u16> &objects, v3f pos, float radius)
+{
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (positions[i].getDistanceFrom(pos) > radius)
+			continue;
+		objects.push_back(i + 1);
+	}
+}
+
+void TestActiveObjectIndex::testInsertRemove()
+{
+	ActiveObjectIndex index;
+	std::vector<u16> objects;
+
+	index.insert(1, v3f(0, 0, 0));
+	index.insert(2, v3f(5, 0, 0) * BS);
+	index.insert(3, v3f(100, 0, 0) * BS);
+	UASSERTEQ(size_t, index.size(), 3);
+
+	index.getObjectsInsideRadius(objects, v3f(0, 0, 0), 10 * BS);
+	UASSERTEQ(size_t, objects.size(), 2);
+
+	// Moving across cells must be reflected in queries
+	index.update(3, v3f(-3, 0, 0) * BS);
+	objects.clear();
+	index.getObjectsInsideRadius(objects, v3f(0, 0, 0), 10 * BS);
+	UASSERTEQ(size_t, objects.size(), 3);
+
+	index.remove(2);
+	index.remove(2);
+	UASSERTEQ(size_t, index.size(), 2);
+	objects.clear();
+	index.getObjectsInsideRadius(objects, v3f(0, 0, 0), 10 * BS);
+	UASSERTEQ(size_t, objects.size(), 2);
+
+	// Updating an unknown id is a no-op
+	index.update(42, v3f(0, 0, 0));
+	UASSERTEQ(size_t, index.size(), 2);
+
+	index.clear();
+	objects.clear();
+	index.getObjectsInsideRadius(objects, v3f(0, 0, 0), 10 * BS);
+	UASSERT(objects.empty());
+}
+
+void TestActiveObjectIndex::testMatchesLinearScan()
+{
+	PcgRandom pr(1337);
+	ActiveObjectIndex index;
+	std::vector<v3f> positions;
+
+	for (u16 id = 1; id <= 2000; id++) {
+		positions.push_back(randomPos(pr, 300));
+		index.insert(id, positions.back());
+	}
+
+	// Move some of them around
+	for (u16 i = 0; i < 500; i++) {
+		u16 id = pr.range(1, 2000);
+		positions[id - 1] = randomPos(pr, 300);
+		index.update(id, positions[id - 1]);
+	}
+
+	const float radii[] = { 0.5f, 3.0f, 20.0f, 64.0f, 1000.0f };
+	for (size_t r = 0; r < ARRLEN(radii); r++)
+	for (u16 q = 0; q < 50; q++) {
+		v3f pos = randomPos(pr, 300);
+		float radius = radii[r] * BS;
+
+		std::vector<u16> expected, actual;
+		linearScan(positions, expected, pos, radius);
+		index.getObjectsInsideRadius(actual, pos, radius);
+
+		std::sort(expected.begin(), expected.end());
+		std::sort(actual.begin(), actual.end());
+		UASSERT(expected == actual);
+	}
+}
+
+void TestActiveObjectIndex::testQueryBenchmark()
+{
+	// Objects spread over a 600x150x600 node area, queried with the radius
+	// a typical mob mod uses
+	const u32 counts[] = { 100, 1000, 3000, 10000 };
+	const u32 num_queries = 2000;
+	const float radius = 16 * BS;
+
+	for (size_t c = 0; c < ARRLEN(counts); c++) {
+		PcgRandom pr(counts[c]);
+		ActiveObjectIndex index;
+		std::vector<v3f> positions;
+		for (u16 id = 1; id <= counts[c]; id++) {
+			positions.push_back(randomPos(pr, 300));
+			index.insert(id, positions.back());
+		}
+
+		std::vector<v3f> queries;
+		for (u32 q = 0; q < num_queries; q++)
+			queries.push_back(positions[pr.range(0, counts[c] - 1)]);
+
+		std::vector<u16> objects;
+		size_t found_linear = 0, found_index = 0;
+
+		u64 t0 = porting::getTimeUs();
+		for (u32 q = 0; q < num_queries; q++) {
+			objects.clear();
+			linearScan(positions, objects, queries[q], radius);
+			found_linear += objects.size();
+		}
+		u64 t1 = porting::getTimeUs();
+		for (u32 q = 0; q < num_queries; q++) {
+			objects.clear();
+			index.getObjectsInsideRadius(objects, queries[q], radius);
+			found_index += objects.size();
+		}
+		u64 t2 = porting::getTimeUs();
+
+		UASSERTEQ(size_t, found_index, found_linear);
+
+		rawstream << "    " << counts[c] << " objects: linear "
+			<< (float)(t1 - t0) / num_queries << "us/query, index "
+			<< (float)(t2 - t1) / num_queries << "us/query" << std::endl;
+	}
+}
@@ -0,0 +1,209 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "clientiface.h"
+#include "emerge.h"
+#include "map.h"
+#include "mapblock.h"
+#include "porting.h"
+#include "util/numeric.h"
+
+class TestClientIface : public TestBase {
+public:
+	TestClientIface()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestClientIface"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testBlockSelection(IGameDef *gamedef);
+	void testBlockSelectionBenchmark(IGameDef *gamedef);
+
+	ServerMap *makeAirMap(IGameDef *gamedef, EmergeManager *emerge,
+		s16 radius);
+	u32 selectBlocks(RemoteClient *client, Map *map, v3f camera_dir,
+		s16 wanted_range, std::vector<v3s16> *selected);
+};
+
+static TestClientIface g_test_instance;
+
+void TestClientIface::runTests(IGameDef *gamedef)
+{
+	TEST(testBlockSelection, gamedef);
+}
+
+void TestClientIface::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testBlockSelectionBenchmark, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sunlit air and a torch in every block, so that day and night differ
+// like near the ground
+ServerMap *TestClientIface::makeAirMap(IGameDef *gamedef,
+	EmergeManager *emerge, s16 radius)
+{
+	ServerMap *map = makeTestMap(gamedef, emerge, radius,
+		MapNode(CONTENT_AIR, LIGHT_SUN), MapNode(CONTENT_AIR, LIGHT_SUN));
+
+	for (s16 x = -radius; x <= radius; x++)
+	for (s16 y = -radius; y <= radius; y++)
+	for (s16 z = -radius; z <= radius; z++) {
+		MapBlock *block = map->getBlockNoCreateNoEx(v3s16(x, y, z));
+		block->getData()[0] = MapNode(t_CONTENT_TORCH);
+	}
+	return map;
+}
+
+// Selects blocks like Server::SendBlocks does and acknowledges them
+// like the client would.
+u32 TestClientIface::selectBlocks(RemoteClient *client, Map *map,
+	v3f camera_dir, s16 wanted_range, std::vector<v3s16> *selected)
+{
+	std::vector<PrioritySortedBlockTransfer> queue;
+	client->SelectBlocksToSend(map, NULL, 0.1, v3f(0, 0, 0), v3f(0, 0, 0),
+		camera_dir, 0, wanted_range, queue);
+
+	for (size_t i = 0; i < queue.size(); i++) {
+		client->SentBlock(queue[i].pos);
+		client->GotBlock(queue[i].pos);
+		if (selected)
+			selected->push_back(queue[i].pos);
+	}
+	return queue.size();
+}
+
+void TestClientIface::testBlockSelection(IGameDef *gamedef)
+{
+	const s16 range = 3;
+	EmergeManager emerge(gamedef);
+	ServerMap *map = makeAirMap(gamedef, &emerge, range);
+
+	RemoteClient client;
+	client.peer_id = 1;
+
+	std::vector<v3s16> selected;
+	v3f camera_dir(1, 0, 0);
+	for (int i = 0; i < 100; i++)
+		selectBlocks(&client, map, camera_dir, range, &selected);
+
+	// Every block in sight is sent exactly once
+	const float fov = (72.0 * M_PI / 180) * 4. / 3.;
+	const float d_in_sight = range * BS * MAP_BLOCKSIZE;
+	std::set<v3s16> sent(selected.begin(), selected.end());
+	UASSERTEQ(size_t, sent.size(), selected.size());
+	u32 num_in_sight = 0;
+	for (s16 x = -range; x <= range; x++)
+	for (s16 y = -range; y <= range; y++)
+	for (s16 z = -range; z <= range; z++) {
+		v3s16 p(x, y, z);
+		bool in_sight = isBlockInSight(p, v3f(0, 0, 0), camera_dir,
+			fov, d_in_sight);
+		UASSERT(in_sight == (sent.find(p) != sent.end()));
+		num_in_sight += in_sight;
+	}
+	UASSERTEQ(u32, sent.size(), num_in_sight);
+
+	// Nothing is selected while the camera stays the same
+	UASSERTEQ(u32, selectBlocks(&client, map, camera_dir, range, NULL), 0);
+
+	// Turning around sends the blocks behind
+	selected.clear();
+	for (int i = 0; i < 100; i++)
+		selectBlocks(&client, map, -camera_dir, range, &selected);
+	for (size_t i = 0; i < selected.size(); i++) {
+		UASSERT(sent.find(selected[i]) == sent.end());
+		UASSERT(isBlockInSight(selected[i], v3f(0, 0, 0), -camera_dir,
+			fov, d_in_sight));
+	}
+	UASSERT(!selected.empty());
+
+	// Modified blocks are sent again, and only those
+	client.SetBlockNotSent(v3s16(-2, 0, 0));
+	client.SetBlockNotSent(v3s16(-3, 1, 0));
+	selected.clear();
+	for (int i = 0; i < 10; i++)
+		selectBlocks(&client, map, -camera_dir, range, &selected);
+	UASSERTEQ(size_t, selected.size(), 2);
+	UASSERT(selected[0] == v3s16(-2, 0, 0));
+	UASSERT(selected[1] == v3s16(-3, 1, 0));
+
+	delete map;
+}
+
+void TestClientIface::testBlockSelectionBenchmark(IGameDef *gamedef)
+{
+	const s16 range = 6;
+	EmergeManager emerge(gamedef);
+	ServerMap *map = makeAirMap(gamedef, &emerge, range);
+
+	const u32 client_counts[] = {1, 10, 60};
+	for (size_t n = 0; n < ARRLEN(client_counts); n++) {
+		u32 num_clients = client_counts[n];
+		std::vector<RemoteClient *> clients;
+		std::vector<v3f> dirs;
+		for (u32 i = 0; i < num_clients; i++) {
+			clients.push_back(new RemoteClient());
+			clients[i]->peer_id = i + 1;
+			float yaw = i * 2 * M_PI / num_clients;
+			dirs.push_back(v3f(cos(yaw), 0, sin(yaw)));
+		}
+
+		// Until everything in sight is sent. Shells without blocks in
+		// sight select nothing, so wait for a few empty rounds in a row.
+		u64 t0 = porting::getTimeUs();
+		u32 calls = 0, blocks = 0;
+		for (s16 empty_rounds = 0; empty_rounds <= range; ) {
+			u32 round_blocks = 0;
+			for (u32 i = 0; i < num_clients; i++) {
+				round_blocks += selectBlocks(clients[i], map, dirs[i], range, NULL);
+				calls++;
+			}
+			blocks += round_blocks;
+			empty_rounds = round_blocks ? 0 : empty_rounds + 1;
+		}
+
+		// Nothing left to send
+		u64 t1 = porting::getTimeUs();
+		const u32 idle_calls = 100;
+		for (u32 j = 0; j < idle_calls; j++)
+		for (u32 i = 0; i < num_clients; i++)
+			UASSERTEQ(u32, selectBlocks(clients[i], map, dirs[i], range, NULL), 0);
+		u64 t2 = porting::getTimeUs();
+
+		for (u32 i = 0; i < num_clients; i++)
+			delete clients[i];
+
+		rawstream << "    " << num_clients << " clients: " << blocks
+			<< " blocks selected in " << calls << " calls, "
+			<< (t1 - t0) / MYMAX(calls, 1) << " us/call; idle "
+			<< (float)(t2 - t1) / (idle_calls * num_clients) << " us/call"
+			<< std::endl;
+	}
+
+	delete map;
+}
@@ -26,17 +26,30 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 #include "nodedef.h"
 #include "noise.h"
+#include "mapblock.h"
+#include "porting.h"
 
 class TestCompression : public TestBase {
 public:
-	TestCompression() { TestManager::registerTestModule(this); }
+	TestCompression()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
 	const char *getName() { return "TestCompression"; }
 
 	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
 
 	void testRLECompression();
 	void testZlibCompression();
 	void testZlibLargeData();
+	void testZstdCompression();
+	void testBlockCompressionBenchmark(IGameDef *gamedef);
+
+private:
+	static void makeTerrainBlock(MapBlock *block, s16 x, s16 y, s16 z);
 };
 
 static TestCompression g_test_instance;
@@ -46,6 +59,12 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testRLECompression);
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
+	TEST(testZstdCompression);
+}
+
+void TestCompression::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testBlockCompressionBenchmark, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -108,7 +127,7 @@ void TestCompression::testZlibCompression()
 	fromdata[3]=1;
 
 	std::ostringstream os(std::ios_base::binary);
-	compress(fromdata, os, SER_FMT_VER_HIGHEST_READ);
+	compress(fromdata, os, SER_FMT_VER_HIGHEST_WRITE);
 
 	std::string str_out = os.str();
 
@@ -121,7 +140,7 @@ void TestCompression::testZlibCompression()
 	std::istringstream is(str_out, std::ios_base::binary);
 	std::ostringstream os2(std::ios_base::binary);
 
-	decompress(is, os2, SER_FMT_VER_HIGHEST_READ);
+	decompress(is, os2, SER_FMT_VER_HIGHEST_WRITE);
 	std::string str_out2 = os2.str();
 
 	infostream << "decompress: ";
@@ -170,3 +189,138 @@ void TestCompression::testZlibLargeData()
 				i, str_decompressed[i], i, data_in[i]);
 	}
 }
+
+void TestCompression::testZstdCompression()
+{
+#if USE_ZSTD
+	u32 size = 50000;
+	std::string data_in;
+	data_in.resize(size);
+	PseudoRandom pseudorandom(9421);
+	for (u32 i = 0; i < size; i++)
+		data_in[i] = pseudorandom.range(0, 3);
+
+	// Compressed data is followed by other data in map blocks; the
+	// decompressor must leave it in the stream
+	std::ostringstream os_compressed(std::ios::binary);
+	compress(data_in, os_compressed, SER_FMT_VER_ZSTD);
+	UASSERT(os_compressed.str().size() < size);
+	os_compressed << "trailer";
+
+	std::istringstream is_compressed(os_compressed.str(), std::ios::binary);
+	std::ostringstream os_decompressed(std::ios::binary);
+	decompress(is_compressed, os_decompressed, SER_FMT_VER_ZSTD);
+	UASSERT(os_decompressed.str() == data_in);
+
+	std::string trailer;
+	is_compressed >> trailer;
+	UASSERT(trailer == "trailer");
+
+	// Truncated input must not be accepted
+	std::string truncated = os_compressed.str().substr(0, 100);
+	std::istringstream is_truncated(truncated, std::ios::binary);
+	std::ostringstream os_truncated(std::ios::binary);
+	try {
+		decompress(is_truncated, os_truncated, SER_FMT_VER_ZSTD);
+		UASSERT(false);
+	} catch (SerializationError &e) {
+	}
+#endif
+}
+
+void TestCompression::makeTerrainBlock(MapBlock *block, s16 bx, s16 by, s16 bz)
+{
+	// Rolling hills around y = 0 with a sea, dirt and grass on top of stone,
+	// and some ore; similar to what the default mapgens produce
+	PcgRandom pr(bx * 1000 + by * 100 + bz);
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		s16 x = bx * MAP_BLOCKSIZE + p.X;
+		s16 z = bz * MAP_BLOCKSIZE + p.Z;
+		s16 height = 12 * noise2d_perlin(x / 40.0, z / 40.0, 1, 3, 0.5);
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++) {
+			s16 y = by * MAP_BLOCKSIZE + p.Y;
+			MapNode n(CONTENT_AIR, LIGHT_SUN);
+			if (y < height - 3)
+				n = MapNode(pr.range(0, 40) == 0 ?
+					t_CONTENT_BRICK : t_CONTENT_STONE);
+			else if (y < height)
+				n = MapNode(t_CONTENT_GRASS);
+			else if (y < 0)
+				n = MapNode(t_CONTENT_WATER, 12);
+			block->setNode(p, n);
+		}
+	}
+}
+
+void TestCompression::testBlockCompressionBenchmark(IGameDef *gamedef)
+{
+	struct Codec {
+		const char *name;
+		u8 version;
+		int level;
+	};
+	const Codec codecs[] = {
+		{ "zlib -1", SER_FMT_VER_HIGHEST_WRITE, -1 },
+		{ "zlib 1", SER_FMT_VER_HIGHEST_WRITE, 1 },
+		{ "zlib 9", SER_FMT_VER_HIGHEST_WRITE, 9 },
+#if USE_ZSTD
+		{ "zstd -1", SER_FMT_VER_ZSTD, -1 },
+		{ "zstd 1", SER_FMT_VER_ZSTD, 1 },
+		{ "zstd 9", SER_FMT_VER_ZSTD, 9 },
+#endif
+	};
+
+	std::vector<MapBlock *> blocks;
+	for (s16 z = 0; z < 4; z++)
+	for (s16 y = -2; y < 2; y++)
+	for (s16 x = 0; x < 4; x++) {
+		MapBlock *block = new MapBlock(NULL, v3s16(x, y, z), gamedef);
+		makeTerrainBlock(block, x, y, z);
+		blocks.push_back(block);
+	}
+	const u32 passes = 5;
+	const float raw_mb = (float)blocks.size() * passes *
+		MapBlock::nodecount * sizeof(MapNode) / (1024 * 1024);
+
+	MapBlock result(NULL, v3s16(0, 0, 0), gamedef);
+	for (size_t c = 0; c < ARRLEN(codecs); c++) {
+		std::vector<std::string> serialized(blocks.size());
+		size_t compressed_size = 0;
+
+		u64 t0 = porting::getTimeUs();
+		for (u32 pass = 0; pass < passes; pass++)
+		for (size_t i = 0; i < blocks.size(); i++) {
+			std::ostringstream os(std::ios_base::binary);
+			blocks[i]->serialize(os, codecs[c].version, false, codecs[c].level);
+			serialized[i] = os.str();
+		}
+		u64 t1 = porting::getTimeUs();
+		for (u32 pass = 0; pass < passes; pass++)
+		for (size_t i = 0; i < blocks.size(); i++) {
+			std::istringstream is(serialized[i], std::ios_base::binary);
+			result.deSerialize(is, codecs[c].version, false);
+		}
+		u64 t2 = porting::getTimeUs();
+
+		for (size_t i = 0; i < blocks.size(); i++)
+			compressed_size += serialized[i].size();
+
+		// The last block read back must match its source
+		MapBlock *last = blocks.back();
+		for (u32 i = 0; i < MapBlock::nodecount; i++)
+			UASSERT(result.getData()[i] == last->getData()[i]);
+
+		rawstream << "    " << codecs[c].name << ": "
+			<< (float)compressed_size / blocks.size() << " bytes/block, ratio "
+			<< (float)blocks.size() * MapBlock::nodecount * sizeof(MapNode)
+				/ compressed_size
+			<< ", compress " << raw_mb / ((t1 - t0) / 1000000.0f + 1e-6f)
+			<< " MB/s, decompress "
+			<< raw_mb / ((t2 - t1) / 1000000.0f + 1e-6f) << " MB/s" << std::endl;
+	}
+
+	for (size_t i = 0; i < blocks.size(); i++)
+		delete blocks[i];
+}
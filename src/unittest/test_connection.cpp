@@ -19,9 +19,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <deque>
 #include "log.h"
+#include "porting.h"
 #include "socket.h"
 #include "settings.h"
+#include "threading/thread.h"
+#include "util/numeric.h"
 #include "util/serialize.h"
 #include "network/connection.h"
 
@@ -29,16 +33,24 @@ class TestConnection : public TestBase {
 public:
 	TestConnection()
 	{
-		if (INTERNET_SIMULATOR == false)
+		if (INTERNET_SIMULATOR == false) {
 			TestManager::registerTestModule(this);
+			TestManager::registerBenchmarkModule(this);
+		}
 	}
 
 	const char *getName() { return "TestConnection"; }
 
 	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
 
 	void testHelpers();
 	void testConnectSendReceive();
+	void testConnectionBenchmark();
+	void testCongestionControl();
+
+	void runBenchmark(const Address &server_address, u16 num_clients);
+	float runLossyTransfer(const std::string &congestion_control, u16 port);
 };
 
 static TestConnection g_test_instance;
@@ -49,6 +61,12 @@ void TestConnection::runTests(IGameDef *gamedef)
 	TEST(testConnectSendReceive);
 }
 
+void TestConnection::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testConnectionBenchmark);
+	TEST(testCongestionControl);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct Handler : public con::PeerHandler
@@ -346,3 +364,312 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id == 2);
 }
+
+void TestConnection::runBenchmark(const Address &server_address, u16 num_clients)
+{
+	const u32 proto_id = 0xad26846a;
+	const u32 num_packets = 20000;
+	const u32 packet_size = 100;
+
+	Handler hand_server("server");
+	con::Connection server(proto_id, 512, 30.0, false, &hand_server);
+	server.Serve(server_address);
+
+	std::vector<Handler *> hand_clients;
+	std::vector<con::Connection *> clients;
+	for (u16 i = 0; i < num_clients; i++) {
+		hand_clients.push_back(new Handler("client"));
+		clients.push_back(new con::Connection(proto_id, 512, 30.0, false,
+			hand_clients.back()));
+		clients.back()->Connect(server_address);
+	}
+
+	// Pump both sides until all clients are connected
+	u64 timems0 = porting::getTimeMs();
+	bool connected = false;
+	while (!connected && porting::getTimeMs() - timems0 < 10000) {
+		NetworkPacket pkt;
+		try {
+			server.Receive(&pkt);
+		} catch (con::NoIncomingDataException &e) {
+		}
+
+		connected = hand_server.count == num_clients;
+		for (u16 i = 0; i < num_clients; i++) {
+			try {
+				clients[i]->Receive(&pkt);
+			} catch (con::NoIncomingDataException &e) {
+			}
+			connected = connected && clients[i]->Connected();
+		}
+		sleep_ms(1);
+	}
+	UASSERT(connected);
+
+	// Peer ids are handed out in order, starting at 2
+	u64 t0 = porting::getTimeUs();
+	for (u32 i = 0; i < num_packets; i++) {
+		NetworkPacket pkt(0, packet_size);
+		for (u32 j = 0; j < packet_size; j++)
+			pkt << (u8)j;
+		server.Send(2 + i % num_clients, 0, &pkt, false);
+	}
+	u64 t1 = porting::getTimeUs();
+
+	// Unreliable packets may be dropped, count what arrives
+	u32 received = 0;
+	u64 t2 = t1;
+	timems0 = porting::getTimeMs();
+	while (received < num_packets && porting::getTimeMs() - timems0 < 2000) {
+		bool idle = true;
+		for (u16 i = 0; i < num_clients; i++) {
+			try {
+				NetworkPacket pkt;
+				clients[i]->Receive(&pkt);
+				received++;
+				idle = false;
+				t2 = porting::getTimeUs();
+			} catch (con::NoIncomingDataException &e) {
+			}
+		}
+		if (idle)
+			sleep_ms(1);
+	}
+
+	rawstream << "    " << num_clients << " peers, packets/s: Send "
+		<< (u64)num_packets * 1000000 / MYMAX(t1 - t0, 1)
+		<< ", delivered " << (u64)received * 1000000 / MYMAX(t2 - t0, 1)
+		<< " (" << received << "/" << num_packets << ")" << std::endl;
+
+	for (u16 i = 0; i < num_clients; i++) {
+		delete clients[i];
+		delete hand_clients[i];
+	}
+}
+
+void TestConnection::testConnectionBenchmark()
+{
+	Address address(127, 0, 0, 1, 30002);
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		Address bind_addr(0, 0, 0, 0, 30002);
+		bind_addr.Resolve(bind_str.c_str());
+		if (!bind_addr.isIPv6() && bind_addr != Address(0, 0, 0, 0, 30002))
+			address = bind_addr;
+	} catch (ResolveError &e) {
+	}
+
+	const u16 peer_counts[] = { 1, 10, 100 };
+	for (size_t i = 0; i < ARRLEN(peer_counts); i++) {
+		address.setPort(30002 + i);
+		runBenchmark(address, peer_counts[i]);
+	}
+}
+
+/*
+	Forwards UDP packets between one client and a server like a slow and
+	lossy link: packets are dropped at random, delayed, limited to a
+	bandwidth and dropped when the queue in front of that limit is full.
+*/
+class LinkSimulator : public Thread
+{
+public:
+	LinkSimulator(const Address &bind_addr, const Address &server_addr,
+			u32 loss_permille, u32 delay_ms, u32 bytes_per_ms, u32 queue_ms) :
+		Thread("LinkSimulator"),
+		m_bind_addr(bind_addr),
+		m_server_addr(server_addr),
+		m_loss_permille(loss_permille),
+		m_delay_us(delay_ms * 1000),
+		m_bytes_per_ms(bytes_per_ms),
+		m_queue_us(queue_ms * 1000)
+	{
+	}
+
+	~LinkSimulator()
+	{
+		stop();
+		wait();
+	}
+
+private:
+	struct QueuedPacket
+	{
+		u64 time;
+		std::string data;
+	};
+
+	struct Direction
+	{
+		Direction() : busy_until(0) {}
+
+		u64 busy_until;
+		std::deque<QueuedPacket> queue;
+	};
+
+	void forward(Direction &d, const char *data, int size, u64 now)
+	{
+		if (myrand() % 1000 < m_loss_permille)
+			return;
+
+		u64 start = MYMAX(now, d.busy_until);
+		if (start - now > m_queue_us)
+			return;
+
+		d.busy_until = start + (u64)size * 1000 / m_bytes_per_ms;
+		QueuedPacket p;
+		p.time = d.busy_until + m_delay_us;
+		p.data.assign(data, size);
+		d.queue.push_back(p);
+	}
+
+	void deliver(UDPSocket &socket, Direction &d, const Address &to, u64 now)
+	{
+		while (!d.queue.empty() && d.queue.front().time <= now) {
+			const std::string &data = d.queue.front().data;
+			try {
+				socket.Send(to, data.c_str(), data.size());
+			} catch (SendFailedException &e) {
+			}
+			d.queue.pop_front();
+		}
+	}
+
+	void *run()
+	{
+		UDPSocket socket(false);
+		socket.Bind(m_bind_addr);
+		socket.setTimeoutMs(1);
+
+		Address client_addr;
+		bool have_client = false;
+		char buf[2048];
+		while (!stopRequested()) {
+			Address sender;
+			int size = socket.Receive(sender, buf, sizeof(buf));
+			u64 now = porting::getTimeUs();
+			if (size > 0) {
+				if (sender == m_server_addr) {
+					if (have_client)
+						forward(m_to_client, buf, size, now);
+				} else {
+					client_addr = sender;
+					have_client = true;
+					forward(m_to_server, buf, size, now);
+				}
+			}
+
+			deliver(socket, m_to_server, m_server_addr, now);
+			if (have_client)
+				deliver(socket, m_to_client, client_addr, now);
+		}
+		return NULL;
+	}
+
+	Address m_bind_addr;
+	Address m_server_addr;
+	u32 m_loss_permille;
+	u64 m_delay_us;
+	u32 m_bytes_per_ms;
+	u64 m_queue_us;
+	Direction m_to_server;
+	Direction m_to_client;
+};
+
+// Sets a setting for as long as it is in scope
+class ScopedSetting
+{
+public:
+	ScopedSetting(const std::string &name, const std::string &value) :
+		m_name(name),
+		m_old_value(g_settings->get(name))
+	{
+		g_settings->set(name, value);
+	}
+
+	~ScopedSetting()
+	{
+		g_settings->set(m_name, m_old_value);
+	}
+
+private:
+	std::string m_name;
+	std::string m_old_value;
+};
+
+float TestConnection::runLossyTransfer(const std::string &congestion_control,
+		u16 port)
+{
+	const u32 proto_id = 0xad26846a;
+	const u32 num_packets = 250;
+	const u32 packet_size = 2000;
+
+	ScopedSetting setting("congestion_control", congestion_control);
+
+	Address server_address(127, 0, 0, 1, port);
+	Address link_address(127, 0, 0, 1, port + 1);
+
+	// 5% loss in each direction, 40 ms one way, 1 MB/s, 100 ms of queue
+	LinkSimulator link(link_address, server_address, 50, 40, 1000, 100);
+	link.start();
+
+	Handler hand_server("server");
+	Handler hand_client("client");
+	con::Connection server(proto_id, 512, 30.0, false, &hand_server);
+	server.Serve(server_address);
+	con::Connection client(proto_id, 512, 30.0, false, &hand_client);
+	client.Connect(link_address);
+
+	u64 timems0 = porting::getTimeMs();
+	while ((hand_server.count == 0 || !client.Connected()) &&
+			porting::getTimeMs() - timems0 < 10000) {
+		NetworkPacket pkt;
+		try {
+			server.Receive(&pkt);
+		} catch (con::NoIncomingDataException &e) {
+		}
+		try {
+			client.Receive(&pkt);
+		} catch (con::NoIncomingDataException &e) {
+		}
+		sleep_ms(1);
+	}
+	UASSERT(hand_server.count == 1);
+	UASSERT(client.Connected());
+
+	// Give the client's request for the big send window time to arrive
+	sleep_ms(500);
+
+	u64 t0 = porting::getTimeMs();
+	for (u32 i = 0; i < num_packets; i++) {
+		NetworkPacket pkt(0, packet_size);
+		for (u32 j = 0; j < packet_size; j++)
+			pkt << (u8)(i + j);
+		server.Send(hand_server.last_id, 0, &pkt, true);
+	}
+
+	u32 received = 0;
+	while (received < num_packets && porting::getTimeMs() - t0 < 60000) {
+		try {
+			NetworkPacket pkt;
+			client.Receive(&pkt);
+			UASSERT(pkt.getSize() == packet_size);
+			received++;
+		} catch (con::NoIncomingDataException &e) {
+			sleep_ms(1);
+		}
+	}
+	u64 t1 = porting::getTimeMs();
+
+	UASSERT(received == num_packets);
+	return (float)num_packets * packet_size / MYMAX(t1 - t0, 1);
+}
+
+void TestConnection::testCongestionControl()
+{
+	float legacy = runLossyTransfer("legacy", 30010);
+	float bbr = runLossyTransfer("bbr", 30012);
+
+	rawstream << "    Reliable transfer over a lossy link (1000 KB/s), KB/s: "
+		<< "legacy " << legacy << ", bbr " << bbr << std::endl;
+}
@@ -0,0 +1,372 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "database-dummy.h"
+#ifdef _WIN32
+#include "database-sqlite3.h"
+#endif
+#include "filesys.h"
+#include "map.h"
+#include "porting.h"
+#include "settings.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/numeric.h"
+#include "util/string.h"
+
+// Fails every write while fail is set, and throws on commit like
+// SQLite3 does while fail_commit is set
+class FailingDatabase : public Database_Dummy {
+public:
+	FailingDatabase() : fail(false), fail_commit(false) {}
+
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		return !fail && Database_Dummy::saveBlock(pos, data);
+	}
+
+	void endSave()
+	{
+		if (fail_commit)
+			throw DatabaseException("Failed to commit transaction");
+	}
+
+	bool fail;
+	bool fail_commit;
+};
+
+class TestMapDatabase : public TestBase {
+public:
+	TestMapDatabase()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testBatchedAccessDummy();
+#ifdef _WIN32
+	void testBatchedAccessSQLite3();
+	void testSQLite3Benchmark();
+#endif
+	void testMapSaveThread();
+	void testMapSaveThreadFailedWrites();
+
+	void checkLoadBlocks(MapDatabase *db);
+	void checkSaveBlocks(MapDatabase *db);
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	TEST(testBatchedAccessDummy);
+#ifdef _WIN32
+	TEST(testBatchedAccessSQLite3);
+#endif
+	TEST(testMapSaveThread);
+	TEST(testMapSaveThreadFailedWrites);
+}
+
+void TestMapDatabase::runBenchmarks(IGameDef *gamedef)
+{
+#ifdef _WIN32
+	TEST(testSQLite3Benchmark);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapDatabase::checkLoadBlocks(MapDatabase *db)
+{
+	// Every other block of a 6x6 area is stored
+	db->beginSave();
+	for (s16 x = -3; x < 3; x++)
+	for (s16 z = -3; z < 3; z++) {
+		if ((x + z) & 1)
+			continue;
+		v3s16 p(x, 1, z);
+		UASSERT(db->saveBlock(p, "block" + itos(x) + "," + itos(z)));
+	}
+	db->endSave();
+
+	// More positions than one SQLite3 batch, with duplicates
+	std::vector<v3s16> pos;
+	for (s16 x = -3; x < 3; x++)
+	for (s16 z = -3; z < 3; z++)
+		pos.push_back(v3s16(x, 1, z));
+	pos.push_back(v3s16(0, 1, 0));
+	pos.push_back(v3s16(0, 2, 0));
+
+	std::vector<std::string> blocks;
+	blocks.push_back("stale");
+	db->loadBlocks(pos, &blocks);
+	UASSERTEQ(size_t, blocks.size(), pos.size());
+
+	for (size_t i = 0; i < pos.size(); i++) {
+		std::string expected;
+		db->loadBlock(pos[i], &expected);
+		UASSERT(blocks[i] == expected);
+	}
+	UASSERT(blocks[0] == "block-3,-3");
+	UASSERT(blocks[1] == "");
+	UASSERT(blocks[pos.size() - 2] == "block0,0");
+	UASSERT(blocks[pos.size() - 1] == "");
+
+	pos.clear();
+	db->loadBlocks(pos, &blocks);
+	UASSERT(blocks.empty());
+}
+
+void TestMapDatabase::checkSaveBlocks(MapDatabase *db)
+{
+	// One full SQLite3 batch and a few more
+	std::vector<v3s16> pos;
+	std::vector<std::string> blocks;
+	for (s16 i = 0; i < 20; i++) {
+		pos.push_back(v3s16(i, -1, 5));
+		blocks.push_back("saved" + itos(i));
+	}
+
+	db->beginSave();
+	UASSERT(db->saveBlocks(pos, blocks));
+	db->endSave();
+
+	// Existing blocks are replaced
+	blocks[0] = "replaced";
+	blocks[19] = "replaced too";
+	db->beginSave();
+	UASSERT(db->saveBlocks(pos, blocks));
+	db->endSave();
+
+	for (size_t i = 0; i < pos.size(); i++) {
+		std::string stored;
+		db->loadBlock(pos[i], &stored);
+		UASSERT(stored == blocks[i]);
+	}
+
+	std::vector<v3s16> all;
+	db->listAllLoadableBlocks(all);
+	UASSERTEQ(size_t, all.size(), 18 + pos.size());
+}
+
+void TestMapDatabase::testBatchedAccessDummy()
+{
+	Database_Dummy db;
+	checkLoadBlocks(&db);
+	checkSaveBlocks(&db);
+}
+
+#ifdef _WIN32
+void TestMapDatabase::testBatchedAccessSQLite3()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "sqlite3";
+	{
+		MapDatabaseSQLite3 db(dir);
+		checkLoadBlocks(&db);
+		checkSaveBlocks(&db);
+	}
+	fs::RecursiveDelete(dir);
+}
+
+void TestMapDatabase::testSQLite3Benchmark()
+{
+	const size_t num_blocks = 4096;
+	const size_t batch_size = 64;
+
+	std::vector<v3s16> pos;
+	std::vector<std::string> blocks;
+	for (size_t i = 0; i < num_blocks; i++) {
+		pos.push_back(v3s16(i % 16, (i / 16) % 16, i / 256));
+		// About the size of a compressed block with some detail in it
+		std::string data(1500, '\0');
+		for (size_t j = 0; j < data.size(); j++)
+			data[j] = myrand() & 0xff;
+		blocks.push_back(data);
+	}
+
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "sqlite3_bench";
+	{
+		MapDatabaseSQLite3 db(dir);
+
+		u64 t0 = porting::getTimeUs();
+		db.beginSave();
+		for (size_t i = 0; i < num_blocks; i++)
+			db.saveBlock(pos[i], blocks[i]);
+		db.endSave();
+
+		u64 t1 = porting::getTimeUs();
+		for (size_t i = 0; i < num_blocks; i += batch_size) {
+			std::vector<v3s16> p(pos.begin() + i, pos.begin() + i + batch_size);
+			std::vector<std::string> b(blocks.begin() + i,
+				blocks.begin() + i + batch_size);
+			db.beginSave();
+			db.saveBlocks(p, b);
+			db.endSave();
+		}
+
+		u64 t2 = porting::getTimeUs();
+		std::string data;
+		for (size_t i = 0; i < num_blocks; i++)
+			db.loadBlock(pos[i], &data);
+
+		u64 t3 = porting::getTimeUs();
+		std::vector<std::string> loaded;
+		for (size_t i = 0; i < num_blocks; i += 16) {
+			std::vector<v3s16> p(pos.begin() + i, pos.begin() + i + 16);
+			db.loadBlocks(p, &loaded);
+		}
+		u64 t4 = porting::getTimeUs();
+
+		UASSERT(loaded.back() == blocks.back());
+
+		std::string journal_mode = g_settings->get("sqlite_journal_mode");
+		rawstream << "    SQLite3 (journal mode "
+			<< (journal_mode.empty() ? "unchanged" : journal_mode)
+			<< ", synchronous " << g_settings->get("sqlite_synchronous")
+			<< "), blocks/s: saveBlock " << num_blocks * 1000000 / MYMAX(t1 - t0, 1)
+			<< ", saveBlocks by " << batch_size << " per transaction "
+			<< num_blocks * 1000000 / MYMAX(t2 - t1, 1)
+			<< ", loadBlock " << num_blocks * 1000000 / MYMAX(t3 - t2, 1)
+			<< ", loadBlocks " << num_blocks * 1000000 / MYMAX(t4 - t3, 1)
+			<< std::endl;
+	}
+	fs::RecursiveDelete(dir);
+}
+#endif
+
+void TestMapDatabase::testMapSaveThread()
+{
+	Database_Dummy db;
+	Mutex db_mutex;
+
+	{
+		MapSaveThread thread(&db, &db_mutex, 4);
+
+		// Saving a queued block again only keeps the newest data
+		std::string data = "old";
+		thread.push(v3s16(0, 0, 0), &data);
+		data = "new";
+		thread.push(v3s16(0, 0, 0), &data);
+		UASSERTEQ(size_t, thread.getQueueSize(), 1);
+
+		std::string pending;
+		{
+			MutexAutoLock lock(db_mutex);
+			UASSERT(thread.getPending(v3s16(0, 0, 0), &pending));
+			UASSERT(!thread.isPending(v3s16(1, 0, 0)));
+		}
+		UASSERT(pending == "new");
+
+		// Cancelled blocks are not written
+		data = "deleted";
+		thread.push(v3s16(1, 0, 0), &data);
+		{
+			MutexAutoLock lock(db_mutex);
+			thread.cancel(v3s16(1, 0, 0));
+		}
+
+		// Writing while more blocks than the queue limit are pushed
+		thread.start();
+		for (s16 i = 2; i < 100; i++) {
+			data = "block" + itos(i);
+			thread.push(v3s16(i, 0, 0), &data);
+			UASSERT(thread.getQueueSize() <= 4);
+
+			// Every block is either queued or written
+			MutexAutoLock lock(db_mutex);
+			std::string stored;
+			v3s16 p(i / 2, 0, 0);
+			if (!thread.getPending(p, &stored))
+				db.loadBlock(p, &stored);
+			UASSERT(p.X == 1 ? stored.empty() : !stored.empty());
+		}
+		// The destructor writes the rest
+	}
+
+	std::string stored;
+	db.loadBlock(v3s16(0, 0, 0), &stored);
+	UASSERT(stored == "new");
+	stored.clear();
+	db.loadBlock(v3s16(1, 0, 0), &stored);
+	UASSERT(stored.empty());
+	for (s16 i = 2; i < 100; i++) {
+		db.loadBlock(v3s16(i, 0, 0), &stored);
+		UASSERT(stored == "block" + itos(i));
+	}
+}
+
+void TestMapDatabase::testMapSaveThreadFailedWrites()
+{
+	FailingDatabase db;
+	Mutex db_mutex;
+	// Not started; blocks are written by flush()
+	MapSaveThread thread(&db, &db_mutex, 2);
+
+	db.fail = true;
+	std::string data = "first";
+	thread.push(v3s16(0, 0, 0), &data);
+	UASSERT(!thread.flush());
+
+	// The block stays queued and readable
+	std::string stored;
+	{
+		MutexAutoLock lock(db_mutex);
+		UASSERT(thread.getPending(v3s16(0, 0, 0), &stored));
+	}
+	UASSERT(stored == "first");
+
+	// A database exception is a failed write too
+	db.fail = false;
+	db.fail_commit = true;
+	UASSERT(!thread.flush());
+	{
+		MutexAutoLock lock(db_mutex);
+		UASSERT(thread.getPending(v3s16(0, 0, 0), &stored));
+	}
+	db.fail = true;
+	db.fail_commit = false;
+
+	// Pushing does not wait for a writer that keeps failing
+	for (s16 i = 1; i < 5; i++) {
+		data = "block" + itos(i);
+		thread.push(v3s16(i, 0, 0), &data);
+	}
+	UASSERTEQ(size_t, thread.getQueueSize(), 5);
+
+	// Saving again replaces the data that failed to be written
+	data = "second";
+	thread.push(v3s16(0, 0, 0), &data);
+
+	db.fail = false;
+	UASSERT(thread.flush());
+	UASSERTEQ(size_t, thread.getQueueSize(), 0);
+	stored.clear();
+	db.loadBlock(v3s16(0, 0, 0), &stored);
+	UASSERT(stored == "second");
+	for (s16 i = 1; i < 5; i++) {
+		db.loadBlock(v3s16(i, 0, 0), &stored);
+		UASSERT(stored == "block" + itos(i));
+	}
+}
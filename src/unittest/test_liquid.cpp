@@ -0,0 +1,228 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "emerge.h"
+#include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "porting.h"
+#include "settings.h"
+#include "threading/thread.h"
+
+class TestLiquid : public TestBase {
+public:
+	TestLiquid()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestLiquid"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testLiquidThreadsExact(IGameDef *gamedef);
+	void testLiquidThreadDeferred(IGameDef *gamedef);
+	void testFloodBenchmark(IGameDef *gamedef);
+
+	ServerMap *makeMap(IGameDef *gamedef, EmergeManager *emerge,
+		u16 num_threads, s16 radius);
+	void addWater(ServerMap *map, v3s16 minp, v3s16 maxp);
+	void getNodes(Map *map, s16 radius, std::vector<MapNode> *nodes);
+};
+
+static TestLiquid g_test_instance;
+
+void TestLiquid::runTests(IGameDef *gamedef)
+{
+	std::string orig_threads = g_settings->get("num_liquid_threads");
+	std::string orig_loop_max = g_settings->get("liquid_loop_max");
+
+	TEST(testLiquidThreadsExact, gamedef);
+	TEST(testLiquidThreadDeferred, gamedef);
+
+	g_settings->set("liquid_loop_max", orig_loop_max);
+	g_settings->set("num_liquid_threads", orig_threads);
+}
+
+void TestLiquid::runBenchmarks(IGameDef *gamedef)
+{
+	std::string orig_threads = g_settings->get("num_liquid_threads");
+
+	TEST(testFloodBenchmark, gamedef);
+
+	g_settings->set("num_liquid_threads", orig_threads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A stone floor below y = 0 and air above
+ServerMap *TestLiquid::makeMap(IGameDef *gamedef, EmergeManager *emerge,
+	u16 num_threads, s16 radius)
+{
+	g_settings->setU16("num_liquid_threads", num_threads);
+	return makeTestMap(gamedef, emerge, radius,
+		MapNode(t_CONTENT_STONE), MapNode(CONTENT_AIR, LIGHT_SUN));
+}
+
+void TestLiquid::addWater(ServerMap *map, v3s16 minp, v3s16 maxp)
+{
+	std::vector<std::pair<v3s16, MapNode> > nodes;
+	for (s16 z = minp.Z; z <= maxp.Z; z++)
+	for (s16 y = minp.Y; y <= maxp.Y; y++)
+	for (s16 x = minp.X; x <= maxp.X; x++)
+		nodes.push_back(std::make_pair(v3s16(x, y, z), MapNode(t_CONTENT_WATER)));
+
+	std::map<v3s16, MapBlock *> modified_blocks;
+	map->addNodesAndUpdate(nodes, modified_blocks);
+}
+
+void TestLiquid::getNodes(Map *map, s16 radius, std::vector<MapNode> *nodes)
+{
+	nodes->clear();
+	for (s16 x = -radius; x <= radius; x++)
+	for (s16 y = -radius; y <= radius; y++)
+	for (s16 z = -radius; z <= radius; z++) {
+		MapBlock *block = map->getBlockNoCreateNoEx(v3s16(x, y, z));
+		nodes->insert(nodes->end(), block->getData(),
+			block->getData() + MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	}
+}
+
+void TestLiquid::testLiquidThreadsExact(IGameDef *gamedef)
+{
+	const s16 radius = 2;
+	EmergeManager emerge(gamedef);
+
+	// Water falling onto the floor across block borders, two springs
+	// running into each other, and a small limit on the nodes per step.
+	// With liquid threads, each step is applied once it is decided, which
+	// a server does at its next liquid update.
+	g_settings->setS32("liquid_loop_max", 500);
+	std::vector<MapNode> expected, nodes;
+	s32 expected_queue_size = 0;
+	const u16 thread_counts[] = {0, 1, 4};
+	for (size_t j = 0; j < ARRLEN(thread_counts); j++) {
+		u16 threads = thread_counts[j];
+		ServerMap *map = makeMap(gamedef, &emerge, threads, radius);
+		addWater(map, v3s16(-2, 10, -2), v3s16(2, 10, 2));
+		addWater(map, v3s16(12, 0, 0), v3s16(12, 0, 0));
+		addWater(map, v3s16(20, 0, 0), v3s16(20, 0, 0));
+
+		for (int i = 0; i < 40; i++) {
+			std::map<v3s16, MapBlock *> modified_blocks;
+			map->transformLiquids(modified_blocks, NULL);
+			map->finishLiquidTransforms(modified_blocks, NULL);
+		}
+
+		if (threads == 0) {
+			getNodes(map, radius, &expected);
+			expected_queue_size = map->transforming_liquid_size();
+
+			// The water reached the floor and spread out on it
+			UASSERT(map->getNodeNoEx(v3s16(0, 0, 0)).getContent() ==
+				t_CONTENT_WATER_FLOWING);
+			UASSERT(map->getNodeNoEx(v3s16(6, 0, 0)).getContent() ==
+				t_CONTENT_WATER_FLOWING);
+			UASSERT(map->getNodeNoEx(v3s16(16, 0, 0)).getContent() ==
+				t_CONTENT_WATER_FLOWING);
+			UASSERT(map->getNodeNoEx(v3s16(0, 5, 12)).getContent() ==
+				CONTENT_AIR);
+		} else {
+			getNodes(map, radius, &nodes);
+			UASSERTEQ(size_t, nodes.size(), expected.size());
+			u32 num_different = 0;
+			for (size_t i = 0; i < nodes.size(); i++) {
+				num_different += nodes[i].getContent() != expected[i].getContent() ||
+					nodes[i].param2 != expected[i].param2;
+			}
+			UASSERTEQ(u32, num_different, 0);
+			UASSERTEQ(s32, map->transforming_liquid_size(), expected_queue_size);
+		}
+		delete map;
+	}
+}
+
+void TestLiquid::testLiquidThreadDeferred(IGameDef *gamedef)
+{
+	EmergeManager emerge(gamedef);
+	ServerMap *map = makeMap(gamedef, &emerge, 1, 1);
+	addWater(map, v3s16(0, 5, 0), v3s16(0, 5, 0));
+	std::map<v3s16, MapBlock *> modified_blocks;
+
+	// The flow below the source is only applied by the next step
+	map->transformLiquids(modified_blocks, NULL);
+	UASSERT(map->getNodeNoEx(v3s16(0, 4, 0)).getContent() == CONTENT_AIR);
+	UASSERT(modified_blocks.empty());
+	map->finishLiquidTransforms(modified_blocks, NULL);
+	UASSERT(map->getNodeNoEx(v3s16(0, 4, 0)).getContent() ==
+		t_CONTENT_WATER_FLOWING);
+	UASSERT(!modified_blocks.empty());
+
+	// A node changed while the flow into it was being decided is kept
+	map->transformLiquids(modified_blocks, NULL);
+	MapNode stone(t_CONTENT_STONE);
+	map->setNode(v3s16(0, 3, 0), stone);
+	map->finishLiquidTransforms(modified_blocks, NULL);
+	UASSERT(map->getNodeNoEx(v3s16(0, 3, 0)).getContent() == t_CONTENT_STONE);
+
+	delete map;
+}
+
+void TestLiquid::testFloodBenchmark(IGameDef *gamedef)
+{
+	const s16 radius = 3;
+	const int num_steps = 30;
+	const u32 step_interval_ms = 50;
+	EmergeManager emerge(gamedef);
+
+	// A lake of water sources above the floor of a 112^3 node map, as if
+	// a dam broke. Only the time spent in the server step is counted; the
+	// liquid threads have the time until the next liquid update.
+	u16 max_threads = MYMAX(Thread::getNumberOfProcessors(), 1);
+	for (u16 threads = 0; threads <= max_threads;
+			threads = threads ? threads * 2 : 1) {
+		ServerMap *map = makeMap(gamedef, &emerge, threads, radius);
+		addWater(map, v3s16(-16, 20, -16), v3s16(15, 21, 15));
+
+		s32 max_queue_size = 0;
+		u64 step_time = 0;
+		u64 max_step_time = 0;
+		for (int i = 0; i < num_steps; i++) {
+			std::map<v3s16, MapBlock *> modified_blocks;
+			u64 t0 = porting::getTimeUs();
+			map->transformLiquids(modified_blocks, NULL);
+			u64 t = porting::getTimeUs() - t0;
+			step_time += t;
+			max_step_time = MYMAX(max_step_time, t);
+			max_queue_size = MYMAX(max_queue_size, map->transforming_liquid_size());
+			sleep_ms(step_interval_ms);
+		}
+
+		rawstream << "    " << threads << " liquid threads: " << num_steps
+			<< " steps, " << (float)step_time / num_steps / 1000
+			<< " ms/step, at most " << (float)max_step_time / 1000
+			<< " ms, queue up to " << max_queue_size << " nodes, "
+			<< map->transforming_liquid_size() << " left" << std::endl;
+		delete map;
+	}
+}
@@ -0,0 +1,356 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "log.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
+#include "noise.h"
+#include "porting.h"
+#include "rollback_interface.h"
+
+class TestMap : public TestBase {
+public:
+	TestMap()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestMap"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testBlockLookup(IGameDef *gamedef);
+	void testAddNodesWithEvent(IGameDef *gamedef);
+	void testAddNodesRollback(IGameDef *gamedef);
+	void testGetNodeBenchmark(IGameDef *gamedef);
+
+	MapSector *getSector(Map *map, IGameDef *gamedef, v2s16 p2d);
+	void checkBlocks(Map *map, const std::map<v3s16, MapBlock *> &expected,
+		s16 radius);
+};
+
+static TestMap g_test_instance;
+
+class TestMapEventCollector : public MapEventReceiver {
+public:
+	void onMapEditEvent(MapEditEvent *event)
+	{
+		events.push_back(event->clone());
+	}
+
+	~TestMapEventCollector()
+	{
+		for (size_t i = 0; i < events.size(); i++)
+			delete events[i];
+	}
+
+	std::vector<MapEditEvent *> events;
+};
+
+// Records the rollback actions reported by the map
+class TestRollbackRecorder : public IRollbackManager {
+public:
+	void reportAction(const RollbackAction &action)
+	{
+		actions.push_back(action);
+	}
+	std::string getActor() { return ""; }
+	bool isActorGuess() { return false; }
+	void setActor(const std::string &actor, bool is_guess) {}
+	std::string getSuspect(v3s16 p, float nearness_shortcut,
+		float min_nearness)
+	{
+		return "";
+	}
+	void flush() {}
+	std::list<RollbackAction> getNodeActors(v3s16 pos, int range,
+		time_t seconds, int limit)
+	{
+		return std::list<RollbackAction>();
+	}
+	std::list<RollbackAction> getRevertActions(const std::string &actor,
+		time_t seconds)
+	{
+		return std::list<RollbackAction>();
+	}
+
+	std::vector<RollbackAction> actions;
+};
+
+// The test game definitions with a rollback manager
+class TestRollbackGameDef : public IGameDef {
+public:
+	TestRollbackGameDef(IGameDef *gamedef, IRollbackManager *rollback) :
+		m_gamedef(gamedef),
+		m_rollback(rollback)
+	{}
+
+	IItemDefManager *getItemDefManager()
+	{
+		return m_gamedef->getItemDefManager();
+	}
+	INodeDefManager *getNodeDefManager()
+	{
+		return m_gamedef->getNodeDefManager();
+	}
+	ICraftDefManager *getCraftDefManager()
+	{
+		return m_gamedef->getCraftDefManager();
+	}
+	u16 allocateUnknownNodeId(const std::string &name)
+	{
+		return m_gamedef->allocateUnknownNodeId(name);
+	}
+	MtEventManager *getEventManager() { return m_gamedef->getEventManager(); }
+	IRollbackManager *getRollbackManager() { return m_rollback; }
+	const std::vector<ModSpec> &getMods() const
+	{
+		return m_gamedef->getMods();
+	}
+	const ModSpec *getModSpec(const std::string &modname) const
+	{
+		return m_gamedef->getModSpec(modname);
+	}
+	std::string getModStoragePath() const
+	{
+		return m_gamedef->getModStoragePath();
+	}
+	bool registerModStorage(ModMetadata *storage)
+	{
+		return m_gamedef->registerModStorage(storage);
+	}
+	void unregisterModStorage(const std::string &name)
+	{
+		m_gamedef->unregisterModStorage(name);
+	}
+
+private:
+	IGameDef *m_gamedef;
+	IRollbackManager *m_rollback;
+};
+
+void TestMap::runTests(IGameDef *gamedef)
+{
+	TEST(testBlockLookup, gamedef);
+	TEST(testAddNodesWithEvent, gamedef);
+	TEST(testAddNodesRollback, gamedef);
+}
+
+void TestMap::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testGetNodeBenchmark, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MapSector *TestMap::getSector(Map *map, IGameDef *gamedef, v2s16 p2d)
+{
+	MapSector *sector = map->getSectorNoGenerateNoEx(p2d);
+	if (sector == NULL) {
+		sector = new ServerMapSector(map, p2d, gamedef);
+		(*map->getSectorsPtr())[p2d] = sector;
+	}
+	return sector;
+}
+
+void TestMap::checkBlocks(Map *map,
+	const std::map<v3s16, MapBlock *> &expected, s16 radius)
+{
+	for (s16 x = -radius; x <= radius; x++)
+	for (s16 y = -radius; y <= radius; y++)
+	for (s16 z = -radius; z <= radius; z++) {
+		v3s16 p(x, y, z);
+		std::map<v3s16, MapBlock *>::const_iterator it = expected.find(p);
+		MapBlock *block = map->getBlockNoCreateNoEx(p);
+		UASSERT(block == (it == expected.end() ? NULL : it->second));
+	}
+}
+
+void TestMap::testBlockLookup(IGameDef *gamedef)
+{
+	const s16 radius = 6;
+	Map map(dstream, gamedef);
+	std::map<v3s16, MapBlock *> expected;
+	PseudoRandom pr(42);
+
+	// Add and remove random blocks, enough for the table to grow a few
+	// times and for removals in the middle of probe sequences
+	for (int i = 0; i < 4000; i++) {
+		v3s16 p(pr.range(-radius, radius), pr.range(-radius, radius),
+			pr.range(-radius, radius));
+		MapSector *sector = getSector(&map, gamedef, v2s16(p.X, p.Z));
+		MapBlock *block = sector->getBlockNoCreateNoEx(p.Y);
+		if (block == NULL) {
+			if (i % 2)
+				block = sector->createBlankBlock(p.Y);
+			else
+				sector->insertBlock(block = sector->createBlankBlockNoInsert(p.Y));
+			expected[p] = block;
+		} else if (pr.range(0, 2) == 0) {
+			sector->deleteBlock(block);
+			expected.erase(p);
+		}
+
+		// The block just looked up must not be returned after it is gone
+		UASSERT(map.getBlockNoCreateNoEx(p) == (expected.count(p) ?
+			expected[p] : NULL));
+	}
+	checkBlocks(&map, expected, radius);
+
+	// Deleting sectors removes their blocks
+	std::vector<v2s16> sectors;
+	for (s16 x = -radius; x <= 0; x++)
+	for (s16 z = -radius; z <= radius; z++) {
+		v2s16 p2d(x, z);
+		if (map.getSectorNoGenerateNoEx(p2d) == NULL)
+			continue;
+		sectors.push_back(p2d);
+		for (s16 y = -radius; y <= radius; y++)
+			expected.erase(v3s16(x, y, z));
+	}
+	map.deleteSectors(sectors);
+	checkBlocks(&map, expected, radius);
+}
+
+void TestMap::testAddNodesWithEvent(IGameDef *gamedef)
+{
+	Map map(dstream, gamedef);
+	for (s16 x = 0; x <= 1; x++) {
+		MapSector *sector = getSector(&map, gamedef, v2s16(x, 0));
+		MapBlock *block = sector->createBlankBlock(0);
+		for (s16 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++)
+			block->getData()[i] = MapNode(CONTENT_AIR);
+	}
+
+	TestMapEventCollector collector;
+	map.addEventReceiver(&collector);
+
+	// Nodes in two blocks and one in a block that is not loaded
+	std::vector<std::pair<v3s16, MapNode> > nodes;
+	for (s16 x = 10; x < 20; x++)
+		nodes.push_back(std::make_pair(v3s16(x, 5, 5),
+			MapNode(t_CONTENT_STONE, 0, x)));
+	nodes.push_back(std::make_pair(v3s16(40, 5, 5), MapNode(t_CONTENT_STONE)));
+	map.addNodesWithEvent(nodes);
+	map.removeEventReceiver(&collector);
+
+	UASSERTEQ(size_t, collector.events.size(), 1);
+	MapEditEvent *event = collector.events[0];
+	UASSERT(event->type == MEET_OTHER);
+	UASSERT(event->modified_blocks.count(v3s16(0, 0, 0)) == 1);
+	UASSERT(event->modified_blocks.count(v3s16(1, 0, 0)) == 1);
+	UASSERT(event->modified_blocks.count(v3s16(2, 0, 0)) == 0);
+
+	for (s16 x = 10; x < 20; x++) {
+		MapNode n = map.getNodeNoEx(v3s16(x, 5, 5));
+		UASSERT(n.getContent() == t_CONTENT_STONE);
+		UASSERTEQ(int, n.getParam2(), x);
+	}
+}
+
+void TestMap::testAddNodesRollback(IGameDef *gamedef)
+{
+	TestRollbackRecorder recorder;
+	TestRollbackGameDef rollback_gamedef(gamedef, &recorder);
+	Map map(dstream, &rollback_gamedef);
+	MapBlock *block = getSector(&map, &rollback_gamedef, v2s16(0, 0))
+		->createBlankBlock(0);
+	for (s16 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++)
+		block->getData()[i] = MapNode(CONTENT_AIR);
+
+	// The same position is changed three times
+	v3s16 p(5, 5, 5);
+	std::vector<std::pair<v3s16, MapNode> > nodes;
+	for (u8 i = 1; i <= 3; i++)
+		nodes.push_back(std::make_pair(p, MapNode(t_CONTENT_STONE, 0, i)));
+	std::map<v3s16, MapBlock *> modified_blocks;
+	map.addNodesAndUpdate(nodes, modified_blocks, true);
+
+	// Each action goes from the node of the last one to its own node
+	UASSERTEQ(size_t, recorder.actions.size(), 3);
+	for (u8 i = 0; i < 3; i++) {
+		const RollbackAction &action = recorder.actions[i];
+		UASSERT(action.p == p);
+		UASSERT(action.n_new.name == "default:stone");
+		UASSERTEQ(int, action.n_new.param2, i + 1);
+		if (i == 0)
+			UASSERT(action.n_old.name == "air");
+		else
+			UASSERTEQ(int, action.n_old.param2, i);
+	}
+}
+
+void TestMap::testGetNodeBenchmark(IGameDef *gamedef)
+{
+	const s16 radius = 5;
+	const u32 num_lookups = 1000000;
+	Map map(dstream, gamedef);
+
+	for (s16 x = -radius; x <= radius; x++)
+	for (s16 z = -radius; z <= radius; z++) {
+		MapSector *sector = getSector(&map, gamedef, v2s16(x, z));
+		for (s16 y = -radius; y <= radius; y++) {
+			MapBlock *block = sector->createBlankBlock(y);
+			for (s16 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++)
+				block->getData()[i] = MapNode(i % 2 ? t_CONTENT_STONE : CONTENT_AIR);
+		}
+	}
+
+	// Random nodes, some of them outside of the loaded blocks
+	std::vector<v3s16> positions;
+	PseudoRandom pr(7);
+	s16 n = (radius + 1) * MAP_BLOCKSIZE;
+	for (u32 i = 0; i < num_lookups; i++)
+		positions.push_back(v3s16(pr.range(-n, n - 1), pr.range(-n, n - 1),
+			pr.range(-n, n - 1)));
+
+	// Through the sector and its blocks, like getBlockNoCreateNoEx was
+	u64 t0 = porting::getTimeUs();
+	u32 num_stone_sectors = 0;
+	for (u32 i = 0; i < num_lookups; i++) {
+		v3s16 blockpos = getNodeBlockPos(positions[i]);
+		MapSector *sector = map.getSectorNoGenerateNoEx(
+			v2s16(blockpos.X, blockpos.Z));
+		MapBlock *block = sector ? sector->getBlockNoCreateNoEx(blockpos.Y) : NULL;
+		if (block == NULL)
+			continue;
+		bool is_valid_position;
+		num_stone_sectors += block->getNodeNoCheck(
+			positions[i] - blockpos * MAP_BLOCKSIZE,
+			&is_valid_position).getContent() == t_CONTENT_STONE;
+	}
+	u64 t1 = porting::getTimeUs();
+
+	u32 num_stone = 0;
+	for (u32 i = 0; i < num_lookups; i++)
+		num_stone += map.getNodeNoEx(positions[i]).getContent() == t_CONTENT_STONE;
+	u64 t2 = porting::getTimeUs();
+
+	UASSERTEQ(u32, num_stone, num_stone_sectors);
+
+	rawstream << "    " << num_lookups << " random getNodeNoEx: sectors "
+		<< (float)(t1 - t0) * 1000 / num_lookups << " ns, block table "
+		<< (float)(t2 - t1) * 1000 / num_lookups << " ns" << std::endl;
+}
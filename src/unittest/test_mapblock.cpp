@@ -0,0 +1,163 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "mapblock.h"
+#include "serialization.h"
+#include "voxel.h"
+
+class TestMapBlock : public TestBase {
+public:
+	TestMapBlock() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlock"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testContentSummary();
+	void testBlockContentSummary(IGameDef *gamedef);
+	void testNetworkDataCache(IGameDef *gamedef);
+};
+
+static TestMapBlock g_test_instance;
+
+void TestMapBlock::runTests(IGameDef *gamedef)
+{
+	TEST(testContentSummary);
+	TEST(testBlockContentSummary, gamedef);
+	TEST(testNetworkDataCache, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapBlock::testContentSummary()
+{
+	ContentSummary a, b;
+	UASSERT(!a.intersects(b));
+	UASSERT(!a.mayContain(CONTENT_AIR));
+
+	a.add(CONTENT_AIR);
+	a.add(t_CONTENT_STONE);
+	UASSERT(a.mayContain(CONTENT_AIR));
+	UASSERT(a.mayContain(t_CONTENT_STONE));
+
+	b.add(t_CONTENT_STONE + 1);
+	UASSERT(!a.intersects(b));
+	b.add(t_CONTENT_STONE);
+	UASSERT(a.intersects(b));
+
+	// Ids 256 apart share a bit; false positives are allowed
+	ContentSummary c;
+	c.add(300);
+	UASSERT(c.mayContain(300 + 256));
+
+	a.add(c);
+	UASSERT(a.mayContain(300));
+	a.clear();
+	UASSERT(!a.intersects(b));
+}
+
+void TestMapBlock::testBlockContentSummary(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+
+	// A fresh block is all ignore
+	UASSERT(block.getContentSummary().mayContain(CONTENT_IGNORE));
+	UASSERT(!block.getContentSummary().mayContain(t_CONTENT_WATER));
+
+	MapNode n(t_CONTENT_WATER);
+	block.setNode(v3s16(1, 2, 3), n);
+	UASSERT(block.getContentSummary().mayContain(t_CONTENT_WATER));
+
+	MapNode n2(t_CONTENT_LAVA);
+	block.setNodeNoCheck(v3s16(4, 5, 6), n2);
+	UASSERT(block.getContentSummary().mayContain(t_CONTENT_LAVA));
+
+	// Replacing the node leaves the bit set until the summary is rebuilt
+	MapNode stone(t_CONTENT_STONE);
+	block.setNode(v3s16(1, 2, 3), stone);
+	UASSERT(block.getContentSummary().mayContain(t_CONTENT_WATER));
+	block.updateContentSummary();
+	UASSERT(!block.getContentSummary().mayContain(t_CONTENT_WATER));
+	UASSERT(block.getContentSummary().mayContain(t_CONTENT_STONE));
+	UASSERT(block.getContentSummary().mayContain(t_CONTENT_LAVA));
+
+	// Blitting from a VoxelManipulator rebuilds it as well
+	VoxelManipulator vm;
+	VoxelArea area(v3s16(0, 0, 0), v3s16(MAP_BLOCKSIZE - 1,
+		MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1));
+	vm.addArea(area);
+	for (s32 i = 0; i < area.getVolume(); i++)
+		vm.m_data[i] = MapNode(CONTENT_AIR);
+	vm.m_data[area.index(7, 7, 7)] = MapNode(t_CONTENT_BRICK);
+	block.copyFrom(vm);
+
+	const ContentSummary &summary = block.getContentSummary();
+	UASSERT(summary.mayContain(CONTENT_AIR));
+	UASSERT(summary.mayContain(t_CONTENT_BRICK));
+	UASSERT(!summary.mayContain(t_CONTENT_STONE));
+	UASSERT(!summary.mayContain(t_CONTENT_LAVA));
+}
+
+void TestMapBlock::testNetworkDataCache(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	MapNode stone(t_CONTENT_STONE);
+	block.setNode(v3s16(1, 1, 1), stone);
+
+	bool hit = true;
+	std::string first = block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE, -1, &hit);
+	UASSERT(!hit);
+	UASSERT(block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE, -1, &hit) == first);
+	UASSERT(hit);
+
+	// Other versions and levels are serialized separately
+	block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE - 1, -1, &hit);
+	UASSERT(!hit);
+	block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE - 1, -1, &hit);
+	UASSERT(hit);
+	block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE - 1, 1, &hit);
+	UASSERT(!hit);
+
+	// Only the most recent one is kept
+	block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE, -1, &hit);
+	UASSERT(!hit);
+
+	// Any modification invalidates it
+	MapNode water(t_CONTENT_WATER);
+	block.setNode(v3s16(2, 2, 2), water);
+	std::string second = block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE, -1, &hit);
+	UASSERT(!hit);
+	UASSERT(second != first);
+
+	block.setIsUnderground(true);
+	block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE, -1, &hit);
+	UASSERT(!hit);
+
+	// The cached data reads back as the block
+	std::istringstream is(block.getNetworkData(SER_FMT_VER_HIGHEST_WRITE, -1),
+		std::ios_base::binary);
+	MapBlock result(NULL, v3s16(0, 0, 0), gamedef);
+	result.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, false);
+	result.deSerializeNetworkSpecific(is);
+	UASSERT(result.getIsUnderground());
+	UASSERT(result.getNodeNoEx(v3s16(1, 1, 1)).getContent() == t_CONTENT_STONE);
+	UASSERT(result.getNodeNoEx(v3s16(2, 2, 2)).getContent() == t_CONTENT_WATER);
+}
@@ -0,0 +1,228 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "mapblock_snapshot.h"
+#include "noise.h"
+#include "porting.h"
+#include "voxel.h"
+#include "util/directiontables.h"
+
+#define BLOCK_VOLUME (MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE)
+
+class TestMapBlockSnapshot : public TestBase {
+public:
+	TestMapBlockSnapshot()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestMapBlockSnapshot"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testViewMatchesVoxelManipulator();
+	void testSnapshotOutlivesCache();
+	void testMeshDataBenchmark();
+
+	void makeBlocks(MapBlockSnapshot **snapshots,
+		std::vector<MapNode> *blocks);
+};
+
+static TestMapBlockSnapshot g_test_instance;
+
+void TestMapBlockSnapshot::runTests(IGameDef *gamedef)
+{
+	TEST(testViewMatchesVoxelManipulator);
+	TEST(testSnapshotOutlivesCache);
+}
+
+void TestMapBlockSnapshot::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testMeshDataBenchmark);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Random nodes for the 27 blocks around a block, in the order of
+// g_27dirs, with the blocks at odd indices missing (NULL)
+void TestMapBlockSnapshot::makeBlocks(MapBlockSnapshot **snapshots,
+	std::vector<MapNode> *blocks)
+{
+	PseudoRandom pr(27);
+	blocks->resize(27 * BLOCK_VOLUME);
+	for (u32 i = 0; i < blocks->size(); i++)
+		(*blocks)[i] = MapNode(pr.range(0, 200), pr.range(0, 255),
+			pr.range(0, 255));
+
+	for (u16 i = 0; i < 27; i++) {
+		snapshots[i] = i % 2 ? NULL :
+			new MapBlockSnapshot(&(*blocks)[i * BLOCK_VOLUME]);
+	}
+}
+
+// The way MeshMakeData copied the blocks before the snapshots
+static void fill_vmanip(VoxelManipulator *vm, v3s16 blockpos,
+	MapBlockSnapshot **snapshots, std::vector<MapNode> &blocks)
+{
+	v3s16 blockpos_nodes = blockpos * MAP_BLOCKSIZE;
+	vm->clear();
+	vm->addArea(VoxelArea(blockpos_nodes - v3s16(1, 1, 1) * MAP_BLOCKSIZE,
+		blockpos_nodes + v3s16(1, 1, 1) * MAP_BLOCKSIZE * 2 - v3s16(1, 1, 1)));
+
+	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
+	VoxelArea data_area(v3s16(0, 0, 0), data_size - v3s16(1, 1, 1));
+	for (u16 i = 0; i < 27; i++) {
+		if (!snapshots[i])
+			continue;
+		vm->copyFrom(&blocks[i * BLOCK_VOLUME], data_area, v3s16(0, 0, 0),
+			(blockpos + g_27dirs[i]) * MAP_BLOCKSIZE, data_size);
+	}
+}
+
+static void fill_view(MapBlockSnapshotView *view, v3s16 blockpos,
+	MapBlockSnapshot **snapshots)
+{
+	view->reset(blockpos);
+	for (u16 i = 0; i < 27; i++)
+		view->setBlock(g_27dirs[i], snapshots[i]);
+}
+
+void TestMapBlockSnapshot::testViewMatchesVoxelManipulator()
+{
+	MapBlockSnapshot *snapshots[27];
+	std::vector<MapNode> blocks;
+	makeBlocks(snapshots, &blocks);
+
+	const v3s16 blockpos(-3, 2, 5);
+	VoxelManipulator vm;
+	fill_vmanip(&vm, blockpos, snapshots, blocks);
+	MapBlockSnapshotView view;
+	fill_view(&view, blockpos, snapshots);
+
+	// Including a layer of nodes outside of the 27 blocks
+	v3s16 minp = (blockpos - v3s16(1, 1, 1)) * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	v3s16 maxp = (blockpos + v3s16(2, 2, 2)) * MAP_BLOCKSIZE;
+	u32 num_different = 0;
+	for (s16 z = minp.Z; z <= maxp.Z; z++)
+	for (s16 y = minp.Y; y <= maxp.Y; y++)
+	for (s16 x = minp.X; x <= maxp.X; x++) {
+		v3s16 p(x, y, z);
+		MapNode expected = vm.getNodeNoExNoEmerge(p);
+		MapNode n = view.getNodeNoEx(p);
+		num_different += n.getContent() != expected.getContent() ||
+			n.param1 != expected.param1 || n.param2 != expected.param2;
+	}
+	UASSERTEQ(u32, num_different, 0);
+
+	for (u16 i = 0; i < 27; i++) {
+		if (snapshots[i])
+			snapshots[i]->drop();
+	}
+}
+
+void TestMapBlockSnapshot::testSnapshotOutlivesCache()
+{
+	MapNode data[BLOCK_VOLUME];
+	for (u32 i = 0; i < BLOCK_VOLUME; i++)
+		data[i] = MapNode(CONTENT_AIR);
+	data[0] = MapNode(CONTENT_IGNORE);
+
+	// A mesh job reads a block that the cache replaces meanwhile
+	MapBlockSnapshot *cached = new MapBlockSnapshot(data);
+	MapBlockSnapshotView view;
+	view.reset(v3s16(0, 0, 0));
+	view.setBlock(v3s16(0, 0, 0), cached);
+	data[0] = MapNode(CONTENT_UNKNOWN);
+	cached->drop();
+	cached = new MapBlockSnapshot(data);
+
+	UASSERT(view.getNodeNoEx(v3s16(0, 0, 0)).getContent() == CONTENT_IGNORE);
+	UASSERT(cached->getData()[0].getContent() == CONTENT_UNKNOWN);
+	UASSERT(view.getNodeNoEx(v3s16(1, 0, 0)).getContent() == CONTENT_AIR);
+	UASSERT(view.getNodeNoEx(v3s16(-1, 0, 0)).getContent() == CONTENT_IGNORE);
+
+	view.reset(v3s16(0, 0, 0));
+	cached->drop();
+}
+
+void TestMapBlockSnapshot::testMeshDataBenchmark()
+{
+	MapBlockSnapshot *snapshots[27];
+	std::vector<MapNode> blocks;
+	makeBlocks(snapshots, &blocks);
+	// All 27 blocks present, like inside a loaded area
+	for (u16 i = 1; i < 27; i += 2)
+		snapshots[i] = new MapBlockSnapshot(&blocks[i * BLOCK_VOLUME]);
+
+	const u32 jobs = 2000;
+	const v3s16 blockpos(0, 0, 0);
+	// The mesher reads the block and one node around it
+	v3s16 minp = blockpos * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	v3s16 maxp = minp + v3s16(1, 1, 1) * (MAP_BLOCKSIZE + 1);
+
+	u32 sum = 0;
+	u64 t0 = porting::getTimeUs();
+	size_t vm_bytes = 0;
+	for (u32 j = 0; j < jobs; j++) {
+		VoxelManipulator vm;
+		fill_vmanip(&vm, blockpos, snapshots, blocks);
+		vm_bytes = vm.m_area.getVolume() * (sizeof(MapNode) + sizeof(u8));
+	}
+	u64 t1 = porting::getTimeUs();
+	for (u32 j = 0; j < jobs; j++) {
+		MapBlockSnapshotView view;
+		fill_view(&view, blockpos, snapshots);
+	}
+	u64 t2 = porting::getTimeUs();
+
+	VoxelManipulator vm;
+	fill_vmanip(&vm, blockpos, snapshots, blocks);
+	MapBlockSnapshotView view;
+	fill_view(&view, blockpos, snapshots);
+	u64 t3 = porting::getTimeUs();
+	for (u32 j = 0; j < jobs / 10; j++)
+	for (s16 z = minp.Z; z <= maxp.Z; z++)
+	for (s16 y = minp.Y; y <= maxp.Y; y++)
+	for (s16 x = minp.X; x <= maxp.X; x++)
+		sum += vm.getNodeNoExNoEmerge(v3s16(x, y, z)).getContent();
+	u64 t4 = porting::getTimeUs();
+	for (u32 j = 0; j < jobs / 10; j++)
+	for (s16 z = minp.Z; z <= maxp.Z; z++)
+	for (s16 y = minp.Y; y <= maxp.Y; y++)
+	for (s16 x = minp.X; x <= maxp.X; x++)
+		sum -= view.getNodeNoEx(v3s16(x, y, z)).getContent();
+	u64 t5 = porting::getTimeUs();
+	UASSERTEQ(u32, sum, 0);
+
+	rawstream << "    Mesh job setup: VoxelManipulator copy "
+		<< (float)(t1 - t0) / jobs << " us and " << vm_bytes / 1024
+		<< " KiB, snapshot view " << (float)(t2 - t1) / jobs << " us and "
+		<< sizeof(MapBlockSnapshotView) << " bytes" << std::endl;
+	rawstream << "    Reading 18^3 nodes: VoxelManipulator "
+		<< (float)(t4 - t3) / (jobs / 10) << " us, snapshot view "
+		<< (float)(t5 - t4) / (jobs / 10) << " us" << std::endl;
+
+	view.reset(blockpos);
+	for (u16 i = 0; i < 27; i++)
+		snapshots[i]->drop();
+}
@@ -0,0 +1,429 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "emerge.h"
+#include "gamedef.h"
+#include "map.h"
+#include "mapgen.h"
+#include "nodedef.h"
+#include "noise.h"
+#include "porting.h"
+#include "settings.h"
+#include "util/basic_macros.h"
+#include "util/thread.h"
+
+class TestMapgen : public TestBase {
+public:
+	TestMapgen()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
+	const char *getName() { return "TestMapgen"; }
+
+	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
+
+	void testChunkThreadsExact(IGameDef *gamedef, EmergeManager *emerge);
+	void testStageStats(IGameDef *gamedef, EmergeManager *emerge);
+	void testChunkBenchmark(IGameDef *gamedef, EmergeManager *emerge);
+	void testLightingExact(IGameDef *gamedef, EmergeManager *emerge);
+	void testLightingBenchmark(IGameDef *gamedef, EmergeManager *emerge);
+
+	MapgenParams *makeParams(const char *mg_name);
+	void initChunkData(Map *map, Mapgen *mg, IGameDef *gamedef, v3s16 bpmin,
+		BlockMakeData *data);
+	void generateChunk(Mapgen *mg, IGameDef *gamedef, v3s16 bpmin,
+		std::vector<MapNode> *nodes);
+	u32 compareLighting(IGameDef *gamedef, EmergeManager *emerge,
+		const char *mg_name, v3s16 bpmin, u32 num_torches,
+		u64 *reference_us, u64 *us);
+};
+
+static TestMapgen g_test_instance;
+
+static const char *mapgen_names[] = {"v7", "v5", "valleys"};
+
+void TestMapgen::runTests(IGameDef *gamedef)
+{
+	IWritableNodeDefManager *ndef =
+		(IWritableNodeDefManager *)gamedef->getNodeDefManager();
+
+	ndef->resetNodeResolveState();
+	EmergeManager emerge(gamedef);
+	ndef->setNodeRegistrationStatus(true);
+	ndef->runNodeResolveCallbacks();
+
+	// Pools are set up by the tests
+	WorkerPool *orig_pool = emerge.chunk_pool;
+
+	TEST(testChunkThreadsExact, gamedef, &emerge);
+	TEST(testStageStats, gamedef, &emerge);
+	TEST(testLightingExact, gamedef, &emerge);
+
+	emerge.chunk_pool = orig_pool;
+}
+
+void TestMapgen::runBenchmarks(IGameDef *gamedef)
+{
+	IWritableNodeDefManager *ndef =
+		(IWritableNodeDefManager *)gamedef->getNodeDefManager();
+
+	ndef->resetNodeResolveState();
+	EmergeManager emerge(gamedef);
+	ndef->setNodeRegistrationStatus(true);
+	ndef->runNodeResolveCallbacks();
+
+	// Pools are set up by the benchmarks
+	WorkerPool *orig_pool = emerge.chunk_pool;
+
+	TEST(testChunkBenchmark, gamedef, &emerge);
+	TEST(testLightingBenchmark, gamedef, &emerge);
+
+	emerge.chunk_pool = orig_pool;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MapgenParams *TestMapgen::makeParams(const char *mg_name)
+{
+	Settings conf;
+	conf.set("mg_name", mg_name);
+	conf.set("seed", "5900033");
+	conf.set("mg_flags", "caves,dungeons,light,decorations");
+
+	MapgenParams *params =
+		Mapgen::createMapgenParams(Mapgen::getMapgenType(mg_name));
+	params->MapgenParams::readParams(&conf);
+	params->readParams(&conf);
+	return params;
+}
+
+void TestMapgen::initChunkData(Map *map, Mapgen *mg, IGameDef *gamedef,
+	v3s16 bpmin, BlockMakeData *data)
+{
+	data->seed = mg->seed;
+	data->blockpos_min = bpmin;
+	data->blockpos_max = bpmin + v3s16(4, 4, 4);
+	data->blockpos_requested = bpmin;
+	data->nodedef = gamedef->getNodeDefManager();
+	data->vmanip = new MMVManip(map);
+	data->vmanip->initialEmerge(data->blockpos_min - v3s16(1, 1, 1),
+		data->blockpos_max + v3s16(1, 1, 1));
+}
+
+void TestMapgen::generateChunk(Mapgen *mg, IGameDef *gamedef, v3s16 bpmin,
+	std::vector<MapNode> *nodes)
+{
+	Map map(dstream, gamedef);
+
+	BlockMakeData data;
+	initChunkData(&map, mg, gamedef, bpmin, &data);
+	mg->makeChunk(&data);
+
+	if (nodes) {
+		MMVManip *vm = data.vmanip;
+		nodes->assign(vm->m_data, vm->m_data + vm->m_area.getVolume());
+	}
+}
+
+void TestMapgen::testChunkThreadsExact(IGameDef *gamedef, EmergeManager *emerge)
+{
+	// More threads than the sandbox might have processors, so that the
+	// chunk is split even then
+	WorkerPool pool("MapgenTest", 4);
+
+	// Around the surface, and underground with caves
+	v3s16 chunks[] = { v3s16(-2, -2, -2), v3s16(8, -7, -2) };
+
+	for (size_t i = 0; i < ARRLEN(mapgen_names); i++) {
+		MapgenParams *params = makeParams(mapgen_names[i]);
+		Mapgen *mg = Mapgen::createMapgen(params->mgtype, 0, params, emerge);
+
+		for (size_t j = 0; j < ARRLEN(chunks); j++) {
+			std::vector<MapNode> expected, nodes;
+			emerge->chunk_pool = NULL;
+			generateChunk(mg, gamedef, chunks[j], &expected);
+			emerge->chunk_pool = &pool;
+			generateChunk(mg, gamedef, chunks[j], &nodes);
+
+			UASSERTEQ(size_t, nodes.size(), expected.size());
+			u32 num_different = 0, num_stone = 0;
+			for (size_t k = 0; k < nodes.size(); k++) {
+				num_different += !(nodes[k] == expected[k]);
+				num_stone += nodes[k].getContent() == t_CONTENT_STONE;
+			}
+			UASSERTEQ(u32, num_different, 0);
+			// Not just ignore or air
+			UASSERT(num_stone > 0);
+		}
+
+		delete mg;
+		delete params;
+	}
+}
+
+void TestMapgen::testStageStats(IGameDef *gamedef, EmergeManager *emerge)
+{
+	emerge->chunk_pool = NULL;
+	MapgenParams *params = makeParams("v7");
+	Mapgen *mg = Mapgen::createMapgen(params->mgtype, 0, params, emerge);
+
+	// Nothing is kept by default
+	UASSERT(mg->stats == NULL);
+	generateChunk(mg, gamedef, v3s16(-2, -2, -2), NULL);
+
+	MapgenStats stats;
+	mg->stats = &stats;
+	generateChunk(mg, gamedef, v3s16(-2, -2, -2), NULL);
+	UASSERT(stats.stage_us[MGSTAGE_TERRAIN] > 0);
+	UASSERT(stats.stage_us[MGSTAGE_LIGHTING] > 0);
+
+	// Stages add up over chunks
+	MapgenStats first = stats;
+	generateChunk(mg, gamedef, v3s16(3, -2, -2), NULL);
+	for (int i = 0; i != NUM_MGSTAGES; i++)
+		UASSERT(stats.stage_us[i] >= first.stage_us[i]);
+	UASSERT(stats.stage_us[MGSTAGE_TERRAIN] > first.stage_us[MGSTAGE_TERRAIN]);
+
+	MapgenStats total;
+	total.add(stats);
+	total.add(first);
+	UASSERTEQ(u64, total.stage_us[MGSTAGE_CAVES],
+		stats.stage_us[MGSTAGE_CAVES] + first.stage_us[MGSTAGE_CAVES]);
+
+	delete mg;
+	delete params;
+}
+
+void TestMapgen::testChunkBenchmark(IGameDef *gamedef, EmergeManager *emerge)
+{
+	WorkerPool pool("MapgenBench", Thread::getNumberOfProcessors());
+	const u32 num_chunks = 4;
+
+	for (size_t i = 0; i < ARRLEN(mapgen_names); i++) {
+		MapgenParams *params = makeParams(mapgen_names[i]);
+		Mapgen *mg = Mapgen::createMapgen(params->mgtype, 0, params, emerge);
+
+		rawstream << "    " << mapgen_names[i] << ":";
+		WorkerPool *pools[] = { NULL, &pool };
+		for (size_t p = 0; p < ARRLEN(pools); p++) {
+			emerge->chunk_pool = pools[p];
+			u64 t0 = porting::getTimeUs();
+			for (u32 n = 0; n < num_chunks; n++)
+				generateChunk(mg, gamedef, v3s16(-2 + 5 * n, -2, -2), NULL);
+			u64 t1 = porting::getTimeUs();
+
+			rawstream << " " << (pools[p] ? pool.getThreadCount() : 1)
+				<< " threads " << (float)(t1 - t0) / num_chunks / 1000
+				<< " ms/chunk";
+		}
+		rawstream << std::endl;
+
+		delete mg;
+		delete params;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The recursive light spreading mapgens used before, for comparison
+
+static void reference_light_spread(MMVManip *vm, INodeDefManager *ndef,
+	VoxelArea &a, v3s16 p, u8 light)
+{
+	if (light <= 1 || !a.contains(p))
+		return;
+
+	MapNode &n = vm->m_data[vm->m_area.index(p)];
+
+	u8 light_day = light & 0x0F;
+	if (light_day > 0)
+		light_day -= 0x01;
+
+	u8 light_night = light & 0xF0;
+	if (light_night > 0)
+		light_night -= 0x10;
+
+	if ((light_day <= (n.param1 & 0x0F) &&
+		light_night <= (n.param1 & 0xF0)) ||
+		!ndef->get(n).light_propagates)
+		return;
+
+	light = MYMAX(light_day, n.param1 & 0x0F) |
+		MYMAX(light_night, n.param1 & 0xF0);
+	n.param1 = light;
+
+	reference_light_spread(vm, ndef, a, p + v3s16(0, 0, 1), light);
+	reference_light_spread(vm, ndef, a, p + v3s16(0, 1, 0), light);
+	reference_light_spread(vm, ndef, a, p + v3s16(1, 0, 0), light);
+	reference_light_spread(vm, ndef, a, p - v3s16(0, 0, 1), light);
+	reference_light_spread(vm, ndef, a, p - v3s16(0, 1, 0), light);
+	reference_light_spread(vm, ndef, a, p - v3s16(1, 0, 0), light);
+}
+
+static void reference_calc_lighting(MMVManip *vm, INodeDefManager *ndef,
+	s16 water_level, v3s16 nmin, v3s16 nmax, v3s16 full_nmin, v3s16 full_nmax)
+{
+	VoxelArea a(nmin, nmax);
+	v3s16 em = vm->m_area.getExtent();
+	for (s16 z = a.MinEdge.Z; z <= a.MaxEdge.Z; z++)
+	for (s16 x = a.MinEdge.X; x <= a.MaxEdge.X; x++) {
+		u32 i = vm->m_area.index(x, a.MaxEdge.Y + 1, z);
+		if (vm->m_data[i].getContent() == CONTENT_IGNORE) {
+			if (water_level >= nmax.Y)
+				continue;
+		} else if ((vm->m_data[i].param1 & 0x0F) != LIGHT_SUN) {
+			continue;
+		}
+		vm->m_area.add_y(em, i, -1);
+		for (s16 y = a.MaxEdge.Y; y >= a.MinEdge.Y; y--) {
+			MapNode &n = vm->m_data[i];
+			if (!ndef->get(n).sunlight_propagates)
+				break;
+			n.param1 = LIGHT_SUN;
+			vm->m_area.add_y(em, i, -1);
+		}
+	}
+
+	VoxelArea fa(full_nmin, full_nmax);
+	for (s16 z = fa.MinEdge.Z; z <= fa.MaxEdge.Z; z++)
+	for (s16 y = fa.MinEdge.Y; y <= fa.MaxEdge.Y; y++)
+	for (s16 x = fa.MinEdge.X; x <= fa.MaxEdge.X; x++) {
+		MapNode &n = vm->m_data[vm->m_area.index(x, y, z)];
+		if (n.getContent() == CONTENT_IGNORE)
+			continue;
+		const ContentFeatures &cf = ndef->get(n);
+		if (!cf.light_propagates)
+			continue;
+		if (cf.light_source)
+			n.param1 = cf.light_source | (cf.light_source << 4);
+		u8 light = n.param1;
+		if (light) {
+			reference_light_spread(vm, ndef, fa, v3s16(x, y, z + 1), light);
+			reference_light_spread(vm, ndef, fa, v3s16(x, y + 1, z), light);
+			reference_light_spread(vm, ndef, fa, v3s16(x + 1, y, z), light);
+			reference_light_spread(vm, ndef, fa, v3s16(x, y, z - 1), light);
+			reference_light_spread(vm, ndef, fa, v3s16(x, y - 1, z), light);
+			reference_light_spread(vm, ndef, fa, v3s16(x - 1, y, z), light);
+		}
+	}
+}
+
+// Lights an unlit chunk with torches in random air nodes both ways and
+// returns the number of nodes that came out differently
+u32 TestMapgen::compareLighting(IGameDef *gamedef, EmergeManager *emerge,
+	const char *mg_name, v3s16 bpmin, u32 num_torches,
+	u64 *reference_us, u64 *us)
+{
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	MapgenParams *params = makeParams(mg_name);
+	params->flags &= ~MG_LIGHT;
+	Mapgen *mg = Mapgen::createMapgen(params->mgtype, 0, params, emerge);
+
+	Map map(dstream, gamedef);
+	BlockMakeData data;
+	initChunkData(&map, mg, gamedef, bpmin, &data);
+	mg->makeChunk(&data);
+	MMVManip *vm = data.vmanip;
+
+	v3s16 node_min = bpmin * MAP_BLOCKSIZE;
+	v3s16 node_max = (data.blockpos_max + 1) * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	v3s16 full_node_min = node_min - MAP_BLOCKSIZE;
+	v3s16 full_node_max = node_max + MAP_BLOCKSIZE;
+
+	// Also under the open sky and next to each other, where the light of
+	// the torches overrides light spread before
+	PseudoRandom pr(bpmin.X * 1000 + bpmin.Z);
+	for (u32 i = 0; i < num_torches; i++) {
+		v3s16 p(pr.range(node_min.X, node_max.X),
+			pr.range(node_min.Y, node_max.Y),
+			pr.range(node_min.Z, node_max.Z));
+		MapNode &n = vm->m_data[vm->m_area.index(p)];
+		if (n.getContent() == CONTENT_AIR)
+			n = MapNode(t_CONTENT_TORCH);
+	}
+
+	std::vector<MapNode> unlit(vm->m_data,
+		vm->m_data + vm->m_area.getVolume());
+
+	u64 t0 = porting::getTimeUs();
+	reference_calc_lighting(vm, ndef, mg->water_level,
+		node_min - v3s16(0, 1, 0), node_max + v3s16(0, 1, 0),
+		full_node_min, full_node_max);
+	u64 t1 = porting::getTimeUs();
+	std::vector<MapNode> expected(vm->m_data,
+		vm->m_data + vm->m_area.getVolume());
+
+	std::copy(unlit.begin(), unlit.end(), vm->m_data);
+	u64 t2 = porting::getTimeUs();
+	mg->calcLighting(node_min - v3s16(0, 1, 0), node_max + v3s16(0, 1, 0),
+		full_node_min, full_node_max);
+	u64 t3 = porting::getTimeUs();
+
+	*reference_us += t1 - t0;
+	*us += t3 - t2;
+
+	u32 num_different = 0;
+	for (size_t i = 0; i < expected.size(); i++)
+		num_different += vm->m_data[i].param1 != expected[i].param1;
+
+	delete mg;
+	delete params;
+	return num_different;
+}
+
+void TestMapgen::testLightingExact(IGameDef *gamedef, EmergeManager *emerge)
+{
+	emerge->chunk_pool = NULL;
+
+	// Around the surface, and underground with caves
+	v3s16 chunks[] = { v3s16(-2, -2, -2), v3s16(8, -7, -2) };
+	const char *names[] = { "v7", "valleys" };
+
+	for (size_t i = 0; i < ARRLEN(names); i++)
+	for (size_t j = 0; j < ARRLEN(chunks); j++) {
+		u64 reference_us = 0, us = 0;
+		UASSERTEQ(u32, compareLighting(gamedef, emerge, names[i], chunks[j],
+			0, &reference_us, &us), 0);
+		UASSERTEQ(u32, compareLighting(gamedef, emerge, names[i], chunks[j],
+			5000, &reference_us, &us), 0);
+	}
+}
+
+void TestMapgen::testLightingBenchmark(IGameDef *gamedef, EmergeManager *emerge)
+{
+	emerge->chunk_pool = NULL;
+	const char *names[] = { "v7", "valleys" };
+	const u32 num_chunks = 4;
+
+	for (size_t i = 0; i < ARRLEN(names); i++) {
+		u64 reference_us = 0, us = 0;
+		for (u32 n = 0; n < num_chunks; n++) {
+			compareLighting(gamedef, emerge, names[i],
+				v3s16(-2 + 5 * n, -2 - 5 * (n & 1), -2), 0, &reference_us, &us);
+		}
+		rawstream << "    " << names[i] << " lighting: recursive "
+			<< (float)reference_us / num_chunks / 1000 << " ms/chunk, queue "
+			<< (float)us / num_chunks / 1000 << " ms/chunk" << std::endl;
+	}
+}
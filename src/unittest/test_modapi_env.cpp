@@ -0,0 +1,129 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "exceptions.h"
+#include "filesys.h"
+#include "map.h"
+#include "mapblock.h"
+#include "scripting_server.h"
+#include "server.h"
+#include "serverenvironment.h"
+#include "subgame.h"
+
+class TestModApiEnv : public TestBase {
+public:
+	TestModApiEnv() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestModApiEnv"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSetNodes();
+};
+
+static TestModApiEnv g_test_instance;
+
+void TestModApiEnv::runTests(IGameDef *gamedef)
+{
+	TEST(testSetNodes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const char *set_nodes_mod =
+	"settest = {destructs = 0}\n"
+	"minetest.register_node(\"settest:stone\", {})\n"
+	"minetest.register_node(\"settest:counter\", {\n"
+	"	on_destruct = function() settest.destructs = settest.destructs + 1 end,\n"
+	"})\n";
+
+static const char *set_nodes_script =
+	"local c_air = minetest.get_content_id(\"air\")\n"
+	"local c_stone = minetest.get_content_id(\"settest:stone\")\n"
+	"local c_counter = minetest.get_content_id(\"settest:counter\")\n"
+	"local p1, p2 = {x = 1, y = 2, z = 3}, {x = 4, y = 2, z = 3}\n"
+	"\n"
+	"local function check_error(pattern, ...)\n"
+	"	local ok, err = pcall(minetest.set_nodes, ...)\n"
+	"	assert(not ok, \"no error, expected: \" .. pattern)\n"
+	"	assert(err:find(pattern, 1, true), err)\n"
+	"end\n"
+	"\n"
+	"-- Nothing is set if any entry is invalid\n"
+	"check_error(\"differ in length\", {p1, p2}, {c_stone})\n"
+	"check_error(\"differ in length\", {p1}, {c_stone}, {0, 0})\n"
+	"check_error(\"number expected\", {p1, p2}, {c_stone, \"settest:stone\"})\n"
+	"check_error(\"number expected\", {p1}, {c_stone}, {\"x\"})\n"
+	"check_error(\"not a registered node\", {p1, p2},\n"
+	"	{c_stone, minetest.get_content_id(\"ignore\")})\n"
+	"check_error(\"not a registered node\", {p1},\n"
+	"	{minetest.get_content_id(\"unknown\")})\n"
+	"check_error(\"not a registered node\", {p1}, {60000})\n"
+	"check_error(\"not a registered node\", {p1}, {-1})\n"
+	"assert(minetest.get_node(p1).name == \"air\")\n"
+	"\n"
+	"assert(minetest.set_nodes({p1, p2}, {c_counter, c_counter}, {0, 7}) == 2)\n"
+	"assert(minetest.get_node(p2).name == \"settest:counter\")\n"
+	"assert(minetest.get_node(p2).param2 == 7)\n"
+	"\n"
+	"-- A position listed twice gets its last node, and the node there is\n"
+	"-- destructed once\n"
+	"assert(minetest.set_nodes({p1, p2, p1}, {c_stone, c_stone, c_air}) == 2)\n"
+	"assert(settest.destructs == 2)\n"
+	"assert(minetest.get_node(p1).name == \"air\")\n"
+	"assert(minetest.get_node(p2).name == \"settest:stone\")\n"
+	"\n"
+	"-- Unloaded nodes are skipped\n"
+	"assert(minetest.set_nodes({{x = 1000, y = 0, z = 0}}, {c_stone}) == 0)\n";
+
+void TestModApiEnv::testSetNodes()
+{
+	// A world with its own game, which has a mod defining the nodes
+	std::string world = getTestTempDirectory() + DIR_DELIM + "set_nodes_world";
+	std::string game = world + DIR_DELIM + "game";
+	std::string mod = game + DIR_DELIM + "mods" + DIR_DELIM + "settest";
+	UASSERT(fs::CreateAllDirs(mod));
+	UASSERT(fs::safeWriteToFile(world + DIR_DELIM + "world.mt",
+		"gameid = settest\nbackend = dummy\n"));
+	UASSERT(fs::safeWriteToFile(game + DIR_DELIM + "game.conf",
+		"name = set_nodes test\n"));
+	UASSERT(fs::safeWriteToFile(mod + DIR_DELIM + "init.lua", set_nodes_mod));
+	std::string script = getTestTempFile();
+	UASSERT(fs::safeWriteToFile(script, set_nodes_script));
+
+	Server server(world, findWorldSubgame(world), false, false, true);
+
+	// One loaded block of air around the positions of the script
+	ServerMap &map = server.getEnv().getServerMap();
+	MapBlock *block = map.createBlock(v3s16(0, 0, 0));
+	for (s16 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++)
+		block->getData()[i] = MapNode(CONTENT_AIR, LIGHT_SUN);
+	block->setGenerated(true);
+
+	bool script_ok = true;
+	try {
+		server.getScriptIface()->loadScript(script);
+	} catch (ModError &e) {
+		rawstream << e.what() << std::endl;
+		script_ok = false;
+	}
+	UASSERT(script_ok);
+	UASSERT(map.getNodeNoEx(v3s16(4, 2, 3)).getContent() != CONTENT_AIR);
+}
@@ -19,21 +19,37 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <string.h>
 #include "exceptions.h"
 #include "noise.h"
+#include "porting.h"
+#include "util/basic_macros.h"
+#include "util/thread.h"
 
 class TestNoise : public TestBase {
 public:
-	TestNoise() { TestManager::registerTestModule(this); }
+	TestNoise()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
 	const char *getName() { return "TestNoise"; }
 
 	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
 
 	void testNoise2dPoint();
 	void testNoise2dBulk();
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimdExact();
+	void testNoiseSimdBenchmark();
+
+	bool compareNoiseMaps(Noise *noise, NoiseSimdLevel level,
+		float x, float y, float z, float *persistence_map,
+		WorkerPool *pool=NULL);
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -48,6 +64,12 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimdExact);
+}
+
+void TestNoise::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testNoiseSimdBenchmark);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -120,6 +142,114 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+static const char *noise_simd_names[] = {"scalar", "generic", "SSE2", "AVX2"};
+
+bool TestNoise::compareNoiseMaps(Noise *noise, NoiseSimdLevel level,
+	float x, float y, float z, float *persistence_map, WorkerPool *pool)
+{
+	size_t bufsize = noise->sx * noise->sy * noise->sz;
+	std::vector<float> expected(bufsize);
+
+	UASSERT(noise->setSimdLevel(NOISE_SIMD_NONE));
+	if (noise->sz > 1)
+		noise->perlinMap3D(x, y, z, persistence_map);
+	else
+		noise->perlinMap2D(x, y, persistence_map);
+	memcpy(&expected[0], noise->result, bufsize * sizeof(float));
+
+	UASSERT(noise->setSimdLevel(level));
+	if (noise->sz > 1)
+		noise->perlinMap3D(x, y, z, persistence_map, pool);
+	else
+		noise->perlinMap2D(x, y, persistence_map);
+
+	return memcmp(&expected[0], noise->result, bufsize * sizeof(float)) == 0;
+}
+
+void TestNoise::testNoiseSimdExact()
+{
+	NoiseParams params[] = {
+		NoiseParams(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0),
+		NoiseParams(0, 1, v3f(250, 120, 250), 5934, 4, 0.5, 2.0,
+			NOISE_FLAG_EASED),
+		NoiseParams(-3, 2, v3f(100, 100, 100), 42, 3, 0.63, 2.0, 0),
+		// Lattice steps larger than one node
+		NoiseParams(0, 1, v3f(7, 3, 5), 1, 4, 0.7, 2.5,
+			NOISE_FLAG_ABSVALUE | NOISE_FLAG_EASED),
+	};
+	v3f sizes[] = {
+		v3f(80, 80, 1), v3f(13, 7, 1), v3f(40, 41, 19), v3f(5, 3, 7),
+	};
+	v3f positions[] = {
+		v3f(0, 0, 0), v3f(-1234.5, 77.25, -9999), v3f(31000, -31000, 250.75),
+	};
+
+	float persistence_map[80 * 80];
+	for (size_t i = 0; i != ARRLEN(persistence_map); i++)
+		persistence_map[i] = 0.4 + (i % 13) * 0.05;
+
+	// Slabs of layers on the threads of a pool, more threads than some
+	// of the maps have layers
+	WorkerPool pool("NoiseTest", 8);
+
+	for (int level = NOISE_SIMD_GENERIC; level <= getNoiseSimdSupport(); level++)
+	for (size_t i = 0; i != ARRLEN(params); i++)
+	for (size_t j = 0; j != ARRLEN(sizes); j++)
+	for (size_t k = 0; k != ARRLEN(positions); k++) {
+		Noise noise(&params[i], 1337, sizes[j].X, sizes[j].Y, sizes[j].Z);
+		v3f p = positions[k];
+		UASSERT(compareNoiseMaps(&noise, (NoiseSimdLevel)level,
+			p.X, p.Y, p.Z, NULL));
+		if (noise.sz == 1) {
+			UASSERT(compareNoiseMaps(&noise, (NoiseSimdLevel)level,
+				p.X, p.Y, p.Z, persistence_map));
+		} else {
+			UASSERT(compareNoiseMaps(&noise, (NoiseSimdLevel)level,
+				p.X, p.Y, p.Z, NULL, &pool));
+		}
+	}
+
+	NoiseParams np(0, 1, v3f(50, 50, 50), 9, 5, 0.6, 2.0);
+	Noise noise(&np, 1337, 16, 16);
+	UASSERT(noise.setSimdLevel(getNoiseSimdSupport()));
+	UASSERT(!noise.setSimdLevel(
+		(NoiseSimdLevel)(getNoiseSimdSupport() + 1)));
+}
+
+void TestNoise::testNoiseSimdBenchmark()
+{
+	// Like the terrain noises of mapgen v7 for one 80 node chunk
+	NoiseParams np_2d(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0);
+	NoiseParams np_3d(0, 1, v3f(250, 120, 250), 5934, 4, 0.5, 2.0);
+	Noise noise_2d(&np_2d, 1337, 80, 80);
+	Noise noise_3d(&np_3d, 1337, 80, 80, 80);
+
+	WorkerPool pool("NoiseBench", Thread::getNumberOfProcessors());
+
+	const u32 maps_2d = 200, maps_3d = 10;
+	for (int level = NOISE_SIMD_NONE; level <= getNoiseSimdSupport(); level++) {
+		UASSERT(noise_2d.setSimdLevel((NoiseSimdLevel)level));
+		UASSERT(noise_3d.setSimdLevel((NoiseSimdLevel)level));
+
+		u64 t0 = porting::getTimeUs();
+		for (u32 i = 0; i != maps_2d; i++)
+			noise_2d.perlinMap2D(i * 80, 0);
+		u64 t1 = porting::getTimeUs();
+		for (u32 i = 0; i != maps_3d; i++)
+			noise_3d.perlinMap3D(i * 80, 0, 0);
+		u64 t2 = porting::getTimeUs();
+		for (u32 i = 0; i != maps_3d; i++)
+			noise_3d.perlinMap3D(i * 80, 0, 0, NULL, &pool);
+		u64 t3 = porting::getTimeUs();
+
+		rawstream << "    " << noise_simd_names[level] << ": perlinMap2D 80x80 "
+			<< (float)(t1 - t0) / maps_2d << " us, perlinMap3D 80x80x80 "
+			<< (float)(t2 - t1) / maps_3d << " us, on "
+			<< pool.getThreadCount() << " threads "
+			<< (float)(t3 - t2) / maps_3d << " us" << std::endl;
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
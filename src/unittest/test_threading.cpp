@@ -22,6 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "threading/atomic.h"
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "util/container.h"
+#include "util/thread.h"
 
 
 class TestThreading : public TestBase {
@@ -33,6 +35,9 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testThreadKill();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
+	void testBoundedMPSCQueue();
+	void testRequestQueueCallers();
 };
 
 static TestThreading g_test_instance;
@@ -42,6 +47,9 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testThreadKill);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
+	TEST(testBoundedMPSCQueue);
+	TEST(testRequestQueueCallers);
 }
 
 class SimpleTestThread : public Thread {
@@ -181,3 +189,216 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+class CountingBatch : public WorkerPool::Batch {
+public:
+	CountingBatch(u32 count) : hits(count, 0) {}
+
+	void runItem(u32 i)
+	{
+		hits[i]++;
+		total++;
+	}
+
+	std::vector<u32> hits;
+	Atomic<u32> total;
+};
+
+
+class WorkerPoolTestThread : public Thread {
+public:
+	WorkerPoolTestThread(WorkerPool &pool, Semaphore &trigger) :
+		Thread("WorkerPoolTest"),
+		ok(true),
+		pool(pool),
+		trigger(trigger)
+	{
+	}
+
+	bool ok;
+
+private:
+	void *run()
+	{
+		trigger.wait();
+		for (u32 n = 0; n < 200; n++) {
+			CountingBatch batch(n);
+			batch.total = 0;
+			pool.run(&batch, n);
+
+			ok = ok && batch.total == n;
+			for (u32 i = 0; i < n; i++)
+				ok = ok && batch.hits[i] == 1;
+		}
+		return NULL;
+	}
+
+	WorkerPool &pool;
+	Semaphore &trigger;
+};
+
+
+void TestThreading::testWorkerPool()
+{
+	WorkerPool pool("Test", 4);
+	UASSERTEQ(u32, pool.getThreadCount(), 4);
+
+	// Run several batches back to back, including empty and tiny ones
+	const u32 counts[] = { 0, 1, 3, 1000, 7, 50000 };
+	for (size_t c = 0; c < ARRLEN(counts); c++) {
+		CountingBatch batch(counts[c]);
+		batch.total = 0;
+		pool.run(&batch, counts[c]);
+
+		UASSERTEQ(u32, batch.total, counts[c]);
+		for (u32 i = 0; i < counts[c]; i++)
+			UASSERTEQ(u32, batch.hits[i], 1);
+	}
+
+	// Several threads sharing the pool
+	Semaphore trigger;
+	static const u8 num_threads = 4;
+	WorkerPoolTestThread *threads[num_threads];
+	for (u8 i = 0; i < num_threads; ++i) {
+		threads[i] = new WorkerPoolTestThread(pool, trigger);
+		UASSERT(threads[i]->start());
+	}
+
+	trigger.post(num_threads);
+
+	for (u8 i = 0; i < num_threads; ++i) {
+		threads[i]->wait();
+		UASSERT(threads[i]->ok);
+		delete threads[i];
+	}
+}
+
+
+class QueueProducerThread : public Thread {
+public:
+	QueueProducerThread(BoundedMPSCQueue<u32> &q, u32 id, Semaphore &trigger) :
+		Thread("QueueProducer"),
+		queue(q),
+		id(id),
+		trigger(trigger)
+	{
+	}
+
+	static const u32 count = 0x10000;
+
+private:
+	void *run()
+	{
+		trigger.wait();
+		// The producer id goes in the high bits, a sequence number in the low
+		for (u32 i = 0; i < count; i++) {
+			while (!queue.push((id << 24) | i))
+				sleep_ms(0);
+		}
+		return NULL;
+	}
+
+	BoundedMPSCQueue<u32> &queue;
+	u32 id;
+	Semaphore &trigger;
+};
+
+
+void TestThreading::testBoundedMPSCQueue()
+{
+	{
+		BoundedMPSCQueue<u32> queue(5);
+		UASSERTEQ(u32, queue.capacity(), 8);
+
+		u32 v;
+		UASSERT(!queue.pop(&v));
+		for (u32 i = 0; i < 8; i++)
+			UASSERT(queue.push(i));
+		UASSERT(!queue.push(8));
+		UASSERTEQ(u32, queue.size(), 8);
+
+		// Wrap around a few times
+		for (u32 i = 0; i < 100; i++) {
+			UASSERT(queue.pop(&v));
+			UASSERTEQ(u32, v, i);
+			UASSERT(queue.push(i + 8));
+		}
+		for (u32 i = 100; i < 108; i++) {
+			UASSERT(queue.pop(&v));
+			UASSERTEQ(u32, v, i);
+		}
+		UASSERT(!queue.pop(&v));
+	}
+
+	// Several producers, the test thread consumes
+	BoundedMPSCQueue<u32> queue(64);
+	Semaphore trigger;
+	static const u8 num_threads = 4;
+
+	QueueProducerThread *threads[num_threads];
+	for (u8 i = 0; i < num_threads; ++i) {
+		threads[i] = new QueueProducerThread(queue, i, trigger);
+		UASSERT(threads[i]->start());
+	}
+
+	trigger.post(num_threads);
+
+	u32 next[num_threads] = {0};
+	u32 received = 0;
+	u32 v;
+	while (received < num_threads * QueueProducerThread::count) {
+		if (!queue.pop(&v)) {
+			sleep_ms(0);
+			continue;
+		}
+		// Items of each producer arrive in order, without loss
+		u32 id = v >> 24;
+		UASSERT(id < num_threads);
+		UASSERTEQ(u32, v & 0xffffff, next[id]);
+		next[id]++;
+		received++;
+	}
+
+	for (u8 i = 0; i < num_threads; ++i) {
+		threads[i]->wait();
+		delete threads[i];
+	}
+
+	UASSERT(!queue.pop(&v));
+}
+
+
+void TestThreading::testRequestQueueCallers()
+{
+	typedef ResultQueue<std::string, u32, u8, u8> Results;
+	RequestQueue<std::string, u32, u8, u8> requests;
+	Results results1, results2;
+
+	// Threads that share a caller ID but wait on their own result queues,
+	// and a repeated request of one of them
+	requests.add("a", 0, 1, &results1);
+	requests.add("a", 0, 2, &results2);
+	requests.add("a", 0, 3, &results1);
+	requests.add("b", 0, 4, &results2);
+
+	GetRequest<std::string, u32, u8, u8> request = requests.pop();
+	UASSERT(request.key == "a");
+	UASSERTEQ(size_t, request.callers.size(), 2);
+	requests.pushResult(request, 10);
+	request = requests.pop();
+	UASSERT(request.key == "b");
+	requests.pushResult(request, 20);
+	UASSERT(requests.empty());
+
+	// Each gets its own answers, with the last caller data it passed
+	GetResult<std::string, u32, u8, u8> result = results1.pop_frontNoEx();
+	UASSERT(result.key == "a" && result.item == 10);
+	UASSERTEQ(int, result.caller.second, 3);
+	UASSERT(results1.empty());
+	result = results2.pop_frontNoEx();
+	UASSERT(result.key == "a" && result.item == 10);
+	UASSERTEQ(int, result.caller.second, 2);
+	result = results2.pop_frontNoEx();
+	UASSERT(result.key == "b" && result.item == 20);
+	UASSERT(results2.empty());
+}
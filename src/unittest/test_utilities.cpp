@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include "noise.h"
 #include "util/numeric.h"
 #include "util/string.h"
 
@@ -50,6 +51,7 @@ class TestUtilities : public TestBase {
 	void testIsNumber();
 	void testIsPowerOfTwo();
 	void testMyround();
+	void testIsSphereInSight();
 };
 
 static TestUtilities g_test_instance;
@@ -77,6 +79,7 @@ void TestUtilities::runTests(IGameDef *gamedef)
 	TEST(testIsNumber);
 	TEST(testIsPowerOfTwo);
 	TEST(testMyround);
+	TEST(testIsSphereInSight);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -326,3 +329,38 @@ void TestUtilities::testMyround()
 	UASSERT(myround(-6.5f) == -7);
 }
 
+void TestUtilities::testIsSphereInSight()
+{
+	const s16 region_size = 8;
+	const f32 region_radius = 0.866025403784 * region_size * MAP_BLOCKSIZE * BS;
+	PseudoRandom pr(13);
+
+	for (int i = 0; i < 2000; i++) {
+		v3f camera_pos(pr.range(-1000, 1000) * BS, pr.range(-1000, 1000) * BS,
+			pr.range(-1000, 1000) * BS);
+		v3f camera_dir(pr.range(-100, 100), pr.range(-100, 100),
+			pr.range(-100, 100));
+		if (camera_dir.getLength() == 0)
+			continue;
+		camera_dir.normalize();
+		f32 fov = pr.range(30, 160) * M_PI / 180;
+		f32 range = pr.range(50, 1000) * BS;
+
+		// If a block of a region near the camera is in sight, the sphere
+		// around the region is in sight too
+		v3s16 region = getContainerPos(
+			floatToInt(camera_pos, BS * MAP_BLOCKSIZE), region_size) +
+			v3s16(pr.range(-2, 2), pr.range(-2, 2), pr.range(-2, 2));
+		v3f center = intToFloat(region * region_size * MAP_BLOCKSIZE +
+			v3s16(1, 1, 1) * (region_size * MAP_BLOCKSIZE / 2), BS);
+		bool region_in_sight = isSphereInSight(center, region_radius,
+			camera_pos, camera_dir, fov, range);
+
+		for (s16 j = 0; j < 16; j++) {
+			v3s16 block = region * region_size + v3s16(pr.range(0, 7),
+				pr.range(0, 7), pr.range(0, 7));
+			if (isBlockInSight(block, camera_pos, camera_dir, fov, range))
+				UASSERT(region_in_sight);
+		}
+	}
+}
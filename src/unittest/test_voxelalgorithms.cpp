@@ -19,20 +19,50 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include "emerge.h"
 #include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "porting.h"
 #include "voxelalgorithms.h"
 #include "util/numeric.h"
 
+typedef std::vector<std::pair<v3s16, MapNode> > NodeChanges;
+
+enum LightUpdateMethod {
+	LIGHT_UPDATE_NODE,
+	LIGHT_UPDATE_BATCH,
+	LIGHT_UPDATE_VMANIP,
+	LIGHT_UPDATE_VMANIP_RELIGHT,
+};
+
 class TestVoxelAlgorithms : public TestBase {
 public:
-	TestVoxelAlgorithms() { TestManager::registerTestModule(this); }
+	TestVoxelAlgorithms()
+	{
+		TestManager::registerTestModule(this);
+		TestManager::registerBenchmarkModule(this);
+	}
+
 	const char *getName() { return "TestVoxelAlgorithms"; }
 
 	void runTests(IGameDef *gamedef);
+	void runBenchmarks(IGameDef *gamedef);
 
 	void testPropogateSunlight(INodeDefManager *ndef);
 	void testClearLightAndCollectSources(INodeDefManager *ndef);
 	void testVoxelLineIterator(INodeDefManager *ndef);
+	void testBlockFaceConnections(INodeDefManager *ndef);
+	void testCaveCulling();
+	void testBatchedLightUpdate(IGameDef *gamedef);
+	void testExplosionBenchmark(IGameDef *gamedef);
+
+	ServerMap *makeTerrainMap(IGameDef *gamedef, EmergeManager *emerge,
+		s16 radius);
+	void applyChanges(ServerMap *map, const NodeChanges &changes,
+		LightUpdateMethod method);
+	void getNodes(Map *map, s16 radius, std::vector<MapNode> *nodes);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -44,6 +74,14 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 	TEST(testPropogateSunlight, ndef);
 	TEST(testClearLightAndCollectSources, ndef);
 	TEST(testVoxelLineIterator, ndef);
+	TEST(testBlockFaceConnections, ndef);
+	TEST(testCaveCulling);
+	TEST(testBatchedLightUpdate, gamedef);
+}
+
+void TestVoxelAlgorithms::runBenchmarks(IGameDef *gamedef)
+{
+	TEST(testExplosionBenchmark, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -261,3 +299,334 @@ void TestVoxelAlgorithms::testVoxelLineIterator(INodeDefManager *ndef)
 		UASSERTEQ(int, actual_nodecount, nodecount);
 	}
 }
+
+void TestVoxelAlgorithms::testBlockFaceConnections(INodeDefManager *ndef)
+{
+	const s16 size = MAP_BLOCKSIZE;
+	MapNode data[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+	u8 connections[6];
+	// Faces in g_6dirs order
+	const u8 back = 1 << 0, top = 1 << 1, right = 1 << 2,
+		front = 1 << 3, left = 1 << 5;
+#define DATA(x, y, z) data[((z) * size + (y)) * size + (x)]
+
+	// Solid block
+	for (s16 i = 0; i < size * size * size; i++)
+		data[i] = MapNode(t_CONTENT_STONE);
+	voxalgo::get_block_face_connections(data, ndef, connections);
+	for (int i = 0; i < 6; i++)
+		UASSERTEQ(int, connections[i], 0);
+
+	// A tunnel from left to right
+	for (s16 x = 0; x < size; x++)
+		DATA(x, 8, 8) = MapNode(CONTENT_AIR);
+	voxalgo::get_block_face_connections(data, ndef, connections);
+	UASSERTEQ(int, connections[2], right | left);
+	UASSERTEQ(int, connections[5], right | left);
+	UASSERTEQ(int, connections[0] | connections[1] | connections[3] |
+		connections[4], 0);
+
+	// A shaft from the tunnel to the top
+	for (s16 y = 8; y < size; y++)
+		DATA(3, y, 8) = MapNode(CONTENT_AIR);
+	voxalgo::get_block_face_connections(data, ndef, connections);
+	for (int i = 0; i < 6; i++) {
+		u8 expected = (1 << i) & (top | right | left) ?
+			top | right | left : 0;
+		UASSERTEQ(int, connections[i], expected);
+	}
+
+	// Air with a wall between the front and the back
+	for (s16 i = 0; i < size * size * size; i++)
+		data[i] = MapNode(CONTENT_AIR);
+	for (s16 y = 0; y < size; y++)
+	for (s16 x = 0; x < size; x++)
+		DATA(x, y, 8) = MapNode(t_CONTENT_STONE);
+	voxalgo::get_block_face_connections(data, ndef, connections);
+	UASSERTEQ(int, connections[0], 0x3f & ~front);
+	UASSERTEQ(int, connections[3], 0x3f & ~back);
+	for (int i = 0; i < 6; i++) {
+		if (i != 0 && i != 3)
+			UASSERTEQ(int, connections[i], 0x3f);
+	}
+#undef DATA
+}
+
+// Blocks in a box are loaded, all with the same face connections
+class TestFaceConnectionSource : public voxalgo::BlockFaceConnectionSource
+{
+public:
+	TestFaceConnectionSource(v3s16 min, v3s16 max, u8 exits) :
+		m_area(min, max)
+	{
+		for (int i = 0; i < 6; i++)
+			m_connections[i] = (1 << i) & exits ? exits : 0;
+	}
+
+	bool getFaceConnections(v3s16 blockpos, u8 *connections)
+	{
+		if (!m_area.contains(blockpos) || unloaded.count(blockpos))
+			return false;
+		memcpy(connections, m_connections, sizeof(m_connections));
+		return true;
+	}
+
+	std::set<v3s16> unloaded;
+
+private:
+	VoxelArea m_area;
+	u8 m_connections[6];
+};
+
+void TestVoxelAlgorithms::testCaveCulling()
+{
+	voxalgo::CaveCulling culling;
+	const v3f camera_pos = intToFloat(v3s16(1, 1, 1) * (MAP_BLOCKSIZE / 2), BS);
+	const v3f camera_dir(1, 0, 0);
+	const f32 fov = 1.5;
+	const f32 range = 100000 * BS;
+	const v3s16 box_min(-3, -3, -3), box_max(5, 3, 3);
+
+	// Open blocks: every loaded block in sight is reached
+	TestFaceConnectionSource open(box_min, v3s16(3, 3, 3), 0x3f);
+	UASSERT(culling.update(&open, v3s16(0, 0, 0), box_min, box_max,
+		camera_pos, camera_dir, fov, range) > 0);
+	for (s16 z = box_min.Z; z <= box_max.Z; z++)
+	for (s16 y = box_min.Y; y <= box_max.Y; y++)
+	for (s16 x = box_min.X; x <= box_max.X; x++) {
+		v3s16 p(x, y, z);
+		if (p == v3s16(0, 0, 0))
+			continue;
+		bool reachable = x <= 3 &&
+			isBlockInSight(p, camera_pos, camera_dir, fov, range);
+		UASSERT(culling.isCulled(p) != reachable);
+	}
+	// Blocks that are not loaded are not walked into
+	UASSERT(culling.isCulled(v3s16(4, 0, 0)));
+	// Outside of the box, nothing is culled
+	UASSERT(!culling.isCulled(v3s16(6, 0, 0)));
+
+	// Tunnels along X: the walk goes along the tunnel from the camera
+	// block but stops in the blocks above it
+	const u8 right = 1 << 2, left = 1 << 5;
+	TestFaceConnectionSource tunnels(box_min, v3s16(3, 3, 3), right | left);
+	culling.update(&tunnels, v3s16(0, 0, 0), box_min, box_max,
+		camera_pos, camera_dir, fov, range);
+	UASSERT(!culling.isCulled(v3s16(0, 0, 0)));
+	UASSERT(!culling.isCulled(v3s16(1, 0, 0)));
+	UASSERT(!culling.isCulled(v3s16(3, 0, 0)));
+	UASSERT(culling.isCulled(v3s16(4, 0, 0)));
+	UASSERT(!culling.isCulled(v3s16(0, 1, 0)));
+	UASSERT(culling.isCulled(v3s16(0, 2, 0)));
+	UASSERT(culling.isCulled(v3s16(1, 1, 0)));
+	UASSERT(culling.isCulled(v3s16(2, 0, 1)));
+
+	// A block that is unloaded cuts the tunnel; the entries of the last
+	// update do not count
+	tunnels.unloaded.insert(v3s16(2, 0, 0));
+	culling.update(&tunnels, v3s16(0, 0, 0), box_min, box_max,
+		camera_pos, camera_dir, fov, range);
+	UASSERT(!culling.isCulled(v3s16(1, 0, 0)));
+	UASSERT(culling.isCulled(v3s16(2, 0, 0)));
+	UASSERT(culling.isCulled(v3s16(3, 0, 0)));
+
+	// Camera outside of the box: the whole box is culled
+	UASSERTEQ(u32, culling.update(&open, v3s16(10, 0, 0), box_min, box_max,
+		camera_pos, camera_dir, fov, range), 0);
+	UASSERT(culling.isCulled(v3s16(0, 0, 0)));
+	UASSERT(culling.isCulled(v3s16(1, 0, 0)));
+}
+
+static const char *light_update_method_names[] = {
+	"addNodeAndUpdate", "addNodesAndUpdate", "blit_back_with_light",
+	"blit_back_and_relight",
+};
+
+static void add_sphere(NodeChanges *changes, v3s16 center, s16 radius,
+	MapNode n)
+{
+	for (s16 z = -radius; z <= radius; z++)
+	for (s16 y = -radius; y <= radius; y++)
+	for (s16 x = -radius; x <= radius; x++) {
+		if (x * x + y * y + z * z <= radius * radius)
+			changes->push_back(std::make_pair(center + v3s16(x, y, z), n));
+	}
+}
+
+// Stone below y = 0 and sunlit air above, which is lit correctly
+ServerMap *TestVoxelAlgorithms::makeTerrainMap(IGameDef *gamedef,
+	EmergeManager *emerge, s16 radius)
+{
+	return makeTestMap(gamedef, emerge, radius,
+		MapNode(t_CONTENT_STONE), MapNode(CONTENT_AIR, LIGHT_SUN));
+}
+
+void TestVoxelAlgorithms::applyChanges(ServerMap *map,
+	const NodeChanges &changes, LightUpdateMethod method)
+{
+	std::map<v3s16, MapBlock *> modified_blocks;
+	if (method == LIGHT_UPDATE_NODE) {
+		for (size_t i = 0; i < changes.size(); i++)
+			map->addNodeAndUpdate(changes[i].first, changes[i].second,
+				modified_blocks);
+		return;
+	}
+	if (method == LIGHT_UPDATE_BATCH) {
+		map->addNodesAndUpdate(changes, modified_blocks);
+		return;
+	}
+
+	// Like a mod reading the blocks around the changes
+	VoxelArea area;
+	for (size_t i = 0; i < changes.size(); i++)
+		area.addPoint(changes[i].first);
+	MMVManip vm(map);
+	vm.initialEmerge(getNodeBlockPos(area.MinEdge),
+		getNodeBlockPos(area.MaxEdge));
+	for (size_t i = 0; i < changes.size(); i++)
+		vm.m_data[vm.m_area.index(changes[i].first)] = changes[i].second;
+
+	if (method == LIGHT_UPDATE_VMANIP)
+		voxalgo::blit_back_with_light(map, &vm, &modified_blocks);
+	else
+		voxalgo::blit_back_and_relight(map, &vm, &modified_blocks);
+}
+
+void TestVoxelAlgorithms::getNodes(Map *map, s16 radius,
+	std::vector<MapNode> *nodes)
+{
+	nodes->clear();
+	for (s16 x = -radius; x <= radius; x++)
+	for (s16 y = -radius; y <= radius; y++)
+	for (s16 z = -radius; z <= radius; z++) {
+		MapBlock *block = map->getBlockNoCreateNoEx(v3s16(x, y, z));
+		nodes->insert(nodes->end(), block->getData(),
+			block->getData() + MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	}
+}
+
+void TestVoxelAlgorithms::testBatchedLightUpdate(IGameDef *gamedef)
+{
+	const s16 radius = 2;
+	EmergeManager emerge(gamedef);
+	MapNode air(CONTENT_AIR), stone(t_CONTENT_STONE), torch(t_CONTENT_TORCH);
+
+	// A cave with torches, a crater letting the sunlight in, a tunnel
+	// between them and a roof over everything, half of which is removed
+	// again along with one of the torches
+	std::vector<NodeChanges> steps(5);
+	add_sphere(&steps[0], v3s16(0, -10, 0), 5, air);
+	steps[0].push_back(std::make_pair(v3s16(0, -10, 0), torch));
+	steps[0].push_back(std::make_pair(v3s16(3, -12, 2), torch));
+	add_sphere(&steps[1], v3s16(5, 0, -3), 4, air);
+	for (s16 i = 0; i <= 5; i++)
+		add_sphere(&steps[2], v3s16(5 - i * 5 / 6, -4 - i, -3 + i / 2), 1, air);
+	for (s16 x = -8; x <= 8; x++)
+	for (s16 z = -8; z <= 8; z++)
+		steps[3].push_back(std::make_pair(v3s16(x, 6, z), stone));
+	for (s16 x = 0; x <= 8; x++)
+	for (s16 z = -8; z <= 8; z++)
+		steps[4].push_back(std::make_pair(v3s16(x, 6, z), air));
+	steps[4].push_back(std::make_pair(v3s16(3, -12, 2), air));
+	// Changed twice in the same batch
+	steps[4].push_back(std::make_pair(v3s16(-2, -10, 0), torch));
+	steps[4].push_back(std::make_pair(v3s16(-2, -10, 0), air));
+
+	// Changing one node at a time is the reference
+	std::vector<MapNode> expected, nodes;
+	ServerMap *map = makeTerrainMap(gamedef, &emerge, radius);
+	for (size_t i = 0; i < steps.size(); i++)
+		applyChanges(map, steps[i], LIGHT_UPDATE_NODE);
+	getNodes(map, radius, &expected);
+
+	// The torch lights the cave, and the sun the bottom of the crater
+	INodeDefManager *ndef = gamedef->getNodeDefManager();
+	UASSERTEQ(int, map->getNodeNoEx(v3s16(1, -10, 0)).getLight(
+		LIGHTBANK_NIGHT, ndef), LIGHT_MAX - 2);
+	UASSERTEQ(int, map->getNodeNoEx(v3s16(5, -3, -3)).getLight(
+		LIGHTBANK_DAY, ndef), LIGHT_SUN);
+	delete map;
+
+	for (int method = LIGHT_UPDATE_BATCH;
+			method <= LIGHT_UPDATE_VMANIP_RELIGHT; method++) {
+		map = makeTerrainMap(gamedef, &emerge, radius);
+		for (size_t i = 0; i < steps.size(); i++)
+			applyChanges(map, steps[i], (LightUpdateMethod)method);
+		getNodes(map, radius, &nodes);
+		delete map;
+
+		u32 num_different = 0;
+		for (size_t i = 0; i < expected.size(); i++) {
+			num_different += nodes[i].getContent() != expected[i].getContent() ||
+				nodes[i].param1 != expected[i].param1 ||
+				nodes[i].param2 != expected[i].param2;
+		}
+		if (num_different) {
+			rawstream << "    " << light_update_method_names[method] << ": "
+				<< num_different << " nodes differ" << std::endl;
+		}
+		UASSERTEQ(u32, num_different, 0);
+	}
+
+	// Too many changes are not written at all
+	map = makeTerrainMap(gamedef, &emerge, radius);
+	{
+		MMVManip vm(map);
+		vm.initialEmerge(v3s16(-1, -1, -1), v3s16(0, 0, 0));
+		for (size_t i = 0; i < steps[0].size(); i++)
+			vm.m_data[vm.m_area.index(steps[0][i].first)] = steps[0][i].second;
+		std::map<v3s16, MapBlock *> modified_blocks;
+		UASSERT(!voxalgo::blit_back_changed_nodes(map, &vm, 100,
+			&modified_blocks));
+		UASSERT(modified_blocks.empty());
+		UASSERT(map->getNodeNoEx(v3s16(0, -10, 0)).getContent() ==
+			t_CONTENT_STONE);
+	}
+	delete map;
+}
+
+void TestVoxelAlgorithms::testExplosionBenchmark(IGameDef *gamedef)
+{
+	const s16 radius = 3;
+	const u32 num_explosions = 20;
+	EmergeManager emerge(gamedef);
+
+	// TNT blasts of radius 3 into the ground, and a mod digging out a
+	// large area at once
+	std::vector<NodeChanges> explosions(num_explosions);
+	PseudoRandom pr(13);
+	for (u32 i = 0; i < num_explosions; i++) {
+		add_sphere(&explosions[i], v3s16(pr.range(-30, 30), pr.range(-6, 1),
+			pr.range(-30, 30)), 3, MapNode(CONTENT_AIR));
+	}
+	std::vector<NodeChanges> terraform(1);
+	for (s16 z = -24; z < 24; z++)
+	for (s16 y = -8; y < 0; y++)
+	for (s16 x = -24; x < 24; x++)
+		terraform[0].push_back(std::make_pair(v3s16(x, y, z),
+			MapNode(CONTENT_AIR)));
+
+	std::vector<NodeChanges> *scenarios[] = { &explosions, &terraform };
+	const char *scenario_names[] = { "explosions", "terraform" };
+	for (size_t s = 0; s < ARRLEN(scenarios); s++) {
+		const std::vector<NodeChanges> &batches = *scenarios[s];
+		size_t num_nodes = 0;
+		for (size_t i = 0; i < batches.size(); i++)
+			num_nodes += batches[i].size();
+
+		rawstream << "    " << batches.size() << " " << scenario_names[s]
+			<< ", " << num_nodes << " nodes, ms:";
+		for (int method = LIGHT_UPDATE_NODE;
+				method <= LIGHT_UPDATE_VMANIP_RELIGHT; method++) {
+			ServerMap *map = makeTerrainMap(gamedef, &emerge, radius);
+			u64 t0 = porting::getTimeUs();
+			for (size_t i = 0; i < batches.size(); i++)
+				applyChanges(map, batches[i], (LightUpdateMethod)method);
+			u64 t1 = porting::getTimeUs();
+			delete map;
+			rawstream << " " << light_update_method_names[method] << " "
+				<< (float)(t1 - t0) / 1000;
+		}
+		rawstream << std::endl;
+	}
+}
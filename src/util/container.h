@@ -25,6 +25,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "../threading/mutex.h"
 #include "../threading/mutex_auto_lock.h"
 #include "../threading/semaphore.h"
+#include "../threading/atomic.h"
+#include "basic_macros.h"
 #include <list>
 #include <vector>
 #include <map>
@@ -234,6 +236,99 @@ class MutexedQueue
 	Semaphore m_signal;
 };
 
+/*
+Bounded lock-free queue for any number of producer threads and a single
+consumer thread. The capacity is rounded up to a power of two.
+Each slot carries a sequence number telling whether it is free for the
+producer claiming that position or filled for the consumer.
+*/
+
+template<typename T>
+class BoundedMPSCQueue
+{
+public:
+	BoundedMPSCQueue(u32 capacity):
+		m_head(0),
+		m_tail(0)
+	{
+		u32 size = 2;
+		while (size < capacity)
+			size <<= 1;
+		m_mask = size - 1;
+		m_slots = new Slot[size];
+		for (u32 i = 0; i < size; i++)
+			m_slots[i].seq = i;
+	}
+
+	~BoundedMPSCQueue()
+	{
+		delete[] m_slots;
+	}
+
+	// Returns false if the queue is full
+	bool push(const T &t)
+	{
+		u32 pos = m_head;
+		Slot *slot;
+		for (;;) {
+			slot = &m_slots[pos & m_mask];
+			s32 diff = (s32)((u32)slot->seq - pos);
+			if (diff == 0) {
+				// Claim the position
+				if (m_head.compare_exchange_strong(pos, pos + 1))
+					break;
+				pos = m_head;
+			} else if (diff < 0) {
+				// The consumer has not freed this slot yet
+				return false;
+			} else {
+				// Another producer claimed it first
+				pos = m_head;
+			}
+		}
+
+		slot->value = t;
+		slot->seq = pos + 1;
+		return true;
+	}
+
+	// Must only be called from the consumer thread.
+	// Returns false if the queue is empty.
+	bool pop(T *t)
+	{
+		u32 pos = m_tail;
+		Slot *slot = &m_slots[pos & m_mask];
+		if ((s32)((u32)slot->seq - (pos + 1)) < 0)
+			return false;
+
+		*t = slot->value;
+		slot->value = T();
+		slot->seq = pos + m_mask + 1;
+		m_tail = pos + 1;
+		return true;
+	}
+
+	u32 capacity() const { return m_mask + 1; }
+
+	// Approximate when called while other threads are pushing
+	u32 size() { return (u32)m_head - (u32)m_tail; }
+
+private:
+	struct Slot {
+		Atomic<u32> seq;
+		T value;
+	};
+
+	Slot *m_slots;
+	u32 m_mask;
+	// Next position to push, shared by the producers
+	Atomic<u32> m_head;
+	// Next position to pop, only written by the consumer
+	Atomic<u32> m_tail;
+
+	DISABLE_CLASS_COPY(BoundedMPSCQueue);
+};
+
 template<typename K, typename V>
 class LRUCache
 {
@@ -168,6 +168,16 @@ class Buffer
 	{
 		return m_size;
 	}
+	// Exchanges the contents with another buffer without copying them
+	void swap(Buffer &buffer)
+	{
+		T *t = data;
+		data = buffer.data;
+		buffer.data = t;
+		unsigned int size = m_size;
+		m_size = buffer.m_size;
+		buffer.m_size = size;
+	}
 private:
 	void drop()
 	{
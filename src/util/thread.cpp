@@ -0,0 +1,107 @@
+/*
+Minetest
+Copyright (C) 2017 MultiCraft Development Team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 3.0 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "thread.h"
+#include "../debug.h"
+
+/*
+	WorkerPool
+*/
+
+WorkerPool::WorkerPool(const std::string &name, u32 num_threads) :
+	m_batch(NULL),
+	m_count(0),
+	m_next(0)
+{
+	for (u32 i = 1; i < num_threads; i++) {
+		WorkerThread *thread = new WorkerThread(name, this);
+		if (!thread->start()) {
+			errorstream << "WorkerPool: failed to start " << name
+				<< " thread" << std::endl;
+			delete thread;
+			break;
+		}
+		m_workers.push_back(thread);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->stop();
+
+	m_work_sem.post(m_workers.size());
+
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		m_workers[i]->wait();
+		delete m_workers[i];
+	}
+}
+
+void WorkerPool::run(Batch *batch, u32 count)
+{
+	if (count == 0)
+		return;
+
+	if (!m_run_mutex.try_lock()) {
+		for (u32 i = 0; i < count; i++)
+			batch->runItem(i);
+		return;
+	}
+
+	m_batch = batch;
+	m_count = count;
+	m_next = 0;
+
+	// Not worth waking anyone up for a single item
+	u32 helpers = MYMIN(m_workers.size(), count - 1);
+	m_work_sem.post(helpers);
+	processItems();
+	for (u32 i = 0; i < helpers; i++)
+		m_done_sem.wait();
+
+	m_batch = NULL;
+	m_run_mutex.unlock();
+}
+
+void WorkerPool::processItems()
+{
+	u32 i;
+	while ((i = m_next++) < m_count)
+		m_batch->runItem(i);
+}
+
+void *WorkerPool::WorkerThread::run()
+{
+	DSTACK(FUNCTION_NAME);
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	for (;;) {
+		m_pool->m_work_sem.wait();
+		if (stopRequested())
+			break;
+
+		m_pool->processItems();
+		m_pool->m_done_sem.post();
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return NULL;
+}
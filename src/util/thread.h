@@ -27,6 +27,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "porting.h"
 #include "log.h"
 #include "container.h"
+#include "../threading/atomic.h"
+#include <vector>
 
 template<typename T>
 class MutexedVariable
@@ -116,7 +118,9 @@ class RequestQueue {
 			MutexAutoLock lock(m_queue.getMutex());
 
 			/*
-				If the caller is already on the list, only update CallerData
+				If the caller is already on the list, only update CallerData.
+				Threads that share a caller ID are told apart by their
+				result queue.
 			*/
 			for (i = m_queue.getQueue().begin(); i != m_queue.getQueue().end(); ++i) {
 				GetRequest<Key, T, Caller, CallerData> &request = *i;
@@ -125,7 +129,7 @@ class RequestQueue {
 
 				for (j = request.callers.begin(); j != request.callers.end(); ++j) {
 					CallerInfo<Caller, CallerData, Key, T> &ca = *j;
-					if (ca.caller == caller) {
+					if (ca.caller == caller && ca.dest == dest) {
 						ca.data = callerdata;
 						return;
 					}
@@ -230,5 +234,60 @@ class UpdateThread : public Thread
 	Semaphore m_update_sem;
 };
 
-#endif
+/*
+	A fixed set of worker threads processing batches of independent items.
 
+	The caller implements WorkerPool::Batch; run() distributes the item
+	indices over the workers and the calling thread and returns once all
+	of them have been processed. Only one batch runs at a time; when
+	several threads share a pool, a run() while the workers are busy
+	processes its items on the calling thread alone.
+*/
+class WorkerPool
+{
+public:
+	class Batch
+	{
+	public:
+		virtual ~Batch() {}
+		// Called from an arbitrary thread of the pool, once per item
+		virtual void runItem(u32 i) = 0;
+	};
+
+	// num_threads includes the thread calling run()
+	WorkerPool(const std::string &name, u32 num_threads);
+	~WorkerPool();
+
+	u32 getThreadCount() const { return m_workers.size() + 1; }
+
+	void run(Batch *batch, u32 count);
+
+private:
+	class WorkerThread : public Thread
+	{
+	public:
+		WorkerThread(const std::string &name, WorkerPool *pool) :
+			Thread(name), m_pool(pool)
+		{}
+
+		void *run();
+
+	private:
+		WorkerPool *m_pool;
+	};
+
+	void processItems();
+
+	std::vector<WorkerThread *> m_workers;
+	Semaphore m_work_sem;
+	Semaphore m_done_sem;
+
+	Mutex m_run_mutex;
+	Batch *m_batch;
+	u32 m_count;
+	Atomic<u32> m_next;
+
+	DISABLE_CLASS_COPY(WorkerPool);
+};
+
+#endif
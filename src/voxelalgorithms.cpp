@@ -21,6 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "mapblock.h"
 #include "map.h"
+#include "util/directiontables.h"
+#include "util/numeric.h"
+#include <algorithm>
 
 namespace voxalgo
 {
@@ -1183,8 +1186,90 @@ void finish_bulk_light_update(Map *map, mapblock_v3 minblock,
 	}
 }
 
+bool blit_back_changed_nodes(Map *map, MMVManip *vm, u32 max_changes,
+	std::map<v3s16, MapBlock*> *modified_blocks)
+{
+	INodeDefManager *ndef = map->getNodeDefManager();
+	mapblock_v3 minblock = getNodeBlockPos(vm->m_area.MinEdge);
+	mapblock_v3 maxblock = getNodeBlockPos(vm->m_area.MaxEdge);
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	// Dummy boolean.
+	bool is_valid;
+
+	// --- STEP 1: Find the changed nodes, the map is not touched yet
+
+	for (s16 b_z = minblock.Z; b_z <= maxblock.Z; b_z++)
+	for (s16 b_y = minblock.Y; b_y <= maxblock.Y; b_y++)
+	for (s16 b_x = minblock.X; b_x <= maxblock.X; b_x++) {
+		MapBlock *block = map->getBlockNoCreateNoEx(v3s16(b_x, b_y, b_z));
+		if (!block || block->isDummy())
+			continue;
+		v3s16 offset = block->getPosRelative();
+		if (!vm->m_area.contains(VoxelArea(offset,
+				offset + v3s16(1, 1, 1) * (MAP_BLOCKSIZE - 1))))
+			continue;
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+			u32 vi = vm->m_area.index(offset + v3s16(0, y, z));
+			for (s16 x = 0; x < MAP_BLOCKSIZE; x++, vi++) {
+				// Blocks that did not exist when the voxel manipulator
+				// was read are not written back
+				if (vm->m_flags[vi] & VOXELFLAG_NO_DATA)
+					continue;
+				MapNode oldnode = block->getNodeNoCheck(x, y, z, &is_valid);
+				const MapNode &newnode = vm->m_data[vi];
+				// The light of unchanged nodes stays correct
+				if (oldnode.getContent() == newnode.getContent() &&
+						oldnode.param2 == newnode.param2 &&
+						(oldnode.param1 == newnode.param1 ||
+						ndef->get(newnode).param_type == CPT_LIGHT))
+					continue;
+				if (oldnodes.size() == max_changes)
+					return false;
+				oldnodes.push_back(std::pair<v3s16, MapNode>(
+					offset + v3s16(x, y, z), oldnode));
+			}
+		}
+	}
+
+	// --- STEP 2: Overwrite the changed nodes without light
+
+	for (size_t i = 0; i < oldnodes.size(); i++) {
+		v3s16 p = oldnodes[i].first;
+		mapblock_v3 blockpos;
+		relative_v3 relpos;
+		getNodeBlockPosWithOffset(p, blockpos, relpos);
+		MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
+		MapNode n = vm->m_data[vm->m_area.index(p)];
+		n.setLight(LIGHTBANK_DAY, 0, ndef);
+		n.setLight(LIGHTBANK_NIGHT, 0, ndef);
+		block->setNodeNoCheck(relpos, n);
+		block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_VMANIP);
+		(*modified_blocks)[blockpos] = block;
+	}
+
+	// --- STEP 3: Update the light of the changed nodes at once
+
+	update_lighting_nodes(map, oldnodes, *modified_blocks);
+	for (std::map<v3s16, MapBlock*>::iterator it = modified_blocks->begin();
+			it != modified_blocks->end(); ++it)
+		it->second->expireDayNightDiff();
+	return true;
+}
+
 void blit_back_with_light(ServerMap *map, MMVManip *vm,
 	std::map<v3s16, MapBlock*> *modified_blocks)
+{
+	// Relighting a few changed nodes is much cheaper than relighting
+	// every block of the voxel manipulator
+	if (!blit_back_changed_nodes(map, vm,
+			vm->m_area.getVolume() / BLIT_BACK_MAX_CHANGED_DIVISOR,
+			modified_blocks))
+		blit_back_and_relight(map, vm, modified_blocks);
+}
+
+void blit_back_and_relight(ServerMap *map, MMVManip *vm,
+	std::map<v3s16, MapBlock*> *modified_blocks)
 {
 	INodeDefManager *ndef = map->getNodeDefManager();
 	mapblock_v3 minblock = getNodeBlockPos(vm->m_area.MinEdge);
@@ -1402,6 +1487,154 @@ void repair_block_light(ServerMap *map, MapBlock *block,
 		modified_blocks);
 }
 
+void get_block_face_connections(const MapNode *data, INodeDefManager *ndef,
+	u8 *connections)
+{
+	const s16 size = MAP_BLOCKSIZE;
+	const u16 nodecount = size * size * size;
+	enum { FREE, SOLID, VISITED };
+
+	for (int i = 0; i < 6; i++)
+		connections[i] = 0;
+
+	u8 state[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+	for (u16 i = 0; i < nodecount; i++)
+		state[i] = ndef->get(data[i]).drawtype == NDT_NORMAL ? SOLID : FREE;
+
+	// Fill each group of connected free nodes and note the faces it touches
+	std::vector<u16> stack;
+	for (u16 start = 0; start < nodecount; start++) {
+		if (state[start] != FREE)
+			continue;
+		u8 faces = 0;
+		state[start] = VISITED;
+		stack.push_back(start);
+		while (!stack.empty()) {
+			u16 i = stack.back();
+			stack.pop_back();
+			v3s16 pos(i % size, i / size % size, i / (size * size));
+			for (int d = 0; d < 6; d++) {
+				v3s16 p = pos + g_6dirs[d];
+				if (p.X < 0 || p.X >= size || p.Y < 0 || p.Y >= size ||
+						p.Z < 0 || p.Z >= size) {
+					faces |= 1 << d;
+					continue;
+				}
+				u16 j = (p.Z * size + p.Y) * size + p.X;
+				if (state[j] != FREE)
+					continue;
+				state[j] = VISITED;
+				stack.push_back(j);
+			}
+		}
+		for (int d = 0; d < 6; d++) {
+			if (faces & (1 << d))
+				connections[d] |= faces;
+		}
+	}
+}
+
+// Marks the camera block, which is not entered through any face
+#define CAVE_CULLING_START 0x40
+#define CAVE_CULLING_GENERATION_SHIFT 7
+
+CaveCulling::CaveCulling() :
+	m_min(0, 0, 0),
+	m_size(0, 0, 0),
+	m_generation(0)
+{
+}
+
+s32 CaveCulling::getIndex(v3s16 blockpos) const
+{
+	v3s16 rel = blockpos - m_min;
+	if (rel.X < 0 || rel.X >= m_size.X || rel.Y < 0 || rel.Y >= m_size.Y ||
+			rel.Z < 0 || rel.Z >= m_size.Z)
+		return -1;
+	return (rel.Z * m_size.Y + rel.Y) * m_size.X + rel.X;
+}
+
+u32 CaveCulling::update(BlockFaceConnectionSource *source, v3s16 camera_block,
+	v3s16 blocks_min, v3s16 blocks_max, v3f camera_pos, v3f camera_dir,
+	f32 camera_fov, f32 range)
+{
+	m_min = blocks_min;
+	m_size = blocks_max - blocks_min + v3s16(1, 1, 1);
+	u32 volume = (u32)m_size.X * m_size.Y * m_size.Z;
+	if (m_entries.size() < volume)
+		m_entries.resize(volume, 0);
+
+	// Entries of earlier updates read as not reached
+	m_generation++;
+	if (m_generation >= (1U << (32 - CAVE_CULLING_GENERATION_SHIFT))) {
+		std::fill(m_entries.begin(), m_entries.end(), 0);
+		m_generation = 1;
+	}
+	const u32 generation = m_generation << CAVE_CULLING_GENERATION_SHIFT;
+
+	s32 index = getIndex(camera_block);
+	if (index < 0)
+		return 0;
+	m_entries[index] = generation | CAVE_CULLING_START;
+
+	m_queue.clear();
+	Step start;
+	start.p = camera_block;
+	start.entry_face = 6;
+	start.exits = 0x3f;
+	start.directions = 0;
+	m_queue.push_back(start);
+
+	u8 connections[6];
+	for (size_t i = 0; i < m_queue.size(); i++) {
+		const Step step = m_queue[i];
+
+		for (u8 d = 0; d < 6; d++) {
+			// The face of the next block that faces this one
+			u8 back = (d + 3) % 6;
+			if (!(step.exits & (1 << d)) || (step.directions & (1 << back)))
+				continue;
+
+			v3s16 p = step.p + g_6dirs[d];
+			index = getIndex(p);
+			if (index < 0)
+				continue;
+			u32 &entries = m_entries[index];
+			if ((entries & ~0x7fU) != generation)
+				entries = generation;
+			else if (entries & ((1 << back) | CAVE_CULLING_START))
+				continue;
+
+			// Anything seen through a block is further away in the same
+			// direction, so blocks out of sight need not be walked through
+			if (!isBlockInSight(p, camera_pos, camera_dir, camera_fov, range))
+				continue;
+			if (!source->getFaceConnections(p, connections))
+				continue;
+
+			entries |= 1 << back;
+			Step next;
+			next.p = p;
+			next.entry_face = back;
+			next.exits = connections[back];
+			next.directions = step.directions | (1 << d);
+			m_queue.push_back(next);
+		}
+	}
+
+	return m_queue.size();
+}
+
+bool CaveCulling::isCulled(v3s16 blockpos) const
+{
+	s32 index = getIndex(blockpos);
+	if (index < 0)
+		return false;
+	u32 entries = m_entries[index];
+	return (entries >> CAVE_CULLING_GENERATION_SHIFT) != m_generation ||
+		(entries & 0x7f) == 0;
+}
+
 VoxelLineIterator::VoxelLineIterator(
 	const v3f &start_position,
 	const v3f &line_vector) :
@@ -97,6 +97,35 @@ void update_block_border_lighting(Map *map, MapBlock *block,
 void blit_back_with_light(ServerMap *map, MMVManip *vm,
 	std::map<v3s16, MapBlock*> *modified_blocks);
 
+/*!
+ * Like blit_back_with_light, but always copies back every node and
+ * relights every block of the voxel manipulator.
+ * For server use only.
+ */
+void blit_back_and_relight(ServerMap *map, MMVManip *vm,
+	std::map<v3s16, MapBlock*> *modified_blocks);
+
+/*!
+ * blit_back_with_light only copies back the changed nodes and updates
+ * their light with update_lighting_nodes if at most the volume of the
+ * voxel manipulator divided by this changed. Otherwise every block is
+ * relit.
+ */
+#define BLIT_BACK_MAX_CHANGED_DIVISOR 16
+
+/*!
+ * Copies back the nodes of a voxel manipulator that differ from the
+ * map and updates the lighting of those only.
+ * Blocks that are not entirely in the voxel manipulator are skipped.
+ *
+ * \param max_changes if more nodes differ, nothing is copied and the
+ * function returns false
+ * \param modified_blocks output, contains all map blocks that
+ * the function modified
+ */
+bool blit_back_changed_nodes(Map *map, MMVManip *vm, u32 max_changes,
+	std::map<v3s16, MapBlock*> *modified_blocks);
+
 /*!
  * Corrects the light in a map block.
  * For server use only.
@@ -106,6 +135,90 @@ void blit_back_with_light(ServerMap *map, MMVManip *vm,
 void repair_block_light(ServerMap *map, MapBlock *block,
 	std::map<v3s16, MapBlock*> *modified_blocks);
 
+/*!
+ * Finds which faces of a map block can see each other through the
+ * nodes of the block that are not drawn as solid cubes, for
+ * CaveCulling.
+ *
+ * \param data the MAP_BLOCKSIZE^3 nodes of the block
+ * \param connections receives one bit mask per face, in g_6dirs order:
+ * bit j of connections[i] is set if face j can be reached from face i
+ */
+void get_block_face_connections(const MapNode *data, INodeDefManager *ndef,
+	u8 *connections);
+
+/*!
+ * Tells CaveCulling which blocks are loaded and how their faces connect.
+ */
+class BlockFaceConnectionSource
+{
+public:
+	virtual ~BlockFaceConnectionSource() {}
+
+	/*!
+	 * Gets the face connections of a block, see
+	 * get_block_face_connections.
+	 *
+	 * \param connections receives 6 masks, all 0x3f if the block is
+	 * loaded but not meshed yet
+	 * 
+eturn false if the block is not loaded
+	 */
+	virtual bool getFaceConnections(v3s16 blockpos, u8 *connections) = 0;
+};
+
+/*!
+ * Cave culling: the blocks that can be seen are found by walking from the
+ * camera block through block faces. A block is left through a face only
+ * if that face is connected to the face it was entered through, and never
+ * back towards the camera, so blocks behind cave walls are not reached.
+ * A block can be entered once through each of its faces. Blocks that are
+ * not loaded or not in sight are not walked into.
+ */
+class CaveCulling
+{
+public:
+	CaveCulling();
+
+	/*!
+	 * Walks from the camera block through the blocks in
+	 * blocks_min..blocks_max.
+	 *
+	 * 
+eturn the number of steps taken
+	 */
+	u32 update(BlockFaceConnectionSource *source, v3s16 camera_block,
+		v3s16 blocks_min, v3s16 blocks_max, v3f camera_pos, v3f camera_dir,
+		f32 camera_fov, f32 range);
+
+	//! Whether the last update did not reach the block
+	bool isCulled(v3s16 blockpos) const;
+
+private:
+	struct Step
+	{
+		v3s16 p;
+		// Face the block was entered through, 6 for the camera block
+		u8 entry_face;
+		// Faces the block can be left through
+		u8 exits;
+		// Directions moved in from the camera block
+		u8 directions;
+	};
+
+	// Index of the block in m_entries, -1 if it is outside of the box
+	s32 getIndex(v3s16 blockpos) const;
+
+	v3s16 m_min;
+	v3s16 m_size;
+	// For each block of the box: the update that last reached it, shifted
+	// left by 7 bits, and the faces it was entered through in that update.
+	// Kept between updates so they need not clear it.
+	std::vector<u32> m_entries;
+	u32 m_generation;
+	std::vector<Step> m_queue;
+};
+
 /*!
  * This class iterates trough voxels that intersect with
  * a line. The collision detection does not see nodeboxes,